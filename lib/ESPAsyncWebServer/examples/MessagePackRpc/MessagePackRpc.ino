@@ -0,0 +1,172 @@
+//
+//  MessagePack-RPC over one WebSocket with AsyncMessagePackRpc
+//  config.get, config.set and wifi.scan as methods on /rpc, live metrics pushed as notifications once a second
+//  the same config and scan are served over HTTP too (/config, /setsite, /scan), to compare the two
+//
+//  a client, with @msgpack/msgpack in the browser:
+//
+//    const ws = new WebSocket('ws://192.168.4.1/rpc');
+//    ws.binaryType = 'arraybuffer';
+//    ws.onmessage = (e) => console.log(MessagePack.decode(new Uint8Array(e.data)));
+//    ws.onopen = () => ws.send(MessagePack.encode([0, 1, 'config.set', {postcode: '1234AB', huisnummer: '7'}]));
+//
+
+#include <Arduino.h>
+#ifdef ESP32
+  #include <AsyncTCP.h>
+  #include <WiFi.h>
+#elif defined(ESP8266)
+  #include <ESP8266WiFi.h>
+  #include <ESPAsyncTCP.h>
+#elif defined(TARGET_RP2040)
+  #include <WebServer.h>
+  #include <WiFi.h>
+#endif
+
+#include <ESPAsyncWebServer.h>
+#include <AsyncJson.h>
+#include <AsyncMessagePackRpc.h>
+
+#if ASYNC_MSG_PACK_SUPPORT == 1
+
+AsyncWebServer server(80);
+AsyncWebSocket ws("/rpc");
+AsyncMessagePackRpc rpc;
+
+static struct {
+    String postcode;
+    String huisnummer;
+    String trafocode;
+} site;
+
+// the scan runs in the background, its results go out as a wifi.networks notification
+static bool scanRequested = false;
+static uint32_t lastMetrics = 0;
+
+static void configGet(JsonVariant result) {
+  result["postcode"] = site.postcode;
+  result["huisnummer"] = site.huisnummer;
+  result["trafocode"] = site.trafocode;
+}
+
+static void addNetworks(JsonArray list, int n) {
+  for (int i = 0; i < n; i++) {
+  #if ARDUINOJSON_VERSION_MAJOR == 6
+    JsonObject network = list.createNestedObject();
+  #else
+    JsonObject network = list.add<JsonObject>();
+  #endif
+    network["ssid"] = WiFi.SSID(i);
+    network["rssi"] = WiFi.RSSI(i);
+    network["channel"] = WiFi.channel(i);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+
+  #ifndef CONFIG_IDF_TARGET_ESP32H2
+  WiFi.mode(WIFI_AP_STA);
+  WiFi.softAP("esp-captive");
+  #endif
+
+  rpc.on("config.get", [](AsyncWebSocketClient* client, JsonVariantConst params, JsonVariant result) {
+    configGet(result);
+    return true;
+  });
+  rpc.on("config.set", [](AsyncWebSocketClient* client, JsonVariantConst params, JsonVariant result) {
+    if (!params["postcode"].is<const char*>() || !params["huisnummer"].is<const char*>()) {
+      result.set("postcode and huisnummer required");
+      return false;
+    }
+    site.postcode = params["postcode"].as<const char*>();
+    site.huisnummer = params["huisnummer"].as<const char*>();
+    site.trafocode = params["trafocode"] | "";
+    configGet(result);
+    return true;
+  });
+  // handlers run on the network task, a blocking scan would stall every connection
+  rpc.on("wifi.scan", [](AsyncWebSocketClient* client, JsonVariantConst params, JsonVariant result) {
+    if (WiFi.scanComplete() != WIFI_SCAN_RUNNING)
+      WiFi.scanNetworks(true);
+    scanRequested = true;
+    result.set("scanning");
+    return true;
+  });
+  rpc.attach(ws);
+  // a browser sends a request in one frame, reassembly covers clients that fragment them
+  ws.setMessageReassembly(1024);
+  server.addHandler(&ws);
+
+  server.on("/config", HTTP_GET, [](AsyncWebServerRequest* request) {
+    AsyncJsonResponse* response = new AsyncJsonResponse();
+    configGet(response->getRoot());
+    response->setLength();
+    request->send(response);
+  });
+  server.on("/setsite", HTTP_GET, [](AsyncWebServerRequest* request) {
+    if (!request->hasParam("postcode") || !request->hasParam("huisnummer")) {
+      request->send(400, "text/plain", "postcode and huisnummer required");
+      return;
+    }
+    site.postcode = request->getParam("postcode")->value();
+    site.huisnummer = request->getParam("huisnummer")->value();
+    site.trafocode = request->hasParam("trafocode") ? request->getParam("trafocode")->value() : String();
+    request->send(200, "text/plain", "OK");
+  });
+  server.on("/scan", HTTP_GET, [](AsyncWebServerRequest* request) {
+    const int n = WiFi.scanComplete();
+    if (n < 0) {
+      if (n != WIFI_SCAN_RUNNING)
+        WiFi.scanNetworks(true);
+      request->send(202, "text/plain", "scanning");
+      return;
+    }
+    AsyncJsonResponse* response = new AsyncJsonResponse(true);
+    addNetworks(response->getRoot().as<JsonArray>(), n);
+    WiFi.scanDelete();
+    response->setLength();
+    request->send(response);
+  });
+
+  // go to http://192.168.4.1/config
+  server.begin();
+}
+
+void loop() {
+  if (scanRequested && WiFi.scanComplete() >= 0) {
+    scanRequested = false;
+  #if ARDUINOJSON_VERSION_MAJOR == 6
+    DynamicJsonDocument doc(2048);
+  #else
+    JsonDocument doc;
+  #endif
+    addNetworks(doc.to<JsonArray>(), WiFi.scanComplete());
+    WiFi.scanDelete();
+    rpc.notifyAll("wifi.networks", doc.as<JsonVariantConst>());
+  }
+
+  if (millis() - lastMetrics >= 1000) {
+    lastMetrics = millis();
+    ws.cleanupClients();
+    if (ws.count()) {
+  #if ARDUINOJSON_VERSION_MAJOR == 6
+      StaticJsonDocument<128> doc;
+  #else
+      JsonDocument doc;
+  #endif
+      doc["heap"] = ESP.getFreeHeap();
+      doc["rssi"] = WiFi.RSSI();
+      doc["uptime"] = millis() / 1000;
+      doc["clients"] = ws.count();
+      rpc.notifyAll("metrics", doc.as<JsonVariantConst>());
+    }
+  }
+}
+
+#else
+
+void setup() {}
+void loop() {}
+
+#endif
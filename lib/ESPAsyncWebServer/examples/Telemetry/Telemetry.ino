@@ -0,0 +1,93 @@
+//
+//  Live telemetry over SSE with AsyncEventTelemetry
+//  samples a simulated meter, the WiFi signal and the heap 50 times a second and publishes them as one event
+//  open / for a live view, /metrics for the counters of the publisher and of the event source
+
+#include <Arduino.h>
+#ifdef ESP32
+  #include <AsyncTCP.h>
+  #include <WiFi.h>
+#elif defined(ESP8266)
+  #include <ESP8266WiFi.h>
+  #include <ESPAsyncTCP.h>
+#elif defined(TARGET_RP2040)
+  #include <WebServer.h>
+  #include <WiFi.h>
+#endif
+
+#include <ESPAsyncWebServer.h>
+#include <AsyncTelemetry.h>
+
+static const char* htmlContent PROGMEM = R"(
+<!DOCTYPE html>
+<html>
+<head>
+  <title>Telemetry</title>
+</head>
+<body>
+  <h1>Telemetry</h1>
+  <pre id="sample">waiting...</pre>
+  <script>
+    var source = new EventSource('/events');
+    source.addEventListener('telemetry', function(e) {
+      document.getElementById('sample').textContent = JSON.stringify(JSON.parse(e.data), null, 2);
+    }, false);
+  </script>
+</body>
+</html>
+)";
+
+AsyncWebServer server(80);
+AsyncEventSource events("/events");
+AsyncEventTelemetry telemetry("telemetry");
+
+// a meter drawing a slow sine around 1.2 kW
+static float power() {
+  return 1200.0f + 300.0f * sinf(millis() / 5000.0f);
+}
+
+static float voltage() {
+  return 230.0f + 2.0f * sinf(millis() / 1300.0f);
+}
+
+void setup() {
+  Serial.begin(115200);
+
+#ifndef CONFIG_IDF_TARGET_ESP32H2
+  WiFi.mode(WIFI_AP);
+  WiFi.softAP("esp-captive");
+#endif
+
+  telemetry.addFloat("power", power);
+  telemetry.addFloat("voltage", voltage, 1);
+  telemetry.addInt("rssi", [] { return (int32_t)WiFi.RSSI(); });
+  telemetry.addInt("heap", [] { return (int32_t)ESP.getFreeHeap(); });
+  telemetry.addString("state", [] { return millis() / 10000 % 2 ? "up" : "down"; });
+  telemetry.setRate(50);
+  // a slow client gets the latest sample instead of a queue of old ones
+  telemetry.attach(events);
+  // the status events are not coalesced, each of them arrives
+  events.onConnect([](AsyncEventSourceClient* client) {
+    client->send("connected", "status", millis());
+  });
+
+  server.on("/", HTTP_GET, [](AsyncWebServerRequest* request) {
+    request->send(200, "text/html", htmlContent);
+  });
+
+  server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest* request) {
+    AsyncResponseStream* response = request->beginResponseStream("text/plain; version=0.0.4");
+    telemetry.printTo(*response);
+    events.printMetrics(*response);
+    request->send(response);
+  });
+
+  // go to http://192.168.4.1/
+  server.addHandler(&events);
+
+  server.begin();
+}
+
+void loop() {
+  telemetry.loop();
+}
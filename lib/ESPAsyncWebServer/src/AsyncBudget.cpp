@@ -0,0 +1,189 @@
+#include "AsyncBudget.h"
+
+#include <algorithm>
+
+AsyncWebServerBudget::Flow::~Flow() {
+  AsyncWebServerBudget& budget = Instance();
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(budget._lock);
+#endif
+  budget._release(*this, _used);
+  if (_next)
+    budget._leave(*this);
+}
+
+bool AsyncWebServerBudget::Flow::admit(size_t len) {
+  return !len || Instance()._take(*this, len, len) == len;
+}
+
+size_t AsyncWebServerBudget::Flow::grant(size_t wanted, size_t minimum) {
+  return Instance()._take(*this, wanted, minimum ? minimum : 1);
+}
+
+void AsyncWebServerBudget::Flow::release(size_t len) {
+  AsyncWebServerBudget& budget = Instance();
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(budget._lock);
+#endif
+  budget._release(*this, len);
+}
+
+bool AsyncWebServerBudget::_heapLow() const {
+#if defined(ESP32) || defined(ESP8266)
+  return _heapReserve && ESP.getFreeHeap() < _heapReserve;
+#else
+  return false;
+#endif
+}
+
+void AsyncWebServerBudget::setLimit(size_t bytes) {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_lock);
+#endif
+  _limit = bytes;
+}
+
+size_t AsyncWebServerBudget::used() const {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_lock);
+#endif
+  return _used;
+}
+
+void AsyncWebServerBudget::_join(Flow& flow) {
+  if (_cursor) {
+    // behind the cursor, so the flow waits a full round like the others
+    flow._next = _cursor;
+    flow._prev = _cursor->_prev;
+    _cursor->_prev->_next = &flow;
+    _cursor->_prev = &flow;
+  } else {
+    flow._next = flow._prev = &flow;
+    _cursor = &flow;
+  }
+  _backlogged++;
+}
+
+void AsyncWebServerBudget::_leave(Flow& flow) {
+  if (flow._next == &flow) {
+    _cursor = nullptr;
+  } else {
+    flow._prev->_next = flow._next;
+    flow._next->_prev = flow._prev;
+    if (_cursor == &flow)
+      _cursor = flow._next;
+  }
+  flow._next = flow._prev = nullptr;
+  _credited -= flow._deficit;
+  flow._deficit = 0;
+  flow._wanted = 0;
+  _backlogged--;
+}
+
+void AsyncWebServerBudget::_deal(Flow& flow, size_t wanted) {
+  // deal the unassigned bytes a quantum at a time, flows already holding what they asked for are skipped
+  size_t free = _free();
+  while (flow._deficit < wanted && free) {
+    Flow* f = _cursor;
+    const size_t cap = f == &flow ? wanted : std::max(f->_wanted, _quantum);
+    if (f->_deficit < cap) {
+      const size_t q = std::min(std::min(_quantum, free), cap - f->_deficit);
+      f->_deficit += q;
+      _credited += q;
+      free -= q;
+    }
+    _cursor = f->_next;
+  }
+}
+
+bool AsyncWebServerBudget::_forfeitIdle() {
+  const uint32_t now = millis();
+  bool forfeited = false;
+  Flow* f = _cursor;
+  for (size_t n = _backlogged; n; n--) {
+    Flow* next = f->_next;
+    if (!f->_used && now - f->_askedAt >= ASYNCWEBSERVER_BUDGET_IDLE_MS) {
+      forfeited |= f->_deficit != 0;
+      _leave(*f);
+    }
+    f = next;
+  }
+  return forfeited;
+}
+
+size_t AsyncWebServerBudget::_take(Flow& flow, size_t wanted, size_t minimum) {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_lock);
+#endif
+  if (_heapLow()) {
+    _stats.heapRefused++;
+    return 0;
+  }
+  // more than the whole budget is never granted, the flow must not wait for it in the backlog
+  if (_limit && minimum > _limit) {
+    _stats.refused++;
+    return 0;
+  }
+  if (_limit)
+    wanted = std::min(wanted, _limit);
+  flow._askedAt = millis();
+
+  size_t granted;
+  if (!_limit) {
+    granted = wanted;
+  } else if (!_cursor) {
+    // nobody waits, take what is left
+    granted = std::min(wanted, _free());
+  } else {
+    if (!flow._next)
+      _join(flow);
+    _deal(flow, wanted);
+    // A flow holding no bytes has no ack to retry on, the credit parked for it is only claimed if it asks again.
+    // When the budget runs dry the ones that stopped asking leave the backlog and give their credit back. Flows
+    // that keep asking keep theirs, or they would take it from each other and none would ever get enough.
+    if (flow._deficit < wanted && _forfeitIdle())
+      _deal(flow, wanted);
+    granted = std::min(wanted, flow._deficit);
+    if (granted >= minimum) {
+      flow._deficit -= granted;
+      flow._wanted = 0;
+      _credited -= granted;
+    }
+  }
+
+  if (granted < minimum || !granted) {
+    if (_limit && !flow._next)
+      _join(flow);
+    flow._wanted = wanted;
+    _stats.refused++;
+    return 0;
+  }
+  flow._used += granted;
+  _used += granted;
+  return granted;
+}
+
+void AsyncWebServerBudget::_release(Flow& flow, size_t len) {
+  len = std::min(len, flow._used);
+  flow._used -= len;
+  _used -= len;
+  // an idle flow forfeits its credit like an empty queue in deficit round-robin
+  if (!flow._used && flow._next)
+    _leave(flow);
+}
+
+void AsyncWebServerBudget::printTo(Print& out) const {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_lock);
+#endif
+  out.print(F("# TYPE asyncwebserver_budget_limit_bytes gauge\n"));
+  out.printf("asyncwebserver_budget_limit_bytes %u\n", (unsigned)_limit);
+  out.print(F("# TYPE asyncwebserver_budget_used_bytes gauge\n"));
+  out.printf("asyncwebserver_budget_used_bytes %u\n", (unsigned)_used);
+  out.print(F("# TYPE asyncwebserver_budget_backlogged_flows gauge\n"));
+  out.printf("asyncwebserver_budget_backlogged_flows %u\n", (unsigned)_backlogged);
+  out.print(F("# TYPE asyncwebserver_budget_refused_total counter\n"));
+  out.printf("asyncwebserver_budget_refused_total %lu\n", (unsigned long)_stats.refused);
+  out.print(F("# TYPE asyncwebserver_budget_heap_refused_total counter\n"));
+  out.printf("asyncwebserver_budget_heap_refused_total %lu\n", (unsigned long)_stats.heapRefused);
+}
@@ -0,0 +1,139 @@
+/*
+  Global byte budget for data queued by AsyncEventSource and AsyncWebSocket clients and in flight for chunked responses
+
+  Example
+
+    AsyncWebServerBudget& budget = AsyncWebServerBudget::Instance();
+    budget.setLimit(48 * 1024);
+    budget.setHeapReserve(24 * 1024);
+
+    server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest* request) {
+      AsyncResponseStream* response = request->beginResponseStream(F("text/plain; version=0.0.4"));
+      AsyncWebServerBudget::Instance().printTo(*response);
+      request->send(response);
+    });
+
+  Every client and chunked response is a flow charged for the bytes it holds. While nobody was refused, a flow
+  takes what is left of the limit. Once a flow is refused it joins the backlog, and the bytes released from then
+  on are dealt out by deficit round-robin: a quantum per backlogged flow and round, so a flow with big messages
+  gets its turn and a flow behind a slow consumer cannot take more than its share. A flow leaves the backlog and
+  forfeits its unused credit when it holds nothing any more, and so does a refused flow holding nothing that has
+  not asked again for ASYNCWEBSERVER_BUDGET_IDLE_MS: it has no ack to retry on, and credit parked for a flow that
+  gave up is never claimed. Requests larger than the whole limit are refused without waiting.
+
+  Refused work is handled like a full queue: WebSocket clients apply their queue policy (dropping the oldest
+  message or keeping the conflated one), SSE events are discarded unless they coalesce, and chunked responses
+  wait for the next ack or poll. Shared broadcast buffers are charged to every client that holds them.
+*/
+#ifndef ASYNC_BUDGET_H_
+#define ASYNC_BUDGET_H_
+
+#include <Arduino.h>
+
+#ifdef ESP32
+  #include <mutex>
+#endif
+
+#ifndef ASYNCWEBSERVER_BUDGET_QUANTUM
+  #define ASYNCWEBSERVER_BUDGET_QUANTUM 1460
+#endif
+
+// a refused flow holding nothing that has not asked again for this long gives its credit back
+#ifndef ASYNCWEBSERVER_BUDGET_IDLE_MS
+  #define ASYNCWEBSERVER_BUDGET_IDLE_MS 2000
+#endif
+
+class AsyncWebServerBudget {
+  public:
+    class Flow {
+        friend AsyncWebServerBudget;
+
+      private:
+        size_t _used{0};
+        size_t _deficit{0};
+        // size of the last refused request, credit parked for the flow is capped to it
+        size_t _wanted{0};
+        uint32_t _askedAt{0};
+        // backlog ring, null while not backlogged
+        Flow* _next{nullptr};
+        Flow* _prev{nullptr};
+
+      public:
+        Flow() = default;
+        ~Flow();
+        Flow(const Flow&) = delete;
+        Flow& operator=(const Flow&) = delete;
+
+        /**
+         * @brief Charge len bytes, all or nothing
+         */
+        bool admit(size_t len);
+
+        /**
+         * @brief Charge up to wanted bytes
+         * @return the bytes charged, 0 when fewer than minimum were available
+         */
+        size_t grant(size_t wanted, size_t minimum = 1);
+
+        // give back bytes no longer held, more than charged is ignored
+        void release(size_t len);
+        size_t used() const { return _used; }
+    };
+
+    struct Stats {
+        uint32_t refused;
+        // refusals because free heap was below the reserve
+        uint32_t heapRefused;
+    };
+
+  private:
+    size_t _limit{0};
+    size_t _heapReserve{0};
+    size_t _quantum{ASYNCWEBSERVER_BUDGET_QUANTUM};
+    size_t _used{0};
+    // credit dealt to backlogged flows and not spent yet
+    size_t _credited{0};
+    size_t _backlogged{0};
+    // next backlogged flow to get a quantum
+    Flow* _cursor{nullptr};
+    Stats _stats{};
+#ifdef ESP32
+    mutable std::mutex _lock;
+#endif
+
+    AsyncWebServerBudget() = default;
+    size_t _take(Flow& flow, size_t wanted, size_t minimum);
+    void _release(Flow& flow, size_t len);
+    void _join(Flow& flow);
+    void _leave(Flow& flow);
+    void _deal(Flow& flow, size_t wanted);
+    // make the backlogged flows that hold no bytes and stopped asking leave, true when that freed credit
+    bool _forfeitIdle();
+    size_t _free() const { return _limit > _used + _credited ? _limit - _used - _credited : 0; }
+    bool _heapLow() const;
+
+  public:
+    AsyncWebServerBudget(const AsyncWebServerBudget&) = delete;
+    AsyncWebServerBudget& operator=(const AsyncWebServerBudget&) = delete;
+
+    static AsyncWebServerBudget& Instance() {
+      static AsyncWebServerBudget instance;
+      return instance;
+    }
+
+    // bytes all flows may hold together, 0 for no limit (default)
+    void setLimit(size_t bytes);
+    // refuse everything while the free heap is below bytes, 0 to disable (default)
+    void setHeapReserve(size_t bytes) { _heapReserve = bytes; }
+    // bytes dealt to each backlogged flow per round
+    void setQuantum(size_t bytes) { _quantum = bytes ? bytes : 1; }
+
+    size_t limit() const { return _limit; }
+    size_t used() const;
+    const Stats& stats() const { return _stats; }
+
+    // Prometheus text exposition format
+    void printTo(Print& out) const;
+};
+
+#endif // ASYNC_BUDGET_H_
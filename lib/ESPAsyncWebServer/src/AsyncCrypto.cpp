@@ -0,0 +1,189 @@
+#include "AsyncCrypto.h"
+
+namespace asyncsrv {
+
+uint32_t randomWord() {
+#if defined(ESP32)
+  return esp_random();
+#elif defined(ESP8266)
+  return RANDOM_REG32;
+#elif defined(TARGET_RP2040)
+  return rp2040.hwrand32();
+#else
+  return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+#endif
+}
+
+#ifdef ESP32
+
+  #if ESP_IDF_VERSION_MAJOR < 5
+    #define sha256Starts mbedtls_sha256_starts_ret
+    #define sha256Update mbedtls_sha256_update_ret
+    #define sha256Finish mbedtls_sha256_finish_ret
+  #else
+    #define sha256Starts mbedtls_sha256_starts
+    #define sha256Update mbedtls_sha256_update
+    #define sha256Finish mbedtls_sha256_finish
+  #endif
+
+HmacSha256::HmacSha256() {
+  mbedtls_sha256_init(&_inner);
+  mbedtls_sha256_init(&_outer);
+}
+
+HmacSha256::~HmacSha256() {
+  mbedtls_sha256_free(&_inner);
+  mbedtls_sha256_free(&_outer);
+}
+
+void HmacSha256::setKey(const uint8_t* key, size_t len) {
+  uint8_t pad[64] = {};
+  if (len > sizeof(pad)) {
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    sha256Starts(&ctx, 0);
+    sha256Update(&ctx, key, len);
+    sha256Finish(&ctx, pad);
+    mbedtls_sha256_free(&ctx);
+  } else {
+    memcpy(pad, key, len);
+  }
+
+  for (size_t i = 0; i < sizeof(pad); i++)
+    pad[i] ^= 0x36;
+  sha256Starts(&_inner, 0);
+  sha256Update(&_inner, pad, sizeof(pad));
+  for (size_t i = 0; i < sizeof(pad); i++)
+    pad[i] ^= 0x36 ^ 0x5c;
+  sha256Starts(&_outer, 0);
+  sha256Update(&_outer, pad, sizeof(pad));
+
+  memset(pad, 0, sizeof(pad));
+  _hasKey = true;
+}
+
+void HmacSha256::mac(const uint8_t* data, size_t len, uint8_t* out) const {
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_clone(&ctx, &_inner);
+  sha256Update(&ctx, data, len);
+  sha256Finish(&ctx, out);
+  mbedtls_sha256_clone(&ctx, &_outer);
+  sha256Update(&ctx, out, MAC_SIZE);
+  sha256Finish(&ctx, out);
+  mbedtls_sha256_free(&ctx);
+}
+
+#else
+
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t IV[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+static inline uint32_t ror(uint32_t x, uint8_t n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+static void sha256Block(uint32_t* state, const uint8_t* block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++)
+    w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+  for (int i = 16; i < 64; i++) {
+    const uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    const uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 64; i++) {
+    const uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+    const uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+// hash the rest of a message whose first prefix bytes (whole blocks) are already in state
+static void sha256Finish(uint32_t* state, const uint8_t* data, size_t len, size_t prefix, uint8_t* digest) {
+  const uint64_t bits = (uint64_t)(prefix + len) * 8;
+  for (; len >= 64; data += 64, len -= 64)
+    sha256Block(state, data);
+
+  uint8_t block[64];
+  memcpy(block, data, len);
+  block[len++] = 0x80;
+  if (len > 56) {
+    memset(block + len, 0, 64 - len);
+    sha256Block(state, block);
+    len = 0;
+  }
+  memset(block + len, 0, 56 - len);
+  for (int i = 0; i < 8; i++)
+    block[56 + i] = bits >> (56 - i * 8);
+  sha256Block(state, block);
+
+  for (int i = 0; i < 32; i++)
+    digest[i] = state[i / 4] >> (24 - (i % 4) * 8);
+}
+
+HmacSha256::HmacSha256() {}
+
+HmacSha256::~HmacSha256() {}
+
+void HmacSha256::setKey(const uint8_t* key, size_t len) {
+  uint8_t pad[64] = {};
+  if (len > sizeof(pad)) {
+    uint32_t state[8];
+    memcpy(state, IV, sizeof(state));
+    sha256Finish(state, key, len, 0, pad);
+  } else {
+    memcpy(pad, key, len);
+  }
+
+  for (size_t i = 0; i < sizeof(pad); i++)
+    pad[i] ^= 0x36;
+  memcpy(_inner, IV, sizeof(_inner));
+  sha256Block(_inner, pad);
+  for (size_t i = 0; i < sizeof(pad); i++)
+    pad[i] ^= 0x36 ^ 0x5c;
+  memcpy(_outer, IV, sizeof(_outer));
+  sha256Block(_outer, pad);
+
+  memset(pad, 0, sizeof(pad));
+  _hasKey = true;
+}
+
+void HmacSha256::mac(const uint8_t* data, size_t len, uint8_t* out) const {
+  uint32_t state[8];
+  memcpy(state, _inner, sizeof(state));
+  sha256Finish(state, data, len, 64, out);
+  memcpy(state, _outer, sizeof(state));
+  sha256Finish(state, out, MAC_SIZE, 64, out);
+}
+
+#endif
+
+} // namespace asyncsrv
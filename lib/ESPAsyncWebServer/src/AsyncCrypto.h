@@ -0,0 +1,48 @@
+#pragma once
+
+/*
+  Random numbers and HMAC-SHA256 shared by the WebSocket masking, the digest nonces and the session tokens
+*/
+
+#include <Arduino.h>
+
+#ifdef ESP32
+  #include <mbedtls/sha256.h>
+#endif
+
+namespace asyncsrv {
+
+// from the hardware random number generator where the platform has one
+uint32_t randomWord();
+
+/**
+ * @brief HMAC-SHA256 with the hash states after the inner and outer padded key blocks kept, so a MAC of a message
+ * shorter than 56 bytes costs two SHA-256 blocks. Uses the mbedTLS SHA-256 on ESP32 (hardware accelerated where
+ * the chip has it), a portable one elsewhere.
+ */
+class HmacSha256 {
+  public:
+    static constexpr size_t MAC_SIZE = 32;
+
+    HmacSha256();
+    ~HmacSha256();
+    HmacSha256(const HmacSha256&) = delete;
+    HmacSha256& operator=(const HmacSha256&) = delete;
+
+    // keys longer than 64 bytes are hashed first
+    void setKey(const uint8_t* key, size_t len);
+    bool hasKey() const { return _hasKey; }
+    void mac(const uint8_t* data, size_t len, uint8_t* out) const;
+
+  private:
+#ifdef ESP32
+    mbedtls_sha256_context _inner;
+    mbedtls_sha256_context _outer;
+#else
+    uint32_t _inner[8];
+    uint32_t _outer[8];
+#endif
+    bool _hasKey = false;
+};
+
+} // namespace asyncsrv
@@ -27,86 +27,89 @@
 
 using namespace asyncsrv;
 
-static String generateEventMessage(const char* message, const char* event, uint32_t id, uint32_t reconnect) {
-  String str;
-  size_t len{0};
-  if (message)
-    len += strlen(message);
-
-  if (event)
-    len += strlen(event);
-
-  len += 42; // give it some overhead
-
-  str.reserve(len);
+namespace {
+  size_t decimalLength(uint32_t value) {
+    size_t n = 1;
+    while (value >= 10) {
+      value /= 10;
+      n++;
+    }
+    return n;
+  }
 
-  if (reconnect) {
-    str += T_retry_;
-    str += reconnect;
-    str += ASYNC_SSE_NEW_LINE_CHAR; // '\n'
+  void appendDecimal(String& out, uint32_t value) {
+    char digits[10];
+    size_t i = sizeof(digits);
+    do {
+      digits[--i] = '0' + value % 10;
+      value /= 10;
+    } while (value);
+    out.concat(digits + i, sizeof(digits) - i);
   }
 
-  if (id) {
-    str += T_id__;
-    str += id;
-    str += ASYNC_SSE_NEW_LINE_CHAR; // '\n'
+  // a line ends at \r\n, \n or \r, *next is set past the line break
+  const char* lineEnd(const char* p, const char* end, const char** next) {
+    while (p < end && *p != '\n' && *p != '\r')
+      p++;
+    *next = p < end && *p == '\r' && p + 1 < end && p[1] == '\n' ? p + 2 : p + 1;
+    return p;
   }
 
-  if (event != NULL) {
-    str += T_event_;
-    str += event;
-    str += ASYNC_SSE_NEW_LINE_CHAR; // '\n'
+  size_t eventLength(const char* message, size_t len, size_t eventLen, uint32_t id, uint32_t reconnect) {
+    size_t n = 0;
+    if (reconnect)
+      n += strlen(T_retry_) + decimalLength(reconnect) + 1;
+    if (id)
+      n += strlen(T_id__) + decimalLength(id) + 1;
+    if (eventLen)
+      n += strlen(T_event_) + eventLen + 1;
+    if (!message)
+      return n;
+
+    // every line becomes a data field, a trailing line break does not start another one
+    const char* end = message + len;
+    const char* p = message;
+    do {
+      const char* next;
+      n += strlen(T_data_) + (lineEnd(p, end, &next) - p) + 1;
+      p = next;
+    } while (p < end);
+    // blank line dispatching the event
+    return n + 1;
   }
 
-  if (!message)
-    return str;
-
-  size_t messageLen = strlen(message);
-  char* lineStart = (char*)message;
-  char* lineEnd;
-  do {
-    char* nextN = strchr(lineStart, '\n');
-    char* nextR = strchr(lineStart, '\r');
-    if (nextN == NULL && nextR == NULL) {
-      // a message is a single-line string
-      str += T_data_;
-      str += message;
-      str += T_nn;
-      return str;
+  void encodeEvent(String& out, const char* message, size_t len, const char* event, size_t eventLen, uint32_t id, uint32_t reconnect) {
+    if (reconnect) {
+      out.concat(T_retry_, strlen(T_retry_));
+      appendDecimal(out, reconnect);
+      out += ASYNC_SSE_NEW_LINE_CHAR;
     }
-
-    // a message is a multi-line string
-    char* nextLine = NULL;
-    if (nextN != NULL && nextR != NULL) { // windows line-ending \r\n
-      if (nextR + 1 == nextN) {
-        // normal \r\n sequense
-        lineEnd = nextR;
-        nextLine = nextN + 1;
-      } else {
-        // some abnormal \n \r mixed sequence
-        lineEnd = std::min(nextR, nextN);
-        nextLine = lineEnd + 1;
-      }
-    } else if (nextN != NULL) { // Unix/Mac OS X LF
-      lineEnd = nextN;
-      nextLine = nextN + 1;
-    } else { // some ancient garbage
-      lineEnd = nextR;
-      nextLine = nextR + 1;
+    if (id) {
+      out.concat(T_id__, strlen(T_id__));
+      appendDecimal(out, id);
+      out += ASYNC_SSE_NEW_LINE_CHAR;
     }
-
-    str += T_data_;
-    str.concat(lineStart, lineEnd - lineStart);
-    str += ASYNC_SSE_NEW_LINE_CHAR; // \n
-
-    lineStart = nextLine;
-  } while (lineStart < ((char*)message + messageLen));
-
-  // append another \n to terminate message
-  str += ASYNC_SSE_NEW_LINE_CHAR; // '\n'
-
-  return str;
-}
+    if (eventLen) {
+      out.concat(T_event_, strlen(T_event_));
+      out.concat(event, eventLen);
+      out += ASYNC_SSE_NEW_LINE_CHAR;
+    }
+    if (!message)
+      return;
+
+    const char* end = message + len;
+    const char* p = message;
+    do {
+      const char* next;
+      const char* e = lineEnd(p, end, &next);
+      out.concat(T_data_, strlen(T_data_));
+      out.concat(p, e - p);
+      out += ASYNC_SSE_NEW_LINE_CHAR;
+      p = next;
+    } while (p < end);
+    out += ASYNC_SSE_NEW_LINE_CHAR;
+  }
+} // namespace
 
 // Message
 
@@ -179,56 +182,71 @@ AsyncEventSourceClient::~AsyncEventSourceClient() {
 #ifdef ESP32
   std::lock_guard<std::mutex> lock(_lockmq);
 #endif
-  _messageQueue.clear();
+  for (auto& slot : _messageQueue)
+    slot = AsyncEventSourceMessage();
   close();
 }
 
 bool AsyncEventSourceClient::_queueMessage(const char* message, size_t len) {
-  if (_messageQueue.size() >= SSE_MAX_QUEUED_MESSAGES) {
-#ifdef ESP8266
-    ets_printf(String(F("ERROR: Too many messages queued\n")).c_str());
-#elif defined(ESP32)
-    log_e("Event message queue overflow: discard message");
-#endif
-    return false;
-  }
+  AsyncEvent_SharedData_t data = std::make_shared<String>();
+  data->concat(message, len);
+  return _queueMessage(std::move(data));
+}
 
+bool AsyncEventSourceClient::_queueMessage(AsyncEvent_SharedData_t&& msg, uint32_t key, uint32_t id) {
+  {
 #ifdef ESP32
-  // length() is not thread-safe, thus acquiring the lock before this call..
-  std::lock_guard<std::mutex> lock(_lockmq);
+    std::lock_guard<std::mutex> producer(_lockProducer);
 #endif
+    if (key) {
+#ifdef ESP32
+      // messages are only inspected while the AsyncTCP task is out of the queue, otherwise this one is appended
+      std::unique_lock<std::mutex> lock(_lockmq, std::try_to_lock);
+      if (lock.owns_lock())
+#endif
+      {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        for (size_t i = _tail.load(std::memory_order_relaxed); i != head;) {
+          i = (i + _queueSlots - 1) % _queueSlots;
+          AsyncEventSourceMessage& message = _messageQueue[i];
+          if (message.key() == key && !message.started()) {
+            const size_t queued = message.size();
+            // over the budget the queued event stays, stale but no bigger
+            if (msg->length() > queued && !_budget.admit(msg->length() - queued))
+              return false;
+            _budget.release(queued > msg->length() ? queued - msg->length() : 0);
+            message.replace(std::move(msg), id);
+            _coalesced++;
+            _server->_countCoalesced();
+            return true;
+          }
+          // moved ahead of an event with an id, the client's last event id would go back, so it is appended
+          if (id && message.id())
+            break;
+        }
+      }
+    }
 
-  _messageQueue.emplace_back(message, len);
-
-  /*
-    throttle queue run
-    if Q is filled for >25% then network/CPU is congested, since there is no zero-copy mode for socket buff
-    forcing Q run will only eat more heap ram and blow the buffer, let's just keep data in our own queue
-    the queue will be processed at least on each onAck()/onPoll() call from AsyncTCP
-  */
-  if (_messageQueue.size() < SSE_MAX_QUEUED_MESSAGES >> 2 && _client->canSend()) {
-    _runQueue();
-  }
-
-  return true;
-}
-
-bool AsyncEventSourceClient::_queueMessage(AsyncEvent_SharedData_t&& msg) {
-  if (_messageQueue.size() >= SSE_MAX_QUEUED_MESSAGES) {
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    const size_t next = (tail + 1) % _queueSlots;
+    if (next == _head.load(std::memory_order_acquire)) {
 #ifdef ESP8266
-    ets_printf(String(F("ERROR: Too many messages queued\n")).c_str());
+      ets_printf(String(F("ERROR: Too many messages queued\n")).c_str());
 #elif defined(ESP32)
-    log_e("Event message queue overflow: discard message");
+      log_e("Event message queue overflow: discard message");
 #endif
-    return false;
-  }
-
+      return false;
+    }
+    if (!_budget.admit(msg->length())) {
 #ifdef ESP32
-  // length() is not thread-safe, thus acquiring the lock before this call..
-  std::lock_guard<std::mutex> lock(_lockmq);
+      log_w("Event message over the global budget: discard message");
 #endif
-
-  _messageQueue.emplace_back(std::move(msg));
+      return false;
+    }
+    // the slot at the tail was released by the consumer before it moved the head past it
+    _messageQueue[tail] = AsyncEventSourceMessage(std::move(msg), key, id);
+    _tail.store(next, std::memory_order_release);
+  }
 
   /*
     throttle queue run
@@ -236,8 +254,13 @@ bool AsyncEventSourceClient::_queueMessage(AsyncEvent_SharedData_t&& msg) {
     forcing Q run will only eat more heap ram and blow the buffer, let's just keep data in our own queue
     the queue will be processed at least on each onAck()/onPoll() call from AsyncTCP
   */
-  if (_messageQueue.size() < SSE_MAX_QUEUED_MESSAGES >> 2 && _client->canSend()) {
-    _runQueue();
+  if (packetsWaiting() < SSE_MAX_QUEUED_MESSAGES >> 2 && _client->canSend()) {
+#ifdef ESP32
+    // never wait for the AsyncTCP task, when it holds the queue it sends the message on its next ack or poll
+    std::unique_lock<std::mutex> lock(_lockmq, std::try_to_lock);
+    if (lock.owns_lock())
+#endif
+      _runQueue();
   }
   return true;
 }
@@ -255,21 +278,26 @@ void AsyncEventSourceClient::_onAck(size_t len __attribute__((unused)), uint32_t
     _inflight = 0;
 
   // acknowledge as much messages's data as we got confirmed len from a AsyncTCP
-  while (len && _messageQueue.size()) {
-    len = _messageQueue.front().ack(len);
-    if (_messageQueue.front().finished()) {
+  size_t head = _head.load(std::memory_order_relaxed);
+  const size_t tail = _tail.load(std::memory_order_acquire);
+  while (len && head != tail) {
+    len = _messageQueue[head].ack(len);
+    if (_messageQueue[head].finished()) {
       // now we could release full ack'ed messages, we were keeping it unless send confirmed from AsyncTCP
-      _messageQueue.pop_front();
+      _budget.release(_messageQueue[head].size());
+      _messageQueue[head] = AsyncEventSourceMessage();
+      head = (head + 1) % _queueSlots;
+      _head.store(head, std::memory_order_release);
     }
   }
 
   // try to send another batch of data
-  if (_messageQueue.size())
+  if (packetsWaiting())
     _runQueue();
 }
 
 void AsyncEventSourceClient::_onPoll() {
-  if (_messageQueue.size()) {
+  if (packetsWaiting()) {
 #ifdef ESP32
     // Same here, acquiring the lock early
     std::lock_guard<std::mutex> lock(_lockmq);
@@ -296,9 +324,37 @@ void AsyncEventSourceClient::close() {
 }
 
 bool AsyncEventSourceClient::send(const char* message, const char* event, uint32_t id, uint32_t reconnect) {
+  return send((const uint8_t*)message, message ? strlen(message) : 0, event, id, reconnect);
+}
+
+bool AsyncEventSourceClient::send(const uint8_t* message, size_t len, const char* event, uint32_t id, uint32_t reconnect) {
   if (!connected())
     return false;
-  return _queueMessage(std::make_shared<String>(generateEventMessage(message, event, id, reconnect)));
+  AsyncEvent_SharedData_t data = _server->_encodeEvent((const char*)message, len, event, id, reconnect);
+  return data && _queueMessage(std::move(data), _server->_eventKey(event), id);
+}
+
+void AsyncEventSourceClient::setMaxEventRate(uint16_t eventsPerSecond) {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_lockmq);
+#endif
+  _maxRate = eventsPerSecond;
+  _tokens = eventsPerSecond * 1000UL;
+  _lastRefill = millis();
+}
+
+bool AsyncEventSourceClient::_takeToken() {
+  if (!_maxRate)
+    return true;
+  const uint32_t now = millis();
+  const uint32_t elapsed = now - _lastRefill;
+  const uint32_t capacity = _maxRate * 1000UL;
+  _lastRefill = now;
+  _tokens = elapsed >= 1000 ? capacity : std::min(capacity, _tokens + elapsed * _maxRate);
+  if (_tokens < 1000)
+    return false;
+  _tokens -= 1000;
+  return true;
 }
 
 void AsyncEventSourceClient::_runQueue() {
@@ -307,9 +363,19 @@ void AsyncEventSourceClient::_runQueue() {
 
   // there is no need to lock the mutex here, 'cause all the calls to this method must be already lock'ed
   size_t total_bytes_written = 0;
-  for (auto i = _messageQueue.begin(); i != _messageQueue.end(); ++i) {
-    if (!i->sent()) {
-      const size_t bytes_written = i->write(_client);
+  const size_t head = _head.load(std::memory_order_relaxed);
+  const size_t tail = _tail.load(std::memory_order_acquire);
+  for (size_t i = head; i != tail; i = (i + 1) % _queueSlots) {
+    AsyncEventSourceMessage& message = _messageQueue[i];
+    if (!message.sent()) {
+      // Events stay in their slot until acknowledged. Half the slots at most hold events in flight, the others are
+      // kept for new events to queue, or to be coalesced, while a slow peer acknowledges the window.
+      if (!message.started() && (i + _queueSlots - head) % _queueSlots >= SSE_MAX_QUEUED_MESSAGES / 2)
+        break;
+      // a held event stays replaceable until a token lets it start
+      if (!message.started() && !_takeToken())
+        break;
+      const size_t bytes_written = message.write(_client);
       total_bytes_written += bytes_written;
       _inflight += bytes_written;
       if (bytes_written == 0 || _inflight > _max_inflight) {
@@ -344,6 +410,9 @@ void AsyncEventSource::_addClient(AsyncEventSourceClient* client) {
   std::lock_guard<std::mutex> lock(_client_queue_lock);
 #endif
   _clients.emplace_back(client);
+  if (_maxRate)
+    client->setMaxEventRate(_maxRate);
+  _replayTo(client);
   if (_connectcb)
     _connectcb(client);
 
@@ -357,8 +426,10 @@ void AsyncEventSource::_handleDisconnect(AsyncEventSourceClient* client) {
   std::lock_guard<std::mutex> lock(_client_queue_lock);
 #endif
   for (auto i = _clients.begin(); i != _clients.end(); ++i) {
-    if (i->get() == client)
+    if (i->get() == client) {
       _clients.erase(i);
+      break;
+    }
   }
   _adjust_inflight_window();
 }
@@ -395,16 +466,89 @@ size_t AsyncEventSource::avgPacketsWaiting() const {
   return ((aql) + (nConnectedClients / 2)) / (nConnectedClients); // round up
 }
 
+AsyncEvent_SharedData_t AsyncEventSource::_encodeEvent(const char* message, size_t len, const char* event, uint32_t id, uint32_t reconnect) {
+  const size_t eventLen = event ? strlen(event) : 0;
+  const size_t total = eventLength(message, len, eventLen, id, reconnect);
+
+  AsyncEvent_SharedData_t data;
+  {
+#ifdef ESP32
+    std::lock_guard<std::mutex> lock(_poolLock);
+#endif
+    for (auto& entry : _eventPool) {
+      if (!entry)
+        entry = std::make_shared<String>();
+      if (entry.use_count() == 1) {
+        data = entry;
+        break;
+      }
+    }
+  }
+  // every pooled event is still queued somewhere
+  if (!data)
+    data = std::make_shared<String>();
+
+  data->remove(0);
+  if (!data->reserve(total))
+    return nullptr;
+  encodeEvent(*data, message, len, event, eventLen, id, reconnect);
+  return data;
+}
+
 AsyncEventSource::SendStatus AsyncEventSource::send(
   const char* message, const char* event, uint32_t id, uint32_t reconnect) {
-  AsyncEvent_SharedData_t shared_msg = std::make_shared<String>(generateEventMessage(message, event, id, reconnect));
+  return send((const uint8_t*)message, message ? strlen(message) : 0, event, id, reconnect);
+}
+
+static uint32_t eventHash(const char* event) {
+  uint32_t hash = 2166136261UL;
+  while (*event)
+    hash = (hash ^ (uint8_t)*event++) * 16777619UL;
+  return hash ? hash : 1;
+}
+
+bool AsyncEventSource::coalesceEvent(const char* event) {
+  if (!event || !*event)
+    return false;
+  const uint32_t hash = eventHash(event);
+  for (uint32_t& entry : _coalescedEvents) {
+    if (entry == hash)
+      return true;
+    if (!entry) {
+      entry = hash;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t AsyncEventSource::_eventKey(const char* event) const {
+  if (!event || !*event)
+    return 0;
+  const uint32_t hash = eventHash(event);
+  if (_coalescing)
+    return hash;
+  for (uint32_t entry : _coalescedEvents) {
+    if (entry == hash)
+      return hash;
+  }
+  return 0;
+}
+
+AsyncEventSource::SendStatus AsyncEventSource::send(const uint8_t* message, size_t len, const char* event, uint32_t id, uint32_t reconnect) {
+  AsyncEvent_SharedData_t shared_msg = _encodeEvent((const char*)message, len, event, id, reconnect);
+  if (!shared_msg)
+    return DISCARDED;
+  const uint32_t key = _eventKey(event);
 #ifdef ESP32
   std::lock_guard<std::mutex> lock(_client_queue_lock);
 #endif
+  if (id && !_replay.empty())
+    _record(id, shared_msg);
   size_t hits = 0;
   size_t miss = 0;
   for (const auto& c : _clients) {
-    if (c->write(shared_msg))
+    if (c->write(shared_msg, key, id))
       ++hits;
     else
       ++miss;
@@ -412,6 +556,104 @@ AsyncEventSource::SendStatus AsyncEventSource::send(
   return hits == 0 ? DISCARDED : (miss == 0 ? ENQUEUED : PARTIALLY_ENQUEUED);
 }
 
+void AsyncEventSource::enableReplay(size_t count, size_t maxBytes) {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_client_queue_lock);
+#endif
+  _replay.clear();
+  _replay.shrink_to_fit();
+  _replay.resize(count);
+  _replayHead = 0;
+  _replayCount = 0;
+  _replayBytes = 0;
+  _replayMaxBytes = maxBytes;
+  _replayEvictedId = 0;
+}
+
+void AsyncEventSource::_replayEvict() {
+  ReplayEntry& oldest = _replayAt(0);
+  _replayEvictedId = oldest.id;
+  _replayBytes -= oldest.data->length();
+  oldest.data.reset();
+  _replayHead = (_replayHead + 1) % _replay.size();
+  _replayCount--;
+  _replayStats.evicted++;
+}
+
+void AsyncEventSource::_record(uint32_t id, const AsyncEvent_SharedData_t& data) {
+  // a restarted id sequence makes the events held useless for lookups by id
+  if (_replayCount && id <= _replayAt(_replayCount - 1).id) {
+    while (_replayCount)
+      _replayEvict();
+    _replayEvictedId = 0;
+  }
+
+  const size_t len = data->length();
+  if (_replayMaxBytes && len > _replayMaxBytes) {
+    // never fits, reconnecting clients learn about it as a gap
+    _replayEvictedId = id;
+    _replayStats.evicted++;
+    return;
+  }
+  while (_replayCount == _replay.size() || (_replayMaxBytes && _replayBytes + len > _replayMaxBytes))
+    _replayEvict();
+
+  _replayAt(_replayCount) = {id, data};
+  _replayCount++;
+  _replayBytes += len;
+}
+
+void AsyncEventSource::_replayTo(AsyncEventSourceClient* client) {
+  const uint32_t last = client->lastId();
+  if (!last || !_replayCount)
+    return;
+
+  // first event newer than the client has seen, ids increase along the ring
+  size_t lo = 0;
+  size_t hi = _replayCount;
+  while (lo < hi) {
+    const size_t mid = (lo + hi) / 2;
+    if (_replayAt(mid).id <= last)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  // the oldest missed events are given up when the client queue cannot take them all
+  const size_t room = SSE_MAX_QUEUED_MESSAGES - client->packetsWaiting();
+  const bool gap = last < _replayEvictedId || _replayCount - lo > room;
+  if (_replayCount - lo > room)
+    lo = _replayCount - room;
+  if (gap)
+    _replayStats.gaps++;
+
+  for (; lo < _replayCount; lo++) {
+    if (client->write(_replayAt(lo).data, 0, _replayAt(lo).id))
+      _replayStats.replayed++;
+  }
+}
+
+void AsyncEventSource::printMetrics(Print& out) const {
+  const char* url = _url.c_str();
+  out.print(F("# TYPE asynceventsource_clients gauge\n"));
+  out.printf("asynceventsource_clients{url=\"%s\"} %u\n", url, (unsigned)count());
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_client_queue_lock);
+#endif
+  out.print(F("# TYPE asynceventsource_coalesced_total counter\n"));
+  out.printf("asynceventsource_coalesced_total{url=\"%s\"} %lu\n", url, (unsigned long)_coalesced);
+  out.print(F("# TYPE asynceventsource_replay_events gauge\n"));
+  out.printf("asynceventsource_replay_events{url=\"%s\"} %u\n", url, (unsigned)_replayCount);
+  out.print(F("# TYPE asynceventsource_replay_bytes gauge\n"));
+  out.printf("asynceventsource_replay_bytes{url=\"%s\"} %u\n", url, (unsigned)_replayBytes);
+  out.print(F("# TYPE asynceventsource_replay_evicted_total counter\n"));
+  out.printf("asynceventsource_replay_evicted_total{url=\"%s\"} %lu\n", url, (unsigned long)_replayStats.evicted);
+  out.print(F("# TYPE asynceventsource_replayed_total counter\n"));
+  out.printf("asynceventsource_replayed_total{url=\"%s\"} %lu\n", url, (unsigned long)_replayStats.replayed);
+  out.print(F("# TYPE asynceventsource_replay_gaps_total counter\n"));
+  out.printf("asynceventsource_replay_gaps_total{url=\"%s\"} %lu\n", url, (unsigned long)_replayStats.gaps);
+}
+
 size_t AsyncEventSource::count() const {
 #ifdef ESP32
   std::lock_guard<std::mutex> lock(_client_queue_lock);
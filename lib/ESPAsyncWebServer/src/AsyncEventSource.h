@@ -21,6 +21,7 @@
 #define ASYNCEVENTSOURCE_H_
 
 #include <Arduino.h>
+#include <atomic>
 
 #ifdef ESP32
   #include <AsyncTCP.h>
@@ -48,6 +49,18 @@
 
 #include <ESPAsyncWebServer.h>
 
+#include "AsyncBudget.h"
+
+// Encoded events kept by each AsyncEventSource for reuse once all client queues are done with them
+#ifndef SSE_EVENT_POOL_SIZE
+  #define SSE_EVENT_POOL_SIZE 4
+#endif
+
+// Event names each AsyncEventSource can coalesce on their own, see AsyncEventSource::coalesceEvent()
+#ifndef SSE_COALESCED_EVENTS
+  #define SSE_COALESCED_EVENTS 4
+#endif
+
 #ifdef ESP8266
   #include <Hash.h>
   #ifdef CRYPTO_HASH_h // include Hash.h from espressif framework if the first include was from the crypto library
@@ -63,6 +76,15 @@ using ArAuthorizeConnectHandler = ArAuthorizeFunction;
 // shared message object container
 using AsyncEvent_SharedData_t = std::shared_ptr<String>;
 
+typedef struct {
+    /** Events dropped from the replay buffer to make room for newer ones. */
+    uint32_t evicted;
+    /** Events replayed to reconnecting clients. */
+    uint32_t replayed;
+    /** Reconnecting clients that missed events no longer held. */
+    uint32_t gaps;
+} AsyncEventReplayStats;
+
 /**
  * @brief Async Event Message container with shared message content data
  *
@@ -70,17 +92,21 @@ using AsyncEvent_SharedData_t = std::shared_ptr<String>;
 class AsyncEventSourceMessage {
 
   private:
-    const AsyncEvent_SharedData_t _data;
+    AsyncEvent_SharedData_t _data;
     size_t _sent{0};  // num of bytes already sent
     size_t _acked{0}; // num of bytes acked
+    uint32_t _key{0}; // event name hash when coalescing, 0 otherwise
+    uint32_t _id{0};  // id of the event, 0 without one
 
   public:
-    AsyncEventSourceMessage(AsyncEvent_SharedData_t data) : _data(data) {};
+    // an empty slot of a client queue
+    AsyncEventSourceMessage() = default;
+    AsyncEventSourceMessage(AsyncEvent_SharedData_t data, uint32_t key = 0, uint32_t id = 0) : _data(data), _key(key), _id(id) {};
 #ifdef ESP32
     AsyncEventSourceMessage(const char* data, size_t len) : _data(std::make_shared<String>(data, len)) {};
 #else
     // esp8266's String does not have constructor with data/length arguments. Use a concat method here
-    AsyncEventSourceMessage(const char* data, size_t len) { _data->concat(data, len); };
+    AsyncEventSourceMessage(const char* data, size_t len) : _data(std::make_shared<String>()) { _data->concat(data, len); };
 #endif
 
     /**
@@ -118,6 +144,17 @@ class AsyncEventSourceMessage {
      *
      */
     bool sent() { return _sent == _data->length(); }
+
+    // true once any byte went out, the message cannot be replaced any more
+    bool started() const { return _sent != 0; }
+    uint32_t key() const { return _key; }
+    uint32_t id() const { return _id; }
+    void replace(AsyncEvent_SharedData_t data, uint32_t id) {
+      _data = std::move(data);
+      _id = id;
+    }
+    // bytes charged to the global budget
+    size_t size() const { return _data ? _data->length() : 0; }
 };
 
 /**
@@ -131,14 +168,29 @@ class AsyncEventSourceClient {
     uint32_t _lastId{0};
     size_t _inflight{0};                   // num of unacknowledged bytes that has been written to socket buffer
     size_t _max_inflight{SSE_MAX_INFLIGH}; // max num of unacknowledged bytes that could be written to socket buffer
-    std::list<AsyncEventSourceMessage> _messageQueue;
+    // Bounded single producer, single consumer ring. Publishers append at _tail, serialized among themselves
+    // by _lockProducer, while the AsyncTCP task sends and releases messages from _head under _lockmq,
+    // so publishing never waits for the network task and the network task never waits for a publisher.
+    static constexpr size_t _queueSlots = SSE_MAX_QUEUED_MESSAGES + 1;
+    AsyncEventSourceMessage _messageQueue[_queueSlots];
+    std::atomic<size_t> _head{0};
+    std::atomic<size_t> _tail{0};
 #ifdef ESP32
     mutable std::mutex _lockmq;
+    std::mutex _lockProducer;
 #endif
     bool _queueMessage(const char* message, size_t len);
-    bool _queueMessage(AsyncEvent_SharedData_t&& msg);
+    bool _queueMessage(AsyncEvent_SharedData_t&& msg, uint32_t key = 0, uint32_t id = 0);
     void _runQueue();
 
+    // token bucket in thousandths of an event, consumer side only
+    uint16_t _maxRate{0};
+    uint32_t _tokens{0};
+    uint32_t _lastRefill{0};
+    uint32_t _coalesced{0};
+    bool _takeToken();
+    AsyncWebServerBudget::Flow _budget;
+
   public:
     AsyncEventSourceClient(AsyncWebServerRequest* request, AsyncEventSource* server);
     ~AsyncEventSourceClient();
@@ -157,16 +209,23 @@ class AsyncEventSourceClient {
     bool send(const char* message, const char* event = NULL, uint32_t id = 0, uint32_t reconnect = 0);
     bool send(const String& message, const String& event, uint32_t id = 0, uint32_t reconnect = 0) { return send(message.c_str(), event.c_str(), id, reconnect); }
     bool send(const String& message, const char* event, uint32_t id = 0, uint32_t reconnect = 0) { return send(message.c_str(), event, id, reconnect); }
+    /**
+     * @brief Send len bytes of message, which may hold NUL bytes and need not be terminated
+     */
+    bool send(const uint8_t* message, size_t len, const char* event = NULL, uint32_t id = 0, uint32_t reconnect = 0);
 
     /**
      * @brief place supplied preformatted SSE message to the message queue
      * @note message must a properly formatted SSE string according to https://developer.mozilla.org/en-US/docs/Web/API/Server-sent_events/Using_server-sent_events
      *
      * @param message data
+     * @param key non zero to replace the newest queued message with the same key that did not start sending yet
+     * @param id id of the event, one with an id only replaces a message no other event with an id is queued behind,
+     * so the ids reach the client in order
      * @return true on success
      * @return false on queue overflow or no client connected
      */
-    bool write(AsyncEvent_SharedData_t message) { return connected() && _queueMessage(std::move(message)); };
+    bool write(AsyncEvent_SharedData_t message, uint32_t key = 0, uint32_t id = 0) { return connected() && _queueMessage(std::move(message), key, id); };
 
     [[deprecated("Use _write(AsyncEvent_SharedData_t message) instead to share same data with multiple SSE clients")]]
     bool write(const char* message, size_t len) { return connected() && _queueMessage(message, len); };
@@ -179,7 +238,7 @@ class AsyncEventSourceClient {
     AsyncClient* client() { return _client; }
     bool connected() const { return _client && _client->connected(); }
     uint32_t lastId() const { return _lastId; }
-    size_t packetsWaiting() const { return _messageQueue.size(); };
+    size_t packetsWaiting() const { return (_tail.load(std::memory_order_acquire) + _queueSlots - _head.load(std::memory_order_acquire)) % _queueSlots; };
 
     /**
      * @brief Sets max amount of bytes that could be written to client's socket while awaiting delivery acknowledge
@@ -197,6 +256,19 @@ class AsyncEventSourceClient {
      */
     size_t get_max_inflight_bytes() const { return _max_inflight; }
 
+    /**
+     * @brief Start at most eventsPerSecond events a second, with bursts of up to one second worth
+     * @note held events stay queued, where coalescing keeps replacing them with newer ones of the same name.
+     * The queue resumes on the next ack or poll, so the rate is enforced with the AsyncTCP poll granularity.
+     *
+     * @param eventsPerSecond 0 for no limit (default)
+     */
+    void setMaxEventRate(uint16_t eventsPerSecond);
+    uint16_t maxEventRate() const { return _maxRate; }
+
+    // queued events replaced by a newer one of the same name
+    uint32_t coalescedEvents() const { return _coalesced; }
+
     // system callbacks (do not call if from user code!)
     void _onAck(size_t len, uint32_t time);
     void _onPoll();
@@ -220,10 +292,41 @@ class AsyncEventSource : public AsyncWebHandler {
 #endif
     ArEventHandlerFunction _connectcb = nullptr;
     ArEventHandlerFunction _disconnectcb = nullptr;
+    bool _coalescing{false};
+    // hashes of the event names coalesced while _coalescing is off, 0 for a free entry
+    uint32_t _coalescedEvents[SSE_COALESCED_EVENTS]{};
+    uint16_t _maxRate{0};
+    uint32_t _coalesced{0};
 
     // this method manipulates in-fligh data size for connected client depending on number of active connections
     void _adjust_inflight_window();
 
+    // Replay ring of the last events sent with an id, oldest at _replayHead. Guarded by _client_queue_lock
+    // like the delivery to the clients, so a reconnecting client gets the replay before any live event.
+    struct ReplayEntry {
+        uint32_t id;
+        AsyncEvent_SharedData_t data;
+    };
+    std::vector<ReplayEntry> _replay;
+    size_t _replayHead{0};
+    size_t _replayCount{0};
+    size_t _replayBytes{0};
+    size_t _replayMaxBytes{0};
+    // id of the newest event evicted, clients that saw only older ones have a gap
+    uint32_t _replayEvictedId{0};
+    AsyncEventReplayStats _replayStats{};
+
+    ReplayEntry& _replayAt(size_t i) { return _replay[(_replayHead + i) % _replay.size()]; }
+    void _replayEvict();
+    void _record(uint32_t id, const AsyncEvent_SharedData_t& data);
+    void _replayTo(AsyncEventSourceClient* client);
+
+    // an entry is free again once the pool holds its only reference, its String keeps the capacity
+    AsyncEvent_SharedData_t _eventPool[SSE_EVENT_POOL_SIZE];
+#ifdef ESP32
+    std::mutex _poolLock;
+#endif
+
   public:
     typedef enum {
       DISCARDED = 0,
@@ -260,6 +363,11 @@ class AsyncEventSource : public AsyncWebHandler {
     SendStatus send(const char* message, const char* event = NULL, uint32_t id = 0, uint32_t reconnect = 0);
     SendStatus send(const String& message, const String& event, uint32_t id = 0, uint32_t reconnect = 0) { return send(message.c_str(), event.c_str(), id, reconnect); }
     SendStatus send(const String& message, const char* event, uint32_t id = 0, uint32_t reconnect = 0) { return send(message.c_str(), event, id, reconnect); }
+    /**
+     * @brief Send len bytes of message, which may hold NUL bytes and need not be terminated
+     * @note the event is encoded once into a buffer of its exact size, taken from a small pool, and shared by all clients
+     */
+    SendStatus send(const uint8_t* message, size_t len, const char* event = NULL, uint32_t id = 0, uint32_t reconnect = 0);
 
     // The client pointer sent to the callback is only for reference purposes. DO NOT CALL ANY METHOD ON IT !
     void onDisconnect(ArEventHandlerFunction cb) { _disconnectcb = cb; }
@@ -271,7 +379,43 @@ class AsyncEventSource : public AsyncWebHandler {
     // returns average number of messages pending in all client's queues
     size_t avgPacketsWaiting() const;
 
+    /**
+     * @brief Keep the last events sent with a non zero id and replay the ones after its Last-Event-ID
+     * to a reconnecting client, before it gets any live event
+     * @note ids must increase from one event to the next, a smaller id starts over with an empty buffer.
+     * Entries share the event text with the client queues, at most as many as a client queue holds are replayed.
+     *
+     * @param count events kept
+     * @param maxBytes total length of the events kept, 0 for no limit
+     */
+    void enableReplay(size_t count, size_t maxBytes = 0);
+    void disableReplay() { enableReplay(0); }
+
+    /**
+     * @brief Replace a queued event that did not start sending yet with a newer one of the same event name,
+     * so a slow client gets the latest value instead of every sample and its queue stops overflowing
+     * @note unnamed events are never coalesced, and an event with an id does not overtake another one with an id
+     */
+    void setCoalescing(bool enable) { _coalescing = enable; }
+    bool coalescing() const { return _coalescing; }
+    /**
+     * @brief Coalesce the events of this name only, the other ones keep queueing up unless setCoalescing(true)
+     * @return false when all SSE_COALESCED_EVENTS names are taken
+     */
+    bool coalesceEvent(const char* event);
+    // rate limit applied to clients connecting from now on, see AsyncEventSourceClient::setMaxEventRate()
+    void setMaxEventRate(uint16_t eventsPerSecond) { _maxRate = eventsPerSecond; }
+    const AsyncEventReplayStats& replayStats() const { return _replayStats; }
+
+    // Prometheus text exposition of the client count and the replay buffer,
+    // to be appended to the output of AsyncWebServerMetrics::printTo()
+    void printMetrics(Print& out) const;
+
     // system callbacks (do not call from user code!)
+    AsyncEvent_SharedData_t _encodeEvent(const char* message, size_t len, const char* event, uint32_t id, uint32_t reconnect);
+    // key of a named event while coalescing, 0 otherwise
+    uint32_t _eventKey(const char* event) const;
+    void _countCoalesced() { _coalesced++; }
     void _addClient(AsyncEventSourceClient* client);
     void _handleDisconnect(AsyncEventSourceClient* client);
     bool canHandle(AsyncWebServerRequest* request) const override final;
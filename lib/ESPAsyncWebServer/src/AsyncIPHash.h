@@ -0,0 +1,27 @@
+#pragma once
+
+/*
+  Slot of an IPv4 address in the fixed tables of the per client limits (AsyncRateLimitMiddleware, AsyncWebServer)
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace asyncsrv {
+
+constexpr unsigned slotBits(size_t slots) {
+  return slots > 1 ? 1 + slotBits(slots / 2) : 0;
+}
+
+/**
+ * @brief Fibonacci hashing of ip into a table of Slots entries
+ * @note IPAddress keeps the first octet in the low byte and the last one, the only one that differs between clients
+ * of a LAN, in the high byte. Only the top bits of the product depend on all of them, so those are taken.
+ */
+template <size_t Slots>
+inline size_t ipSlot(uint32_t ip) {
+  static_assert(Slots && !(Slots & (Slots - 1)), "table sizes hashed by IP must be a power of two");
+  return Slots == 1 ? 0 : (uint32_t)(ip * 2654435761UL) >> ((32 - slotBits(Slots)) & 31);
+}
+
+} // namespace asyncsrv
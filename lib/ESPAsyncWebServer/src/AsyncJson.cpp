@@ -43,6 +43,18 @@ size_t AsyncJsonResponse::setLength() {
   return _contentLength;
 }
 
+String AsyncJsonResponse::_contentETag() {
+  if (!_isValid)
+    return String();
+  HashPrint dest;
+  #if ARDUINOJSON_VERSION_MAJOR == 5
+  _root.printTo(dest);
+  #else
+  serializeJson(_root, dest);
+  #endif
+  return dest.etag();
+}
+
 size_t AsyncJsonResponse::_fillBuffer(uint8_t* data, size_t len) {
   ChunkPrint dest(data, _sentLength, len);
   #if ARDUINOJSON_VERSION_MAJOR == 5
@@ -71,6 +83,18 @@ size_t PrettyAsyncJsonResponse::setLength() {
   return _contentLength;
 }
 
+String PrettyAsyncJsonResponse::_contentETag() {
+  if (!_isValid)
+    return String();
+  HashPrint dest;
+  #if ARDUINOJSON_VERSION_MAJOR == 5
+  _root.prettyPrintTo(dest);
+  #else
+  serializeJsonPretty(_root, dest);
+  #endif
+  return dest.etag();
+}
+
 size_t PrettyAsyncJsonResponse::_fillBuffer(uint8_t* data, size_t len) {
   ChunkPrint dest(data, _sentLength, len);
   #if ARDUINOJSON_VERSION_MAJOR == 5
@@ -83,10 +107,10 @@ size_t PrettyAsyncJsonResponse::_fillBuffer(uint8_t* data, size_t len) {
 
   #if ARDUINOJSON_VERSION_MAJOR == 6
 AsyncCallbackJsonWebHandler::AsyncCallbackJsonWebHandler(const String& uri, ArJsonRequestHandlerFunction onRequest, size_t maxJsonBufferSize)
-    : _uri(uri), _method(HTTP_GET | HTTP_POST | HTTP_PUT | HTTP_PATCH), _onRequest(onRequest), maxJsonBufferSize(maxJsonBufferSize), _maxContentLength(16384) {}
+    : _uri(uri), _method(HTTP_GET | HTTP_HEAD | HTTP_POST | HTTP_PUT | HTTP_PATCH), _onRequest(onRequest), maxJsonBufferSize(maxJsonBufferSize), _maxContentLength(16384) {}
   #else
 AsyncCallbackJsonWebHandler::AsyncCallbackJsonWebHandler(const String& uri, ArJsonRequestHandlerFunction onRequest)
-    : _uri(uri), _method(HTTP_GET | HTTP_POST | HTTP_PUT | HTTP_PATCH), _onRequest(onRequest), _maxContentLength(16384) {}
+    : _uri(uri), _method(HTTP_GET | HTTP_HEAD | HTTP_POST | HTTP_PUT | HTTP_PATCH), _onRequest(onRequest), _maxContentLength(16384) {}
   #endif
 
 bool AsyncCallbackJsonWebHandler::canHandle(AsyncWebServerRequest* request) const {
@@ -96,7 +120,7 @@ bool AsyncCallbackJsonWebHandler::canHandle(AsyncWebServerRequest* request) cons
   if (_uri.length() && (_uri != request->url() && !request->url().startsWith(_uri + "/")))
     return false;
 
-  if (request->method() != HTTP_GET && !request->contentType().equalsIgnoreCase(asyncsrv::T_application_json))
+  if (request->method() != HTTP_GET && request->method() != HTTP_HEAD && !request->contentType().equalsIgnoreCase(asyncsrv::T_application_json))
     return false;
 
   return true;
@@ -104,9 +128,22 @@ bool AsyncCallbackJsonWebHandler::canHandle(AsyncWebServerRequest* request) cons
 
 void AsyncCallbackJsonWebHandler::handleRequest(AsyncWebServerRequest* request) {
   if (_onRequest) {
-    if (request->method() == HTTP_GET) {
+    if (request->method() == HTTP_GET || request->method() == HTTP_HEAD) {
+      String etag;
+      if (_version) {
+        // an up to date client gets a 304 before the body is ever built
+        etag = AsyncWebServerResponse::versionETag(_version());
+        if (AsyncWebServerResponse::etagMatch(request->header(asyncsrv::T_INM).c_str(), etag.c_str())) {
+          AsyncWebServerResponse* response = request->beginResponse(304);
+          response->addHeader(asyncsrv::T_ETag, etag);
+          request->send(response);
+          return;
+        }
+      }
       JsonVariant json;
       _onRequest(request, json);
+      if (etag.length() && request->getResponse())
+        request->getResponse()->addHeader(asyncsrv::T_ETag, etag);
       return;
     } else if (request->_tempObject != NULL) {
 
@@ -77,6 +77,7 @@ class AsyncJsonResponse : public AsyncAbstractResponse {
     JsonVariant& getRoot() { return _root; }
     bool _sourceValid() const { return _isValid; }
     size_t setLength();
+    String _contentETag();
     size_t getSize() const { return _jsonBuffer.size(); }
     size_t _fillBuffer(uint8_t* data, size_t len);
   #if ARDUINOJSON_VERSION_MAJOR >= 6
@@ -92,6 +93,7 @@ class PrettyAsyncJsonResponse : public AsyncJsonResponse {
     PrettyAsyncJsonResponse(bool isArray = false);
   #endif
     size_t setLength();
+    String _contentETag();
     size_t _fillBuffer(uint8_t* data, size_t len);
 };
 
@@ -102,6 +104,7 @@ class AsyncCallbackJsonWebHandler : public AsyncWebHandler {
     String _uri;
     WebRequestMethodComposite _method;
     ArJsonRequestHandlerFunction _onRequest;
+    ArVersionFunction _version;
     size_t _contentLength;
   #if ARDUINOJSON_VERSION_MAJOR == 6
     size_t maxJsonBufferSize;
@@ -118,6 +121,11 @@ class AsyncCallbackJsonWebHandler : public AsyncWebHandler {
     void setMethod(WebRequestMethodComposite method) { _method = method; }
     void setMaxContentLength(int maxContentLength) { _maxContentLength = maxContentLength; }
     void onRequest(ArJsonRequestHandlerFunction fn) { _onRequest = fn; }
+    /**
+     * @brief Declare a counter bumped whenever the GET payload changes
+     * @note GET and HEAD responses are then tagged with it, and a matching If-None-Match is answered with 304 without calling onRequest
+     */
+    void setVersion(ArVersionFunction fn) { _version = fn; }
 
     bool canHandle(AsyncWebServerRequest* request) const override final;
     void handleRequest(AsyncWebServerRequest* request) override final;
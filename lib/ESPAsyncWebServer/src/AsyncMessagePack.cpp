@@ -30,6 +30,14 @@ size_t AsyncMessagePackResponse::setLength() {
   return _contentLength;
 }
 
+String AsyncMessagePackResponse::_contentETag() {
+  if (!_isValid)
+    return String();
+  HashPrint dest;
+  serializeMsgPack(_root, dest);
+  return dest.etag();
+}
+
 size_t AsyncMessagePackResponse::_fillBuffer(uint8_t* data, size_t len) {
   ChunkPrint dest(data, _sentLength, len);
   serializeMsgPack(_root, dest);
@@ -38,10 +46,10 @@ size_t AsyncMessagePackResponse::_fillBuffer(uint8_t* data, size_t len) {
 
   #if ARDUINOJSON_VERSION_MAJOR == 6
 AsyncCallbackMessagePackWebHandler::AsyncCallbackMessagePackWebHandler(const String& uri, ArMessagePackRequestHandlerFunction onRequest, size_t maxJsonBufferSize)
-    : _uri(uri), _method(HTTP_GET | HTTP_POST | HTTP_PUT | HTTP_PATCH), _onRequest(onRequest), maxJsonBufferSize(maxJsonBufferSize), _maxContentLength(16384) {}
+    : _uri(uri), _method(HTTP_GET | HTTP_HEAD | HTTP_POST | HTTP_PUT | HTTP_PATCH), _onRequest(onRequest), maxJsonBufferSize(maxJsonBufferSize), _maxContentLength(16384) {}
   #else
 AsyncCallbackMessagePackWebHandler::AsyncCallbackMessagePackWebHandler(const String& uri, ArMessagePackRequestHandlerFunction onRequest)
-    : _uri(uri), _method(HTTP_GET | HTTP_POST | HTTP_PUT | HTTP_PATCH), _onRequest(onRequest), _maxContentLength(16384) {}
+    : _uri(uri), _method(HTTP_GET | HTTP_HEAD | HTTP_POST | HTTP_PUT | HTTP_PATCH), _onRequest(onRequest), _maxContentLength(16384) {}
   #endif
 
 bool AsyncCallbackMessagePackWebHandler::canHandle(AsyncWebServerRequest* request) const {
@@ -51,7 +59,7 @@ bool AsyncCallbackMessagePackWebHandler::canHandle(AsyncWebServerRequest* reques
   if (_uri.length() && (_uri != request->url() && !request->url().startsWith(_uri + "/")))
     return false;
 
-  if (request->method() != HTTP_GET && !request->contentType().equalsIgnoreCase(asyncsrv::T_application_msgpack))
+  if (request->method() != HTTP_GET && request->method() != HTTP_HEAD && !request->contentType().equalsIgnoreCase(asyncsrv::T_application_msgpack))
     return false;
 
   return true;
@@ -59,9 +67,22 @@ bool AsyncCallbackMessagePackWebHandler::canHandle(AsyncWebServerRequest* reques
 
 void AsyncCallbackMessagePackWebHandler::handleRequest(AsyncWebServerRequest* request) {
   if (_onRequest) {
-    if (request->method() == HTTP_GET) {
+    if (request->method() == HTTP_GET || request->method() == HTTP_HEAD) {
+      String etag;
+      if (_version) {
+        // an up to date client gets a 304 before the body is ever built
+        etag = AsyncWebServerResponse::versionETag(_version());
+        if (AsyncWebServerResponse::etagMatch(request->header(asyncsrv::T_INM).c_str(), etag.c_str())) {
+          AsyncWebServerResponse* response = request->beginResponse(304);
+          response->addHeader(asyncsrv::T_ETag, etag);
+          request->send(response);
+          return;
+        }
+      }
       JsonVariant json;
       _onRequest(request, json);
+      if (etag.length() && request->getResponse())
+        request->getResponse()->addHeader(asyncsrv::T_ETag, etag);
       return;
     } else if (request->_tempObject != NULL) {
 
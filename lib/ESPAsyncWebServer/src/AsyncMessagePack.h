@@ -61,6 +61,7 @@ class AsyncMessagePackResponse : public AsyncAbstractResponse {
     JsonVariant& getRoot() { return _root; }
     bool _sourceValid() const { return _isValid; }
     size_t setLength();
+    String _contentETag();
     size_t getSize() const { return _jsonBuffer.size(); }
     size_t _fillBuffer(uint8_t* data, size_t len);
   #if ARDUINOJSON_VERSION_MAJOR >= 6
@@ -75,6 +76,7 @@ class AsyncCallbackMessagePackWebHandler : public AsyncWebHandler {
     String _uri;
     WebRequestMethodComposite _method;
     ArMessagePackRequestHandlerFunction _onRequest;
+    ArVersionFunction _version;
     size_t _contentLength;
   #if ARDUINOJSON_VERSION_MAJOR == 6
     size_t maxJsonBufferSize;
@@ -91,6 +93,11 @@ class AsyncCallbackMessagePackWebHandler : public AsyncWebHandler {
     void setMethod(WebRequestMethodComposite method) { _method = method; }
     void setMaxContentLength(int maxContentLength) { _maxContentLength = maxContentLength; }
     void onRequest(ArMessagePackRequestHandlerFunction fn) { _onRequest = fn; }
+    /**
+     * @brief Declare a counter bumped whenever the GET payload changes
+     * @note GET and HEAD responses are then tagged with it, and a matching If-None-Match is answered with 304 without calling onRequest
+     */
+    void setVersion(ArVersionFunction fn) { _version = fn; }
 
     bool canHandle(AsyncWebServerRequest* request) const override final;
     void handleRequest(AsyncWebServerRequest* request) override final;
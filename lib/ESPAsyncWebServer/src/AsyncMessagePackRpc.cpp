@@ -0,0 +1,192 @@
+#include "AsyncMessagePackRpc.h"
+
+#if ASYNC_MSG_PACK_SUPPORT == 1
+
+  #define RPC_REQUEST      0
+  #define RPC_RESPONSE     1
+  #define RPC_NOTIFICATION 2
+
+namespace {
+  uint32_t methodHash(const char* name) {
+    uint32_t hash = 2166136261UL;
+    while (*name)
+      hash = (hash ^ (uint8_t)*name++) * 16777619UL;
+    return hash;
+  }
+
+  // the envelope around the payload is encoded by hand so the payload is serialized once, straight
+  // into a buffer of its exact size
+  size_t uintSize(uint32_t value) {
+    return value < 0x80 ? 1 : value <= 0xFF ? 2 : value <= 0xFFFF ? 3 : 5;
+  }
+
+  uint8_t* writeUint(uint8_t* p, uint32_t value) {
+    if (value < 0x80) {
+      *p++ = value;
+    } else if (value <= 0xFF) {
+      *p++ = 0xcc;
+      *p++ = value;
+    } else if (value <= 0xFFFF) {
+      *p++ = 0xcd;
+      *p++ = value >> 8;
+      *p++ = value;
+    } else {
+      *p++ = 0xce;
+      *p++ = value >> 24;
+      *p++ = value >> 16;
+      *p++ = value >> 8;
+      *p++ = value;
+    }
+    return p;
+  }
+
+  size_t strSize(size_t len) {
+    return len + (len < 32 ? 1 : len <= 0xFF ? 2 : 3);
+  }
+
+  uint8_t* writeStr(uint8_t* p, const char* str, size_t len) {
+    if (len < 32) {
+      *p++ = 0xa0 | len;
+    } else if (len <= 0xFF) {
+      *p++ = 0xd9;
+      *p++ = len;
+    } else {
+      *p++ = 0xda;
+      *p++ = len >> 8;
+      *p++ = len;
+    }
+    memcpy(p, str, len);
+    return p + len;
+  }
+
+  AsyncWebSocketSharedBuffer makeNotification(const char* method, JsonVariantConst params) {
+    const size_t nameLen = strlen(method);
+    const size_t payload = measureMsgPack(params);
+    AsyncWebSocketSharedBuffer buffer = std::make_shared<std::vector<uint8_t>>(2 + strSize(nameLen) + payload);
+    uint8_t* p = buffer->data();
+    *p++ = 0x93;
+    *p++ = RPC_NOTIFICATION;
+    p = writeStr(p, method, nameLen);
+    serializeMsgPack(params, p, payload);
+    return buffer;
+  }
+} // namespace
+
+bool AsyncMessagePackRpc::on(const char* name, ArRpcHandler handler) {
+  if (_count == ASYNC_RPC_MAX_METHODS || _find(name))
+    return false;
+  const uint32_t hash = methodHash(name);
+  size_t i = _count++;
+  for (; i && _methods[i - 1].hash > hash; i--)
+    _methods[i] = std::move(_methods[i - 1]);
+  _methods[i] = {hash, name, std::move(handler)};
+  return true;
+}
+
+const AsyncMessagePackRpc::Method* AsyncMessagePackRpc::_find(const char* name) const {
+  const uint32_t hash = methodHash(name);
+  size_t lo = 0;
+  size_t hi = _count;
+  while (lo < hi) {
+    const size_t mid = (lo + hi) / 2;
+    if (_methods[mid].hash < hash)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (; lo < _count && _methods[lo].hash == hash; lo++) {
+    if (!strcmp(_methods[lo].name, name))
+      return &_methods[lo];
+  }
+  return nullptr;
+}
+
+void AsyncMessagePackRpc::attach(AsyncWebSocket& ws) {
+  _server = &ws;
+  ws.onEvent([this](AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len) {
+    handleEvent(server, client, type, arg, data, len);
+  });
+}
+
+void AsyncMessagePackRpc::handleEvent(AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len) {
+  if (!_server)
+    _server = server;
+  if (type != WS_EVT_DATA)
+    return;
+  const AwsFrameInfo* info = (const AwsFrameInfo*)arg;
+  // fragments of a message that was not reassembled cannot be decoded
+  if (info->opcode != WS_BINARY || !info->final || info->index || info->len != len)
+    return;
+  _dispatch(client, data, len);
+}
+
+void AsyncMessagePackRpc::_dispatch(AsyncWebSocketClient* client, const uint8_t* data, size_t len) {
+  #if ARDUINOJSON_VERSION_MAJOR == 6
+  DynamicJsonDocument request(ASYNC_RPC_DOCUMENT_SIZE);
+  DynamicJsonDocument result(ASYNC_RPC_DOCUMENT_SIZE);
+  #else
+  JsonDocument request;
+  JsonDocument result;
+  #endif
+
+  if (deserializeMsgPack(request, data, len))
+    return;
+  JsonArrayConst message = request.as<JsonArrayConst>();
+  const uint8_t type = message[0] | 0xFF;
+
+  if (type == RPC_NOTIFICATION && message.size() == 3) {
+    const char* name = message[1];
+    const Method* method = name ? _find(name) : nullptr;
+    if (method)
+      method->handler(client, message[2], result.to<JsonVariant>());
+    return;
+  }
+  if (type != RPC_REQUEST || message.size() != 4 || !message[1].is<uint32_t>())
+    return;
+
+  const uint32_t msgid = message[1];
+  const char* name = message[2];
+  const Method* method = name ? _find(name) : nullptr;
+  if (!method) {
+    result.set("no such method");
+    _reply(client, msgid, false, result.as<JsonVariantConst>());
+    return;
+  }
+  const bool ok = method->handler(client, message[3], result.to<JsonVariant>());
+  _reply(client, msgid, ok, result.as<JsonVariantConst>());
+}
+
+bool AsyncMessagePackRpc::_reply(AsyncWebSocketClient* client, uint32_t msgid, bool ok, JsonVariantConst payload) {
+  const size_t payloadLen = measureMsgPack(payload);
+  // array header, type, msgid, the payload and nil in the other of the error and result slots
+  AsyncWebSocketSharedBuffer buffer = std::make_shared<std::vector<uint8_t>>(2 + uintSize(msgid) + payloadLen + 1);
+  uint8_t* p = buffer->data();
+  *p++ = 0x94;
+  *p++ = RPC_RESPONSE;
+  p = writeUint(p, msgid);
+  if (ok)
+    *p++ = 0xc0;
+  serializeMsgPack(payload, p, payloadLen);
+  p += payloadLen;
+  if (!ok)
+    *p++ = 0xc0;
+  return client->binary(buffer);
+}
+
+bool AsyncMessagePackRpc::notify(AsyncWebSocketClient* client, const char* method, JsonVariantConst params) {
+  return client->binary(makeNotification(method, params));
+}
+
+AsyncWebSocket::SendStatus AsyncMessagePackRpc::notifyAll(const char* method, JsonVariantConst params) {
+  if (!_server)
+    return AsyncWebSocket::DISCARDED;
+  return _server->binaryAll(makeNotification(method, params));
+}
+
+AsyncWebSocket::SendStatus AsyncMessagePackRpc::publish(const char* topic, const char* method, JsonVariantConst params) {
+  if (!_server)
+    return AsyncWebSocket::DISCARDED;
+  return _server->publish(topic, makeNotification(method, params), WS_BINARY);
+}
+
+#endif // ASYNC_MSG_PACK_SUPPORT == 1
@@ -0,0 +1,104 @@
+#pragma once
+
+/*
+  MessagePack-RPC over a WebSocket, one persistent connection instead of a request per call
+
+  Example (all of it, with the same methods over HTTP to compare, in examples/MessagePackRpc)
+
+    AsyncWebSocket ws("/rpc");
+    AsyncMessagePackRpc rpc;
+
+    rpc.on("config.get", [](AsyncWebSocketClient* client, JsonVariantConst params, JsonVariant result) {
+      result["site"] = config.site;
+      return true;
+    });
+    rpc.on("config.set", [](AsyncWebSocketClient* client, JsonVariantConst params, JsonVariant result) {
+      if (!params["site"].is<const char*>()) {
+        result.set("site missing");
+        return false;
+      }
+      config.site = params["site"].as<const char*>();
+      return true;
+    });
+    // handlers run on the network task, hand out results of an asynchronous scan (WiFi.scanNetworks(true))
+    rpc.on("wifi.scan", [](AsyncWebSocketClient* client, JsonVariantConst params, JsonVariant result) { ... });
+    rpc.attach(ws);
+    ws.setMessageReassembly(1024);
+    server.addHandler(&ws);
+
+    // live values are pushed as notifications
+    rpc.notifyAll("metrics", doc.as<JsonVariantConst>());
+
+  Wire format (https://github.com/msgpack-rpc/msgpack-rpc/blob/master/spec.md), in binary messages:
+
+    request       [0, msgid, method, params]
+    response      [1, msgid, error, result]
+    notification  [2, method, params]
+
+  Requests must arrive as one complete message, enable message reassembly on the AsyncWebSocket
+  if clients may fragment them.
+*/
+
+#include "AsyncMessagePack.h"
+
+#if ASYNC_MSG_PACK_SUPPORT == 1
+
+  #ifndef ASYNC_RPC_MAX_METHODS
+    #define ASYNC_RPC_MAX_METHODS 16
+  #endif
+
+  #if ARDUINOJSON_VERSION_MAJOR == 6
+    #ifndef ASYNC_RPC_DOCUMENT_SIZE
+      #define ASYNC_RPC_DOCUMENT_SIZE DYNAMIC_JSON_DOCUMENT_SIZE
+    #endif
+  #endif
+
+/**
+ * @brief Called for a request or notification
+ * @param result filled with the result, or with the error when returning false
+ * @return false to answer with an error
+ */
+using ArRpcHandler = std::function<bool(AsyncWebSocketClient* client, JsonVariantConst params, JsonVariant result)>;
+
+class AsyncMessagePackRpc {
+  private:
+    struct Method {
+        uint32_t hash;
+        const char* name;
+        ArRpcHandler handler;
+    };
+
+    // sorted by hash, looked up with a binary search
+    Method _methods[ASYNC_RPC_MAX_METHODS];
+    size_t _count = 0;
+    AsyncWebSocket* _server = nullptr;
+
+    const Method* _find(const char* name) const;
+    void _dispatch(AsyncWebSocketClient* client, const uint8_t* data, size_t len);
+    bool _reply(AsyncWebSocketClient* client, uint32_t msgid, bool ok, JsonVariantConst payload);
+
+  public:
+    /**
+     * @brief Register a method, name must outlive this object (a literal)
+     * @return false when all ASYNC_RPC_MAX_METHODS entries are taken or the name is registered already
+     */
+    bool on(const char* name, ArRpcHandler handler);
+
+    /**
+     * @brief Dispatch the messages of ws, this takes its onEvent handler
+     */
+    void attach(AsyncWebSocket& ws);
+
+    /**
+     * @brief Feed an event from an onEvent handler of your own
+     */
+    void handleEvent(AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len);
+
+    bool notify(AsyncWebSocketClient* client, const char* method, JsonVariantConst params);
+    // serialized and framed once for every client of the attached socket
+    AsyncWebSocket::SendStatus notifyAll(const char* method, JsonVariantConst params);
+    // to the subscribers of topic only
+    AsyncWebSocket::SendStatus publish(const char* topic, const char* method, JsonVariantConst params);
+};
+
+#endif // ASYNC_MSG_PACK_SUPPORT == 1
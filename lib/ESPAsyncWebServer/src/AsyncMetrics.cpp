@@ -0,0 +1,101 @@
+#include "AsyncMetrics.h"
+
+static const uint32_t latencyBounds[AsyncWebServerMetrics::LATENCY_BUCKETS] = {1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000, 5000000};
+static const uint32_t sizeBounds[AsyncWebServerMetrics::SIZE_BUCKETS] = {256, 1024, 4096, 16384, 65536, 262144};
+
+AsyncWebServerMetrics::AsyncWebServerMetrics() {
+  _routes[ASYNCWEBSERVER_METRICS_ROUTES].label = "other";
+}
+
+bool AsyncWebServerMetrics::track(const AsyncWebHandler& handler, const String& label) {
+  for (size_t i = 0; i < ASYNCWEBSERVER_METRICS_ROUTES; i++) {
+    if (_routes[i].handler == nullptr || _routes[i].handler == &handler) {
+      _routes[i].handler = &handler;
+      _routes[i].label = label;
+      return true;
+    }
+  }
+  return false;
+}
+
+AsyncWebServerMetrics::Route& AsyncWebServerMetrics::_route(const AsyncWebHandler* handler) {
+  for (size_t i = 0; i < ASYNCWEBSERVER_METRICS_ROUTES && _routes[i].handler; i++) {
+    if (_routes[i].handler == handler)
+      return _routes[i];
+  }
+  return _routes[ASYNCWEBSERVER_METRICS_ROUTES];
+}
+
+void AsyncWebServerMetrics::record(const AsyncWebHandler* handler, uint32_t ttfb, uint32_t total, size_t bytes, int32_t systemHeapDrop) {
+  Route& r = _route(handler);
+  r.requests++;
+  r.ttfb.add(ttfb, latencyBounds);
+  r.total.add(total, latencyBounds);
+  r.bytes.add(bytes, sizeBounds);
+  r.systemHeapDrop.add(systemHeapDrop > 0 ? systemHeapDrop : 0, sizeBounds);
+}
+
+void AsyncWebServerMetrics::reset() {
+  for (auto& r : _routes) {
+    r.requests = 0;
+    r.ttfb = {};
+    r.total = {};
+    r.bytes = {};
+    r.systemHeapDrop = {};
+  }
+}
+
+void AsyncWebServerMetrics::_printHistogram(Print& out, const char* name, const char* route, const uint32_t* counts, const uint32_t* bounds, size_t n, uint64_t sum, double scale) const {
+  uint32_t cumulative = 0;
+  for (size_t i = 0; i <= n; i++) {
+    cumulative += counts[i];
+    out.printf("%s_bucket{route=\"%s\",le=\"", name, route);
+    if (i < n)
+      out.print(bounds[i] * scale, scale < 1 ? 3 : 0);
+    else
+      out.print("+Inf");
+    out.printf("\"} %lu\n", (unsigned long)cumulative);
+  }
+  out.printf("%s_sum{route=\"%s\"} ", name, route);
+  out.print(sum * scale, scale < 1 ? 6 : 0);
+  out.print('\n');
+  out.printf("%s_count{route=\"%s\"} %lu\n", name, route, (unsigned long)cumulative);
+}
+
+void AsyncWebServerMetrics::printTo(Print& out) const {
+  out.print(F("# TYPE asyncwebserver_requests_total counter\n"));
+  for (const auto& r : _routes) {
+    if (r.requests)
+      out.printf("asyncwebserver_requests_total{route=\"%s\"} %lu\n", r.label.c_str(), (unsigned long)r.requests);
+  }
+
+  out.print(F("# TYPE asyncwebserver_ttfb_seconds histogram\n"));
+  for (const auto& r : _routes) {
+    if (r.requests)
+      _printHistogram(out, "asyncwebserver_ttfb_seconds", r.label.c_str(), r.ttfb.counts, latencyBounds, LATENCY_BUCKETS, r.ttfb.sum, 1e-6);
+  }
+
+  out.print(F("# TYPE asyncwebserver_response_seconds histogram\n"));
+  for (const auto& r : _routes) {
+    if (r.requests)
+      _printHistogram(out, "asyncwebserver_response_seconds", r.label.c_str(), r.total.counts, latencyBounds, LATENCY_BUCKETS, r.total.sum, 1e-6);
+  }
+
+  out.print(F("# TYPE asyncwebserver_response_bytes histogram\n"));
+  for (const auto& r : _routes) {
+    if (r.requests)
+      _printHistogram(out, "asyncwebserver_response_bytes", r.label.c_str(), r.bytes.counts, sizeBounds, SIZE_BUCKETS, r.bytes.sum, 1);
+  }
+
+  out.print(F("# TYPE asyncwebserver_system_heap_drop_bytes histogram\n"));
+  for (const auto& r : _routes) {
+    if (r.requests)
+      _printHistogram(out, "asyncwebserver_system_heap_drop_bytes", r.label.c_str(), r.systemHeapDrop.counts, sizeBounds, SIZE_BUCKETS, r.systemHeapDrop.sum, 1);
+  }
+}
+
+void AsyncWebServerMetrics::send(AsyncWebServerRequest* request) const {
+  AsyncResponseStream* response = request->beginResponseStream(F("text/plain; version=0.0.4"));
+  printTo(*response);
+  request->send(response);
+}
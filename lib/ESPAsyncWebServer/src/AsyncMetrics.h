@@ -0,0 +1,88 @@
+/*
+  Per-route request metrics for AsyncWebServer
+
+  Example
+
+    AsyncWebServerMetrics metrics;
+
+    metrics.track(server.on("/scan", HTTP_GET, handleScan), "/scan");
+    server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest* request) { metrics.send(request); });
+    server.setMetrics(&metrics);
+
+  Requests served by handlers that are not tracked are aggregated under route="other".
+*/
+#ifndef ASYNC_METRICS_H_
+#define ASYNC_METRICS_H_
+
+#include <ESPAsyncWebServer.h>
+
+#ifndef ASYNCWEBSERVER_METRICS_ROUTES
+  #define ASYNCWEBSERVER_METRICS_ROUTES 8
+#endif
+
+class AsyncWebServerMetrics {
+  public:
+    // upper bounds of the latency buckets in microseconds (1-2-5 series), followed by +Inf
+    static constexpr size_t LATENCY_BUCKETS = 12;
+    // upper bounds of the size buckets in bytes (powers of 4), followed by +Inf
+    static constexpr size_t SIZE_BUCKETS = 6;
+
+    template <size_t N>
+    struct Histogram {
+        uint32_t counts[N + 1] = {};
+        uint64_t sum = 0;
+
+        void add(uint32_t value, const uint32_t (&bounds)[N]) {
+          size_t i = 0;
+          while (i < N && value > bounds[i])
+            i++;
+          counts[i]++;
+          sum += value;
+        }
+    };
+
+    struct Route {
+        const AsyncWebHandler* handler = nullptr;
+        String label;
+        uint32_t requests = 0;
+        Histogram<LATENCY_BUCKETS> ttfb;
+        Histogram<LATENCY_BUCKETS> total;
+        Histogram<SIZE_BUCKETS> bytes;
+        // how far the free heap of the whole system fell from accept to completion, floored at 0. Other
+        // requests and tasks running meanwhile count too, it is not what this request allocated
+        Histogram<SIZE_BUCKETS> systemHeapDrop;
+    };
+
+  private:
+    // last slot collects requests of untracked handlers
+    Route _routes[ASYNCWEBSERVER_METRICS_ROUTES + 1];
+
+    Route& _route(const AsyncWebHandler* handler);
+    void _printHistogram(Print& out, const char* name, const char* route, const uint32_t* counts, const uint32_t* bounds, size_t n, uint64_t sum, double scale) const;
+
+  public:
+    AsyncWebServerMetrics();
+
+    /**
+     * @brief Aggregate the requests served by handler under its own route label
+     * @return false when all ASYNCWEBSERVER_METRICS_ROUTES slots are taken
+     */
+    bool track(const AsyncWebHandler& handler, const String& label);
+
+    /**
+     * @brief Account one completed request, does not allocate
+     *
+     * @param ttfb microseconds from accept to the response head being queued
+     * @param total microseconds from accept to the response being fully acked
+     * @param systemHeapDrop free heap of the system at accept minus free heap at completion
+     */
+    void record(const AsyncWebHandler* handler, uint32_t ttfb, uint32_t total, size_t bytes, int32_t systemHeapDrop);
+
+    void reset();
+
+    // Prometheus text exposition format
+    void printTo(Print& out) const;
+    void send(AsyncWebServerRequest* request) const;
+};
+
+#endif // ASYNC_METRICS_H_
@@ -0,0 +1,170 @@
+#include "AsyncSession.h"
+
+#include "literals.h"
+
+#ifdef ESP32
+  #include <esp_timer.h>
+#endif
+
+using namespace asyncsrv;
+
+namespace {
+
+// does not wrap like millis(), an expiry stays comparable for the whole uptime
+uint32_t uptimeSeconds() {
+#if defined(ESP32)
+  return esp_timer_get_time() / 1000000;
+#elif defined(ESP8266)
+  return micros64() / 1000000;
+#else
+  return millis() / 1000;
+#endif
+}
+
+} // namespace
+
+void AsyncSessionMiddleware::setSecret(const uint8_t* key, size_t len) {
+  _hmac.setKey(key, len);
+  _boot = randomWord();
+}
+
+void AsyncSessionMiddleware::generateSecret() {
+  uint32_t key[8];
+  for (size_t i = 0; i < 8; i++)
+    key[i] = randomWord();
+  _hmac.setKey((const uint8_t*)key, sizeof(key));
+  memset(key, 0, sizeof(key));
+  _boot = randomWord();
+}
+
+void AsyncSessionMiddleware::_sign(const char* expiry, char* out) const {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+  // 32 bytes are 43 characters without padding, the spare byte keeps the last group in bounds
+  uint8_t mac[HmacSha256::MAC_SIZE + 1];
+  uint8_t message[4 + 8];
+  memcpy(message, &_boot, 4);
+  memcpy(message + 4, expiry, 8);
+  _hmac.mac(message, sizeof(message), mac);
+  mac[32] = 0;
+  for (size_t i = 0, o = 0; o < 43; i += 3) {
+    const uint32_t group = (uint32_t)mac[i] << 16 | (uint32_t)mac[i + 1] << 8 | mac[i + 2];
+    for (int shift = 18; shift >= 0 && o < 43; shift -= 6)
+      out[o++] = alphabet[(group >> shift) & 0x3f];
+  }
+  out[43] = '\0';
+}
+
+String AsyncSessionMiddleware::issue() {
+  if (!_hmac.hasKey())
+    generateSecret();
+
+  char token[TOKEN_LENGTH + 1];
+  snprintf(token, sizeof(token), "%08lx.", (unsigned long)(uptimeSeconds() + _lifetime));
+  _sign(token, token + 9);
+  _stats.issued++;
+  return String(token);
+}
+
+void AsyncSessionMiddleware::sendToken(AsyncWebServerRequest* request) {
+  const String token = issue();
+  char body[TOKEN_LENGTH + 40];
+  snprintf(body, sizeof(body), "{\"token\":\"%s\",\"expires_in\":%lu}", token.c_str(), (unsigned long)_lifetime);
+
+  AsyncWebServerResponse* response = request->beginResponse(200, T_application_json, body);
+  response->addHeader(T_Cache_Control, "no-store");
+  if (_cookie) {
+    String cookie;
+    cookie.reserve(strlen(_cookie) + TOKEN_LENGTH + 64);
+    cookie.concat(_cookie);
+    cookie.concat('=');
+    cookie.concat(token);
+    cookie.concat(F("; Max-Age="));
+    cookie.concat(_lifetime);
+    cookie.concat(F("; Path=/; HttpOnly; SameSite=Strict"));
+    response->addHeader(T_Set_Cookie, cookie.c_str());
+  }
+  request->send(response);
+}
+
+bool AsyncSessionMiddleware::verify(const char* token, size_t len) {
+  if (!_hmac.hasKey() || !token || len != TOKEN_LENGTH || token[8] != '.') {
+    _stats.rejected++;
+    return false;
+  }
+
+  uint32_t expiry = 0;
+  for (size_t i = 0; i < 8; i++) {
+    const char c = token[i];
+    if (c >= '0' && c <= '9') {
+      expiry = expiry << 4 | (c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      expiry = expiry << 4 | (c - 'a' + 10);
+    } else {
+      _stats.rejected++;
+      return false;
+    }
+  }
+
+  char signature[44];
+  _sign(token, signature);
+  // constant time, a timing difference would reveal how much of a forged signature is right
+  uint8_t diff = 0;
+  for (size_t i = 0; i < 43; i++)
+    diff |= signature[i] ^ token[9 + i];
+  if (diff) {
+    _stats.rejected++;
+    return false;
+  }
+
+  if (expiry <= uptimeSeconds()) {
+    _stats.expired++;
+    return false;
+  }
+  _stats.accepted++;
+  return true;
+}
+
+bool AsyncSessionMiddleware::allowed(AsyncWebServerRequest* request) {
+  if (request->authMethod() == AsyncAuthType::AUTH_BEARER)
+    return verify(request->authorization().c_str(), request->authorization().length());
+
+  if (_cookie) {
+    const AsyncWebHeader* header = request->getHeader(T_Cookie);
+    const size_t nameLen = strlen(_cookie);
+    for (const char* p = header ? header->value().c_str() : nullptr; p && *p;) {
+      while (*p == ' ')
+        p++;
+      const char* end = strchr(p, ';');
+      if (!end)
+        end = p + strlen(p);
+      if (!strncmp(p, _cookie, nameLen) && p[nameLen] == '=')
+        return verify(p + nameLen + 1, end - p - nameLen - 1);
+      p = *end ? end + 1 : end;
+    }
+  }
+
+  _stats.rejected++;
+  return false;
+}
+
+void AsyncSessionMiddleware::run(AsyncWebServerRequest* request, ArMiddlewareNext next) {
+  if (allowed(request)) {
+    next();
+  } else {
+    AsyncWebServerResponse* response = request->beginResponse(401);
+    response->addHeader(T_WWW_AUTH, "Bearer");
+    request->send(response);
+  }
+}
+
+void AsyncSessionMiddleware::printTo(Print& out) const {
+  out.print(F("# TYPE asyncsession_issued_total counter\n"));
+  out.printf("asyncsession_issued_total %lu\n", (unsigned long)_stats.issued);
+  out.print(F("# TYPE asyncsession_accepted_total counter\n"));
+  out.printf("asyncsession_accepted_total %lu\n", (unsigned long)_stats.accepted);
+  out.print(F("# TYPE asyncsession_rejected_total counter\n"));
+  out.printf("asyncsession_rejected_total %lu\n", (unsigned long)_stats.rejected);
+  out.print(F("# TYPE asyncsession_expired_total counter\n"));
+  out.printf("asyncsession_expired_total %lu\n", (unsigned long)_stats.expired);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+/*
+  Stateless session tokens for AsyncWebServer: the password is checked once by a login route, which hands out an
+  expiring token signed with HMAC-SHA256. API calls then present the token and are verified without hashing the
+  password, allocating or reading NVS.
+
+  Example
+
+    AsyncAuthenticationMiddleware login;
+    AsyncSessionMiddleware session;
+
+    login.setUsername(user);
+    login.setPassword(pass);
+    login.setAuthType(AsyncAuthType::AUTH_DIGEST);
+    session.setLifetime(3600);
+    // lets EventSource connections, which cannot set headers, present the token too
+    session.setCookieName("session");
+
+    server.on("/login", HTTP_POST, [](AsyncWebServerRequest* request) { session.sendToken(request); }).addMiddleware(&login);
+    server.on("/api/state", HTTP_GET, handleState).addMiddleware(&session);
+    events.addMiddleware(&session);
+
+  Clients send "Authorization: Bearer <token>" or the cookie. A token is "<expiry>.<signature>": the uptime in seconds
+  it expires at, in 8 hex digits, and the base64url HMAC-SHA256 of it and of a random id drawn with the secret.
+
+  The secret is drawn from the hardware random number generator on the first token issued, so a reboot or
+  generateSecret() revokes all tokens. Draw it after WiFi started, the ESP32 generator needs the radio for true
+  randomness. Expiries count uptime, which restarts at every boot, so tokens never outlive the boot they were issued
+  in: a secret set with setSecret() is signed together with a new random id at every boot too.
+*/
+
+#include "AsyncCrypto.h"
+#include <ESPAsyncWebServer.h>
+
+#ifndef ASYNC_SESSION_LIFETIME
+  #define ASYNC_SESSION_LIFETIME 3600
+#endif
+
+struct AsyncSessionStats {
+    uint32_t issued;
+    uint32_t accepted;
+    // missing, malformed or with a wrong signature
+    uint32_t rejected;
+    uint32_t expired;
+};
+
+class AsyncSessionMiddleware : public AsyncMiddleware {
+  public:
+    // token length without the terminator
+    static constexpr size_t TOKEN_LENGTH = 8 + 1 + 43;
+
+    // HMAC key, keys longer than 64 bytes are hashed first
+    void setSecret(const uint8_t* key, size_t len);
+    // draw a new 32 byte secret, revoking all tokens
+    void generateSecret();
+
+    void setLifetime(uint32_t seconds) { _lifetime = seconds; }
+    // also accept the token from this cookie, nullptr to only accept the Authorization header (default)
+    void setCookieName(const char* name) { _cookie = name; }
+
+    // new token valid for the lifetime
+    String issue();
+    // respond with {"token":"...","expires_in":seconds} and set the cookie when enabled
+    void sendToken(AsyncWebServerRequest* request);
+
+    bool verify(const char* token, size_t len);
+    bool allowed(AsyncWebServerRequest* request);
+
+    void run(AsyncWebServerRequest* request, ArMiddlewareNext next);
+
+    const AsyncSessionStats& stats() const { return _stats; }
+
+    // Prometheus text exposition format
+    void printTo(Print& out) const;
+
+  private:
+    asyncsrv::HmacSha256 _hmac;
+    uint32_t _lifetime = ASYNC_SESSION_LIFETIME;
+    const char* _cookie = nullptr;
+    AsyncSessionStats _stats{};
+
+    // drawn with the secret, tokens of an earlier boot would otherwise carry expiries of an uptime that restarted
+    uint32_t _boot = 0;
+
+    // base64url HMAC-SHA256 of the boot id and the 8 expiry digits, 43 characters and a terminator
+    void _sign(const char* expiry, char* out) const;
+};
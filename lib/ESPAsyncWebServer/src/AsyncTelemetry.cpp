@@ -0,0 +1,124 @@
+#include "AsyncTelemetry.h"
+
+#include <cmath>
+
+bool AsyncEventTelemetry::_add(const char* name, Field&& field) {
+  if (_count == ASYNC_TELEMETRY_MAX_FIELDS)
+    return false;
+  field.name = name;
+  _fields[_count++] = std::move(field);
+  return true;
+}
+
+bool AsyncEventTelemetry::addInt(const char* name, std::function<int32_t()> read) {
+  return _add(name, {nullptr, 0, [read]() { return (double)read(); }, nullptr});
+}
+
+bool AsyncEventTelemetry::addFloat(const char* name, std::function<float()> read, uint8_t decimals) {
+  return _add(name, {nullptr, decimals, [read]() { return (double)read(); }, nullptr});
+}
+
+bool AsyncEventTelemetry::addString(const char* name, std::function<const char*()> read) {
+  return _add(name, {nullptr, 0, nullptr, std::move(read)});
+}
+
+bool AsyncEventTelemetry::attach(AsyncEventSource& source) {
+  _source = &source;
+  return source.coalesceEvent(_event);
+}
+
+void AsyncEventTelemetry::setRate(uint16_t ticksPerSecond) {
+  _period = 1000000UL / (ticksPerSecond ? std::min<uint16_t>(ticksPerSecond, 1000) : 1);
+}
+
+size_t AsyncEventTelemetry::_serialize() {
+  char* p = _buffer;
+  // the closing brace and the terminator of snprintf are kept free
+  char* const end = _buffer + sizeof(_buffer) - 2;
+
+  *p++ = '{';
+  for (size_t i = 0; i < _count; i++) {
+    const Field& field = _fields[i];
+    int n = snprintf(p, end - p, i ? ",\"%s\":" : "\"%s\":", field.name);
+    if (n < 0 || n >= end - p)
+      return 0;
+    p += n;
+
+    if (field.readNumber) {
+      const double value = field.readNumber();
+      // JSON has no NaN or infinity
+      n = std::isfinite(value) ? snprintf(p, end - p, "%.*f", field.decimals, value) : snprintf(p, end - p, "null");
+      if (n < 0 || n >= end - p)
+        return 0;
+      p += n;
+      continue;
+    }
+
+    const char* value = field.readString();
+    if (!value)
+      value = "";
+    if (p == end)
+      return 0;
+    *p++ = '"';
+    for (; *value; value++) {
+      const uint8_t c = *value;
+      if (c < 0x20) {
+        // control characters have no use in a sample, they are dropped
+        continue;
+      }
+      if (end - p < 2)
+        return 0;
+      if (c == '"' || c == '\\')
+        *p++ = '\\';
+      *p++ = c;
+    }
+    if (p == end)
+      return 0;
+    *p++ = '"';
+  }
+  *p++ = '}';
+  *p = '\0';
+  return p - _buffer;
+}
+
+bool AsyncEventTelemetry::publish() {
+  _stats.ticks++;
+  const size_t len = _serialize();
+  if (!len) {
+    _stats.overflows++;
+    return false;
+  }
+  if (!_source || _source->send((const uint8_t*)_buffer, len, _event, ++_id) == AsyncEventSource::DISCARDED) {
+    _stats.discarded++;
+    return false;
+  }
+  return true;
+}
+
+void AsyncEventTelemetry::loop() {
+  const uint32_t now = micros();
+  if (!_next)
+    _next = now;
+  if ((int32_t)(now - _next) < 0)
+    return;
+  if (now - _next >= _period) {
+    // called too late, the ticks in between are gone
+    _stats.late += (now - _next) / _period;
+    _next = now;
+  }
+  _next += _period;
+
+  if (_source && _source->count())
+    publish();
+}
+
+void AsyncEventTelemetry::printTo(Print& out) const {
+  out.print(F("# TYPE asynctelemetry_ticks_total counter\n"));
+  out.printf("asynctelemetry_ticks_total{event=\"%s\"} %lu\n", _event, (unsigned long)_stats.ticks);
+  out.print(F("# TYPE asynctelemetry_late_ticks_total counter\n"));
+  out.printf("asynctelemetry_late_ticks_total{event=\"%s\"} %lu\n", _event, (unsigned long)_stats.late);
+  out.print(F("# TYPE asynctelemetry_overflows_total counter\n"));
+  out.printf("asynctelemetry_overflows_total{event=\"%s\"} %lu\n", _event, (unsigned long)_stats.overflows);
+  out.print(F("# TYPE asynctelemetry_discarded_total counter\n"));
+  out.printf("asynctelemetry_discarded_total{event=\"%s\"} %lu\n", _event, (unsigned long)_stats.discarded);
+}
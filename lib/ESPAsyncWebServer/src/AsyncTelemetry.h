@@ -0,0 +1,121 @@
+#pragma once
+
+/*
+  Periodic telemetry published as one SSE event for all clients of an AsyncEventSource
+
+  Example
+
+    AsyncEventSource events("/events");
+    AsyncEventTelemetry telemetry("telemetry");
+
+    telemetry.addFloat("power", [] { return meter.power(); });
+    telemetry.addFloat("voltage", [] { return meter.voltage(); }, 1);
+    telemetry.addInt("rssi", [] { return WiFi.RSSI(); });
+    telemetry.addInt("heap", [] { return ESP.getFreeHeap(); });
+    telemetry.addString("db", [] { return g_dbState == DbState::UP ? "up" : g_dbState == DbState::DOWN ? "down" : "unknown"; });
+    telemetry.setRate(10);
+    telemetry.attach(events);
+    server.addHandler(&events);
+
+    void loop() {
+      telemetry.loop();
+    }
+
+  Each tick samples the fields and serializes them once into a fixed buffer, as a JSON object:
+
+    event: telemetry
+    id: 42
+    data: {"power":1234.5,"voltage":230.1,"rssi":-61,"heap":182344,"db":"up"}
+
+  The event is then encoded once and shared by the client queues. attach() turns on coalescing for the telemetry
+  event only, so a client that cannot keep up holds at most one pending sample that is replaced by newer ones
+  instead of a growing queue. Other events sent on the same source keep queueing up in order.
+  Ticks without any client connected do not sample at all.
+*/
+
+#include <ESPAsyncWebServer.h>
+
+#ifndef ASYNC_TELEMETRY_MAX_FIELDS
+  #define ASYNC_TELEMETRY_MAX_FIELDS 8
+#endif
+
+#ifndef ASYNC_TELEMETRY_BUFFER_SIZE
+  #define ASYNC_TELEMETRY_BUFFER_SIZE 256
+#endif
+
+struct AsyncTelemetryStats {
+    uint32_t ticks;
+    // ticks dropped because loop() was called too late for them
+    uint32_t late;
+    // samples that did not fit the buffer
+    uint32_t overflows;
+    // samples no client queue took
+    uint32_t discarded;
+};
+
+class AsyncEventTelemetry {
+  private:
+    struct Field {
+        const char* name;
+        uint8_t decimals;
+        // set for numbers, readString for strings
+        std::function<double()> readNumber;
+        std::function<const char*()> readString;
+    };
+
+    const char* _event;
+    Field _fields[ASYNC_TELEMETRY_MAX_FIELDS];
+    size_t _count = 0;
+    AsyncEventSource* _source = nullptr;
+    uint32_t _period = 1000000;
+    uint32_t _next = 0;
+    uint32_t _id = 0;
+    AsyncTelemetryStats _stats{};
+    char _buffer[ASYNC_TELEMETRY_BUFFER_SIZE];
+
+    bool _add(const char* name, Field&& field);
+    // length of the serialized sample, 0 when it does not fit
+    size_t _serialize();
+
+  public:
+    /**
+     * @param event SSE event name of the samples, must outlive this object (a literal)
+     */
+    AsyncEventTelemetry(const char* event = "telemetry") : _event(event) {}
+
+    /**
+     * @brief Add a field sampled on every tick, name must outlive this object (a literal)
+     * @return false when all ASYNC_TELEMETRY_MAX_FIELDS fields are taken
+     */
+    bool addInt(const char* name, std::function<int32_t()> read);
+    bool addFloat(const char* name, std::function<float()> read, uint8_t decimals = 1);
+    // the string is copied into the sample right away, JSON special characters are escaped
+    bool addString(const char* name, std::function<const char*()> read);
+
+    /**
+     * @brief Publish to the clients of source, this turns on its coalescing of the telemetry event
+     * @return false when the source coalesces SSE_COALESCED_EVENTS other event names already, the samples then
+     * queue up like any other event
+     */
+    bool attach(AsyncEventSource& source);
+
+    // ticks per second, up to 1000
+    void setRate(uint16_t ticksPerSecond);
+
+    /**
+     * @brief Publish a sample when the next tick is due, to be called from the main loop
+     * @note ticks missed by a late call are dropped, not caught up in a burst
+     */
+    void loop();
+
+    /**
+     * @brief Sample and publish now
+     * @return false when no client took the sample
+     */
+    bool publish();
+
+    const AsyncTelemetryStats& stats() const { return _stats; }
+
+    // Prometheus text exposition format
+    void printTo(Print& out) const;
+};
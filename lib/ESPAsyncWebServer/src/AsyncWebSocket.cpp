@@ -20,6 +20,8 @@
 */
 #include "AsyncWebSocket.h"
 #include "Arduino.h"
+#include "AsyncCrypto.h"
+#include "Inflater.h"
 
 #include <cstring>
 
@@ -38,6 +40,49 @@
 
 using namespace asyncsrv;
 
+// XORs len bytes of src into dst with the 4 byte mask, starting offset bytes into the masked stream.
+// src and dst may be the same buffer.
+void webSocketMask(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t* mask, size_t offset) {
+  size_t i = 0;
+#ifndef WS_MASK_SCALAR
+  // word at a time once both pointers are aligned, unaligned loads fault on Xtensa
+  if (len >= 16 && (((uintptr_t)dst ^ (uintptr_t)src) & 3) == 0) {
+    for (; ((uintptr_t)(dst + i) & 3) != 0; i++)
+      dst[i] = src[i] ^ mask[(offset + i) & 3];
+    // mask bytes in the order they land in memory from here on
+    uint8_t rotated[4];
+    for (uint8_t k = 0; k < 4; k++)
+      rotated[k] = mask[(offset + i + k) & 3];
+    uint32_t m;
+    memcpy(&m, rotated, 4);
+    // byte pointers and memcpy keep the accesses within the aliasing rules, the alignment they are
+    // declared with lets the compiler turn each copy into single word loads and stores
+    uint8_t* d = (uint8_t*)__builtin_assume_aligned(dst + i, 4);
+    const uint8_t* s = (const uint8_t*)__builtin_assume_aligned(src + i, 4);
+    const size_t bytes = (len - i) & ~(size_t)3;
+    size_t k = 0;
+    for (; k + 16 <= bytes; k += 16) {
+      uint32_t w[4];
+      memcpy(w, s + k, 16);
+      w[0] ^= m;
+      w[1] ^= m;
+      w[2] ^= m;
+      w[3] ^= m;
+      memcpy(d + k, w, 16);
+    }
+    for (; k < bytes; k += 4) {
+      uint32_t w;
+      memcpy(&w, s + k, 4);
+      w ^= m;
+      memcpy(d + k, &w, 4);
+    }
+    i += bytes;
+  }
+#endif
+  for (; i < len; i++)
+    dst[i] = src[i] ^ mask[(offset + i) & 3];
+}
+
 size_t webSocketSendFrameWindow(AsyncClient* client) {
   if (!client || !client->canSend())
     return 0;
@@ -47,83 +92,74 @@ size_t webSocketSendFrameWindow(AsyncClient* client) {
   return space - 8;
 }
 
-size_t webSocketSendFrame(AsyncClient* client, bool final, uint8_t opcode, bool mask, uint8_t* data, size_t len) {
+// Queues one frame on the client. Small frames are copied behind their header so they reach
+// lwIP in a single add(). With flush unset the caller is expected to call client->send() itself.
+size_t webSocketSendFrame(AsyncClient* client, bool final, uint8_t opcode, bool mask, uint8_t* data, size_t len, bool flush = true) {
   if (!client || !client->canSend()) {
-    // Serial.println("SF 1");
     return 0;
   }
   size_t space = client->space();
-  if (space < 2) {
-    // Serial.println("SF 2");
-    return 0;
-  }
-  uint8_t mbuf[4] = {0, 0, 0, 0};
   uint8_t headLen = 2;
-  if (len && mask) {
+  if (len && mask)
     headLen += 4;
-    mbuf[0] = rand() % 0xFF;
-    mbuf[1] = rand() % 0xFF;
-    mbuf[2] = rand() % 0xFF;
-    mbuf[3] = rand() % 0xFF;
-  }
   if (len > 125)
     headLen += 2;
   if (space < headLen) {
-    // Serial.println("SF 2");
     return 0;
   }
   space -= headLen;
 
-  if (len > space)
+  if (len > space) {
     len = space;
-
-  uint8_t* buf = (uint8_t*)malloc(headLen);
-  if (buf == NULL) {
-    // os_printf("could not malloc %u bytes for frame header\n", headLen);
-    //  Serial.println("SF 3");
-    return 0;
+    // the truncated payload may no longer need the extended length
+    if (len < 126 && (headLen == 4 || headLen == 8))
+      headLen -= 2;
   }
 
-  buf[0] = opcode & 0x0F;
+  uint8_t frame[8 + WS_FRAME_COALESCE_SIZE];
+  frame[0] = opcode & (0x0F | WS_FRAME_RSV1);
   if (final)
-    buf[0] |= 0x80;
+    frame[0] |= 0x80;
   if (len < 126)
-    buf[1] = len & 0x7F;
+    frame[1] = len & 0x7F;
   else {
-    buf[1] = 126;
-    buf[2] = (uint8_t)((len >> 8) & 0xFF);
-    buf[3] = (uint8_t)(len & 0xFF);
+    frame[1] = 126;
+    frame[2] = (uint8_t)((len >> 8) & 0xFF);
+    frame[3] = (uint8_t)(len & 0xFF);
   }
+  // the key ends the header, unmasked frames have none
+  uint8_t* mbuf = nullptr;
   if (len && mask) {
-    buf[1] |= 0x80;
-    memcpy(buf + (headLen - 4), mbuf, 4);
+    frame[1] |= 0x80;
+    mbuf = frame + headLen - 4;
+    const uint32_t key = randomWord();
+    memcpy(mbuf, &key, 4);
   }
-  if (client->add((const char*)buf, headLen) != headLen) {
-    // os_printf("error adding %lu header bytes\n", headLen);
-    free(buf);
-    // Serial.println("SF 4");
-    return 0;
-  }
-  free(buf);
 
-  if (len) {
-    if (len && mask) {
-      size_t i;
-      for (i = 0; i < len; i++)
-        data[i] = data[i] ^ mbuf[i % 4];
+  if (headLen + len <= sizeof(frame)) {
+    uint8_t* payload = frame + headLen;
+    if (mbuf) {
+      webSocketMask(payload, data, len, mbuf, 0);
+    } else if (len) {
+      memcpy(payload, data, len);
+    }
+    if (client->add((const char*)frame, headLen + len) != headLen + len) {
+      return 0;
+    }
+  } else {
+    if (client->add((const char*)frame, headLen) != headLen) {
+      return 0;
+    }
+    if (mbuf) {
+      webSocketMask(data, data, len, mbuf, 0);
     }
     if (client->add((const char*)data, len) != len) {
-      // os_printf("error adding %lu data bytes\n", len);
-      //  Serial.println("SF 5");
       return 0;
     }
   }
-  if (!client->send()) {
-    // os_printf("error sending frame: %lu\n", headLen+len);
-    //  Serial.println("SF 6");
+  if (flush && !client->send()) {
     return 0;
   }
-  // Serial.println("SF");
   return len;
 }
 
@@ -180,7 +216,7 @@ class AsyncWebSocketControl {
         if (_data == NULL)
           _len = 0;
         else
-          memcpy(_data, data, len);
+          memcpy(_data, data, _len);
       } else
         _data = NULL;
     }
@@ -195,7 +231,7 @@ class AsyncWebSocketControl {
     uint8_t len() { return _len + 2; }
     size_t send(AsyncClient* client) {
       _finished = true;
-      return webSocketSendFrame(client, true, _opcode & 0x0F, _mask, _data, _len);
+      return webSocketSendFrame(client, true, _opcode & 0x0F, _mask, _data, _len, false);
     }
 };
 
@@ -203,19 +239,25 @@ class AsyncWebSocketControl {
  * AsyncWebSocketMessage Message
  */
 
-AsyncWebSocketMessage::AsyncWebSocketMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode, bool mask) : _WSbuffer{buffer},
-                                                                                                             _opcode(opcode & 0x07),
-                                                                                                             _mask{mask},
+AsyncWebSocketMessage::AsyncWebSocketMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode, bool mask, bool framed, uint32_t key) : _WSbuffer{buffer},
+                                                                                                                                        _opcode(opcode & (0x07 | WS_FRAME_RSV1)),
+                                                                                                                                        _mask{mask},
+                                                                                                                                        _framed{framed},
+                                                                                                                                        _key{key},
                                                                                                              _status{_WSbuffer ? WS_MSG_SENDING : WS_MSG_ERROR} {
 }
 
-void AsyncWebSocketMessage::ack(size_t len, uint32_t time) {
+size_t AsyncWebSocketMessage::ack(size_t len, uint32_t time) {
   (void)time;
-  _acked += len;
+  const size_t used = std::min(len, _ack - _acked);
+  if (!used)
+    return len;
+  _acked += used;
   if (_sent >= _WSbuffer->size() && _acked >= _ack) {
     _status = WS_MSG_SENT;
   }
   // ets_printf("A: %u\n", len);
+  return len - used;
 }
 
 size_t AsyncWebSocketMessage::send(AsyncClient* client) {
@@ -224,6 +266,15 @@ size_t AsyncWebSocketMessage::send(AsyncClient* client) {
 
   if (_status != WS_MSG_SENDING)
     return 0;
+  if (_framed) {
+    // the buffer already holds the whole frame, continue it from this client's offset
+    if (!client->canSend() || _sent >= _WSbuffer->size())
+      return 0;
+    const size_t added = client->add((const char*)_WSbuffer->data() + _sent, std::min(_WSbuffer->size() - _sent, client->space()));
+    _sent += added;
+    _ack += added;
+    return added;
+  }
   if (_acked < _ack) {
     return 0;
   }
@@ -254,7 +305,7 @@ size_t AsyncWebSocketMessage::send(AsyncClient* client) {
   uint8_t* dPtr = (uint8_t*)(_WSbuffer->data() + (_sent - toSend));
   uint8_t opCode = (toSend && _sent == toSend) ? _opcode : (uint8_t)WS_CONTINUATION;
 
-  size_t sent = webSocketSendFrame(client, final, opCode, _mask, dPtr, toSend);
+  size_t sent = webSocketSendFrame(client, final, opCode, _mask, dPtr, toSend, false);
   _status = WS_MSG_SENDING;
   if (toSend && sent != toSend) {
     // ets_printf("E: %u != %u\n", toSend, sent);
@@ -268,14 +319,15 @@ size_t AsyncWebSocketMessage::send(AsyncClient* client) {
 /*
  * Async WebSocket Client
  */
-const char* AWSC_PING_PAYLOAD = "ESPAsyncWebServer-PING";
-const size_t AWSC_PING_PAYLOAD_LEN = 22;
+// keepalive pings are the tag followed by micros() at sending, the tag tells their pongs from those of application pings
+static const uint8_t keepAliveTag[4] = {'A', 'W', 'S', 'K'};
+#define WS_KEEPALIVE_PAYLOAD_LEN 8
 
 AsyncWebSocketClient::AsyncWebSocketClient(AsyncWebServerRequest* request, AsyncWebSocket* server)
     : _tempObject(NULL) {
   _client = request->client();
   _server = server;
-  _clientId = _server->_getNextId();
+  _clientId = 0;
   _status = WS_CONNECTED;
   _pstate = 0;
   _lastMessageTime = millis();
@@ -300,11 +352,14 @@ AsyncWebSocketClient::~AsyncWebSocketClient() {
     _controlQueue.clear();
   }
   _server->_handleEvent(this, WS_EVT_DISCONNECT, NULL, NULL, 0);
+  _server->_releaseSlot(this);
 }
 
 void AsyncWebSocketClient::_clearQueue() {
-  while (!_messageQueue.empty() && _messageQueue.front().finished())
+  while (!_messageQueue.empty() && _messageQueue.front().finished()) {
+    _budget.release(_messageQueue.front().size());
     _messageQueue.pop_front();
+  }
 }
 
 void AsyncWebSocketClient::_onAck(size_t len, uint32_t time) {
@@ -329,8 +384,11 @@ void AsyncWebSocketClient::_onAck(size_t len, uint32_t time) {
     }
   }
 
-  if (len && !_messageQueue.empty()) {
-    _messageQueue.front().ack(len, time);
+  // frames of several messages may be in flight, acks cover them in queue order
+  for (auto& message : _messageQueue) {
+    if (!len)
+      break;
+    len = message.ack(len, time);
   }
 
   _clearQueue();
@@ -345,14 +403,71 @@ void AsyncWebSocketClient::_onPoll() {
 #ifdef ESP32
   std::unique_lock<std::mutex> lock(_lock);
 #endif
-  if (_client && _client->canSend() && (!_controlQueue.empty() || !_messageQueue.empty())) {
+  if (_client && _client->canSend() && (!_controlQueue.empty() || !_messageQueue.empty()))
     _runQueue();
-  } else if (_keepAlivePeriod > 0 && (millis() - _lastMessageTime) >= _keepAlivePeriod && (_controlQueue.empty() && _messageQueue.empty())) {
 #ifdef ESP32
-    lock.unlock();
+  lock.unlock();
 #endif
-    ping((uint8_t*)AWSC_PING_PAYLOAD, AWSC_PING_PAYLOAD_LEN);
+
+  if (!_keepAlivePeriod || _status != WS_CONNECTED)
+    return;
+
+  const uint32_t now = millis();
+  if (_pingOutstanding) {
+    if (now - _pingSentAt < _pongTimeout())
+      return;
+    _pingOutstanding = false;
+    // acks or data since the ping prove the peer alive even while its pong is stuck behind them
+    if ((int32_t)(_lastMessageTime - _pingSentAt) >= 0) {
+      _missedPongs = 0;
+      return;
+    }
+    _server->_keepAliveStats.missed++;
+    if (++_missedPongs >= _maxMissedPongs) {
+      // a peer that went away cannot take part in a closing handshake
+      _server->_keepAliveStats.evicted++;
+      _client->close(true);
+      return;
+    }
+    _sendKeepAlive();
+  } else if (now - _lastMessageTime >= _keepAlivePeriod) {
+    // also while messages are queued: a peer that stopped acking them is exactly the one to detect
+    _sendKeepAlive();
+  }
+}
+
+void AsyncWebSocketClient::_sendKeepAlive() {
+  uint8_t payload[WS_KEEPALIVE_PAYLOAD_LEN];
+  const uint32_t sent = micros();
+  memcpy(payload, keepAliveTag, sizeof(keepAliveTag));
+  memcpy(payload + sizeof(keepAliveTag), &sent, sizeof(sent));
+  _pingOutstanding = true;
+  _pingSentAt = millis();
+  _server->_keepAliveStats.pings++;
+  _queueControl(WS_PING, payload, sizeof(payload));
+}
+
+void AsyncWebSocketClient::_onKeepAlivePong(const uint8_t* data) {
+  uint32_t sent;
+  memcpy(&sent, data + sizeof(keepAliveTag), sizeof(sent));
+  // the pong of an earlier, retried ping still carries its own send time
+  const uint32_t sample = micros() - sent;
+  if (!_srtt) {
+    _srtt = sample ? sample : 1;
+    _rttVar = sample / 2;
+  } else {
+    const uint32_t delta = _srtt > sample ? _srtt - sample : sample - _srtt;
+    _rttVar = _rttVar - _rttVar / 4 + delta / 4;
+    _srtt = _srtt - _srtt / 8 + sample / 8;
   }
+  _pingOutstanding = false;
+  _missedPongs = 0;
+  _server->_keepAliveStats.pongs++;
+}
+
+uint32_t AsyncWebSocketClient::_pongTimeout() const {
+  const uint32_t timeout = _srtt ? (_srtt + 4 * _rttVar) / 1000 : _keepAlivePeriod;
+  return std::min(std::max(timeout, (uint32_t)WS_KEEPALIVE_MIN_TIMEOUT), _keepAlivePeriod);
 }
 
 void AsyncWebSocketClient::_runQueue() {
@@ -362,11 +477,45 @@ void AsyncWebSocketClient::_runQueue() {
 
   _clearQueue();
 
-  if (!_controlQueue.empty() && (_messageQueue.empty() || _messageQueue.front().betweenFrames()) && webSocketSendFrameWindow(_client) > (size_t)(_controlQueue.front().len() - 1)) {
-    _controlQueue.front().send(_client);
-  } else if (!_messageQueue.empty() && _messageQueue.front().betweenFrames() && webSocketSendFrameWindow(_client)) {
-    _messageQueue.front().send(_client);
+  size_t frames = 0;
+
+  // acks are credited to the control frame first, so it only goes out once no message data is in flight
+  bool controlPending = !_controlQueue.empty() && !_controlQueue.front().finished();
+  if (controlPending) {
+    bool idle = true;
+    for (const auto& message : _messageQueue) {
+      if (!message.betweenFrames()) {
+        idle = false;
+        break;
+      }
+    }
+    if (idle) {
+      if (webSocketSendFrameWindow(_client) <= (size_t)(_controlQueue.front().len() - 1))
+        return;
+      _controlQueue.front().send(_client);
+      frames++;
+      controlPending = false;
+    }
   }
+
+  // fill the window with as many queued frames as fit, then push them out with a single send()
+  for (auto& message : _messageQueue) {
+    // fully queued messages only wait for their acks, the next one can follow right behind
+    if (message.finished() || message.sentAll())
+      continue;
+    // while a control frame waits, only a pre-framed message already on the wire may go on
+    if (controlPending && !message.midFrame())
+      break;
+    // a pre-framed message needs no room for a header, any space takes its next bytes
+    if ((!message.framed() && !webSocketSendFrameWindow(_client)) || !message.send(_client))
+      break;
+    frames++;
+    if (!message.sentAll())
+      break;
+  }
+
+  if (frames)
+    _client->send();
 }
 
 bool AsyncWebSocketClient::queueIsFull() const {
@@ -406,16 +555,52 @@ bool AsyncWebSocketClient::_queueControl(uint8_t opcode, const uint8_t* data, si
   return true;
 }
 
-bool AsyncWebSocketClient::_queueMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode, bool mask) {
+bool AsyncWebSocketClient::_queueMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode, bool mask, bool framed, uint32_t key) {
   if (!_client || buffer->size() == 0 || _status != WS_CONNECTED)
     return false;
 
+  if (_deflateBits && !framed && !mask && !(opcode & WS_FRAME_RSV1) && buffer->size() >= _server->_deflateThreshold) {
+    AsyncWebSocketSharedBuffer deflated = _server->_deflate(buffer, _deflateBits);
+    if (deflated) {
+      buffer = deflated;
+      opcode |= WS_FRAME_RSV1;
+    }
+  }
+
 #ifdef ESP32
   std::lock_guard<std::mutex> lock(_lock);
 #endif
 
+  if (key && _queuePolicy == WS_QUEUE_CONFLATE) {
+    for (auto& m : _messageQueue) {
+      if (m.key() == key && !m.started()) {
+        // over the budget the pending value stays, stale but no bigger
+        if (buffer->size() > m.size() && !_budget.admit(buffer->size() - m.size())) {
+          _queueDrops.rejected++;
+          return false;
+        }
+        _budget.release(m.size() > buffer->size() ? m.size() - buffer->size() : 0);
+        m = AsyncWebSocketMessage(buffer, opcode, mask, framed, key);
+        _queueDrops.conflated++;
+        return true;
+      }
+    }
+  }
+
+  if (_messageQueue.size() >= WS_MAX_QUEUED_MESSAGES && _queuePolicy == WS_QUEUE_DROP_OLDEST) {
+    for (auto it = _messageQueue.begin(); it != _messageQueue.end(); ++it) {
+      if (!it->started()) {
+        _budget.release(it->size());
+        _messageQueue.erase(it);
+        _queueDrops.dropped++;
+        break;
+      }
+    }
+  }
+
   if (_messageQueue.size() >= WS_MAX_QUEUED_MESSAGES) {
-    if (closeWhenFull) {
+    _queueDrops.rejected++;
+    if (closeWhenFull && _queuePolicy == WS_QUEUE_REJECT) {
       _status = WS_DISCONNECTED;
 
       if (_client)
@@ -438,7 +623,31 @@ bool AsyncWebSocketClient::_queueMessage(AsyncWebSocketSharedBuffer buffer, uint
     return false;
   }
 
-  _messageQueue.emplace_back(buffer, opcode, mask);
+  if (!_budget.admit(buffer->size())) {
+    bool admitted = false;
+    // over the global budget, room can only come from this client's own pending messages
+    if (_queuePolicy == WS_QUEUE_DROP_OLDEST) {
+      for (auto it = _messageQueue.begin(); it != _messageQueue.end() && !admitted;) {
+        if (it->started()) {
+          ++it;
+          continue;
+        }
+        _budget.release(it->size());
+        it = _messageQueue.erase(it);
+        _queueDrops.dropped++;
+        admitted = _budget.admit(buffer->size());
+      }
+    }
+    if (!admitted) {
+      _queueDrops.rejected++;
+#ifdef ESP32
+      log_w("Over the global budget: discarding new message");
+#endif
+      return false;
+    }
+  }
+
+  _messageQueue.emplace_back(buffer, opcode, mask, framed, key);
 
   if (_client && _client->canSend())
     _runQueue();
@@ -496,12 +705,45 @@ void AsyncWebSocketClient::_onDisconnect() {
   _client = nullptr;
 }
 
+// length of the frame header starting with the 2 bytes at h, of len bytes available to the end of the segment
+static size_t frameHeaderLength(const uint8_t* h, size_t len) {
+  const uint8_t payloadLen = h[1] & 0x7F;
+  size_t n = 2 + (payloadLen == 126 ? 2 : payloadLen == 127 ? 8 : 0);
+  // if ws.close() is called, Safari sends a close frame of 2 bytes with the masked bit set and no mask
+  if ((h[1] & 0x80) && !(len == 2 && !payloadLen && (h[0] & 0x0F) == WS_DISCONNECT))
+    n += 4;
+  return n;
+}
+
 void AsyncWebSocketClient::_onData(void* pbuf, size_t plen) {
   _lastMessageTime = millis();
+  // after a protocol error the frame boundaries are lost, nothing more is parsed
+  if (_pstate == 2)
+    return;
   uint8_t* data = (uint8_t*)pbuf;
   while (plen > 0) {
     if (!_pstate) {
       const uint8_t* fdata = data;
+      size_t hlen = plen >= 2 ? frameHeaderLength(data, plen) : 0;
+      if (_headerLen || !hlen || plen < hlen) {
+        // the header is cut by the end of the segment, its bytes are kept until the rest arrives
+        while (plen && _headerLen < 2) {
+          _header[_headerLen++] = *data++;
+          plen--;
+        }
+        hlen = _headerLen >= 2 ? frameHeaderLength(_header, _headerLen + plen) : 0;
+        while (plen && _headerLen < hlen) {
+          _header[_headerLen++] = *data++;
+          plen--;
+        }
+        if (!hlen || _headerLen < hlen)
+          return;
+        fdata = _header;
+        _headerLen = 0;
+      } else {
+        data += hlen;
+        plen -= hlen;
+      }
 
       _pinfo.index = 0;
       _pinfo.final = (fdata[0] & 0x80) != 0;
@@ -509,28 +751,37 @@ void AsyncWebSocketClient::_onData(void* pbuf, size_t plen) {
       _pinfo.masked = (fdata[1] & 0x80) != 0;
       _pinfo.len = fdata[1] & 0x7F;
 
+      size_t offset = 2;
+      if (_pinfo.len == 126) {
+        _pinfo.len = fdata[3] | (uint16_t)(fdata[2]) << 8;
+        offset += 2;
+      } else if (_pinfo.len == 127) {
+        _pinfo.len = fdata[9] | (uint16_t)(fdata[8]) << 8 | (uint32_t)(fdata[7]) << 16 | (uint32_t)(fdata[6]) << 24 | (uint64_t)(fdata[5]) << 32 | (uint64_t)(fdata[4]) << 40 | (uint64_t)(fdata[3]) << 48 | (uint64_t)(fdata[2]) << 56;
+        offset += 8;
+      }
+      if (_pinfo.masked && hlen > offset)
+        memcpy(_pinfo.mask, fdata + offset, 4);
+
       // log_d("WS[%" PRIu32 "]: _onData: %" PRIu32, _clientId, plen);
       // log_d("WS[%" PRIu32 "]: _status = %" PRIu32, _clientId, _status);
       // log_d("WS[%" PRIu32 "]: _pinfo: index: %" PRIu64 ", final: %" PRIu8 ", opcode: %" PRIu8 ", masked: %" PRIu8 ", len: %" PRIu64, _clientId, _pinfo.index, _pinfo.final, _pinfo.opcode, _pinfo.masked, _pinfo.len);
 
-      data += 2;
-      plen -= 2;
-
-      if (_pinfo.len == 126 && plen >= 2) {
-        _pinfo.len = fdata[3] | (uint16_t)(fdata[2]) << 8;
-        data += 2;
-        plen -= 2;
-
-      } else if (_pinfo.len == 127 && plen >= 8) {
-        _pinfo.len = fdata[9] | (uint16_t)(fdata[8]) << 8 | (uint32_t)(fdata[7]) << 16 | (uint32_t)(fdata[6]) << 24 | (uint64_t)(fdata[5]) << 32 | (uint64_t)(fdata[4]) << 40 | (uint64_t)(fdata[3]) << 48 | (uint64_t)(fdata[2]) << 56;
-        data += 8;
-        plen -= 8;
+      // control frames are never fragmented and carry 125 bytes at most (RFC 6455 5.5)
+      if (_pinfo.opcode >= WS_DISCONNECT && (!_pinfo.final || _pinfo.len > 125)) {
+        _pstate = 2;
+        _controlPart.clear();
+        close(1002);
+        return;
       }
 
-      if (_pinfo.masked && plen >= 4) { // if ws.close() is called, Safari sends a close frame with plen 2 and masked bit set. We must not decrement plen which is already 0.
-        memcpy(_pinfo.mask, data, 4);
-        data += 4;
-        plen -= 4;
+      if (_pinfo.opcode == WS_TEXT || _pinfo.opcode == WS_BINARY) {
+        // also when the first frame of a fragmented message arrives in one segment
+        _pinfo.message_opcode = _pinfo.opcode;
+        // RSV1 on the first frame marks a compressed message
+        _inflating = _deflateBits && (fdata[0] & WS_FRAME_RSV1);
+        _collecting = _inflating || _server->_reassemblyMax;
+        _messageOpcode = _pinfo.opcode;
+        _reassembly.clear();
       }
     }
 
@@ -538,11 +789,15 @@ void AsyncWebSocketClient::_onData(void* pbuf, size_t plen) {
     const auto datalast = data[datalen];
 
     if (_pinfo.masked) {
-      for (size_t i = 0; i < datalen; i++)
-        data[i] ^= _pinfo.mask[(_pinfo.index + i) % 4];
+      webSocketMask(data, data, datalen, _pinfo.mask, _pinfo.index);
     }
 
-    if ((datalen + _pinfo.index) < _pinfo.len) {
+    if ((datalen + _pinfo.index) < _pinfo.len && _pinfo.opcode >= WS_DISCONNECT) {
+      // control frames are handled whole, the header check above keeps them to 125 bytes
+      _pstate = 1;
+      _controlPart.insert(_controlPart.end(), data, data + datalen);
+      _pinfo.index += datalen;
+    } else if ((datalen + _pinfo.index) < _pinfo.len) {
       _pstate = 1;
 
       if (_pinfo.index == 0) {
@@ -551,38 +806,35 @@ void AsyncWebSocketClient::_onData(void* pbuf, size_t plen) {
           _pinfo.num = 0;
         }
       }
-      if (datalen > 0)
-        _server->_handleEvent(this, WS_EVT_DATA, (void*)&_pinfo, data, datalen);
+      if (datalen > 0) {
+        if (_collecting)
+          _collectData(data, datalen, false);
+        else
+          _server->_handleEvent(this, WS_EVT_DATA, (void*)&_pinfo, data, datalen);
+      }
 
       _pinfo.index += datalen;
     } else if ((datalen + _pinfo.index) == _pinfo.len) {
       _pstate = 0;
-      if (_pinfo.opcode == WS_DISCONNECT) {
-        if (datalen) {
-          uint16_t reasonCode = (uint16_t)(data[0] << 8) + data[1];
-          char* reasonString = (char*)(data + 2);
-          if (reasonCode > 1001) {
-            _server->_handleEvent(this, WS_EVT_ERROR, (void*)&reasonCode, (uint8_t*)reasonString, strlen(reasonString));
-          }
+      if (_pinfo.opcode >= WS_DISCONNECT) {
+        if (_controlPart.empty()) {
+          _onControl(data, datalen);
+        } else {
+          _controlPart.insert(_controlPart.end(), data, data + datalen);
+          // terminated like the byte after a frame in the segment
+          _controlPart.push_back(0);
+          _onControl(_controlPart.data(), _controlPart.size() - 1);
+          _controlPart.clear();
         }
-        if (_status == WS_DISCONNECTING) {
-          _status = WS_DISCONNECTED;
-          if (_client)
-            _client->close(true);
+      } else {
+        // continuation or text/binary frame, a plain message that arrives whole in one frame is handed over in place
+        if (_collecting && (_inflating || !_pinfo.final || _pinfo.opcode == WS_CONTINUATION || !_reassembly.empty())) {
+          _collectData(data, datalen, _pinfo.final);
         } else {
-          _status = WS_DISCONNECTING;
-          if (_client)
-            _client->ackLater();
-          _queueControl(WS_DISCONNECT, data, datalen);
+          if (_collecting)
+            _pinfo.message_opcode = _messageOpcode;
+          _server->_handleEvent(this, WS_EVT_DATA, (void*)&_pinfo, data, datalen);
         }
-      } else if (_pinfo.opcode == WS_PING) {
-        _server->_handleEvent(this, WS_EVT_PING, NULL, NULL, 0);
-        _queueControl(WS_PONG, data, datalen);
-      } else if (_pinfo.opcode == WS_PONG) {
-        if (datalen != AWSC_PING_PAYLOAD_LEN || memcmp(AWSC_PING_PAYLOAD, data, AWSC_PING_PAYLOAD_LEN) != 0)
-          _server->_handleEvent(this, WS_EVT_PONG, NULL, NULL, 0);
-      } else if (_pinfo.opcode < WS_DISCONNECT) { // continuation or text/binary frame
-        _server->_handleEvent(this, WS_EVT_DATA, (void*)&_pinfo, data, datalen);
         if (_pinfo.final)
           _pinfo.num = 0;
         else
@@ -595,14 +847,92 @@ void AsyncWebSocketClient::_onData(void* pbuf, size_t plen) {
     }
 
     // restore byte as _handleEvent may have added a null terminator i.e., data[len] = 0;
-    if (datalen)
-      data[datalen] = datalast;
+    // also after an empty frame, where that byte is the header of the next one
+    data[datalen] = datalast;
 
     data += datalen;
     plen -= datalen;
   }
 }
 
+void AsyncWebSocketClient::_onControl(uint8_t* data, size_t datalen) {
+  if (_pinfo.opcode == WS_DISCONNECT) {
+    if (datalen) {
+      uint16_t reasonCode = (uint16_t)(data[0] << 8) + data[1];
+      char* reasonString = (char*)(data + 2);
+      if (reasonCode > 1001) {
+        _server->_handleEvent(this, WS_EVT_ERROR, (void*)&reasonCode, (uint8_t*)reasonString, strlen(reasonString));
+      }
+    }
+    if (_status == WS_DISCONNECTING) {
+      _status = WS_DISCONNECTED;
+      if (_client)
+        _client->close(true);
+    } else {
+      _status = WS_DISCONNECTING;
+      if (_client)
+        _client->ackLater();
+      _queueControl(WS_DISCONNECT, data, datalen);
+    }
+  } else if (_pinfo.opcode == WS_PING) {
+    _server->_handleEvent(this, WS_EVT_PING, NULL, NULL, 0);
+    _queueControl(WS_PONG, data, datalen);
+  } else if (_pinfo.opcode == WS_PONG) {
+    if (datalen == WS_KEEPALIVE_PAYLOAD_LEN && memcmp(keepAliveTag, data, sizeof(keepAliveTag)) == 0)
+      _onKeepAlivePong(data);
+    else
+      _server->_handleEvent(this, WS_EVT_PONG, NULL, NULL, 0);
+  }
+}
+
+void AsyncWebSocketClient::_collectData(const uint8_t* data, size_t len, bool last) {
+  if (_status != WS_CONNECTED)
+    return;
+
+  const size_t limit = _inflating ? _server->_inflateMax : _server->_reassemblyMax;
+  if (_reassembly.size() + len > limit) {
+    _server->_releaseBuffer(_reassembly);
+    close(1009);
+    return;
+  }
+  if (!_reassembly.capacity())
+    _server->_acquireBuffer(_reassembly);
+  _reassembly.insert(_reassembly.end(), data, data + len);
+  if (!last)
+    return;
+
+  AwsFrameInfo info = _pinfo;
+  info.message_opcode = info.opcode = _messageOpcode;
+  info.num = 0;
+  info.final = 1;
+  info.index = 0;
+
+  if (_inflating) {
+    // restore the sync flush marker the sender stripped (RFC 7692 7.2.2)
+    static const uint8_t tail[4] = {0x00, 0x00, 0xff, 0xff};
+    _reassembly.insert(_reassembly.end(), tail, tail + 4);
+
+    std::vector<uint8_t> message;
+    const InflateStatus status = rawInflate(_reassembly.data(), _reassembly.size(), message, _server->_inflateMax);
+    _server->_releaseBuffer(_reassembly);
+    if (status != INFLATE_OK) {
+      // message too big, or invalid data for the extension
+      close(status == INFLATE_TOO_BIG ? 1009 : 1007);
+      return;
+    }
+
+    // one spare byte so handlers can terminate text in place
+    message.push_back(0);
+    info.len = message.size() - 1;
+    _server->_handleEvent(this, WS_EVT_DATA, (void*)&info, message.data(), message.size() - 1);
+  } else {
+    _reassembly.push_back(0);
+    info.len = _reassembly.size() - 1;
+    _server->_handleEvent(this, WS_EVT_DATA, (void*)&info, _reassembly.data(), _reassembly.size() - 1);
+    _server->_releaseBuffer(_reassembly);
+  }
+}
+
 size_t AsyncWebSocketClient::printf(const char* format, ...) {
   va_list arg;
   va_start(arg, format);
@@ -654,9 +984,33 @@ size_t AsyncWebSocketClient::printf_P(PGM_P formatP, ...) {
 namespace {
   AsyncWebSocketSharedBuffer makeSharedBuffer(const uint8_t* message, size_t len) {
     auto buffer = std::make_shared<std::vector<uint8_t>>(len);
-    std::memcpy(buffer->data(), message, len);
+    // an empty vector has no data() to copy to
+    if (len)
+      std::memcpy(buffer->data(), message, len);
     return buffer;
   }
+
+  // a complete, unmasked server frame around payload
+  AsyncWebSocketSharedBuffer makeFrameBuffer(uint8_t opcode, const std::vector<uint8_t>& payload) {
+    const size_t len = payload.size();
+    const size_t headLen = len < 126 ? 2 : (len <= 0xFFFF ? 4 : 10);
+    auto frame = std::make_shared<std::vector<uint8_t>>(headLen + len);
+    uint8_t* buf = frame->data();
+    buf[0] = 0x80 | (opcode & (0x0F | WS_FRAME_RSV1));
+    if (len < 126) {
+      buf[1] = len;
+    } else if (len <= 0xFFFF) {
+      buf[1] = 126;
+      buf[2] = (uint8_t)(len >> 8);
+      buf[3] = (uint8_t)len;
+    } else {
+      buf[1] = 127;
+      for (uint8_t i = 0; i < 8; i++)
+        buf[2 + i] = (uint8_t)((uint64_t)len >> (8 * (7 - i)));
+    }
+    std::memcpy(buf + headLen, payload.data(), len);
+    return frame;
+  }
 }
 
 bool AsyncWebSocketClient::text(AsyncWebSocketMessageBuffer* buffer) {
@@ -778,10 +1132,20 @@ void AsyncWebSocket::_handleEvent(AsyncWebSocketClient* client, AwsEventType typ
   }
 }
 
-AsyncWebSocketClient* AsyncWebSocket::_newClient(AsyncWebServerRequest* request) {
-  _clients.emplace_back(request, this);
-  _handleEvent(&_clients.back(), WS_EVT_CONNECT, request, NULL, 0);
-  return &_clients.back();
+AsyncWebSocketClient* AsyncWebSocket::_newClient(AsyncWebServerRequest* request, uint8_t deflateBits) {
+  AsyncWebSocketClient* client = _clients.emplace(request, this);
+  if (!client) {
+    // the table filled up while the handshake was in flight
+    request->client()->close(true);
+    return nullptr;
+  }
+  // the counter tags the slot so a stale id never matches the next occupant
+  if (!(_cNextId & 0xFFFFFF))
+    _cNextId = 1;
+  client->_clientId = ((_cNextId++ & 0xFFFFFF) << 8) | client->_slot;
+  client->_deflateBits = deflateBits;
+  _handleEvent(client, WS_EVT_CONNECT, request, NULL, 0);
+  return client;
 }
 
 bool AsyncWebSocket::availableForWriteAll() {
@@ -789,10 +1153,10 @@ bool AsyncWebSocket::availableForWriteAll() {
 }
 
 bool AsyncWebSocket::availableForWrite(uint32_t id) {
-  const auto iter = std::find_if(std::begin(_clients), std::end(_clients), [id](const AsyncWebSocketClient& c) { return c.id() == id; });
-  if (iter == std::end(_clients))
+  const AsyncWebSocketClient* c = _clients.at(id & 0xFF);
+  if (!c || c->id() != id)
     return true;
-  return !iter->queueIsFull();
+  return !c->queueIsFull();
 }
 
 size_t AsyncWebSocket::count() const {
@@ -800,11 +1164,11 @@ size_t AsyncWebSocket::count() const {
 }
 
 AsyncWebSocketClient* AsyncWebSocket::client(uint32_t id) {
-  const auto iter = std::find_if(_clients.begin(), _clients.end(), [id](const AsyncWebSocketClient& c) { return c.id() == id && c.status() == WS_CONNECTED; });
-  if (iter == std::end(_clients))
+  AsyncWebSocketClient* c = _clients.at(id & 0xFF);
+  if (!c || c->id() != id || c->status() != WS_CONNECTED)
     return nullptr;
 
-  return &(*iter);
+  return c;
 }
 
 void AsyncWebSocket::close(uint32_t id, uint16_t code, const char* message) {
@@ -819,14 +1183,52 @@ void AsyncWebSocket::closeAll(uint16_t code, const char* message) {
 }
 
 void AsyncWebSocket::cleanupClients(uint16_t maxClients) {
-  if (count() > maxClients)
-    _clients.front().close();
+  if (count() > maxClients) {
+    // the oldest client holds the smallest counter in its id
+    AsyncWebSocketClient* oldest = nullptr;
+    for (auto& c : _clients) {
+      if (c.status() == WS_CONNECTED && (!oldest || (c.id() >> 8) < (oldest->id() >> 8)))
+        oldest = &c;
+    }
+    if (oldest)
+      oldest->close();
+  }
 
-  for (auto iter = std::begin(_clients); iter != std::end(_clients);) {
-    if (iter->shouldBeDeleted())
-      iter = _clients.erase(iter);
-    else
-      iter++;
+  for (size_t slot = 0; slot < DEFAULT_MAX_WS_CLIENTS; slot++) {
+    const AsyncWebSocketClient* c = _clients.at(slot);
+    if (c && c->shouldBeDeleted())
+      _clients.erase(slot);
+  }
+}
+
+void AsyncWebSocket::printMetrics(Print& out) const {
+  const char* url = _url.c_str();
+  out.print(F("# TYPE asyncwebsocket_clients gauge\n"));
+  out.printf("asyncwebsocket_clients{url=\"%s\"} %u\n", url, (unsigned)count());
+  out.print(F("# TYPE asyncwebsocket_keepalive_pings_total counter\n"));
+  out.printf("asyncwebsocket_keepalive_pings_total{url=\"%s\"} %lu\n", url, (unsigned long)_keepAliveStats.pings);
+  out.print(F("# TYPE asyncwebsocket_keepalive_pongs_total counter\n"));
+  out.printf("asyncwebsocket_keepalive_pongs_total{url=\"%s\"} %lu\n", url, (unsigned long)_keepAliveStats.pongs);
+  out.print(F("# TYPE asyncwebsocket_keepalive_missed_total counter\n"));
+  out.printf("asyncwebsocket_keepalive_missed_total{url=\"%s\"} %lu\n", url, (unsigned long)_keepAliveStats.missed);
+  out.print(F("# TYPE asyncwebsocket_keepalive_evicted_total counter\n"));
+  out.printf("asyncwebsocket_keepalive_evicted_total{url=\"%s\"} %lu\n", url, (unsigned long)_keepAliveStats.evicted);
+
+  out.print(F("# TYPE asyncwebsocket_rtt_seconds gauge\n"));
+  for (const auto& c : _clients) {
+    if (c.rtt()) {
+      out.printf("asyncwebsocket_rtt_seconds{url=\"%s\",client=\"%lu\"} ", url, (unsigned long)c.id());
+      out.print(c.rtt() * 1e-6, 6);
+      out.print('\n');
+    }
+  }
+  out.print(F("# TYPE asyncwebsocket_rtt_deviation_seconds gauge\n"));
+  for (const auto& c : _clients) {
+    if (c.rtt()) {
+      out.printf("asyncwebsocket_rtt_deviation_seconds{url=\"%s\",client=\"%lu\"} ", url, (unsigned long)c.id());
+      out.print(c.rttVariance() * 1e-6, 6);
+      out.print('\n');
+    }
   }
 }
 
@@ -940,14 +1342,7 @@ AsyncWebSocket::SendStatus AsyncWebSocket::textAll(AsyncWebSocketMessageBuffer*
 }
 
 AsyncWebSocket::SendStatus AsyncWebSocket::textAll(AsyncWebSocketSharedBuffer buffer) {
-  size_t hit = 0;
-  size_t miss = 0;
-  for (auto& c : _clients)
-    if (c.status() == WS_CONNECTED && c.text(buffer))
-      hit++;
-    else
-      miss++;
-  return hit == 0 ? DISCARDED : (miss == 0 ? ENQUEUED : PARTIALLY_ENQUEUED);
+  return _messageAll(buffer, WS_TEXT);
 }
 
 bool AsyncWebSocket::binary(uint32_t id, const uint8_t* message, size_t len) {
@@ -1027,16 +1422,236 @@ AsyncWebSocket::SendStatus AsyncWebSocket::binaryAll(AsyncWebSocketMessageBuffer
   return status;
 }
 AsyncWebSocket::SendStatus AsyncWebSocket::binaryAll(AsyncWebSocketSharedBuffer buffer) {
+  return _messageAll(buffer, WS_BINARY);
+}
+
+AsyncWebSocket::SendStatus AsyncWebSocket::_messageAll(AsyncWebSocketSharedBuffer buffer, uint8_t opcode, uint32_t key, const ClientSlots* only) {
+  // every client, or only those in the given slots
+  auto forEach = [&](auto fn) {
+    if (only) {
+      for (size_t i = 0; i < DEFAULT_MAX_WS_CLIENTS; i++) {
+        if (only->test(i) && _clients.at(i))
+          fn(*_clients.at(i));
+      }
+    } else {
+      for (auto& c : _clients)
+        fn(c);
+    }
+  };
+
+  size_t connected = 0;
+  uint8_t deflateBits = 0;
+  forEach([&](const AsyncWebSocketClient& c) {
+    if (c.status() == WS_CONNECTED) {
+      connected++;
+      if (c._deflateBits && (!deflateBits || c._deflateBits < deflateBits))
+        deflateBits = c._deflateBits;
+    }
+  });
+
+  // compress once, within the smallest window any of the clients accepts
+  AsyncWebSocketSharedBuffer deflated;
+  if (deflateBits && buffer && buffer->size() >= _deflateThreshold)
+    deflated = _deflate(buffer, deflateBits);
+
+  // with several receivers, frame the payload once and let every client send the same bytes
+  const bool framed = connected > 1 && buffer && buffer->size();
+  AsyncWebSocketSharedBuffer plainFrame;
+  AsyncWebSocketSharedBuffer deflatedFrame;
+
   size_t hit = 0;
   size_t miss = 0;
-  for (auto& c : _clients)
-    if (c.status() == WS_CONNECTED && c.binary(buffer))
+  forEach([&](AsyncWebSocketClient& c) {
+    bool queued = false;
+    if (c.status() == WS_CONNECTED) {
+      const bool compressed = deflated && c._deflateBits;
+      const AsyncWebSocketSharedBuffer& payload = compressed ? deflated : buffer;
+      const uint8_t op = compressed ? (opcode | WS_FRAME_RSV1) : opcode;
+      if (framed) {
+        AsyncWebSocketSharedBuffer& frame = compressed ? deflatedFrame : plainFrame;
+        if (!frame)
+          frame = makeFrameBuffer(op, *payload);
+        queued = c._queueMessage(frame, op, false, true, key);
+      } else {
+        queued = c._queueMessage(payload, op, false, false, key);
+      }
+    }
+    if (queued)
       hit++;
     else
       miss++;
+  });
   return hit == 0 ? DISCARDED : (miss == 0 ? ENQUEUED : PARTIALLY_ENQUEUED);
 }
 
+/*
+ * Topics
+ */
+
+static uint32_t topicHash(const char* name) {
+  uint32_t hash = 2166136261UL;
+  while (*name)
+    hash = (hash ^ (uint8_t)*name++) * 16777619UL;
+  return hash;
+}
+
+int AsyncWebSocket::_findTopic(const char* name) const {
+  const uint32_t hash = topicHash(name);
+  for (size_t i = 0; i < WS_MAX_TOPICS; i++) {
+    const Topic& t = _topics[i];
+    if (t.subscribers.any() && t.hash == hash && t.name.equals(name))
+      return i;
+  }
+  return -1;
+}
+
+void AsyncWebSocket::_releaseSlot(AsyncWebSocketClient* client) {
+  unsubscribeAll(client);
+}
+
+bool AsyncWebSocket::subscribe(AsyncWebSocketClient* client, const char* topic) {
+  if (!client)
+    return false;
+  int i = _findTopic(topic);
+  if (i < 0) {
+    for (i = 0; i < WS_MAX_TOPICS && _topics[i].subscribers.any(); i++)
+      ;
+    if (i == WS_MAX_TOPICS)
+      return false;
+    _topics[i].hash = topicHash(topic);
+    _topics[i].name = topic;
+  }
+  _topics[i].subscribers.set(client->_slot);
+  return true;
+}
+
+void AsyncWebSocket::unsubscribe(AsyncWebSocketClient* client, const char* topic) {
+  if (!client)
+    return;
+  const int i = _findTopic(topic);
+  if (i >= 0) {
+    _topics[i].subscribers.reset(client->_slot);
+    if (_topics[i].subscribers.none())
+      _topics[i].name = String();
+  }
+}
+
+void AsyncWebSocket::unsubscribeAll(AsyncWebSocketClient* client) {
+  if (!client)
+    return;
+  for (auto& t : _topics) {
+    if (t.subscribers.test(client->_slot)) {
+      t.subscribers.reset(client->_slot);
+      if (t.subscribers.none())
+        t.name = String();
+    }
+  }
+}
+
+bool AsyncWebSocket::subscribed(const AsyncWebSocketClient* client, const char* topic) const {
+  if (!client)
+    return false;
+  const int i = _findTopic(topic);
+  return i >= 0 && _topics[i].subscribers.test(client->_slot);
+}
+
+size_t AsyncWebSocket::subscribers(const char* topic) const {
+  const int i = _findTopic(topic);
+  return i >= 0 ? _topics[i].subscribers.count() : 0;
+}
+
+AsyncWebSocket::SendStatus AsyncWebSocket::publish(const char* topic, AsyncWebSocketSharedBuffer buffer, uint8_t opcode) {
+  const int i = _findTopic(topic);
+  if (i < 0)
+    return DISCARDED;
+  // copied, a handler may unsubscribe while the message is queued
+  const ClientSlots subscribers = _topics[i].subscribers;
+  return _messageAll(buffer, opcode, 0, &subscribers);
+}
+
+AsyncWebSocket::SendStatus AsyncWebSocket::publish(const char* topic, const uint8_t* message, size_t len, uint8_t opcode) {
+  if (_findTopic(topic) < 0)
+    return DISCARDED;
+  return publish(topic, makeSharedBuffer(message, len), opcode);
+}
+
+AsyncWebSocket::SendStatus AsyncWebSocket::publish(const char* topic, const String& message) {
+  return publish(topic, (const uint8_t*)message.c_str(), message.length());
+}
+
+void AsyncWebSocket::_acquireBuffer(AsyncWebSocketMessageData& buffer) {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_poolLock);
+#endif
+  if (!_bufferPool.empty()) {
+    buffer = std::move(_bufferPool.back());
+    _bufferPool.pop_back();
+  }
+}
+
+void AsyncWebSocket::_releaseBuffer(AsyncWebSocketMessageData& buffer) {
+  if (!buffer.capacity())
+    return;
+  buffer.clear();
+  {
+#ifdef ESP32
+    std::lock_guard<std::mutex> lock(_poolLock);
+#endif
+    if (_bufferPool.size() < WS_REASSEMBLY_POOL_SIZE) {
+      _bufferPool.push_back(std::move(buffer));
+      buffer = AsyncWebSocketMessageData();
+      return;
+    }
+  }
+  AsyncWebSocketMessageData().swap(buffer);
+}
+
+void AsyncWebSocket::enableDeflate(uint8_t windowBits, size_t threshold, size_t maxInflated) {
+  uint8_t maxBits = 8;
+  while ((1UL << (maxBits + 1)) <= GZIP_WINDOW_SIZE)
+    maxBits++;
+  _deflateBits = windowBits < 8 ? 8 : (windowBits > maxBits ? maxBits : windowBits);
+  _deflateThreshold = threshold;
+  _inflateMax = maxInflated;
+}
+
+AsyncWebSocketSharedBuffer AsyncWebSocket::_deflate(const AsyncWebSocketSharedBuffer& payload, uint8_t windowBits) {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_deflateLock);
+#endif
+  if (!_deflater)
+    _deflater.reset(new GzipEncoder());
+  if (!_deflater->begin(GzipEncoder::Format::Raw, 1UL << windowBits))
+    return nullptr;
+
+  auto out = std::make_shared<std::vector<uint8_t>>();
+  auto drain = [&]() {
+    const size_t n = _deflater->pending();
+    if (n) {
+      const size_t at = out->size();
+      out->resize(at + n);
+      _deflater->read(out->data() + at, n);
+    }
+  };
+
+  size_t pos = 0;
+  while (pos < payload->size()) {
+    pos += _deflater->write(payload->data() + pos, payload->size() - pos);
+    drain();
+    // incompressible, send it as is
+    if (out->size() >= payload->size())
+      return nullptr;
+  }
+  _deflater->flush();
+  drain();
+
+  // the trailing 00 00 ff ff of the sync flush is implied by the protocol (RFC 7692 7.2.1)
+  out->resize(out->size() - 4);
+  if (out->size() >= payload->size())
+    return nullptr;
+  return out;
+}
+
 size_t AsyncWebSocket::printf(uint32_t id, const char* format, ...) {
   AsyncWebSocketClient* c = client(id);
   if (c) {
@@ -1118,6 +1733,12 @@ const char __WS_STR_KEY[] PROGMEM = {"Sec-WebSocket-Key"};
 const char __WS_STR_PROTOCOL[] PROGMEM = {"Sec-WebSocket-Protocol"};
 const char __WS_STR_ACCEPT[] PROGMEM = {"Sec-WebSocket-Accept"};
 const char __WS_STR_UUID[] PROGMEM = {"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"};
+const char __WS_STR_EXTENSIONS[] PROGMEM = {"Sec-WebSocket-Extensions"};
+const char __WS_STR_PERMESSAGE_DEFLATE[] PROGMEM = {"permessage-deflate"};
+const char __WS_STR_SERVER_NO_CONTEXT[] PROGMEM = {"server_no_context_takeover"};
+const char __WS_STR_CLIENT_NO_CONTEXT[] PROGMEM = {"client_no_context_takeover"};
+const char __WS_STR_SERVER_MAX_BITS[] PROGMEM = {"server_max_window_bits"};
+const char __WS_STR_CLIENT_MAX_BITS[] PROGMEM = {"client_max_window_bits"};
 
 #define WS_STR_UUID_LEN 36
 
@@ -1130,11 +1751,83 @@ const char __WS_STR_UUID[] PROGMEM = {"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"};
 #define WS_STR_PROTOCOL   FPSTR(__WS_STR_PROTOCOL)
 #define WS_STR_ACCEPT     FPSTR(__WS_STR_ACCEPT)
 #define WS_STR_UUID       FPSTR(__WS_STR_UUID)
+#define WS_STR_EXTENSIONS FPSTR(__WS_STR_EXTENSIONS)
 
 bool AsyncWebSocket::canHandle(AsyncWebServerRequest* request) const {
   return _enabled && request->isWebSocketUpgrade() && request->url().equals(_url);
 }
 
+// Accepts the first permessage-deflate offer whose parameters can be honoured. Offers are separated by ','
+// and their parameters by ';'. Context takeover is always disabled for both sides.
+uint8_t AsyncWebSocket::_negotiateDeflate(const String& offers, String& accepted) const {
+  int start = 0;
+  while (start < (int)offers.length()) {
+    int end = offers.indexOf(',', start);
+    if (end < 0)
+      end = offers.length();
+    const String offer = offers.substring(start, end);
+    start = end + 1;
+
+    uint8_t bits = _deflateBits;
+    bool serverBits = false;
+    bool valid = true;
+    bool first = true;
+    int pos = 0;
+    while (valid && pos <= (int)offer.length()) {
+      int next = offer.indexOf(';', pos);
+      if (next < 0)
+        next = offer.length();
+      String param = offer.substring(pos, next);
+      pos = next + 1;
+      param.trim();
+      if (first) {
+        valid = param.equalsIgnoreCase(FPSTR(__WS_STR_PERMESSAGE_DEFLATE));
+        first = false;
+        continue;
+      }
+
+      const int eq = param.indexOf('=');
+      String name = eq < 0 ? param : param.substring(0, eq);
+      String value = eq < 0 ? String() : param.substring(eq + 1);
+      name.trim();
+      value.trim();
+      value.replace("\"", "");
+      if (name.equals(FPSTR(__WS_STR_SERVER_NO_CONTEXT)) || name.equals(FPSTR(__WS_STR_CLIENT_NO_CONTEXT))) {
+        continue;
+      } else if (name.equals(FPSTR(__WS_STR_CLIENT_MAX_BITS))) {
+        // incoming messages are inflated whole, any window fits
+        continue;
+      } else if (name.equals(FPSTR(__WS_STR_SERVER_MAX_BITS))) {
+        const long n = value.toInt();
+        if (n < 8 || n > 15) {
+          valid = false;
+        } else {
+          bits = n < bits ? n : bits;
+          serverBits = true;
+        }
+      } else {
+        valid = false;
+      }
+    }
+    if (!valid)
+      continue;
+
+    accepted = FPSTR(__WS_STR_PERMESSAGE_DEFLATE);
+    accepted.concat(F("; "));
+    accepted.concat(FPSTR(__WS_STR_SERVER_NO_CONTEXT));
+    accepted.concat(F("; "));
+    accepted.concat(FPSTR(__WS_STR_CLIENT_NO_CONTEXT));
+    if (serverBits) {
+      accepted.concat(F("; "));
+      accepted.concat(FPSTR(__WS_STR_SERVER_MAX_BITS));
+      accepted.concat('=');
+      accepted.concat(bits);
+    }
+    return bits;
+  }
+  return 0;
+}
+
 void AsyncWebSocket::handleRequest(AsyncWebServerRequest* request) {
   if (!request->hasHeader(WS_STR_VERSION) || !request->hasHeader(WS_STR_KEY)) {
     request->send(400);
@@ -1153,13 +1846,25 @@ void AsyncWebSocket::handleRequest(AsyncWebServerRequest* request) {
     request->send(response);
     return;
   }
+  if (_clients.full()) {
+    request->send(503);
+    return;
+  }
   const AsyncWebHeader* key = request->getHeader(WS_STR_KEY);
-  AsyncWebServerResponse* response = new AsyncWebSocketResponse(key->value(), this);
+  AsyncWebSocketResponse* response = new AsyncWebSocketResponse(key->value(), this);
   if (request->hasHeader(WS_STR_PROTOCOL)) {
     const AsyncWebHeader* protocol = request->getHeader(WS_STR_PROTOCOL);
     // ToDo: check protocol
     response->addHeader(WS_STR_PROTOCOL, protocol->value());
   }
+  if (_deflateBits && request->hasHeader(WS_STR_EXTENSIONS)) {
+    String accepted;
+    const uint8_t bits = _negotiateDeflate(request->getHeader(WS_STR_EXTENSIONS)->value(), accepted);
+    if (bits) {
+      response->addHeader(WS_STR_EXTENSIONS, accepted);
+      response->setDeflate(bits);
+    }
+  }
   request->send(response);
 }
 
@@ -1233,7 +1938,7 @@ size_t AsyncWebSocketResponse::_ack(AsyncWebServerRequest* request, size_t len,
   (void)time;
 
   if (len)
-    _server->_newClient(request);
+    _server->_newClient(request, _deflateBits);
 
   return 0;
 }
@@ -42,7 +42,13 @@
 
 #include <ESPAsyncWebServer.h>
 
+#include "AsyncBudget.h"
+#include "GzipEncoder.h"
+
+#include <bitset>
+#include <iterator>
 #include <memory>
+#include <new>
 
 #ifdef ESP8266
   #include <Hash.h>
@@ -51,6 +57,22 @@
   #endif
 #endif
 
+// Frames whose payload fits are copied behind their header on the stack and added in one call
+#ifndef WS_FRAME_COALESCE_SIZE
+  #define WS_FRAME_COALESCE_SIZE 128
+#endif
+
+// Define WS_MASK_SCALAR to (un)mask payloads one byte at a time instead of a word at a time
+
+// RSV1 bit of the first frame header of a permessage-deflate compressed message
+#define WS_FRAME_RSV1 0x40
+
+// Released message reassembly buffers kept by the server for the next message
+#ifndef WS_REASSEMBLY_POOL_SIZE
+  #define WS_REASSEMBLY_POOL_SIZE 2
+#endif
+
+// Capacity of the client slot table, at most 256, further connections are refused with 503
 #ifndef DEFAULT_MAX_WS_CLIENTS
   #ifdef ESP32
     #define DEFAULT_MAX_WS_CLIENTS 8
@@ -59,11 +81,55 @@
   #endif
 #endif
 
+// Keepalive: consecutive unanswered pings after which a client is dropped, and the floor of the pong timeout in ms
+#ifndef WS_KEEPALIVE_MAX_MISSED
+  #define WS_KEEPALIVE_MAX_MISSED 3
+#endif
+#ifndef WS_KEEPALIVE_MIN_TIMEOUT
+  #define WS_KEEPALIVE_MIN_TIMEOUT 1000
+#endif
+
+// Topics that can have subscribers at the same time
+#ifndef WS_MAX_TOPICS
+  #define WS_MAX_TOPICS 64
+#endif
+
 using AsyncWebSocketSharedBuffer = std::shared_ptr<std::vector<uint8_t>>;
 
+#if defined(ESP32) && defined(BOARD_HAS_PSRAM)
+// Allocates from PSRAM first, aborts like operator new when no memory is left at all
+template <typename T>
+struct AsyncWebSocketPsramAllocator {
+    using value_type = T;
+
+    AsyncWebSocketPsramAllocator() = default;
+    template <typename U>
+    AsyncWebSocketPsramAllocator(const AsyncWebSocketPsramAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+      void* p = ps_malloc(n * sizeof(T));
+      if (!p)
+        p = malloc(n * sizeof(T));
+      if (!p)
+        abort();
+      return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) { free(p); }
+
+    template <typename U>
+    bool operator==(const AsyncWebSocketPsramAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AsyncWebSocketPsramAllocator<U>&) const { return false; }
+};
+using AsyncWebSocketMessageData = std::vector<uint8_t, AsyncWebSocketPsramAllocator<uint8_t>>;
+#else
+using AsyncWebSocketMessageData = std::vector<uint8_t>;
+#endif
+
 class AsyncWebSocket;
 class AsyncWebSocketResponse;
 class AsyncWebSocketClient;
+class AsyncWebSocketClientTable;
 class AsyncWebSocketControl;
 
 typedef struct {
@@ -108,6 +174,29 @@ typedef enum { WS_EVT_CONNECT,
                WS_EVT_PONG,
                WS_EVT_ERROR,
                WS_EVT_DATA } AwsEventType;
+typedef enum { WS_QUEUE_REJECT,
+               WS_QUEUE_DROP_OLDEST,
+               WS_QUEUE_CONFLATE } AwsQueuePolicy;
+
+typedef struct {
+    /** Messages refused because the queue was full. */
+    uint32_t rejected;
+    /** Pending messages evicted to make room under WS_QUEUE_DROP_OLDEST. */
+    uint32_t dropped;
+    /** Pending messages replaced by a newer one with the same key under WS_QUEUE_CONFLATE. */
+    uint32_t conflated;
+} AwsQueueDrops;
+
+typedef struct {
+    /** Keepalive pings sent. */
+    uint32_t pings;
+    /** Keepalive pongs received. */
+    uint32_t pongs;
+    /** Keepalive pings that timed out without any traffic from the peer. */
+    uint32_t missed;
+    /** Clients dropped after too many missed pongs. */
+    uint32_t evicted;
+} AwsKeepAliveStats;
 
 class AsyncWebSocketMessageBuffer {
     friend AsyncWebSocket;
@@ -131,22 +220,37 @@ class AsyncWebSocketMessage {
     AsyncWebSocketSharedBuffer _WSbuffer;
     uint8_t _opcode{WS_TEXT};
     bool _mask{false};
+    // the buffer holds a complete frame shared with other clients
+    bool _framed{false};
+    uint32_t _key{};
     AwsMessageStatus _status{WS_MSG_ERROR};
     size_t _sent{};
     size_t _ack{};
     size_t _acked{};
 
   public:
-    AsyncWebSocketMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode = WS_TEXT, bool mask = false);
+    AsyncWebSocketMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode = WS_TEXT, bool mask = false, bool framed = false, uint32_t key = 0);
 
+    uint32_t key() const { return _key; }
+    bool started() const { return _sent != 0; }
+    bool framed() const { return _framed; }
+    // bytes charged to the global budget
+    size_t size() const { return _WSbuffer ? _WSbuffer->size() : 0; }
     bool finished() const { return _status != WS_MSG_SENDING; }
-    bool betweenFrames() const { return _acked == _ack; }
+    bool sentAll() const { return _WSbuffer && _sent == _WSbuffer->size(); }
+    // part of a pre-framed message is on the wire, nothing else may be sent before the rest
+    bool midFrame() const { return _framed && _sent && !sentAll(); }
+    bool betweenFrames() const { return _acked == _ack && !midFrame(); }
 
-    void ack(size_t len, uint32_t time);
+    // consumes the part of len that covers this message's frames and returns the rest
+    size_t ack(size_t len, uint32_t time);
     size_t send(AsyncClient* client);
 };
 
 class AsyncWebSocketClient {
+    friend AsyncWebSocket;
+    friend AsyncWebSocketClientTable;
+
   private:
     AsyncClient* _client;
     AsyncWebSocket* _server;
@@ -158,17 +262,51 @@ class AsyncWebSocketClient {
     std::deque<AsyncWebSocketControl> _controlQueue;
     std::deque<AsyncWebSocketMessage> _messageQueue;
     bool closeWhenFull = true;
-
+    AwsQueuePolicy _queuePolicy = WS_QUEUE_REJECT;
+    AwsQueueDrops _queueDrops{};
+    AsyncWebServerBudget::Flow _budget;
+
+    // index into the server's slot table
+    uint8_t _slot{0};
+
+    // permessage-deflate window bits negotiated in the handshake, 0 when not in use
+    uint8_t _deflateBits{0};
+    // the current message is collected before delivery, and inflated when compressed
+    bool _collecting{false};
+    bool _inflating{false};
+    uint8_t _messageOpcode{WS_TEXT};
+    AsyncWebSocketMessageData _reassembly;
+    // the part of a control frame received so far when it spans TCP segments
+    std::vector<uint8_t> _controlPart;
+    // the part of a frame header received so far when it spans TCP segments
+    uint8_t _header[14];
+    uint8_t _headerLen{0};
+
+    // 0 waiting for a frame header, 1 inside the payload, 2 failed with a protocol error
     uint8_t _pstate;
     AwsFrameInfo _pinfo;
 
     uint32_t _lastMessageTime;
     uint32_t _keepAlivePeriod;
 
+    // keepalive pings carry their send time in micros(), smoothed as in RFC 6298
+    bool _pingOutstanding{false};
+    uint32_t _pingSentAt{0};
+    uint8_t _missedPongs{0};
+    uint8_t _maxMissedPongs{WS_KEEPALIVE_MAX_MISSED};
+    uint32_t _srtt{0};
+    uint32_t _rttVar{0};
+
+    void _sendKeepAlive();
+    void _onKeepAlivePong(const uint8_t* data);
+    uint32_t _pongTimeout() const;
+
     bool _queueControl(uint8_t opcode, const uint8_t* data = NULL, size_t len = 0, bool mask = false);
-    bool _queueMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode = WS_TEXT, bool mask = false);
+    bool _queueMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode = WS_TEXT, bool mask = false, bool framed = false, uint32_t key = 0);
     void _runQueue();
     void _clearQueue();
+    void _onControl(uint8_t* data, size_t len);
+    void _collectData(const uint8_t* data, size_t len, bool last);
 
   public:
     void* _tempObject;
@@ -184,6 +322,7 @@ class AsyncWebSocketClient {
     AsyncWebSocket* server() { return _server; }
     const AsyncWebSocket* server() const { return _server; }
     AwsFrameInfo const& pinfo() const { return _pinfo; }
+    bool deflateEnabled() const { return _deflateBits != 0; }
 
     //  - If "true" (default), the connection will be closed if the message queue is full.
     // This is the default behavior in yubox-node-org, which is not silently discarding messages but instead closes the connection.
@@ -206,6 +345,16 @@ class AsyncWebSocketClient {
     void setCloseClientOnQueueFull(bool close) { closeWhenFull = close; }
     bool willCloseClientOnQueueFull() const { return closeWhenFull; }
 
+    // What happens to a new message when the queue holds WS_MAX_QUEUED_MESSAGES:
+    // - WS_QUEUE_REJECT (default): the message is refused, and the connection closed if setCloseClientOnQueueFull(true).
+    // - WS_QUEUE_DROP_OLDEST: the oldest message not yet being sent is evicted to make room.
+    // - WS_QUEUE_CONFLATE: a message queued with keyed() replaces the pending message with the same key,
+    //   so only the newest value per key is sent. Other messages are refused when full.
+    // Only WS_QUEUE_REJECT closes the connection on a full queue.
+    void setQueuePolicy(AwsQueuePolicy policy) { _queuePolicy = policy; }
+    AwsQueuePolicy queuePolicy() const { return _queuePolicy; }
+    const AwsQueueDrops& queueDrops() const { return _queueDrops; }
+
     IPAddress remoteIP() const;
     uint16_t remotePort() const;
 
@@ -216,15 +365,25 @@ class AsyncWebSocketClient {
     bool ping(const uint8_t* data = NULL, size_t len = 0);
 
     // set auto-ping period in seconds. disabled if zero (default)
-    void keepAlivePeriod(uint16_t seconds) {
+    // A client silent for that long is pinged. An unanswered ping is retried after the smoothed round trip time
+    // plus four deviations (at least WS_KEEPALIVE_MIN_TIMEOUT ms, at most the period), and the connection is
+    // aborted once maxMissed pings in a row went by without any traffic from the peer.
+    void keepAlivePeriod(uint16_t seconds, uint8_t maxMissed = WS_KEEPALIVE_MAX_MISSED) {
       _keepAlivePeriod = seconds * 1000;
+      _maxMissedPongs = maxMissed ? maxMissed : 1;
     }
     uint16_t keepAlivePeriod() {
       return (uint16_t)(_keepAlivePeriod / 1000);
     }
+    // smoothed round trip time of keepalive pings and its mean deviation in microseconds, 0 before the first pong
+    uint32_t rtt() const { return _srtt; }
+    uint32_t rttVariance() const { return _rttVar; }
+    uint8_t missedPongs() const { return _missedPongs; }
 
     // data packets
     void message(AsyncWebSocketSharedBuffer buffer, uint8_t opcode = WS_TEXT, bool mask = false) { _queueMessage(buffer, opcode, mask); }
+    // queue a message under a topic key (non zero) for WS_QUEUE_CONFLATE
+    bool keyed(uint32_t key, AsyncWebSocketSharedBuffer buffer, uint8_t opcode = WS_TEXT) { return _queueMessage(buffer, opcode, false, false, key); }
     bool queueIsFull() const;
     size_t queueLen() const;
 
@@ -261,14 +420,112 @@ class AsyncWebSocketClient {
 #endif
 };
 
+// Fixed-capacity client storage. Clients are constructed in place in their slot, so a lookup by slot is
+// a single index and iteration only visits occupied slots.
+class AsyncWebSocketClientTable {
+    // client ids carry the slot in their low byte
+    static_assert(DEFAULT_MAX_WS_CLIENTS > 0 && DEFAULT_MAX_WS_CLIENTS <= 256, "DEFAULT_MAX_WS_CLIENTS must be 1 to 256");
+
+  public:
+    using Slots = std::bitset<DEFAULT_MAX_WS_CLIENTS>;
+
+    template <typename Table, typename Client>
+    class Iterator {
+      private:
+        Table* _table;
+        size_t _slot;
+
+        void _skip() {
+          while (_slot < DEFAULT_MAX_WS_CLIENTS && !_table->_used.test(_slot))
+            _slot++;
+        }
+
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Client;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Client*;
+        using reference = Client&;
+
+        Iterator(Table* table, size_t slot) : _table(table), _slot(slot) { _skip(); }
+        reference operator*() const { return *_table->at(_slot); }
+        pointer operator->() const { return _table->at(_slot); }
+        Iterator& operator++() {
+          _slot++;
+          _skip();
+          return *this;
+        }
+        bool operator==(const Iterator& other) const { return _slot == other._slot; }
+        bool operator!=(const Iterator& other) const { return _slot != other._slot; }
+    };
+    using iterator = Iterator<AsyncWebSocketClientTable, AsyncWebSocketClient>;
+    using const_iterator = Iterator<const AsyncWebSocketClientTable, const AsyncWebSocketClient>;
+
+  private:
+    alignas(AsyncWebSocketClient) uint8_t _storage[DEFAULT_MAX_WS_CLIENTS][sizeof(AsyncWebSocketClient)];
+    Slots _used;
+
+  public:
+    AsyncWebSocketClientTable() = default;
+    ~AsyncWebSocketClientTable() { clear(); }
+    AsyncWebSocketClientTable(const AsyncWebSocketClientTable&) = delete;
+    AsyncWebSocketClientTable& operator=(const AsyncWebSocketClientTable&) = delete;
+
+    AsyncWebSocketClient* at(size_t slot) { return slot < DEFAULT_MAX_WS_CLIENTS && _used.test(slot) ? reinterpret_cast<AsyncWebSocketClient*>(_storage[slot]) : nullptr; }
+    const AsyncWebSocketClient* at(size_t slot) const { return slot < DEFAULT_MAX_WS_CLIENTS && _used.test(slot) ? reinterpret_cast<const AsyncWebSocketClient*>(_storage[slot]) : nullptr; }
+
+    /**
+     * @brief Construct a client in the first free slot
+     * @return nullptr when all slots are taken
+     */
+    AsyncWebSocketClient* emplace(AsyncWebServerRequest* request, AsyncWebSocket* server) {
+      for (size_t slot = 0; slot < DEFAULT_MAX_WS_CLIENTS; slot++) {
+        if (!_used.test(slot)) {
+          AsyncWebSocketClient* client = new (_storage[slot]) AsyncWebSocketClient(request, server);
+          client->_slot = slot;
+          _used.set(slot);
+          return client;
+        }
+      }
+      return nullptr;
+    }
+
+    void erase(size_t slot) {
+      AsyncWebSocketClient* client = at(slot);
+      if (client) {
+        // the slot is already free while the disconnect event runs
+        _used.reset(slot);
+        client->~AsyncWebSocketClient();
+      }
+    }
+
+    void clear() {
+      for (size_t slot = 0; slot < DEFAULT_MAX_WS_CLIENTS; slot++)
+        erase(slot);
+    }
+
+    const Slots& used() const { return _used; }
+    size_t size() const { return _used.count(); }
+    bool full() const { return _used.all(); }
+    bool empty() const { return _used.none(); }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, DEFAULT_MAX_WS_CLIENTS); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, DEFAULT_MAX_WS_CLIENTS); }
+};
+
 using AwsHandshakeHandler = std::function<bool(AsyncWebServerRequest* request)>;
 using AwsEventHandler = std::function<void(AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len)>;
 
 // WebServer Handler implementation that plays the role of a socket server
 class AsyncWebSocket : public AsyncWebHandler {
+    friend AsyncWebSocketClient;
+
   private:
     String _url;
-    std::list<AsyncWebSocketClient> _clients;
+    AsyncWebSocketClientTable _clients;
+    // ids are this counter shifted left by 8 and tagged with the client's slot
     uint32_t _cNextId;
     AwsEventHandler _eventHandler{nullptr};
     AwsHandshakeHandler _handshakeHandler;
@@ -277,6 +534,44 @@ class AsyncWebSocket : public AsyncWebHandler {
     mutable std::mutex _lock;
 #endif
 
+    // permessage-deflate, not offered while _deflateBits is 0
+    uint8_t _deflateBits{0};
+    size_t _deflateThreshold{0};
+    size_t _inflateMax{0};
+    // shared by all clients, allocated on first use
+    std::unique_ptr<GzipEncoder> _deflater;
+#ifdef ESP32
+    std::mutex _deflateLock;
+#endif
+
+    AwsKeepAliveStats _keepAliveStats{};
+
+    // whole message delivery, off while 0
+    size_t _reassemblyMax{0};
+    std::vector<AsyncWebSocketMessageData> _bufferPool;
+#ifdef ESP32
+    std::mutex _poolLock;
+#endif
+
+    void _acquireBuffer(AsyncWebSocketMessageData& buffer);
+    void _releaseBuffer(AsyncWebSocketMessageData& buffer);
+
+    using ClientSlots = AsyncWebSocketClientTable::Slots;
+    struct Topic {
+        uint32_t hash;
+        String name;
+        // a bit per client slot, the topic is free again once none is set
+        ClientSlots subscribers;
+    };
+    Topic _topics[WS_MAX_TOPICS];
+
+    // index of the topic in _topics, -1 when nobody subscribed to it
+    int _findTopic(const char* name) const;
+    void _releaseSlot(AsyncWebSocketClient* client);
+
+    uint8_t _negotiateDeflate(const String& offers, String& accepted) const;
+    AsyncWebSocketSharedBuffer _deflate(const AsyncWebSocketSharedBuffer& payload, uint8_t windowBits);
+
   public:
     typedef enum {
       DISCARDED = 0,
@@ -332,6 +627,21 @@ class AsyncWebSocket : public AsyncWebHandler {
     SendStatus binaryAll(AsyncWebSocketMessageBuffer* buffer);
     SendStatus binaryAll(AsyncWebSocketSharedBuffer buffer);
 
+    SendStatus keyedAll(uint32_t key, AsyncWebSocketSharedBuffer buffer, uint8_t opcode = WS_TEXT) { return _messageAll(buffer, opcode, key); }
+
+    // Topic subscriptions, for example "trafo/<code>" or "device/<id>".
+    // Subscribers are kept as a bitset over the client slots, there can be at most WS_MAX_TOPICS distinct topics.
+    // Disconnected clients are unsubscribed.
+    // publish() reaches only the subscribers and frames the message once for all of them.
+    bool subscribe(AsyncWebSocketClient* client, const char* topic);
+    void unsubscribe(AsyncWebSocketClient* client, const char* topic);
+    void unsubscribeAll(AsyncWebSocketClient* client);
+    bool subscribed(const AsyncWebSocketClient* client, const char* topic) const;
+    size_t subscribers(const char* topic) const;
+    SendStatus publish(const char* topic, AsyncWebSocketSharedBuffer buffer, uint8_t opcode = WS_TEXT);
+    SendStatus publish(const char* topic, const uint8_t* message, size_t len, uint8_t opcode = WS_TEXT);
+    SendStatus publish(const char* topic, const String& message);
+
     size_t printf(uint32_t id, const char* format, ...) __attribute__((format(printf, 3, 4)));
     size_t printfAll(const char* format, ...) __attribute__((format(printf, 2, 3)));
 
@@ -347,9 +657,30 @@ class AsyncWebSocket : public AsyncWebHandler {
     void onEvent(AwsEventHandler handler) { _eventHandler = handler; }
     void handleHandshake(AwsHandshakeHandler handler) { _handshakeHandler = handler; }
 
+    // Negotiate permessage-deflate (RFC 7692) with the clients that offer it.
+    // Both directions run without context takeover: a single encoder (GzipEncoder, about 27KB) is shared by all
+    // clients and every incoming message is inflated on its own.
+    //  - windowBits: reach of back references in outgoing messages, from 8 up to log2(GZIP_WINDOW_SIZE)
+    //  - threshold: messages shorter than this go out uncompressed
+    //  - maxInflated: largest incoming message once decompressed, bigger ones close the connection with 1009
+    void enableDeflate(uint8_t windowBits = 12, size_t threshold = 64, size_t maxInflated = 8192);
+    void disableDeflate() { _deflateBits = 0; }
+
+    // Deliver WS_EVT_DATA once per complete message instead of once per frame or TCP segment.
+    // Fragments are collected in a per-client buffer taken from a small pool (PSRAM when available),
+    // a message that arrives whole in a single frame is handed over in place without a copy.
+    // Messages over maxSize close the connection with 1009. 0 turns reassembly off (default).
+    void setMessageReassembly(size_t maxSize) { _reassemblyMax = maxSize; }
+    size_t messageReassembly() const { return _reassemblyMax; }
+
+    const AwsKeepAliveStats& keepAliveStats() const { return _keepAliveStats; }
+    // Prometheus text exposition of the keepalive counters and the round trip time of every client,
+    // to be appended to the output of AsyncWebServerMetrics::printTo()
+    void printMetrics(Print& out) const;
+
     // system callbacks (do not call)
-    uint32_t _getNextId() { return _cNextId++; }
-    AsyncWebSocketClient* _newClient(AsyncWebServerRequest* request);
+    SendStatus _messageAll(AsyncWebSocketSharedBuffer buffer, uint8_t opcode, uint32_t key = 0, const ClientSlots* only = nullptr);
+    AsyncWebSocketClient* _newClient(AsyncWebServerRequest* request, uint8_t deflateBits = 0);
     void _handleEvent(AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len);
     bool canHandle(AsyncWebServerRequest* request) const override final;
     void handleRequest(AsyncWebServerRequest* request) override final;
@@ -358,7 +689,7 @@ class AsyncWebSocket : public AsyncWebHandler {
     AsyncWebSocketMessageBuffer* makeBuffer(size_t size = 0);
     AsyncWebSocketMessageBuffer* makeBuffer(const uint8_t* data, size_t size);
 
-    std::list<AsyncWebSocketClient>& getClients() { return _clients; }
+    AsyncWebSocketClientTable& getClients() { return _clients; }
 };
 
 // WebServer response to authenticate the socket and detach the tcp client from the web server request
@@ -366,9 +697,11 @@ class AsyncWebSocketResponse : public AsyncWebServerResponse {
   private:
     String _content;
     AsyncWebSocket* _server;
+    uint8_t _deflateBits{0};
 
   public:
     AsyncWebSocketResponse(const String& key, AsyncWebSocket* server);
+    void setDeflate(uint8_t windowBits) { _deflateBits = windowBits; }
     void _respond(AsyncWebServerRequest* request);
     size_t _ack(AsyncWebServerRequest* request, size_t len, uint32_t time);
     bool _sourceValid() const { return true; }
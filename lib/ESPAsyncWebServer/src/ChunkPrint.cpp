@@ -13,4 +13,19 @@ size_t ChunkPrint::write(uint8_t c) {
     return 1;
   }
   return 0;
-}
\ No newline at end of file
+}
+
+size_t HashPrint::write(const uint8_t* buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    _hash ^= buffer[i];
+    _hash *= 16777619u;
+  }
+  _length += size;
+  return size;
+}
+
+String HashPrint::etag() const {
+  char buf[11];
+  snprintf(buf, sizeof(buf), "\"%08lx\"", (unsigned long)_hash);
+  return String(buf);
+}
@@ -15,4 +15,20 @@ class ChunkPrint : public Print {
     size_t write(uint8_t c);
     size_t write(const uint8_t* buffer, size_t size) { return this->Print::write(buffer, size); }
 };
+
+// Counts and hashes (32-bit FNV-1a) what is printed, to derive an ETag while measuring a body
+class HashPrint : public Print {
+  private:
+    size_t _length;
+    uint32_t _hash;
+
+  public:
+    HashPrint() : _length(0), _hash(2166136261u) {}
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size);
+    size_t length() const { return _length; }
+    uint32_t hash() const { return _hash; }
+    // quoted strong entity tag for the bytes printed so far
+    String etag() const;
+};
 #endif
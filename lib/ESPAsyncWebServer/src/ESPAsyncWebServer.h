@@ -71,6 +71,7 @@ class AsyncStaticWebHandler;
 class AsyncCallbackWebHandler;
 class AsyncResponseStream;
 class AsyncMiddlewareChain;
+class AsyncWebServerMetrics;
 
 #if defined(TARGET_RP2040)
 typedef enum http_method WebRequestMethod;
@@ -192,6 +193,21 @@ class AsyncWebServerRequest {
     // response is sent
     bool _sent = false;
 
+    // AsyncWebServerMetrics sampling, times in micros()
+    uint32_t _startTime;
+    uint32_t _firstByteTime = 0;
+    // free heap of the whole system, what else runs meanwhile moves it too
+    uint32_t _systemFreeHeapAtAccept = 0;
+    size_t _ackedBytes = 0;
+    bool _metricsRecorded = false;
+
+    // AsyncWebServer limits, times in millis()
+    uint32_t _acceptTime;
+    uint32_t _bodyStartTime = 0;
+    size_t _headerBytes = 0;
+    // client IP counted against the per IP limit, 0 when not counted
+    uint32_t _limitKey = 0;
+
     String _temp;
     uint8_t _parseState;
 
@@ -204,6 +220,12 @@ class AsyncWebServerRequest {
     String _authorization;
     RequestedConnectionType _reqconntype;
     AsyncAuthType _authMethod = AsyncAuthType::AUTH_NONE;
+    // hash of the credentials last verified, checking them again for the same request costs no hashing.
+    // Once set the digest nonce count of the request is used up, other credentials are then checked without
+    // using it again, or they would be refused as a replay.
+    mutable uint32_t _authVerified = 0;
+    // the digest response was right but its nonce was not, the challenge then asks to retry with a new one
+    mutable bool _authStale = false;
     bool _isMultipart;
     bool _isPlainPost;
     bool _expectingContinue;
@@ -234,6 +256,8 @@ class AsyncWebServerRequest {
     void _onTimeout(uint32_t time);
     void _onDisconnect();
     void _onData(void* buf, size_t len);
+    void _recordCompletion();
+    bool _tooSlow();
 
     void _addPathParam(const char* param);
 
@@ -263,6 +287,9 @@ class AsyncWebServerRequest {
     const String& contentType() const { return _contentType; }
     size_t contentLength() const { return _contentLength; }
     bool multipart() const { return _isMultipart; }
+    // scheme and credentials of the Authorization header, without the scheme name
+    AsyncAuthType authMethod() const { return _authMethod; }
+    const String& authorization() const { return _authorization; }
 
     const char* methodToString() const;
     const char* requestedConnTypeToString() const;
@@ -564,7 +591,10 @@ class AsyncAuthenticationMiddleware : public AsyncMiddleware {
     void setPassword(const char* password);
     void setPasswordHash(const char* hash);
 
-    void setRealm(const char* realm) { _realm = realm; }
+    void setRealm(const char* realm) {
+      _realm = realm;
+      _precomputedFor = AsyncAuthType::AUTH_NONE;
+    }
     void setAuthFailureMessage(const char* message) { _authFailMsg = message; }
 
     // set the authentication method to use
@@ -575,7 +605,10 @@ class AsyncAuthenticationMiddleware : public AsyncMiddleware {
     // AUTH_OTHER: other authentication method
     // AUTH_DENIED: always return 401 Unauthorized
     // if a method is set but no username or password is set, authentication will be ignored
-    void setAuthType(AsyncAuthType authMethod) { _authMethod = authMethod; }
+    void setAuthType(AsyncAuthType authMethod) {
+      _authMethod = authMethod;
+      _precomputedFor = AsyncAuthType::AUTH_NONE;
+    }
 
     // precompute and store the hash value based on the username, password, realm.
     // can be used for DIGEST and BASIC to avoid recomputing the hash for each request.
@@ -598,6 +631,11 @@ class AsyncAuthenticationMiddleware : public AsyncMiddleware {
     AsyncAuthType _authMethod = AsyncAuthType::AUTH_NONE;
     String _authFailMsg;
     bool _hasCreds = false;
+
+    // Basic token or digest HA1 of a plain password, computed by the first request and used by all
+    // the next ones for the method it was computed for, AUTH_NONE when there is none yet
+    mutable String _precomputed;
+    mutable AsyncAuthType _precomputedFor = AsyncAuthType::AUTH_NONE;
 };
 
 using ArAuthorizeFunction = std::function<bool(AsyncWebServerRequest* request)>;
@@ -673,20 +711,59 @@ class AsyncCorsMiddleware : public AsyncMiddleware {
     uint32_t _maxAge = 86400;
 };
 
+// a power of two
+#ifndef ASYNCWEBSERVER_RATE_LIMIT_KEYS
+  #define ASYNCWEBSERVER_RATE_LIMIT_KEYS 16
+#endif
+#ifndef ASYNCWEBSERVER_RATE_LIMIT_PROBES
+  #define ASYNCWEBSERVER_RATE_LIMIT_PROBES 4
+#endif
+// 429 responses waiting for their ack without a heap allocation
+#ifndef ASYNCWEBSERVER_RATE_LIMIT_RESPONSES
+  #define ASYNCWEBSERVER_RATE_LIMIT_RESPONSES 4
+#endif
+
 // Rate limit Middleware
+// Sliding window counter: the requests of the current fixed window plus those of the previous one, weighted by how much
+// of it still overlaps the sliding window. Fixed memory, and the 429s come from a pool (AsyncRateLimitResponse), so a
+// flood is answered without allocating.
 class AsyncRateLimitMiddleware : public AsyncMiddleware {
   public:
     void setMaxRequests(size_t maxRequests) { _maxRequests = maxRequests; }
     void setWindowSize(uint32_t seconds) { _windowSizeMillis = seconds * 1000; }
 
+    // count the requests of each client IP on its own, in a table of ASYNCWEBSERVER_RATE_LIMIT_KEYS entries.
+    // When the entries a key may use are all busy, the one with the oldest window is taken over.
+    void setPerClient(bool perClient) { _perClient = perClient; }
+
     bool isRequestAllowed(uint32_t& retryAfterSeconds);
+    bool isRequestAllowed(uint32_t key, uint32_t& retryAfterSeconds);
 
     void run(AsyncWebServerRequest* request, ArMiddlewareNext next);
 
+    // requests answered with 429
+    uint32_t limited() const { return _limited; }
+    // per client entries taken over from another client
+    uint32_t evictions() const { return _evictions; }
+
   private:
+    struct Window {
+        uint32_t key;
+        uint32_t start;
+        uint32_t previous;
+        uint32_t current;
+    };
+
     size_t _maxRequests = 0;
     uint32_t _windowSizeMillis = 0;
-    std::list<uint32_t> _requestTimes;
+    bool _perClient = false;
+    uint32_t _limited = 0;
+    uint32_t _evictions = 0;
+    Window _global{};
+    Window _windows[ASYNCWEBSERVER_RATE_LIMIT_KEYS]{};
+
+    Window& _window(uint32_t key, uint32_t now);
+    bool _allowed(Window& window, uint32_t now, uint32_t& retryAfterSeconds);
 };
 
 /*
@@ -769,9 +846,22 @@ class AsyncWebServerResponse {
     size_t _ackedLength;
     size_t _writtenLength;
     WebResponseState _state;
+    // true while the DefaultHeaders are still emitted from their pre-serialised block
+    // instead of being copied into _headers
+    bool _defaultHeaders;
+    // HTTP minor version the head was assembled for
+    uint8_t _headVersion;
+
+    void _copyDefaultHeaders();
+    // headers _assembleHead() writes without adding them to _headers, contentLength is empty when not sent
+    void _implicitHeaders(uint8_t version, bool& acceptRanges, bool& transferEncoding, bool& contentType, char* contentLength, size_t size) const;
 
   public:
     static const char* responseCodeToString(int code);
+    // weak entity tag identifying a payload by a version counter rather than by its bytes
+    static String versionETag(uint32_t version);
+    // weak comparison (RFC 9110) of etag with the entries of an If-None-Match list, the matching entry or nullptr
+    static const char* etagMatch(const char* inm, const char* etag);
 
   public:
     AsyncWebServerResponse();
@@ -787,7 +877,14 @@ class AsyncWebServerResponse {
     bool addHeader(const String& name, long value, bool replaceExisting = true) { return addHeader(name.c_str(), value, replaceExisting); }
     bool removeHeader(const char* name);
     const AsyncWebHeader* getHeader(const char* name) const;
+    // the headers set on the response, without the default and the implicit ones, see getAllHeaders()
     const std::list<AsyncWebHeader>& getHeaders() const { return _headers; }
+    /**
+     * @brief All headers of the response: the default headers, the ones set on it and, once the head was assembled,
+     * the ones added implicitly (Accept-Ranges, Transfer-Encoding, Content-Length, Content-Type)
+     * @note a copy assembled on each call, the head itself is built without it
+     */
+    std::list<AsyncWebHeader> getAllHeaders() const;
 
 #ifndef ESP8266
     [[deprecated("Use instead: _assembleHead(String& buffer, uint8_t version)")]]
@@ -805,6 +902,10 @@ class AsyncWebServerResponse {
     virtual bool _sourceValid() const;
     virtual void _respond(AsyncWebServerRequest* request);
     virtual size_t _ack(AsyncWebServerRequest* request, size_t len, uint32_t time);
+    // strong entity tag hashed from the body, empty for responses that cannot compute one
+    virtual String _contentETag() { return String(); }
+    // tags a 200 answer to a GET or HEAD with _contentETag() unless it carries an ETag already
+    void _addContentETag(AsyncWebServerRequest* request);
 };
 
 /*
@@ -814,13 +915,49 @@ class AsyncWebServerResponse {
 typedef std::function<void(AsyncWebServerRequest* request)> ArRequestHandlerFunction;
 typedef std::function<void(AsyncWebServerRequest* request, const String& filename, size_t index, uint8_t* data, size_t len, bool final)> ArUploadHandlerFunction;
 typedef std::function<void(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total)> ArBodyHandlerFunction;
+typedef std::function<uint32_t()> ArVersionFunction;
+
+// a power of two
+#ifndef ASYNCWEBSERVER_LIMIT_KEYS
+  #define ASYNCWEBSERVER_LIMIT_KEYS 16
+#endif
+// time a request body gets before its rate is checked, in ms
+#ifndef ASYNCWEBSERVER_BODY_RATE_GRACE
+  #define ASYNCWEBSERVER_BODY_RATE_GRACE 5000
+#endif
+
+struct AsyncWebServerLimitStats {
+    // connections refused by the per IP limit or because all ASYNCWEBSERVER_LIMIT_KEYS entries were taken
+    uint32_t refused;
+    uint32_t headerTimeouts;
+    uint32_t headerOverflows;
+    uint32_t slowBodies;
+};
 
 class AsyncWebServer : public AsyncMiddlewareChain {
+    friend class AsyncWebServerRequest;
+
   protected:
     AsyncServer _server;
     std::list<std::shared_ptr<AsyncWebRewrite>> _rewrites;
     std::list<std::unique_ptr<AsyncWebHandler>> _handlers;
     AsyncCallbackWebHandler* _catchAllHandler;
+    AsyncWebServerMetrics* _metrics = nullptr;
+
+    // requests in progress per client IP, open addressing with linear probing
+    struct ClientCount {
+        uint32_t ip;
+        uint16_t requests;
+    };
+    ClientCount _clientCounts[ASYNCWEBSERVER_LIMIT_KEYS]{};
+    uint8_t _maxRequestsPerIP = 0;
+    uint32_t _headerTimeout = 0;
+    size_t _maxHeaderBytes = 0;
+    uint32_t _minBodyRate = 0;
+    AsyncWebServerLimitStats _limitStats{};
+
+    bool _admitClient(uint32_t ip);
+    void _releaseClient(uint32_t ip);
 
   public:
     AsyncWebServer(uint16_t port);
@@ -889,6 +1026,26 @@ class AsyncWebServer : public AsyncMiddlewareChain {
 
     void reset(); // remove all writers and handlers, with onNotFound/onFileUpload/onRequestBody
 
+    // record timings and sizes of every request into metrics, nullptr to stop
+    void setMetrics(AsyncWebServerMetrics* metrics) { _metrics = metrics; }
+    AsyncWebServerMetrics* metrics() const { return _metrics; }
+
+    // Limits against clients holding requests open, 0 disables each (default). They are checked as data arrives
+    // and on every AsyncTCP poll, a client over a limit is aborted without a response.
+
+    // requests in progress from one IP, new connections over it are refused
+    void setMaxRequestsPerIP(uint8_t requests) { _maxRequestsPerIP = requests; }
+    // time from accepting the connection to the end of the request headers, in ms
+    void setHeaderTimeout(uint32_t ms) { _headerTimeout = ms; }
+    // request line and headers together
+    void setMaxHeaderBytes(size_t bytes) { _maxHeaderBytes = bytes; }
+    // average rate a request body must arrive at once ASYNCWEBSERVER_BODY_RATE_GRACE ms passed
+    void setMinBodyRate(uint32_t bytesPerSecond) { _minBodyRate = bytesPerSecond; }
+    const AsyncWebServerLimitStats& limitStats() const { return _limitStats; }
+
+    // Prometheus text exposition of the limit counters, to be appended to the output of AsyncWebServerMetrics::printTo()
+    void printMetrics(Print& out) const;
+
     void _handleDisconnect(AsyncWebServerRequest* request);
     void _attachHandler(AsyncWebServerRequest* request);
     void _rewriteRequest(AsyncWebServerRequest* request);
@@ -897,6 +1054,8 @@ class AsyncWebServer : public AsyncMiddlewareChain {
 class DefaultHeaders {
     using headers_t = std::list<AsyncWebHeader>;
     headers_t _headers;
+    // "name: value\r\n" lines, kept in sync with _headers so responses can copy them verbatim
+    String _serialized;
 
   public:
     DefaultHeaders() = default;
@@ -905,8 +1064,23 @@ class DefaultHeaders {
 
     void addHeader(const String& name, const String& value) {
       _headers.emplace_back(name, value);
+      _serialized.concat(name);
+      _serialized.concat(": ");
+      _serialized.concat(value);
+      _serialized.concat("\r\n");
+    }
+
+    const AsyncWebHeader* getHeader(const char* name) const {
+      for (const auto& h : _headers) {
+        if (h.name().equalsIgnoreCase(name))
+          return &h;
+      }
+      return nullptr;
     }
 
+    bool empty() const { return _headers.empty(); }
+    const String& serialized() const { return _serialized; }
+
     ConstIterator begin() const { return _headers.begin(); }
     ConstIterator end() const { return _headers.end(); }
 
@@ -919,7 +1093,90 @@ class DefaultHeaders {
     }
 };
 
+class ContentTypes {
+    struct Entry {
+        String extension;
+        String contentType;
+    };
+    std::vector<Entry> _custom;
+
+  public:
+    ContentTypes() = default;
+
+    /**
+     * @brief Register (or override) the MIME type served for files ending in extension
+     *
+     * @param extension file extension including the leading dot, i.e. ".wasm"
+     * @param contentType MIME type to answer with
+     */
+    void add(const String& extension, const String& contentType);
+
+    /**
+     * @brief Resolve the MIME type for a path from the slice after its last dot
+     * @note user registered types take precedence over the built-in table
+     *
+     * @return matching type or text/plain when the extension is unknown
+     */
+    const char* fromPath(const String& path) const;
+
+    ContentTypes(ContentTypes const&) = delete;
+    ContentTypes& operator=(ContentTypes const&) = delete;
+
+    static ContentTypes& Instance() {
+      static ContentTypes instance;
+      return instance;
+    }
+};
+
+class CompressionPolicy {
+    std::vector<String> _contentTypes;
+    size_t _threshold = 512;
+    bool _enabled = false;
+
+  public:
+    CompressionPolicy();
+
+    /**
+     * @brief Compress eligible responses with gzip or deflate, whichever the client prefers
+     *
+     * @param threshold responses with a known length below this are sent as is
+     */
+    void enable(size_t threshold = 512) {
+      _enabled = true;
+      _threshold = threshold;
+    }
+    void disable() { _enabled = false; }
+    bool enabled() const { return _enabled; }
+
+    /**
+     * @brief Allow compression for a content type, or for a family of them when it ends with '/'
+     */
+    void addContentType(const String& contentType) { _contentTypes.push_back(contentType); }
+    void clearContentTypes() { _contentTypes.clear(); }
+
+    /**
+     * @param length content length, 0 when unknown upfront
+     */
+    bool allows(const String& contentType, size_t length) const;
+
+    /**
+     * @brief The content coding to use for an Accept-Encoding value, honouring q-values ("gzip;q=0" refuses it)
+     * @return "gzip", "deflate", or nullptr when the client accepts neither; gzip wins a tie
+     */
+    static const char* encoding(const char* acceptEncoding);
+
+    CompressionPolicy(CompressionPolicy const&) = delete;
+    CompressionPolicy& operator=(CompressionPolicy const&) = delete;
+
+    static CompressionPolicy& Instance() {
+      static CompressionPolicy instance;
+      return instance;
+    }
+};
+
+#include "AsyncBudget.h"
 #include "AsyncEventSource.h"
+#include "AsyncMetrics.h"
 #include "AsyncWebSocket.h"
 #include "WebHandlerImpl.h"
 #include "WebResponseImpl.h"
@@ -0,0 +1,320 @@
+#include "GzipEncoder.h"
+
+#define GZIP_HASH_BITS  10
+#define GZIP_MAX_CHAIN  16
+#define GZIP_MIN_MATCH  3
+#define GZIP_MAX_MATCH  258
+#define GZIP_NO_POS     0xFFFFFFFF
+// worst case fixed-Huffman output is 9 bits per input byte, plus header, block framing and trailer
+#define GZIP_OUT_SIZE   (GZIP_CHUNK_SIZE * 9 / 8 + 64)
+#define GZIP_OUT_SLACK  32
+
+static_assert((GZIP_WINDOW_SIZE & (GZIP_WINDOW_SIZE - 1)) == 0 && GZIP_WINDOW_SIZE <= 32768, "GZIP_WINDOW_SIZE must be a power of 2 up to 32768");
+
+struct GzipEncoder::State {
+    // history followed by the chunk being compressed
+    uint8_t window[GZIP_WINDOW_SIZE + GZIP_CHUNK_SIZE];
+    // stream offsets of the last position per hash, and of the previous one per position
+    uint32_t head[1 << GZIP_HASH_BITS];
+    uint32_t prev[GZIP_WINDOW_SIZE];
+    uint8_t out[GZIP_OUT_SIZE];
+    // bytes used in window and the stream offset of window[0]
+    size_t have;
+    uint32_t base;
+    // CRC-32 of the input for gzip, Adler-32 for zlib
+    uint32_t crc;
+    uint32_t size;
+    uint32_t maxDistance;
+};
+
+static const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// CRC-32 (IEEE), one nibble at a time to keep the table small
+static const uint32_t crcTable[16] = {
+  0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+  0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+static uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc = crcTable[(crc ^ *data) & 0x0f] ^ (crc >> 4);
+    crc = crcTable[(crc ^ (*data >> 4)) & 0x0f] ^ (crc >> 4);
+    data++;
+  }
+  return ~crc;
+}
+
+static uint32_t adler32Update(uint32_t adler, const uint8_t* data, size_t len) {
+  uint32_t a = adler & 0xffff;
+  uint32_t b = adler >> 16;
+  while (len) {
+    // the sums cannot overflow 32 bits within 5552 bytes
+    size_t n = std::min<size_t>(len, 5552);
+    len -= n;
+    while (n--) {
+      a += *data++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return b << 16 | a;
+}
+
+// multiplicative hash of the 3 bytes, the top bits of the product depend on all of them
+static inline uint32_t hash3(const uint8_t* p) {
+  return (uint32_t)((uint32_t)(p[0] | p[1] << 8 | p[2] << 16) * 2654435761UL) >> (32 - GZIP_HASH_BITS);
+}
+
+GzipEncoder::GzipEncoder()
+    : _s(nullptr), _format(Format::Gzip), _outLen(0), _outPos(0), _bits(0), _bitCount(0), _finished(false) {}
+
+GzipEncoder::~GzipEncoder() {
+  free(_s);
+}
+
+bool GzipEncoder::begin(Format format, size_t maxDistance) {
+  if (!_s) {
+#if defined(ESP32) && defined(BOARD_HAS_PSRAM)
+    _s = (State*)ps_malloc(sizeof(State));
+    if (!_s)
+#endif
+      _s = (State*)malloc(sizeof(State));
+    if (!_s)
+      return false;
+  }
+
+  memset(_s->head, 0xff, sizeof(_s->head));
+  memset(_s->prev, 0xff, sizeof(_s->prev));
+  _s->have = 0;
+  _s->base = 0;
+  _s->crc = format == Format::Zlib ? 1 : 0;
+  _s->size = 0;
+  _s->maxDistance = std::min<size_t>(maxDistance, GZIP_WINDOW_SIZE);
+  _format = format;
+  _outLen = _outPos = 0;
+  _bits = 0;
+  _bitCount = 0;
+  _finished = false;
+
+  if (format == Format::Gzip) {
+    // magic, deflate, no flags, no mtime, no extra flags, unknown OS
+    static const uint8_t header[10] = {0x1f, 0x8b, 0x08, 0, 0, 0, 0, 0, 0, 0xff};
+    for (uint8_t b : header)
+      _putByte(b);
+  } else if (format == Format::Zlib) {
+    // deflate with the window as a power of two from 256, fastest level, the header a multiple of 31
+    uint8_t windowBits = 8;
+    while (windowBits < 15 && (1UL << windowBits) < _s->maxDistance)
+      windowBits++;
+    const uint8_t cmf = (windowBits - 8) << 4 | 8;
+    _putByte(cmf);
+    _putByte(31 - (cmf << 8) % 31);
+  }
+  return true;
+}
+
+void GzipEncoder::_putByte(uint8_t b) {
+  _s->out[_outLen++] = b;
+}
+
+void GzipEncoder::_putBits(uint32_t value, uint8_t count) {
+  _bits |= value << _bitCount;
+  _bitCount += count;
+  while (_bitCount >= 8) {
+    _putByte(_bits & 0xff);
+    _bits >>= 8;
+    _bitCount -= 8;
+  }
+}
+
+void GzipEncoder::_putCode(uint32_t code, uint8_t count) {
+  // huffman codes are packed starting from their most significant bit
+  uint32_t reversed = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    reversed = (reversed << 1) | (code & 1);
+    code >>= 1;
+  }
+  _putBits(reversed, count);
+}
+
+void GzipEncoder::_putLiteral(uint8_t c) {
+  if (c < 144)
+    _putCode(0x30 + c, 8);
+  else
+    _putCode(0x190 + c - 144, 9);
+}
+
+void GzipEncoder::_putMatch(size_t length, size_t distance) {
+  uint8_t i = 28;
+  while (lengthBase[i] > length)
+    i--;
+  const uint16_t symbol = 257 + i;
+  if (symbol < 280)
+    _putCode(symbol - 256, 7);
+  else
+    _putCode(0xc0 + symbol - 280, 8);
+  _putBits(length - lengthBase[i], lengthExtra[i]);
+
+  uint8_t d = 29;
+  while (distBase[d] > distance)
+    d--;
+  _putCode(d, 5);
+  _putBits(distance - distBase[d], distExtra[d]);
+}
+
+void GzipEncoder::_flushBits() {
+  if (_bitCount)
+    _putByte(_bits & 0xff);
+  _bits = 0;
+  _bitCount = 0;
+}
+
+size_t GzipEncoder::write(const uint8_t* data, size_t len) {
+  if (!_s || _finished || pending() > GZIP_OUT_SLACK)
+    return 0;
+  if (len > GZIP_CHUNK_SIZE)
+    len = GZIP_CHUNK_SIZE;
+  if (!len)
+    return 0;
+
+  State& s = *_s;
+
+  // keep leftover output at the front of the buffer
+  if (_outPos) {
+    memmove(s.out, s.out + _outPos, pending());
+    _outLen -= _outPos;
+    _outPos = 0;
+  }
+
+  // slide the history so the chunk fits behind it, keeping at least GZIP_WINDOW_SIZE bytes
+  if (s.have + len > sizeof(s.window)) {
+    const size_t drop = s.have + len - sizeof(s.window);
+    memmove(s.window, s.window + drop, s.have - drop);
+    s.have -= drop;
+    s.base += drop;
+  }
+  memcpy(s.window + s.have, data, len);
+  s.crc = _format == Format::Zlib ? adler32Update(s.crc, data, len) : crc32Update(s.crc, data, len);
+  s.size += len;
+
+  _putBits(0, 1); // BFINAL
+  _putBits(1, 2); // BTYPE fixed Huffman
+
+  size_t pos = s.have;
+  const size_t end = s.have + len;
+  while (pos < end) {
+    size_t bestLen = 0;
+    size_t bestDist = 0;
+    const uint32_t abs = s.base + pos;
+
+    if (pos + GZIP_MIN_MATCH <= end) {
+      const size_t maxLen = std::min<size_t>(GZIP_MAX_MATCH, end - pos);
+      const uint8_t* q = s.window + pos;
+      uint32_t cand = s.head[hash3(q)];
+      for (uint8_t chain = GZIP_MAX_CHAIN; chain && cand != GZIP_NO_POS; chain--) {
+        if (cand < s.base || abs - cand > s.maxDistance)
+          break;
+        const uint8_t* p = s.window + (cand - s.base);
+        if (p[bestLen] == q[bestLen]) {
+          size_t l = 0;
+          while (l < maxLen && p[l] == q[l])
+            l++;
+          if (l > bestLen) {
+            bestLen = l;
+            bestDist = abs - cand;
+            if (l == maxLen)
+              break;
+          }
+        }
+        const uint32_t next = s.prev[cand & (GZIP_WINDOW_SIZE - 1)];
+        if (next >= cand)
+          break;
+        cand = next;
+      }
+    }
+
+    size_t step = 1;
+    if (bestLen >= GZIP_MIN_MATCH) {
+      _putMatch(bestLen, bestDist);
+      step = bestLen;
+    } else {
+      _putLiteral(s.window[pos]);
+    }
+
+    // index every covered position that still has a full hash key in this chunk
+    for (; step; step--, pos++) {
+      if (pos + GZIP_MIN_MATCH <= end) {
+        const uint32_t h = hash3(s.window + pos);
+        s.prev[(s.base + pos) & (GZIP_WINDOW_SIZE - 1)] = s.head[h];
+        s.head[h] = s.base + pos;
+      }
+    }
+  }
+
+  _putCode(0, 7); // end of block
+  s.have = end;
+  return len;
+}
+
+void GzipEncoder::finish() {
+  if (!_s || _finished || pending() > GZIP_OUT_SLACK)
+    return;
+
+  if (_outPos) {
+    memmove(_s->out, _s->out + _outPos, pending());
+    _outLen -= _outPos;
+    _outPos = 0;
+  }
+
+  // last, empty block
+  _putBits(1, 1);
+  _putBits(1, 2);
+  _putCode(0, 7);
+  _flushBits();
+
+  if (_format == Format::Gzip) {
+    for (uint8_t i = 0; i < 4; i++)
+      _putByte(_s->crc >> (8 * i));
+    for (uint8_t i = 0; i < 4; i++)
+      _putByte(_s->size >> (8 * i));
+  } else if (_format == Format::Zlib) {
+    // big-endian, unlike the gzip trailer
+    for (uint8_t i = 0; i < 4; i++)
+      _putByte(_s->crc >> (8 * (3 - i)));
+  }
+  _finished = true;
+}
+
+void GzipEncoder::flush() {
+  if (!_s || _finished || pending() > GZIP_OUT_SLACK)
+    return;
+
+  if (_outPos) {
+    memmove(_s->out, _s->out + _outPos, pending());
+    _outLen -= _outPos;
+    _outPos = 0;
+  }
+
+  // not final, stored, then LEN 0 and NLEN 0xffff on the next byte boundary
+  _putBits(0, 3);
+  _flushBits();
+  _putByte(0x00);
+  _putByte(0x00);
+  _putByte(0xff);
+  _putByte(0xff);
+}
+
+size_t GzipEncoder::read(uint8_t* out, size_t maxLen) {
+  const size_t n = std::min(pending(), maxLen);
+  if (n) {
+    memcpy(out, _s->out + _outPos, n);
+    _outPos += n;
+  }
+  if (_outPos == _outLen)
+    _outPos = _outLen = 0;
+  return n;
+}
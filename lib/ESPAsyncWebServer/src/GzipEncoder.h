@@ -0,0 +1,90 @@
+#ifndef GZIPENCODER_H
+#define GZIPENCODER_H
+
+#include <Arduino.h>
+
+// History kept for back references. Must be a power of 2, at most 32768.
+#ifndef GZIP_WINDOW_SIZE
+  #define GZIP_WINDOW_SIZE 4096
+#endif
+
+// Amount of input compressed per deflate block
+#ifndef GZIP_CHUNK_SIZE
+  #define GZIP_CHUNK_SIZE 1024
+#endif
+
+/**
+ * @brief Streaming gzip encoder with a small window
+ *
+ * Emits fixed-Huffman deflate blocks with greedy LZ77 matching, which trades some ratio for
+ * a bounded footprint (about 27KB with the defaults, taken from PSRAM when available).
+ * Feed input with write(), drain output with read() and call finish() once the input is over.
+ * With Format::Zlib the stream is wrapped as HTTP's deflate content coding (RFC 1950), with
+ * Format::Raw the bare deflate stream is produced, as used by WebSocket permessage-deflate.
+ */
+class GzipEncoder {
+  public:
+    enum class Format : uint8_t {
+      Gzip,
+      Zlib,
+      Raw
+    };
+
+  private:
+    struct State;
+    State* _s;
+    Format _format;
+    size_t _outLen;
+    size_t _outPos;
+    uint32_t _bits;
+    uint8_t _bitCount;
+    bool _finished;
+
+    void _putBits(uint32_t value, uint8_t count);
+    void _putCode(uint32_t code, uint8_t count);
+    void _putLiteral(uint8_t c);
+    void _putMatch(size_t length, size_t distance);
+    void _flushBits();
+    void _putByte(uint8_t b);
+
+  public:
+    GzipEncoder();
+    ~GzipEncoder();
+    GzipEncoder(const GzipEncoder&) = delete;
+    GzipEncoder& operator=(const GzipEncoder&) = delete;
+
+    /**
+     * @brief Allocate the encoder state (kept across calls) and start a new stream
+     *
+     * @param maxDistance limit for back references, at most GZIP_WINDOW_SIZE
+     * @return false when the state could not be allocated
+     */
+    bool begin(Format format = Format::Gzip, size_t maxDistance = GZIP_WINDOW_SIZE);
+
+    /**
+     * @brief Compress up to GZIP_CHUNK_SIZE bytes of input, only valid while pending() is 0
+     * @return number of bytes consumed
+     */
+    size_t write(const uint8_t* data, size_t len);
+
+    /**
+     * @brief Terminate the deflate stream and append the gzip or zlib trailer
+     */
+    void finish();
+
+    /**
+     * @brief Byte-align the output with an empty stored block, ending in 00 00 ff ff
+     */
+    void flush();
+
+    /**
+     * @brief Copy out pending compressed bytes
+     * @return number of bytes copied
+     */
+    size_t read(uint8_t* out, size_t maxLen);
+
+    size_t pending() const { return _outLen - _outPos; }
+    bool finished() const { return _finished; }
+};
+
+#endif
@@ -0,0 +1,242 @@
+#include "Inflater.h"
+
+static const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+// order in which the code length code lengths are transmitted
+static const uint8_t codeLengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+namespace {
+  // canonical Huffman code: number of codes per length and symbols sorted by code
+  struct Huffman {
+      uint16_t counts[16];
+      uint16_t symbols[288];
+
+      bool build(const uint8_t* lengths, size_t n) {
+        memset(counts, 0, sizeof(counts));
+        for (size_t i = 0; i < n; i++)
+          counts[lengths[i]]++;
+        counts[0] = 0;
+
+        // reject over-subscribed codes
+        int32_t left = 1;
+        for (uint8_t len = 1; len < 16; len++) {
+          left <<= 1;
+          left -= counts[len];
+          if (left < 0)
+            return false;
+        }
+
+        uint16_t offsets[16];
+        offsets[1] = 0;
+        for (uint8_t len = 1; len < 15; len++)
+          offsets[len + 1] = offsets[len] + counts[len];
+        for (size_t i = 0; i < n; i++) {
+          if (lengths[i])
+            symbols[offsets[lengths[i]]++] = i;
+        }
+        return true;
+      }
+  };
+
+  class Inflate {
+    private:
+      const uint8_t* _in;
+      size_t _len;
+      size_t _pos = 0;
+      uint32_t _bits = 0;
+      uint8_t _bitCount = 0;
+      bool _error = false;
+      // the output would exceed _maxLen, the input may well be valid
+      bool _tooBig = false;
+      std::vector<uint8_t>& _out;
+      size_t _maxLen;
+
+      uint32_t _getBits(uint8_t count) {
+        while (_bitCount < count) {
+          if (_pos >= _len) {
+            _error = true;
+            return 0;
+          }
+          _bits |= (uint32_t)_in[_pos++] << _bitCount;
+          _bitCount += 8;
+        }
+        const uint32_t value = _bits & ((1UL << count) - 1);
+        _bits >>= count;
+        _bitCount -= count;
+        return value;
+      }
+
+      int _decode(const Huffman& h) {
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (uint8_t len = 1; len < 16; len++) {
+          code |= _getBits(1);
+          if (_error)
+            return -1;
+          const int count = h.counts[len];
+          if (code - first < count)
+            return h.symbols[index + code - first];
+          index += count;
+          first = (first + count) << 1;
+          code <<= 1;
+        }
+        return -1;
+      }
+
+      bool _stored() {
+        // skip to the byte boundary, the bit buffer then only holds whole bytes
+        _bits >>= _bitCount & 7;
+        _bitCount -= _bitCount & 7;
+        const uint16_t len = _getBits(16);
+        const uint16_t nlen = _getBits(16);
+        if (_error || len != (uint16_t)~nlen)
+          return false;
+        if (_bitCount || _len - _pos < len)
+          return false;
+        if (_out.size() + len > _maxLen) {
+          _tooBig = true;
+          return false;
+        }
+        _out.insert(_out.end(), _in + _pos, _in + _pos + len);
+        _pos += len;
+        return true;
+      }
+
+      bool _codes(const Huffman& lit, const Huffman& dist) {
+        for (;;) {
+          int symbol = _decode(lit);
+          if (symbol < 0)
+            return false;
+          if (symbol < 256) {
+            if (_out.size() >= _maxLen) {
+              _tooBig = true;
+              return false;
+            }
+            _out.push_back(symbol);
+            continue;
+          }
+          if (symbol == 256)
+            return true;
+
+          symbol -= 257;
+          if (symbol >= 29)
+            return false;
+          const size_t length = lengthBase[symbol] + _getBits(lengthExtra[symbol]);
+          const int d = _decode(dist);
+          if (d < 0 || d >= 30)
+            return false;
+          const size_t distance = distBase[d] + _getBits(distExtra[d]);
+          if (_error || distance > _out.size())
+            return false;
+          if (_out.size() + length > _maxLen) {
+            _tooBig = true;
+            return false;
+          }
+          // copies may overlap the bytes they produce
+          size_t from = _out.size() - distance;
+          for (size_t i = 0; i < length; i++)
+            _out.push_back(_out[from + i]);
+        }
+      }
+
+      bool _fixed() {
+        Huffman lit;
+        Huffman dist;
+        uint8_t lengths[288];
+        memset(lengths, 8, 144);
+        memset(lengths + 144, 9, 112);
+        memset(lengths + 256, 7, 24);
+        memset(lengths + 280, 8, 8);
+        lit.build(lengths, 288);
+        memset(lengths, 5, 30);
+        dist.build(lengths, 30);
+        return _codes(lit, dist);
+      }
+
+      bool _dynamic() {
+        const size_t nlen = _getBits(5) + 257;
+        const size_t ndist = _getBits(5) + 1;
+        const size_t ncode = _getBits(4) + 4;
+        if (_error || nlen > 286 || ndist > 30)
+          return false;
+
+        uint8_t lengths[320] = {};
+        for (size_t i = 0; i < ncode; i++)
+          lengths[codeLengthOrder[i]] = _getBits(3);
+        Huffman lencode;
+        if (_error || !lencode.build(lengths, 19))
+          return false;
+
+        size_t i = 0;
+        while (i < nlen + ndist) {
+          const int symbol = _decode(lencode);
+          if (symbol < 0)
+            return false;
+          if (symbol < 16) {
+            lengths[i++] = symbol;
+            continue;
+          }
+          uint8_t len = 0;
+          size_t repeat;
+          if (symbol == 16) {
+            if (!i)
+              return false;
+            len = lengths[i - 1];
+            repeat = 3 + _getBits(2);
+          } else if (symbol == 17) {
+            repeat = 3 + _getBits(3);
+          } else {
+            repeat = 11 + _getBits(7);
+          }
+          if (_error || i + repeat > nlen + ndist)
+            return false;
+          while (repeat--)
+            lengths[i++] = len;
+        }
+        if (!lengths[256])
+          return false;
+
+        Huffman lit;
+        Huffman dist;
+        if (!lit.build(lengths, nlen) || !dist.build(lengths + nlen, ndist))
+          return false;
+        return _codes(lit, dist);
+      }
+
+    public:
+      Inflate(const uint8_t* in, size_t len, std::vector<uint8_t>& out, size_t maxLen) : _in(in), _len(len), _out(out), _maxLen(maxLen) {}
+
+      InflateStatus run() {
+        bool final = false;
+        while (!final) {
+          // a sync-flushed stream stops on a block boundary without a final block
+          if (_pos == _len && !_bitCount)
+            return INFLATE_OK;
+          final = _getBits(1);
+          const uint8_t type = _getBits(2);
+          if (_error)
+            return INFLATE_MALFORMED;
+          bool ok;
+          if (type == 0)
+            ok = _stored();
+          else if (type == 1)
+            ok = _fixed();
+          else if (type == 2)
+            ok = _dynamic();
+          else
+            ok = false;
+          if (!ok || _error)
+            return _tooBig ? INFLATE_TOO_BIG : INFLATE_MALFORMED;
+        }
+        return INFLATE_OK;
+      }
+  };
+} // namespace
+
+InflateStatus rawInflate(const uint8_t* in, size_t len, std::vector<uint8_t>& out, size_t maxLen) {
+  out.clear();
+  return Inflate(in, len, out, maxLen).run();
+}
@@ -0,0 +1,24 @@
+#ifndef INFLATER_H
+#define INFLATER_H
+
+#include <Arduino.h>
+#include <vector>
+
+typedef enum { INFLATE_OK,
+               // not a valid deflate stream
+               INFLATE_MALFORMED,
+               // valid up to where the output would have exceeded maxLen
+               INFLATE_TOO_BIG } InflateStatus;
+
+/**
+ * @brief Decompress a raw deflate stream (RFC 1951) in one go
+ *
+ * The stream may end after a final block or on a block boundary, as a sync-flushed
+ * permessage-deflate message does. Back references can only reach into the output of
+ * this call, which is what a peer without context takeover produces.
+ *
+ * @param maxLen upper bound for the decompressed size
+ */
+InflateStatus rawInflate(const uint8_t* in, size_t len, std::vector<uint8_t>& out, size_t maxLen);
+
+#endif
@@ -1,6 +1,9 @@
+#include "AsyncIPHash.h"
 #include "WebAuthentication.h"
 #include <ESPAsyncWebServer.h>
 
+#include "WebResponseImpl.h"
+
 AsyncMiddlewareChain::~AsyncMiddlewareChain() {
   for (AsyncMiddleware* m : _middlewares)
     if (m->_freeOnRemoval)
@@ -41,32 +44,41 @@ bool AsyncMiddlewareChain::removeMiddleware(AsyncMiddleware* middleware) {
 void AsyncMiddlewareChain::_runChain(AsyncWebServerRequest* request, ArMiddlewareNext finalizer) {
   if (!_middlewares.size())
     return finalizer();
-  ArMiddlewareNext next;
-  std::list<AsyncMiddleware*>::iterator it = _middlewares.begin();
-  next = [this, &next, &it, request, finalizer]() {
-    if (it == _middlewares.end())
-      return finalizer();
-    AsyncMiddleware* m = *it;
-    it++;
-    return m->run(request, next);
+  struct Chain {
+      std::list<AsyncMiddleware*>& middlewares;
+      std::list<AsyncMiddleware*>::iterator it;
+      AsyncWebServerRequest* request;
+      ArMiddlewareNext& finalizer;
+      ArMiddlewareNext next;
+  } chain{_middlewares, _middlewares.begin(), request, finalizer, nullptr};
+  // the step only points to the chain, so the copy of it each run() takes fits in std::function without allocating
+  chain.next = [&chain]() {
+    if (chain.it == chain.middlewares.end())
+      return chain.finalizer();
+    AsyncMiddleware* m = *chain.it;
+    chain.it++;
+    return m->run(chain.request, chain.next);
   };
-  return next();
+  return chain.next();
 }
 
 void AsyncAuthenticationMiddleware::setUsername(const char* username) {
   _username = username;
+  _precomputedFor = AsyncAuthType::AUTH_NONE;
   _hasCreds = _username.length() && _credentials.length();
 }
 
 void AsyncAuthenticationMiddleware::setPassword(const char* password) {
   _credentials = password;
   _hash = false;
+  _precomputedFor = AsyncAuthType::AUTH_NONE;
   _hasCreds = _username.length() && _credentials.length();
 }
 
 void AsyncAuthenticationMiddleware::setPasswordHash(const char* hash) {
   _credentials = hash;
   _hash = _credentials.length();
+  _precomputedFor = AsyncAuthType::AUTH_NONE;
   _hasCreds = _username.length() && _credentials.length();
 }
 
@@ -105,7 +117,21 @@ bool AsyncAuthenticationMiddleware::allowed(AsyncWebServerRequest* request) cons
   if (!_hasCreds)
     return true;
 
-  return request->authenticate(_username.c_str(), _credentials.c_str(), _realm.c_str(), _hash);
+  if (_hash)
+    return request->authenticate(_username.c_str(), _credentials.c_str(), _realm.c_str(), true);
+
+  if (_precomputedFor != _authMethod) {
+    if (_authMethod == AsyncAuthType::AUTH_BASIC)
+      _precomputed = generateBasicHash(_username.c_str(), _credentials.c_str());
+    else if (_authMethod == AsyncAuthType::AUTH_DIGEST)
+      _precomputed = generateDigestHash(_username.c_str(), _credentials.c_str(), _realm.c_str());
+    else
+      _precomputed = emptyString;
+    _precomputedFor = _authMethod;
+  }
+  if (_precomputed.length())
+    return request->authenticate(_username.c_str(), _precomputed.c_str(), _realm.c_str(), true);
+  return request->authenticate(_username.c_str(), _credentials.c_str(), _realm.c_str(), false);
 }
 
 void AsyncAuthenticationMiddleware::run(AsyncWebServerRequest* request, ArMiddlewareNext next) {
@@ -178,7 +204,7 @@ void AsyncLoggingMiddleware::run(AsyncWebServerRequest* request, ArMiddlewareNex
     _out->print(response->code());
     _out->print(' ');
     _out->println(AsyncWebServerResponse::responseCodeToString(response->code()));
-    for (auto& h : response->getHeaders()) {
+    for (auto& h : response->getAllHeaders()) {
       if (h.value().length()) {
         _out->print('<');
         _out->print(' ');
@@ -226,31 +252,82 @@ void AsyncCorsMiddleware::run(AsyncWebServerRequest* request, ArMiddlewareNext n
   }
 }
 
-bool AsyncRateLimitMiddleware::isRequestAllowed(uint32_t& retryAfterSeconds) {
-  uint32_t now = millis();
+AsyncRateLimitMiddleware::Window& AsyncRateLimitMiddleware::_window(uint32_t key, uint32_t now) {
+  if (!key)
+    return _global;
+
+  const size_t home = asyncsrv::ipSlot<ASYNCWEBSERVER_RATE_LIMIT_KEYS>(key);
+  Window* victim = nullptr;
+  for (size_t p = 0; p < ASYNCWEBSERVER_RATE_LIMIT_PROBES && p < ASYNCWEBSERVER_RATE_LIMIT_KEYS; p++) {
+    Window& w = _windows[(home + p) % ASYNCWEBSERVER_RATE_LIMIT_KEYS];
+    if (w.key == key)
+      return w;
+    // a free entry first, then one that has no request left in the sliding window, then the oldest
+    if (!w.key) {
+      if (!victim || victim->key)
+        victim = &w;
+    } else if (!victim || (victim->key && now - w.start > now - victim->start)) {
+      victim = &w;
+    }
+  }
 
-  while (!_requestTimes.empty() && _requestTimes.front() <= now - _windowSizeMillis)
-    _requestTimes.pop_front();
+  if (victim->key && now - victim->start < 2 * _windowSizeMillis)
+    _evictions++;
+  *victim = {key, now, 0, 0};
+  return *victim;
+}
 
-  _requestTimes.push_back(now);
+bool AsyncRateLimitMiddleware::_allowed(Window& w, uint32_t now, uint32_t& retryAfterSeconds) {
+  retryAfterSeconds = 0;
+  if (!_windowSizeMillis)
+    return _maxRequests;
+
+  const uint32_t windowSize = _windowSizeMillis;
+  uint32_t elapsed = now - w.start;
+  if (elapsed >= windowSize) {
+    const uint32_t windows = elapsed / windowSize;
+    w.previous = windows == 1 ? w.current : 0;
+    w.current = 0;
+    w.start += windows * windowSize;
+    elapsed -= windows * windowSize;
+  }
 
-  if (_requestTimes.size() > _maxRequests) {
-    _requestTimes.pop_front();
-    retryAfterSeconds = (_windowSizeMillis - (now - _requestTimes.front())) / 1000 + 1;
-    return false;
+  // previous * (windowSize - elapsed) / windowSize + current < max, in integers
+  const uint64_t max = (uint64_t)_maxRequests * windowSize;
+  if ((uint64_t)w.previous * (windowSize - elapsed) + (uint64_t)w.current * windowSize < max) {
+    w.current++;
+    return true;
   }
 
-  retryAfterSeconds = 0;
-  return true;
+  // time until the weighted count drops below the limit, rejected requests are not counted:
+  // the first elapsed e with previous * (windowSize - e) < (max - current) * windowSize, in this window or the next
+  uint64_t retryMillis;
+  if (!_maxRequests)
+    retryMillis = windowSize;
+  else if (w.current < _maxRequests)
+    retryMillis = windowSize - elapsed - ((uint64_t)(_maxRequests - w.current) * windowSize + w.previous - 1) / w.previous + 1;
+  else
+    retryMillis = (windowSize - elapsed) + windowSize - (max + w.current - 1) / w.current + 1;
+  retryAfterSeconds = (retryMillis + 999) / 1000;
+  return false;
+}
+
+bool AsyncRateLimitMiddleware::isRequestAllowed(uint32_t& retryAfterSeconds) {
+  return isRequestAllowed(0, retryAfterSeconds);
+}
+
+bool AsyncRateLimitMiddleware::isRequestAllowed(uint32_t key, uint32_t& retryAfterSeconds) {
+  const uint32_t now = millis();
+  return _allowed(_window(key, now), now, retryAfterSeconds);
 }
 
 void AsyncRateLimitMiddleware::run(AsyncWebServerRequest* request, ArMiddlewareNext next) {
   uint32_t retryAfterSeconds;
-  if (isRequestAllowed(retryAfterSeconds)) {
+  const uint32_t key = _perClient ? (uint32_t)request->client()->remoteIP() : 0;
+  if (isRequestAllowed(key, retryAfterSeconds)) {
     next();
   } else {
-    AsyncWebServerResponse* response = request->beginResponse(429);
-    response->addHeader(asyncsrv::T_retry_after, retryAfterSeconds);
-    request->send(response);
+    _limited++;
+    request->send(new AsyncRateLimitResponse(retryAfterSeconds));
   }
 }
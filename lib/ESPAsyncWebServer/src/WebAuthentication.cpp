@@ -25,6 +25,7 @@
 #else
   #include "md5.h"
 #endif
+#include "AsyncCrypto.h"
 #include "literals.h"
 
 using namespace asyncsrv;
@@ -34,7 +35,39 @@ using namespace asyncsrv;
 bool checkBasicAuthentication(const char* hash, const char* username, const char* password) {
   if (username == NULL || password == NULL || hash == NULL)
     return false;
-  return generateBasicHash(username, password).equalsIgnoreCase(hash);
+
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  const size_t usernameLen = strlen(username);
+  const size_t len = usernameLen + 1 + strlen(password);
+  if (strlen(hash) != (len + 2) / 3 * 4)
+    return false;
+
+  auto at = [&](size_t i) -> uint32_t {
+    if (i >= len)
+      return 0;
+    return (uint8_t)(i < usernameLen ? username[i] : i == usernameLen ? ':' : password[i - usernameLen - 1]);
+  };
+  uint8_t diff = 0;
+  for (size_t i = 0; i < len; i += 3, hash += 4) {
+    const uint32_t group = at(i) << 16 | at(i + 1) << 8 | at(i + 2);
+    diff |= hash[0] ^ alphabet[group >> 18 & 63];
+    diff |= hash[1] ^ alphabet[group >> 12 & 63];
+    diff |= hash[2] ^ (i + 1 < len ? alphabet[group >> 6 & 63] : '=');
+    diff |= hash[3] ^ (i + 2 < len ? alphabet[group & 63] : '=');
+  }
+  return !diff;
+}
+
+bool secureEquals(const char* a, const char* b) {
+  if (a == NULL || b == NULL)
+    return false;
+  const size_t len = strlen(a);
+  if (len != strlen(b))
+    return false;
+  uint8_t diff = 0;
+  for (size_t i = 0; i < len; i++)
+    diff |= a[i] ^ b[i];
+  return !diff;
 }
 
 String generateBasicHash(const char* username, const char* password) {
@@ -137,7 +170,7 @@ String generateDigestHash(const char* username, const char* password, const char
   return in;
 }
 
-bool checkDigestAuthentication(const char* header, const char* method, const char* username, const char* password, const char* realm, bool passwordIsHash, const char* nonce, const char* opaque, const char* uri)
+bool checkDigestAuthentication(const char* header, const char* method, const char* username, const char* password, const char* realm, bool passwordIsHash, const char* nonce, const char* opaque, const char* uri, bool* stale, bool useNonce)
 {
   if (username == NULL || password == NULL || header == NULL || method == NULL) {
     // os_printf("AUTH FAIL: missing requred fields\n");
@@ -223,7 +256,14 @@ bool checkDigestAuthentication(const char* header, const char* method, const cha
   String ha2 = stringMD5(String(method) + ':' + myUri);
   String response = ha1 + ':' + myNonce + ':' + myNc + ':' + myCnonce + ':' + myQop + ':' + ha2;
 
-  if (myResponse.equals(stringMD5(response))) {
+  if (secureEquals(myResponse.c_str(), stringMD5(response).c_str())) {
+    // without qop there is no nonce count, the nonce is then good for one request
+    if (nonce == NULL && useNonce && !AsyncDigestNonces::Instance().use(myNonce.c_str(), myNc.length() ? strtoul(myNc.c_str(), NULL, 16) : 1)) {
+      // os_printf("AUTH FAIL: stale nonce\n");
+      if (stale)
+        *stale = true;
+      return false;
+    }
     // os_printf("AUTH SUCCESS\n");
     return true;
   }
@@ -231,3 +271,112 @@ bool checkDigestAuthentication(const char* header, const char* method, const cha
   // os_printf("AUTH FAIL: password\n");
   return false;
 }
+
+void AsyncDigestNonces::_sign(uint32_t issued, uint32_t salt, char* out) const {
+  const uint32_t message[2] = {issued, salt};
+  uint8_t mac[HmacSha256::MAC_SIZE];
+  _key.mac((const uint8_t*)message, sizeof(message), mac);
+  for (size_t i = 0; i < 8; i++)
+    snprintf(out + i * 2, 3, "%02x", mac[i]);
+}
+
+String AsyncDigestNonces::issue() {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_lock);
+#endif
+  if (!_key.hasKey()) {
+    uint32_t key[8];
+    for (size_t i = 0; i < 8; i++)
+      key[i] = randomWord();
+    _key.setKey((const uint8_t*)key, sizeof(key));
+    memset(key, 0, sizeof(key));
+  }
+
+  const uint32_t issued = millis();
+  const uint32_t salt = randomWord();
+  char nonce[33];
+  snprintf(nonce, sizeof(nonce), "%08lx%08lx", (unsigned long)issued, (unsigned long)salt);
+  _sign(issued, salt, nonce + 16);
+  _stats.issued++;
+  return String(nonce);
+}
+
+bool AsyncDigestNonces::use(const char* nonce, uint32_t nc) {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_lock);
+#endif
+  char* end;
+  char field[9] = {};
+  const size_t len = nonce ? strlen(nonce) : 0;
+  if (len != 32 || !_key.hasKey()) {
+    _stats.stale++;
+    return false;
+  }
+  memcpy(field, nonce, 8);
+  const uint32_t issued = strtoul(field, &end, 16);
+  const bool parsed = end == field + 8;
+  memcpy(field, nonce + 8, 8);
+  const uint32_t salt = strtoul(field, &end, 16);
+
+  char signature[17];
+  _sign(issued, salt, signature);
+  const uint32_t now = millis();
+  const uint32_t ttl = ASYNCWEBSERVER_DIGEST_NONCE_TTL * 1000UL;
+  if (_forgot && now - _forgotten >= ttl)
+    _forgot = false;
+  // issued at or before the last one forgotten, counted back from now as millis() wraps
+  const bool forgotten = _forgot && now - issued >= now - _forgotten;
+  if (!parsed || end != field + 8 || !secureEquals(signature, nonce + 16) || now - issued >= ttl || forgotten) {
+    _stats.stale++;
+    return false;
+  }
+
+  Entry* free = nullptr;
+  Entry* oldest = nullptr;
+  for (Entry& entry : _entries) {
+    if (entry.used && now - entry.issued >= ttl)
+      entry.used = false;
+    if (!entry.used) {
+      free = free ? free : &entry;
+      continue;
+    }
+    if (entry.issued == issued && entry.salt == salt) {
+      if (nc <= entry.nc) {
+        _stats.replayed++;
+        return false;
+      }
+      entry.nc = nc;
+      _stats.accepted++;
+      return true;
+    }
+    if (!oldest || now - entry.issued > now - oldest->issued)
+      oldest = &entry;
+  }
+
+  if (!free) {
+    // older than all kept, its nonce count would be forgotten first
+    if (now - issued >= now - oldest->issued) {
+      _stats.stale++;
+      return false;
+    }
+    // none of the nonces issued up to the one forgotten can be accepted any more, their counts are not known
+    _forgotten = oldest->issued;
+    _forgot = true;
+    free = oldest;
+  }
+  *free = Entry{issued, salt, nc, true};
+  _stats.accepted++;
+  return true;
+}
+
+void AsyncDigestNonces::printTo(Print& out) const {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_lock);
+#endif
+  out.print(F("# TYPE asyncwebserver_digest_nonces_issued_total counter\n"));
+  out.printf("asyncwebserver_digest_nonces_issued_total %lu\n", (unsigned long)_stats.issued);
+  out.print(F("# TYPE asyncwebserver_digest_nonce_uses_total counter\n"));
+  out.printf("asyncwebserver_digest_nonce_uses_total{result=\"accepted\"} %lu\n", (unsigned long)_stats.accepted);
+  out.printf("asyncwebserver_digest_nonce_uses_total{result=\"stale\"} %lu\n", (unsigned long)_stats.stale);
+  out.printf("asyncwebserver_digest_nonce_uses_total{result=\"replayed\"} %lu\n", (unsigned long)_stats.replayed);
+}
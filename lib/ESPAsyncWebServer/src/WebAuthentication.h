@@ -23,10 +23,34 @@
 #define WEB_AUTHENTICATION_H_
 
 #include "Arduino.h"
+#include "AsyncCrypto.h"
 
+#ifdef ESP32
+  #include <mutex>
+#endif
+
+// nonces whose nonce counts are remembered, one per client that authenticated within the TTL
+#ifndef ASYNCWEBSERVER_DIGEST_NONCES
+  #define ASYNCWEBSERVER_DIGEST_NONCES 8
+#endif
+// seconds a digest nonce is accepted after it was issued
+#ifndef ASYNCWEBSERVER_DIGEST_NONCE_TTL
+  #define ASYNCWEBSERVER_DIGEST_NONCE_TTL 300
+#endif
+
+// header is compared with base64("username:password") as it is encoded, nothing is allocated
 bool checkBasicAuthentication(const char* header, const char* username, const char* password);
 
-bool checkDigestAuthentication(const char* header, const char* method, const char* username, const char* password, const char* realm, bool passwordIsHash, const char* nonce, const char* opaque, const char* uri);
+/**
+ * @brief Verify a Digest Authorization header
+ * @param nonce the nonce the header must carry, NULL for one issued by AsyncDigestNonces with a nonce count it did not see yet
+ * @param stale set when the response is right but the nonce expired, was not issued or the nonce count was seen already
+ * @param useNonce false when the nonce count of this header was accepted already, for another check of the same request
+ */
+bool checkDigestAuthentication(const char* header, const char* method, const char* username, const char* password, const char* realm, bool passwordIsHash, const char* nonce, const char* opaque, const char* uri, bool* stale = nullptr, bool useNonce = true);
+
+// compares in a time that does not depend on where the strings differ
+bool secureEquals(const char* a, const char* b);
 
 // for storing hashed versions on the device that can be authenticated against
 String generateDigestHash(const char* username, const char* password, const char* realm);
@@ -35,4 +59,68 @@ String generateBasicHash(const char* username, const char* password);
 
 String genRandomMD5();
 
+struct AsyncDigestNonceStats {
+    uint32_t issued;
+    uint32_t accepted;
+    // nonces expired, forged or forgotten
+    uint32_t stale;
+    // nonce counts seen already
+    uint32_t replayed;
+};
+
+/*
+  Nonces of the Digest challenges sent by AsyncWebServerRequest::requestAuthentication(). A nonce carries the time
+  it was issued at, a random salt and an HMAC of both with a key drawn at the first challenge, so it is checked
+  without being stored and challenging does not take the place of anything. A request is only accepted with a nonce
+  issued here less than ASYNCWEBSERVER_DIGEST_NONCE_TTL seconds ago and with a nonce count above the last one
+  accepted with it, so a captured Authorization header cannot be replayed.
+
+  Only nonces a request was accepted with, which takes the password, are kept in the table with their last nonce
+  count. When it is full the one issued first is forgotten, and so are all nonces issued before it: those are stale
+  from then on and the client is challenged again, which browsers answer without asking the user.
+*/
+class AsyncDigestNonces {
+  public:
+    static AsyncDigestNonces& Instance() {
+      static AsyncDigestNonces instance;
+      return instance;
+    }
+
+    AsyncDigestNonces(const AsyncDigestNonces&) = delete;
+    AsyncDigestNonces& operator=(const AsyncDigestNonces&) = delete;
+
+    // 32 hex digits: issue time, salt and the first 8 bytes of their HMAC-SHA256
+    String issue();
+    // accept nc with nonce once
+    bool use(const char* nonce, uint32_t nc);
+
+    const AsyncDigestNonceStats& stats() const { return _stats; }
+
+    // Prometheus text exposition format
+    void printTo(Print& out) const;
+
+  private:
+    struct Entry {
+        uint32_t issued;
+        uint32_t salt;
+        uint32_t nc;
+        bool used;
+    };
+
+    asyncsrv::HmacSha256 _key;
+    Entry _entries[ASYNCWEBSERVER_DIGEST_NONCES]{};
+    // nonces issued at or before it that are not in the table were forgotten
+    uint32_t _forgotten = 0;
+    bool _forgot = false;
+    AsyncDigestNonceStats _stats{};
+#ifdef ESP32
+    mutable std::mutex _lock;
+#endif
+
+    AsyncDigestNonces() = default;
+
+    // hex of the HMAC of issued and salt, 16 digits and a terminator
+    void _sign(uint32_t issued, uint32_t salt, char* out) const;
+};
+
 #endif
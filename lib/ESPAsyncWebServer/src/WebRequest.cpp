@@ -36,6 +36,12 @@ enum { PARSE_REQ_START = 0,
 
 AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* s, AsyncClient* c)
     : _client(c), _server(s), _handler(NULL), _response(NULL), _temp(), _parseState(PARSE_REQ_START), _version(0), _method(HTTP_ANY), _url(), _host(), _contentType(), _boundary(), _authorization(), _reqconntype(RCT_HTTP), _authMethod(AsyncAuthType::AUTH_NONE), _isMultipart(false), _isPlainPost(false), _expectingContinue(false), _contentLength(0), _parsedLength(0), _multiParseState(0), _boundaryPosition(0), _itemStartIndex(0), _itemSize(0), _itemName(), _itemFilename(), _itemType(), _itemValue(), _itemBuffer(0), _itemBufferIndex(0), _itemIsFile(false), _tempObject(NULL) {
+  _startTime = micros();
+  _acceptTime = millis();
+#if defined(ESP32) || defined(ESP8266)
+  if (s->metrics())
+    _systemFreeHeapAtAccept = ESP.getFreeHeap();
+#endif
   c->onError([](void* r, AsyncClient* c, int8_t error) { (void)c; AsyncWebServerRequest *req = (AsyncWebServerRequest*)r; req->_onError(error); }, this);
   c->onAck([](void* r, AsyncClient* c, size_t len, uint32_t time) { (void)c; AsyncWebServerRequest *req = (AsyncWebServerRequest*)r; req->_onAck(len, time); }, this);
   c->onDisconnect([](void* r, AsyncClient* c) { AsyncWebServerRequest *req = (AsyncWebServerRequest*)r; req->_onDisconnect(); delete c; }, this);
@@ -45,6 +51,11 @@ AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* s, AsyncClient* c)
 }
 
 AsyncWebServerRequest::~AsyncWebServerRequest() {
+  // requests that did not complete normally (disconnect, upgrade) are still accounted
+  _recordCompletion();
+  if (_limitKey)
+    _server->_releaseClient(_limitKey);
+
   _headers.clear();
 
   _pathParams.clear();
@@ -96,6 +107,14 @@ void AsyncWebServerRequest::_onData(void* buf, size_t len) {
           break;
         }
       }
+      // also bounds _temp, a line without a new line keeps growing it
+      _headerBytes += i < len ? i + 1 : len;
+      if (_server->_maxHeaderBytes && _headerBytes > _server->_maxHeaderBytes) {
+        _server->_limitStats.headerOverflows++;
+        _parseState = PARSE_REQ_FAIL;
+        _client->abort();
+        return;
+      }
       if (i == len) { // No new line, just add the buffer in _temp
         char ch = str[len - 1];
         str[len - 1] = 0;
@@ -164,6 +183,7 @@ void AsyncWebServerRequest::_onData(void* buf, size_t len) {
             send(500, T_text_plain, "Invalid data in handler");
           _client->setRxTimeout(0);
           _response->_respond(this);
+          _firstByteTime = micros();
           _sent = true;
         }
       }
@@ -172,12 +192,36 @@ void AsyncWebServerRequest::_onData(void* buf, size_t len) {
   }
 }
 
+bool AsyncWebServerRequest::_tooSlow() {
+  const uint32_t now = millis();
+  if (_parseState < PARSE_REQ_BODY) {
+    if (!_server->_headerTimeout || now - _acceptTime < _server->_headerTimeout)
+      return false;
+    _server->_limitStats.headerTimeouts++;
+    return true;
+  }
+  const uint32_t elapsed = now - _bodyStartTime;
+  if (!_server->_minBodyRate || elapsed < ASYNCWEBSERVER_BODY_RATE_GRACE)
+    return false;
+  if ((uint64_t)_parsedLength * 1000 >= (uint64_t)_server->_minBodyRate * elapsed)
+    return false;
+  _server->_limitStats.slowBodies++;
+  return true;
+}
+
 void AsyncWebServerRequest::_onPoll() {
   // os_printf("p\n");
+  // slow clients trickling data are never caught by the rx timeout
+  if (_parseState < PARSE_REQ_END && _client && _tooSlow()) {
+    _parseState = PARSE_REQ_FAIL;
+    _client->abort();
+    return;
+  }
   if (_response != NULL && _client != NULL && _client->canSend()) {
     if (!_response->_finished()) {
       _response->_ack(this, 0, 0);
     } else {
+      _recordCompletion();
       AsyncWebServerResponse* r = _response;
       _response = NULL;
       delete r;
@@ -189,10 +233,12 @@ void AsyncWebServerRequest::_onPoll() {
 
 void AsyncWebServerRequest::_onAck(size_t len, uint32_t time) {
   // os_printf("a:%u:%u\n", len, time);
+  _ackedBytes += len;
   if (_response != NULL) {
     if (!_response->_finished()) {
       _response->_ack(this, len, time);
     } else if (_response->_finished()) {
+      _recordCompletion();
       AsyncWebServerResponse* r = _response;
       _response = NULL;
       delete r;
@@ -224,6 +270,19 @@ void AsyncWebServerRequest::_onDisconnect() {
   _server->_handleDisconnect(this);
 }
 
+void AsyncWebServerRequest::_recordCompletion() {
+  AsyncWebServerMetrics* metrics = _server->metrics();
+  if (!metrics || !_sent || _metricsRecorded)
+    return;
+  _metricsRecorded = true;
+
+  int32_t systemHeapDrop = 0;
+#if defined(ESP32) || defined(ESP8266)
+  systemHeapDrop = (int32_t)_systemFreeHeapAtAccept - (int32_t)ESP.getFreeHeap();
+#endif
+  metrics->record(_handler, _firstByteTime - _startTime, micros() - _startTime, _ackedBytes, systemHeapDrop);
+}
+
 void AsyncWebServerRequest::_addPathParam(const char* p) {
   _pathParams.emplace_back(p);
 }
@@ -612,6 +671,7 @@ void AsyncWebServerRequest::_parseLine() {
       }
       if (_contentLength) {
         _parseState = PARSE_REQ_BODY;
+        _bodyStartTime = millis();
       } else {
         _parseState = PARSE_REQ_END;
         _server->_runChain(this, [this]() { return _handler ? _handler->_runChain(this, [this]() { _handler->handleRequest(this); }) : send(501); });
@@ -622,6 +682,7 @@ void AsyncWebServerRequest::_parseLine() {
             send(500, T_text_plain, "Invalid data in handler");
           _client->setRxTimeout(0);
           _response->_respond(this);
+          _firstByteTime = micros();
           _sent = true;
         }
       }
@@ -795,6 +856,28 @@ void AsyncWebServerRequest::send(AsyncWebServerResponse* response) {
     return;
   if (_response)
     delete _response;
+
+  // answer a conditional GET for an unchanged entity without its body
+  if (response && response->code() == 200 && (_method == HTTP_GET || _method == HTTP_HEAD) && hasHeader(T_INM)) {
+    // the body is only hashed when there is a tag to compare it with
+    response->_addContentETag(this);
+    const AsyncWebHeader* etag = response->getHeader(T_ETag);
+    const String& inm = header(T_INM);
+    const char* matched = etag ? AsyncWebServerResponse::etagMatch(inm.c_str(), etag->value().c_str()) : nullptr;
+    if (matched) {
+      AsyncWebServerResponse* notModified = beginResponse(304);
+      // the tag the client holds, weak when it cached the gzip representation
+      const char* end = matched;
+      while (*end && *end != ',' && *end != ' ' && *end != '\t')
+        end++;
+      notModified->addHeader(T_ETag, *matched == '*' ? etag->value() : String(matched).substring(0, end - matched));
+      if (CompressionPolicy::Instance().enabled())
+        notModified->addHeader(T_Vary, T_Accept_Encoding);
+      delete response;
+      response = notModified;
+    }
+  }
+
   _response = response;
 }
 
@@ -804,21 +887,42 @@ void AsyncWebServerRequest::redirect(const char* url, int code) {
   send(response);
 }
 
-bool AsyncWebServerRequest::authenticate(const char* username, const char* password, const char* realm, bool passwordIsHash) const {
-  if (_authorization.length()) {
-    if (_authMethod == AsyncAuthType::AUTH_DIGEST)
-      return checkDigestAuthentication(_authorization.c_str(), methodToString(), username, password, realm, passwordIsHash, NULL, NULL, NULL);
-    else if (!passwordIsHash)
-      return checkBasicAuthentication(_authorization.c_str(), username, password);
-    else
-      return _authorization.equals(password);
+static uint32_t credentialsKey(const char* username, const char* password, const char* realm, bool passwordIsHash) {
+  uint32_t hash = passwordIsHash ? 2166136261UL : 2166136261UL ^ 1;
+  for (const char* s : {username, password, realm}) {
+    for (; s && *s; s++)
+      hash = (hash ^ (uint8_t)*s) * 16777619UL;
+    // keeps "ab" + "c" apart from "a" + "bc"
+    hash = (hash ^ 0xFF) * 16777619UL;
   }
-  return false;
+  return hash | 1;
+}
+
+bool AsyncWebServerRequest::authenticate(const char* username, const char* password, const char* realm, bool passwordIsHash) const {
+  if (!_authorization.length())
+    return false;
+  const uint32_t key = credentialsKey(username, password, realm, passwordIsHash);
+  if (key == _authVerified)
+    return true;
+
+  bool ok;
+  if (_authMethod == AsyncAuthType::AUTH_DIGEST)
+    ok = checkDigestAuthentication(_authorization.c_str(), methodToString(), username, password, realm, passwordIsHash, NULL, NULL, NULL, &_authStale, !_authVerified);
+  else if (!passwordIsHash)
+    ok = checkBasicAuthentication(_authorization.c_str(), username, password);
+  else
+    ok = secureEquals(_authorization.c_str(), password);
+  if (ok)
+    _authVerified = key;
+  return ok;
 }
 
 bool AsyncWebServerRequest::authenticate(const char* hash) const {
   if (!_authorization.length() || hash == NULL)
     return false;
+  const uint32_t key = credentialsKey(NULL, hash, NULL, true);
+  if (key == _authVerified)
+    return true;
 
   if (_authMethod == AsyncAuthType::AUTH_DIGEST) {
     String hStr = String(hash);
@@ -832,11 +936,14 @@ bool AsyncWebServerRequest::authenticate(const char* hash) const {
       return false;
     String realm = hStr.substring(0, separator);
     hStr = hStr.substring(separator + 1);
-    return checkDigestAuthentication(_authorization.c_str(), methodToString(), username.c_str(), hStr.c_str(), realm.c_str(), true, NULL, NULL, NULL);
+    if (!checkDigestAuthentication(_authorization.c_str(), methodToString(), username.c_str(), hStr.c_str(), realm.c_str(), true, NULL, NULL, NULL, &_authStale, !_authVerified))
+      return false;
+  } else if (!secureEquals(_authorization.c_str(), hash)) {
+    // Basic Auth, Bearer Auth, or other
+    return false;
   }
-
-  // Basic Auth, Bearer Auth, or other
-  return (_authorization.equals(hash));
+  _authVerified = key;
+  return true;
 }
 
 void AsyncWebServerRequest::requestAuthentication(AsyncAuthType method, const char* realm, const char* _authFailMsg) {
@@ -856,17 +963,19 @@ void AsyncWebServerRequest::requestAuthentication(AsyncAuthType method, const ch
       break;
     }
     case AsyncAuthType::AUTH_DIGEST: {
-      size_t len = strlen(T_DIGEST_) + strlen(T_realm__) + strlen(T_auth_nonce) + 32 + strlen(T__opaque) + 32 + 1;
+      size_t len = strlen(T_DIGEST_) + strlen(T_realm__) + strlen(T_auth_nonce) + 32 + strlen(T__opaque) + 32 + 1 + strlen(T__stale);
       String header;
       header.reserve(len + strlen(realm));
       header.concat(T_DIGEST_);
       header.concat(T_realm__);
       header.concat(realm);
       header.concat(T_auth_nonce);
-      header.concat(genRandomMD5());
+      header.concat(AsyncDigestNonces::Instance().issue());
       header.concat(T__opaque);
       header.concat(genRandomMD5());
       header.concat((char)0x22); // '"'
+      if (_authStale)
+        header.concat(T__stale);
       r->addHeader(T_WWW_AUTH, header.c_str());
       break;
     }
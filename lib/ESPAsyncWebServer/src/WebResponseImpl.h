@@ -26,6 +26,8 @@
   #undef min
   #undef max
 #endif
+#include "AsyncBudget.h"
+#include "GzipEncoder.h"
 #include "literals.h"
 #include <StreamString.h>
 #include <memory>
@@ -45,6 +47,27 @@ class AsyncBasicResponse : public AsyncWebServerResponse {
     bool _sourceValid() const override final { return true; }
 };
 
+// The 429 of AsyncRateLimitMiddleware. The head is written from a fixed buffer and the default headers straight from
+// their serialised copy, and the objects come from a pool of ASYNCWEBSERVER_RATE_LIMIT_RESPONSES, so refusing a flood
+// does not touch the heap. The retry-after header is not in getAllHeaders().
+class AsyncRateLimitResponse : public AsyncWebServerResponse {
+  private:
+    uint32_t _retryAfterSeconds;
+    char _head[128];
+    size_t _headPartLength{0};
+    void _write(AsyncWebServerRequest* request);
+
+  public:
+    explicit AsyncRateLimitResponse(uint32_t retryAfterSeconds);
+    void _respond(AsyncWebServerRequest* request) override final;
+    size_t _ack(AsyncWebServerRequest* request, size_t len, uint32_t time) override final;
+    bool _sourceValid() const override final { return true; }
+
+    // a pool slot, or the heap once all of them are in flight
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr);
+};
+
 class AsyncAbstractResponse : public AsyncWebServerResponse {
   private:
     // amount of responce data in-flight, i.e. sent, but not acked yet
@@ -57,8 +80,14 @@ class AsyncAbstractResponse : public AsyncWebServerResponse {
     // we won't be able to access it as contiguous array of bytes when reading from it,
     // so by gaining performance in one place, we'll lose it in another.
     std::vector<uint8_t> _cache;
+    // set when the body is compressed on the fly, with gzip or deflate
+    std::unique_ptr<GzipEncoder> _encoder;
+    // chunks written and not acked yet, the length of a chunked response is not known up front
+    AsyncWebServerBudget::Flow _budget;
     size_t _readDataFromCacheOrContent(uint8_t* data, const size_t len);
     size_t _fillBufferAndProcessTemplates(uint8_t* buf, size_t maxLen);
+    size_t _fillBufferAndCompress(uint8_t* buf, size_t maxLen);
+    void _beginCompression(AsyncWebServerRequest* request);
 
   protected:
     AwsTemplateProcessor _callback;
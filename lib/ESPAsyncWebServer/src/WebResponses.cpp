@@ -126,10 +126,51 @@ const char* AsyncWebServerResponse::responseCodeToString(int code) {
   }
 }
 
+String AsyncWebServerResponse::versionETag(uint32_t version) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "W/\"%lu\"", (unsigned long)version);
+  return String(buf);
+}
+
+const char* AsyncWebServerResponse::etagMatch(const char* inm, const char* etag) {
+  if (!strncmp(etag, "W/", 2))
+    etag += 2;
+  const size_t len = strlen(etag);
+  for (const char* p = inm; *p;) {
+    while (*p == ' ' || *p == '\t' || *p == ',')
+      p++;
+    const char* entry = p;
+    if (*p == '*')
+      return entry;
+    if (!strncmp(p, "W/", 2))
+      p += 2;
+    if (*p && !strncmp(p, etag, len) && (!p[len] || p[len] == ',' || p[len] == ' ' || p[len] == '\t'))
+      return entry;
+    while (*p && *p != ',')
+      p++;
+  }
+  return nullptr;
+}
+
+void AsyncWebServerResponse::_addContentETag(AsyncWebServerRequest* request) {
+  if (_code != 200 || !(request->method() == HTTP_GET || request->method() == HTTP_HEAD) || getHeader(T_ETag))
+    return;
+  String etag = _contentETag();
+  if (etag.length())
+    addHeader(T_ETag, etag, false);
+}
+
 AsyncWebServerResponse::AsyncWebServerResponse()
-    : _code(0), _contentType(), _contentLength(0), _sendContentLength(true), _chunked(false), _headLength(0), _sentLength(0), _ackedLength(0), _writtenLength(0), _state(RESPONSE_SETUP) {
+    : _code(0), _contentType(), _contentLength(0), _sendContentLength(true), _chunked(false), _headLength(0), _sentLength(0), _ackedLength(0), _writtenLength(0), _state(RESPONSE_SETUP), _defaultHeaders(!DefaultHeaders::Instance().empty()), _headVersion(1) {}
+
+void AsyncWebServerResponse::_copyDefaultHeaders() {
+  if (!_defaultHeaders)
+    return;
+  _defaultHeaders = false;
+  // keep the default headers ahead of the ones the response already set
+  auto pos = _headers.begin();
   for (const auto& header : DefaultHeaders::Instance()) {
-    _headers.emplace_back(header);
+    _headers.insert(pos, header);
   }
 }
 
@@ -149,6 +190,8 @@ void AsyncWebServerResponse::setContentType(const char* type) {
 }
 
 bool AsyncWebServerResponse::removeHeader(const char* name) {
+  if (_defaultHeaders && DefaultHeaders::Instance().getHeader(name))
+    _copyDefaultHeaders();
   for (auto i = _headers.begin(); i != _headers.end(); ++i) {
     if (i->name().equalsIgnoreCase(name)) {
       _headers.erase(i);
@@ -160,10 +203,14 @@ bool AsyncWebServerResponse::removeHeader(const char* name) {
 
 const AsyncWebHeader* AsyncWebServerResponse::getHeader(const char* name) const {
   auto iter = std::find_if(std::begin(_headers), std::end(_headers), [&name](const AsyncWebHeader& header) { return header.name().equalsIgnoreCase(name); });
-  return (iter == std::end(_headers)) ? nullptr : &(*iter);
+  if (iter != std::end(_headers))
+    return &(*iter);
+  return _defaultHeaders ? DefaultHeaders::Instance().getHeader(name) : nullptr;
 }
 
 bool AsyncWebServerResponse::addHeader(const char* name, const char* value, bool replaceExisting) {
+  if (_defaultHeaders && DefaultHeaders::Instance().getHeader(name))
+    _copyDefaultHeaders();
   for (auto i = _headers.begin(); i != _headers.end(); ++i) {
     if (i->name().equalsIgnoreCase(name)) {
       // header already set
@@ -182,42 +229,118 @@ bool AsyncWebServerResponse::addHeader(const char* name, const char* value, bool
   return true;
 }
 
-void AsyncWebServerResponse::_assembleHead(String& buffer, uint8_t version) {
-  if (version) {
-    addHeader(T_Accept_Ranges, T_none, false);
-    if (_chunked)
-      addHeader(T_Transfer_Encoding, T_chunked, false);
+namespace {
+  // pre-serialised status lines for the codes most responses use, in flash on ESP8266,
+  // the HTTP minor version digit at STATUS_LINE_VERSION is patched in while copying
+  constexpr int statusCodes[] = {200, 204, 301, 302, 304, 400, 401, 403, 404, 429, 500, 503};
+
+  const char statusLines[][40] PROGMEM = {
+    "HTTP/1.1 200 OK\r\n",
+    "HTTP/1.1 204 No Content\r\n",
+    "HTTP/1.1 301 Moved Permanently\r\n",
+    "HTTP/1.1 302 Found\r\n",
+    "HTTP/1.1 304 Not Modified\r\n",
+    "HTTP/1.1 400 Bad Request\r\n",
+    "HTTP/1.1 401 Unauthorized\r\n",
+    "HTTP/1.1 403 Forbidden\r\n",
+    "HTTP/1.1 404 Not Found\r\n",
+    "HTTP/1.1 429 Too Many Requests\r\n",
+    "HTTP/1.1 500 Internal Server Error\r\n",
+    "HTTP/1.1 503 Service Unavailable\r\n",
+  };
+
+  static_assert(sizeof(statusCodes) / sizeof(statusCodes[0]) == sizeof(statusLines) / sizeof(statusLines[0]), "a status line for each code");
+
+  constexpr size_t STATUS_LINE_VERSION = 7;
+
+  void concatHeader(String& buffer, const char* name, const char* value) {
+    buffer.concat(name);
+    buffer.concat(": ");
+    buffer.concat(value);
+    buffer.concat(T_rn);
   }
+} // namespace
+
+void AsyncWebServerResponse::_implicitHeaders(uint8_t version, bool& acceptRanges, bool& transferEncoding, bool& contentType, char* contentLength, size_t size) const {
+  acceptRanges = version && !getHeader(T_Accept_Ranges);
+  transferEncoding = version && _chunked && !getHeader(T_Transfer_Encoding);
+  contentType = _contentType.length() && !getHeader(T_Content_Type);
+  contentLength[0] = '\0';
+  if (_sendContentLength && !getHeader(T_Content_Length))
+    snprintf(contentLength, size, "%u", (unsigned)_contentLength);
+}
 
-  if (_sendContentLength)
-    addHeader(T_Content_Length, String(_contentLength), false);
+std::list<AsyncWebHeader> AsyncWebServerResponse::getAllHeaders() const {
+  std::list<AsyncWebHeader> headers;
+  if (_defaultHeaders)
+    headers.assign(DefaultHeaders::Instance().begin(), DefaultHeaders::Instance().end());
+  headers.insert(headers.end(), _headers.begin(), _headers.end());
+
+  // the implicit headers are only settled when the head is assembled
+  if (_state > RESPONSE_SETUP) {
+    bool acceptRanges, transferEncoding, contentType;
+    char contentLength[24];
+    _implicitHeaders(_headVersion, acceptRanges, transferEncoding, contentType, contentLength, sizeof(contentLength));
+    if (acceptRanges)
+      headers.emplace_back(T_Accept_Ranges, T_none);
+    if (transferEncoding)
+      headers.emplace_back(T_Transfer_Encoding, T_chunked);
+    if (contentLength[0])
+      headers.emplace_back(T_Content_Length, contentLength);
+    if (contentType)
+      headers.emplace_back(T_Content_Type, _contentType.c_str());
+  }
+  return headers;
+}
 
-  if (_contentType.length())
-    addHeader(T_Content_Type, _contentType.c_str(), false);
+void AsyncWebServerResponse::_assembleHead(String& buffer, uint8_t version) {
+  // headers the response did not set itself are written straight into the buffer
+  // rather than being added to _headers first
+  bool acceptRanges, transferEncoding, contentType;
+  char contentLength[24];
+  _implicitHeaders(version, acceptRanges, transferEncoding, contentType, contentLength, sizeof(contentLength));
+  _headVersion = version;
+
+  const char* status = nullptr;
+  for (size_t i = 0; i < sizeof(statusCodes) / sizeof(statusCodes[0]); i++) {
+    if (statusCodes[i] == _code) {
+      status = statusLines[i];
+      break;
+    }
+  }
 
   // precompute buffer size to avoid reallocations by String class
   size_t len = 0;
   len += 50; // HTTP/1.1 200 <reason>\r\n
+  if (_defaultHeaders)
+    len += DefaultHeaders::Instance().serialized().length();
   for (const auto& header : _headers)
     len += header.name().length() + header.value().length() + 4;
+  if (acceptRanges)
+    len += strlen(T_Accept_Ranges) + strlen(T_none) + 4;
+  if (transferEncoding)
+    len += strlen(T_Transfer_Encoding) + strlen(T_chunked) + 4;
+  if (contentLength[0])
+    len += strlen(T_Content_Length) + strlen(contentLength) + 4;
+  if (contentType)
+    len += strlen(T_Content_Type) + _contentType.length() + 4;
 
   // prepare buffer
   buffer.reserve(len);
 
   // HTTP header
-#ifdef ESP8266
-  buffer.concat(PSTR("HTTP/1."));
-#else
-  buffer.concat("HTTP/1.");
-#endif
-  buffer.concat(version);
-  buffer.concat(' ');
-  buffer.concat(_code);
-  buffer.concat(' ');
-  buffer.concat(responseCodeToString(_code));
-  buffer.concat(T_rn);
+  char line[64];
+  if (status) {
+    memcpy_P(line, status, sizeof(statusLines[0]));
+    line[STATUS_LINE_VERSION] = '0' + version;
+  } else {
+    snprintf_P(line, sizeof(line), PSTR("HTTP/1.%u %d %s\r\n"), version, _code, responseCodeToString(_code));
+  }
+  buffer.concat(line);
 
   // Add headers
+  if (_defaultHeaders)
+    buffer.concat(DefaultHeaders::Instance().serialized());
   for (const auto& header : _headers) {
     buffer.concat(header.name());
 #ifdef ESP8266
@@ -228,6 +351,14 @@ void AsyncWebServerResponse::_assembleHead(String& buffer, uint8_t version) {
     buffer.concat(header.value());
     buffer.concat(T_rn);
   }
+  if (acceptRanges)
+    concatHeader(buffer, T_Accept_Ranges, T_none);
+  if (transferEncoding)
+    concatHeader(buffer, T_Transfer_Encoding, T_chunked);
+  if (contentLength[0])
+    concatHeader(buffer, T_Content_Length, contentLength);
+  if (contentType)
+    concatHeader(buffer, T_Content_Type, _contentType.c_str());
 
   buffer.concat(T_rn);
   _headLength = buffer.length();
@@ -325,6 +456,102 @@ size_t AsyncBasicResponse::_ack(AsyncWebServerRequest* request, size_t len, uint
   return 0;
 }
 
+/*
+ * Rate limit Response
+ * */
+
+namespace {
+  struct RateLimitSlot {
+      alignas(AsyncRateLimitResponse) unsigned char storage[sizeof(AsyncRateLimitResponse)];
+      bool used;
+  };
+
+  RateLimitSlot rateLimitSlots[ASYNCWEBSERVER_RATE_LIMIT_RESPONSES];
+} // namespace
+
+void* AsyncRateLimitResponse::operator new(size_t size) {
+  for (auto& slot : rateLimitSlots) {
+    if (!slot.used) {
+      slot.used = true;
+      return slot.storage;
+    }
+  }
+  return ::operator new(size);
+}
+
+void AsyncRateLimitResponse::operator delete(void* ptr) {
+  for (auto& slot : rateLimitSlots) {
+    if (ptr == slot.storage) {
+      slot.used = false;
+      return;
+    }
+  }
+  ::operator delete(ptr);
+}
+
+AsyncRateLimitResponse::AsyncRateLimitResponse(uint32_t retryAfterSeconds) : _retryAfterSeconds(retryAfterSeconds) {
+  _code = 429;
+}
+
+void AsyncRateLimitResponse::_respond(AsyncWebServerRequest* request) {
+  _headVersion = request->version();
+  _headPartLength = snprintf_P(_head, sizeof(_head), PSTR("HTTP/1.%u 429 Too Many Requests\r\n%s: %lu\r\n%s: 0\r\n%s: %s\r\n"), _headVersion, T_retry_after,
+                               (unsigned long)_retryAfterSeconds, T_Content_Length, T_Connection, T_close);
+  _headLength = _headPartLength + 2;
+  if (_defaultHeaders)
+    _headLength += DefaultHeaders::Instance().serialized().length();
+  // those an outer middleware added, CORS for one
+  for (const auto& header : _headers)
+    _headLength += header.name().length() + header.value().length() + 4;
+  _state = RESPONSE_CONTENT;
+  _write(request);
+}
+
+void AsyncRateLimitResponse::_write(AsyncWebServerRequest* request) {
+  // the head is written piece by piece from where it is, skipping what went out before, and sent in one go
+  size_t skip = _writtenLength;
+  bool full = false;
+  auto add = [&](const char* data, size_t len) {
+    if (full)
+      return;
+    if (skip >= len) {
+      skip -= len;
+      return;
+    }
+    const size_t added = request->client()->add(data + skip, len - skip);
+    _writtenLength += added;
+    full = added < len - skip;
+    skip = 0;
+  };
+
+  add(_head, _headPartLength);
+  if (_defaultHeaders)
+    add(DefaultHeaders::Instance().serialized().c_str(), DefaultHeaders::Instance().serialized().length());
+  for (const auto& header : _headers) {
+    add(header.name().c_str(), header.name().length());
+    add(": ", 2);
+    add(header.value().c_str(), header.value().length());
+    add(T_rn, 2);
+  }
+  add(T_rn, 2);
+  request->client()->send();
+  if (!full)
+    _state = RESPONSE_WAIT_ACK;
+}
+
+size_t AsyncRateLimitResponse::_ack(AsyncWebServerRequest* request, size_t len, uint32_t time) {
+  (void)time;
+  _ackedLength += len;
+  if (_state == RESPONSE_CONTENT) {
+    const size_t before = _writtenLength;
+    _write(request);
+    return _writtenLength - before;
+  }
+  if (_state == RESPONSE_WAIT_ACK && _ackedLength >= _writtenLength)
+    _state = RESPONSE_END;
+  return 0;
+}
+
 /*
  * Abstract Response
  * */
@@ -340,6 +567,9 @@ AsyncAbstractResponse::AsyncAbstractResponse(AwsTemplateProcessor callback) : _c
 
 void AsyncAbstractResponse::_respond(AsyncWebServerRequest* request) {
   addHeader(T_Connection, T_close, false);
+  // before the compression, which weakens the tag
+  _addContentETag(request);
+  _beginCompression(request);
   _assembleHead(_head, request->version());
   _state = RESPONSE_HEADERS;
   _ack(request, 0, 0);
@@ -352,6 +582,8 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest* request, size_t len, u
     request->client()->close();
     return 0;
   }
+  if (_chunked)
+    _budget.release(len);
   // return a credit for each chunk of acked data (polls does not give any credits)
   if (len)
     ++_in_flight_credit;
@@ -403,16 +635,21 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest* request, size_t len, u
         return 0;
       }
 
-      outLen = space;
+      // at least the chunk framing and one byte, otherwise wait for the next ack or poll
+      outLen = _budget.grant(space, 9);
+      if (!outLen)
+        return 0;
     } else if (!_sendContentLength) {
       outLen = space;
     } else {
       outLen = ((_contentLength - _sentLength) > space) ? space : (_contentLength - _sentLength);
     }
 
+    const size_t granted = _chunked ? outLen : 0;
     uint8_t* buf = (uint8_t*)malloc(outLen + headLen);
     if (!buf) {
       // os_printf("_ack malloc %d failed\n", outLen+headLen);
+      _budget.release(granted);
       return 0;
     }
 
@@ -425,9 +662,10 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest* request, size_t len, u
     if (_chunked) {
       // HTTP 1.1 allows leading zeros in chunk length. Or spaces may be added.
       // See RFC2616 sections 2, 3.6.1.
-      readLen = _fillBufferAndProcessTemplates(buf + headLen + 6, outLen - 8);
+      readLen = _fillBufferAndCompress(buf + headLen + 6, outLen - 8);
       if (readLen == RESPONSE_TRY_AGAIN) {
         free(buf);
+        _budget.release(granted);
         return 0;
       }
       outLen = sprintf((char*)buf + headLen, "%04x", readLen) + headLen;
@@ -437,7 +675,7 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest* request, size_t len, u
       buf[outLen++] = '\r';
       buf[outLen++] = '\n';
     } else {
-      readLen = _fillBufferAndProcessTemplates(buf + headLen, outLen);
+      readLen = _fillBufferAndCompress(buf + headLen, outLen);
       if (readLen == RESPONSE_TRY_AGAIN) {
         free(buf);
         return 0;
@@ -457,13 +695,15 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest* request, size_t len, u
 
     if (_chunked) {
       _sentLength += readLen;
+      // keep the charge for what went out, head included
+      _budget.release(granted > outLen ? granted - outLen : 0);
     } else {
       _sentLength += outLen - headLen;
     }
 
     free(buf);
 
-    if ((_chunked && readLen == 0) || (!_sendContentLength && outLen == 0) || (!_chunked && _sentLength == _contentLength)) {
+    if ((_chunked && readLen == 0) || (!_sendContentLength && outLen == 0) || (!_chunked && _sendContentLength && _sentLength == _contentLength)) {
       _state = RESPONSE_WAIT_ACK;
     }
     return outLen;
@@ -478,6 +718,63 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest* request, size_t len, u
   return 0;
 }
 
+void AsyncAbstractResponse::_beginCompression(AsyncWebServerRequest* request) {
+  const CompressionPolicy& policy = CompressionPolicy::Instance();
+  if (!policy.enabled() || _code != 200 || getHeader(T_Content_Encoding))
+    return;
+  if (!policy.allows(_contentType, _sendContentLength ? _contentLength : 0))
+    return;
+  const AsyncWebHeader* accept = request->getHeader(T_Accept_Encoding);
+  const char* encoding = accept ? CompressionPolicy::encoding(accept->value().c_str()) : nullptr;
+  if (!encoding)
+    return;
+
+  GzipEncoder* encoder = new GzipEncoder();
+  if (encoder == NULL)
+    return;
+  if (!encoder->begin(encoding == T_gzip ? GzipEncoder::Format::Gzip : GzipEncoder::Format::Zlib)) {
+    // not enough memory for the encoder state, send the body as is
+    delete encoder;
+    return;
+  }
+  _encoder.reset(encoder);
+
+  // the compressed length is only known at the end: HTTP/1.1 gets chunks, HTTP/1.0 a close-delimited body.
+  // _contentLength stays the length of the source, the responses read their content up to it
+  removeHeader(T_Content_Length);
+  _sendContentLength = false;
+  _chunked = request->version() != 0;
+  addHeader(T_Content_Encoding, encoding);
+  addHeader(T_Vary, T_Accept_Encoding);
+
+  // the compressed body is another representation, it must not share a strong validator with the identity one
+  const AsyncWebHeader* etag = getHeader(T_ETag);
+  if (etag && !etag->value().startsWith("W/"))
+    addHeader(T_ETag, String("W/") + etag->value());
+}
+
+size_t AsyncAbstractResponse::_fillBufferAndCompress(uint8_t* data, size_t len) {
+  if (!_encoder)
+    return _fillBufferAndProcessTemplates(data, len);
+
+  size_t written = 0;
+  while (written < len) {
+    written += _encoder->read(data + written, len - written);
+    // a full buffer must not ask the content for 0 bytes, that would read as its end
+    if (written == len || _encoder->pending() || _encoder->finished())
+      break;
+    // encoder is drained: read more content into the free end of the buffer and compress it
+    const size_t readLen = _fillBufferAndProcessTemplates(data + written, std::min<size_t>(len - written, GZIP_CHUNK_SIZE));
+    if (readLen == RESPONSE_TRY_AGAIN)
+      return written ? written : RESPONSE_TRY_AGAIN;
+    if (readLen)
+      _encoder->write(data + written, readLen);
+    else
+      _encoder->finish();
+  }
+  return written;
+}
+
 size_t AsyncAbstractResponse::_readDataFromCacheOrContent(uint8_t* data, const size_t len) {
   // If we have something in cache, copy it to buffer
   const size_t readFromCache = std::min(len, _cache.size());
@@ -581,6 +878,143 @@ size_t AsyncAbstractResponse::_fillBufferAndProcessTemplates(uint8_t* data, size
   return len;
 }
 
+/*
+ * Content Types
+ * */
+
+namespace {
+  struct ContentTypeEntry {
+      const char* extension;
+      const char* contentType;
+  };
+
+  // must stay sorted by extension (strcmp order) so fromPath() can bisect it
+  constexpr ContentTypeEntry builtinContentTypes[] = {
+    {T__css, T_text_css},
+    {T__eot, T_font_eot},
+    {T__gif, T_image_gif},
+    {T__gz, T_application_x_gzip},
+    {T__htm, T_text_html},
+    {T__html, T_text_html},
+    {T__ico, T_image_x_icon},
+    {T__jpg, T_image_jpeg},
+    {T__js, T_application_javascript},
+    {T__json, T_application_json},
+    {T__pdf, T_application_pdf},
+    {T__png, T_image_png},
+    {T__svg, T_image_svg_xml},
+    {T__ttf, T_font_ttf},
+    {T__woff, T_font_woff},
+    {T__woff2, T_font_woff2},
+    {T__xml, T_text_xml},
+    {T__zip, T_application_zip},
+  };
+
+  // strcmp() and a sortedness check the compiler can evaluate, recursive to stay within C++11 constexpr
+  constexpr int compareExtensions(const char* a, const char* b) {
+    return *a != *b || !*a ? (uint8_t)*a - (uint8_t)*b : compareExtensions(a + 1, b + 1);
+  }
+
+  constexpr bool sortedByExtension(const ContentTypeEntry* entries, size_t count) {
+    return count < 2 || (compareExtensions(entries[0].extension, entries[1].extension) < 0 && sortedByExtension(entries + 1, count - 1));
+  }
+
+  static_assert(sortedByExtension(builtinContentTypes, sizeof(builtinContentTypes) / sizeof(builtinContentTypes[0])),
+                "builtinContentTypes must stay sorted by extension, without duplicates");
+} // namespace
+
+void ContentTypes::add(const String& extension, const String& contentType) {
+  for (auto& e : _custom) {
+    if (e.extension == extension) {
+      e.contentType = contentType;
+      return;
+    }
+  }
+  _custom.push_back({extension, contentType});
+}
+
+const char* ContentTypes::fromPath(const String& path) const {
+  const char* p = path.c_str();
+  const char* ext = strrchr(p, '.');
+  // a dot inside a directory name is not an extension
+  if (ext == nullptr || strchr(ext, '/') != nullptr)
+    return T_text_plain;
+
+  for (const auto& e : _custom) {
+    if (e.extension.equals(ext))
+      return e.contentType.c_str();
+  }
+
+  const ContentTypeEntry* first = std::begin(builtinContentTypes);
+  const ContentTypeEntry* last = std::end(builtinContentTypes);
+  const ContentTypeEntry* it = std::lower_bound(first, last, ext, [](const ContentTypeEntry& e, const char* key) {
+    return strcmp(e.extension, key) < 0;
+  });
+  if (it != last && strcmp(it->extension, ext) == 0)
+    return it->contentType;
+  return T_text_plain;
+}
+
+/*
+ * Compression Policy
+ * */
+
+CompressionPolicy::CompressionPolicy()
+    : _contentTypes{"text/", T_application_json, T_application_javascript, T_image_svg_xml} {}
+
+bool CompressionPolicy::allows(const String& contentType, size_t length) const {
+  if (length && length < _threshold)
+    return false;
+  for (const auto& t : _contentTypes) {
+    if (!contentType.startsWith(t))
+      continue;
+    // a family prefix, the exact type, or the exact type followed by parameters such as a charset
+    if (t.endsWith("/") || contentType.length() == t.length() || contentType[t.length()] == ';')
+      return true;
+  }
+  return false;
+}
+
+const char* CompressionPolicy::encoding(const char* acceptEncoding) {
+  // q-values in thousandths, -1 while not listed
+  int gzip = -1;
+  int deflate = -1;
+  int any = -1;
+  for (const char* p = acceptEncoding; p && *p;) {
+    while (*p == ' ' || *p == '\t' || *p == ',')
+      p++;
+    const char* name = p;
+    while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+      p++;
+    const size_t nameLen = p - name;
+
+    int q = 1000;
+    while (*p && *p != ',') {
+      if (*p++ != ';')
+        continue;
+      while (*p == ' ' || *p == '\t')
+        p++;
+      if ((*p == 'q' || *p == 'Q') && p[1] == '=')
+        q = (int)(atof(p + 2) * 1000);
+    }
+
+    // x-gzip is an alias of gzip (RFC 9110)
+    if ((nameLen == 4 && !strncasecmp(name, T_gzip, 4)) || (nameLen == 6 && !strncasecmp(name, "x-gzip", 6)))
+      gzip = std::max(gzip, q);
+    else if (nameLen == 7 && !strncasecmp(name, T_deflate, 7))
+      deflate = q;
+    else if (nameLen == 1 && *name == '*')
+      any = q;
+  }
+  if (gzip < 0)
+    gzip = any;
+  if (deflate < 0)
+    deflate = any;
+  if (gzip > 0 && gzip >= deflate)
+    return T_gzip;
+  return deflate > 0 ? T_deflate : nullptr;
+}
+
 /*
  * File Response
  * */
@@ -594,44 +1028,7 @@ void AsyncFileResponse::_setContentTypeFromPath(const String& path) {
   #endif
   _contentType = getContentType(path);
 #else
-  if (path.endsWith(T__html))
-    _contentType = T_text_html;
-  else if (path.endsWith(T__htm))
-    _contentType = T_text_html;
-  else if (path.endsWith(T__css))
-    _contentType = T_text_css;
-  else if (path.endsWith(T__json))
-    _contentType = T_application_json;
-  else if (path.endsWith(T__js))
-    _contentType = T_application_javascript;
-  else if (path.endsWith(T__png))
-    _contentType = T_image_png;
-  else if (path.endsWith(T__gif))
-    _contentType = T_image_gif;
-  else if (path.endsWith(T__jpg))
-    _contentType = T_image_jpeg;
-  else if (path.endsWith(T__ico))
-    _contentType = T_image_x_icon;
-  else if (path.endsWith(T__svg))
-    _contentType = T_image_svg_xml;
-  else if (path.endsWith(T__eot))
-    _contentType = T_font_eot;
-  else if (path.endsWith(T__woff))
-    _contentType = T_font_woff;
-  else if (path.endsWith(T__woff2))
-    _contentType = T_font_woff2;
-  else if (path.endsWith(T__ttf))
-    _contentType = T_font_ttf;
-  else if (path.endsWith(T__xml))
-    _contentType = T_text_xml;
-  else if (path.endsWith(T__pdf))
-    _contentType = T_application_pdf;
-  else if (path.endsWith(T__zip))
-    _contentType = T_application_zip;
-  else if (path.endsWith(T__gz))
-    _contentType = T_application_x_gzip;
-  else
-    _contentType = T_text_plain;
+  _contentType = ContentTypes::Instance().fromPath(path);
 #endif
 }
 
@@ -19,6 +19,7 @@
   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 #include "ESPAsyncWebServer.h"
+#include "AsyncIPHash.h"
 #include "WebHandlerImpl.h"
 
 using namespace asyncsrv;
@@ -53,12 +54,23 @@ AsyncWebServer::AsyncWebServer(uint16_t port)
   _server.onClient([](void* s, AsyncClient* c) {
     if (c == NULL)
       return;
+    AsyncWebServer* server = (AsyncWebServer*)s;
+    const uint32_t ip = server->_maxRequestsPerIP ? (uint32_t)c->remoteIP() : 0;
+    if (ip && !server->_admitClient(ip)) {
+      c->abort();
+      delete c;
+      return;
+    }
     c->setRxTimeout(3);
-    AsyncWebServerRequest* r = new AsyncWebServerRequest((AsyncWebServer*)s, c);
+    AsyncWebServerRequest* r = new AsyncWebServerRequest(server, c);
     if (r == NULL) {
+      if (ip)
+        server->_releaseClient(ip);
       c->abort();
       delete c;
+      return;
     }
+    r->_limitKey = ip;
   },
                    this);
 }
@@ -137,6 +149,66 @@ void AsyncWebServer::_handleDisconnect(AsyncWebServerRequest* request) {
   delete request;
 }
 
+static size_t clientSlot(uint32_t ip) {
+  return asyncsrv::ipSlot<ASYNCWEBSERVER_LIMIT_KEYS>(ip);
+}
+
+bool AsyncWebServer::_admitClient(uint32_t ip) {
+  const size_t home = clientSlot(ip);
+  for (size_t p = 0; p < ASYNCWEBSERVER_LIMIT_KEYS; p++) {
+    ClientCount& entry = _clientCounts[(home + p) % ASYNCWEBSERVER_LIMIT_KEYS];
+    if (entry.ip == ip) {
+      if (entry.requests >= _maxRequestsPerIP) {
+        _limitStats.refused++;
+        return false;
+      }
+      entry.requests++;
+      return true;
+    }
+    // entries are never left empty inside a probe sequence, so the IP is not in the table
+    if (!entry.ip) {
+      entry = {ip, 1};
+      return true;
+    }
+  }
+  _limitStats.refused++;
+  return false;
+}
+
+void AsyncWebServer::_releaseClient(uint32_t ip) {
+  size_t i = clientSlot(ip);
+  for (size_t p = 0;; p++) {
+    if (p == ASYNCWEBSERVER_LIMIT_KEYS || !_clientCounts[i].ip)
+      return;
+    if (_clientCounts[i].ip == ip)
+      break;
+    i = (i + 1) % ASYNCWEBSERVER_LIMIT_KEYS;
+  }
+  if (--_clientCounts[i].requests)
+    return;
+
+  // backward shift deletion: move up the entries behind the hole that may sit in it
+  size_t hole = i;
+  for (size_t j = (hole + 1) % ASYNCWEBSERVER_LIMIT_KEYS; _clientCounts[j].ip && j != hole; j = (j + 1) % ASYNCWEBSERVER_LIMIT_KEYS) {
+    const size_t want = clientSlot(_clientCounts[j].ip);
+    // the entry may move when the hole lies cyclically between its home slot and its slot
+    if ((j - want + ASYNCWEBSERVER_LIMIT_KEYS) % ASYNCWEBSERVER_LIMIT_KEYS >= (j - hole + ASYNCWEBSERVER_LIMIT_KEYS) % ASYNCWEBSERVER_LIMIT_KEYS) {
+      _clientCounts[hole] = _clientCounts[j];
+      hole = j;
+    }
+  }
+  _clientCounts[hole] = {0, 0};
+}
+
+void AsyncWebServer::printMetrics(Print& out) const {
+  out.print(F("# TYPE asyncwebserver_refused_connections_total counter\n"));
+  out.printf("asyncwebserver_refused_connections_total %lu\n", (unsigned long)_limitStats.refused);
+  out.print(F("# TYPE asyncwebserver_aborted_requests_total counter\n"));
+  out.printf("asyncwebserver_aborted_requests_total{reason=\"header_timeout\"} %lu\n", (unsigned long)_limitStats.headerTimeouts);
+  out.printf("asyncwebserver_aborted_requests_total{reason=\"header_size\"} %lu\n", (unsigned long)_limitStats.headerOverflows);
+  out.printf("asyncwebserver_aborted_requests_total{reason=\"slow_body\"} %lu\n", (unsigned long)_limitStats.slowBodies);
+}
+
 void AsyncWebServer::_rewriteRequest(AsyncWebServerRequest* request) {
   for (const auto& r : _rewrites) {
     if (r->match(request)) {
@@ -5,9 +5,11 @@ namespace asyncsrv {
   static constexpr const char* empty = "";
 
   static constexpr const char* T__opaque = "\", opaque=\"";
+  static constexpr const char* T__stale = ", stale=TRUE";
   static constexpr const char* T_100_CONTINUE = "100-continue";
   static constexpr const char* T_13 = "13";
   static constexpr const char* T_ACCEPT = "accept";
+  static constexpr const char* T_Accept_Encoding = "accept-encoding";
   static constexpr const char* T_Accept_Ranges = "accept-ranges";
   static constexpr const char* T_app_xform_urlencoded = "application/x-www-form-urlencoded";
   static constexpr const char* T_AUTH = "authorization";
@@ -41,6 +43,7 @@ namespace asyncsrv {
   static constexpr const char* T_FALSE = "false";
   static constexpr const char* T_filename = "filename";
   static constexpr const char* T_gzip = "gzip";
+  static constexpr const char* T_deflate = "deflate";
   static constexpr const char* T_Host = "host";
   static constexpr const char* T_HTTP_1_0 = "HTTP/1.0";
   static constexpr const char* T_HTTP_100_CONT = "HTTP/1.1 100 Continue\r\n\r\n";
@@ -68,11 +71,13 @@ namespace asyncsrv {
   static constexpr const char* T_nn = "\n\n";
   static constexpr const char* T_rn = "\r\n";
   static constexpr const char* T_rnrn = "\r\n\r\n";
+  static constexpr const char* T_Set_Cookie = "set-cookie";
   static constexpr const char* T_Transfer_Encoding = "transfer-encoding";
   static constexpr const char* T_TRUE = "true";
   static constexpr const char* T_UPGRADE = "upgrade";
   static constexpr const char* T_uri = "uri";
   static constexpr const char* T_username = "username";
+  static constexpr const char* T_Vary = "vary";
   static constexpr const char* T_WS = "websocket";
   static constexpr const char* T_WWW_AUTH = "www-authenticate";
 
@@ -1,4 +1,5 @@
 #include "DeviceConfig.h"
+#include "WebMetrics.h"
 #include <WiFi.h>
 #include <nvs_flash.h>
 #include <nvs.h>
@@ -51,8 +52,8 @@ void DeviceConfig::begin() {
 
 void DeviceConfig::attachRoutes(WebServer& server) {
   _srv = &server;
-  _srv->on("/setup",   HTTP_GET, std::bind(&DeviceConfig::handleSetup,  this));
-  _srv->on("/setsite", HTTP_GET, std::bind(&DeviceConfig::handleSetSite,this));
+  _srv->on("/setup",   HTTP_GET, Metrics.track("/setup",   std::bind(&DeviceConfig::handleSetup,  this)));
+  _srv->on("/setsite", HTTP_GET, Metrics.track("/setsite", std::bind(&DeviceConfig::handleSetSite,this)));
 }
 
 void DeviceConfig::load() {
@@ -0,0 +1,82 @@
+#include "LiveFeed.h"
+#include "WebMetrics.h"
+#include <lwip/sockets.h>
+
+LiveFeed Feed;
+
+void LiveFeed::attachRoutes(WebServer& server) {
+  _srv = &server;
+  _srv->on("/events", HTTP_GET, Metrics.track("/events", std::bind(&LiveFeed::handleEvents, this)));
+}
+
+void LiveFeed::setRate(uint16_t ticksPerSecond) {
+  _period = 1000 / (ticksPerSecond ? std::min<uint16_t>(ticksPerSecond, 1000) : 1);
+}
+
+size_t LiveFeed::clients() const {
+  size_t n = 0;
+  for (const WiFiClient& c : _clients) if (c) n++;
+  return n;
+}
+
+void LiveFeed::handleEvents() {
+  if (!_srv) return;
+
+  WiFiClient* slot = nullptr;
+  // een WiFiClient is false zodra de verbinding weg is, die plek is weer vrij
+  for (WiFiClient& c : _clients) {
+    if (!c && !slot) slot = &c;
+  }
+  if (!slot) {
+    _srv->send(503, "text/plain", "Too many clients");
+    return;
+  }
+
+  // de stream neemt de verbinding over, WebServer stuurt zelf geen antwoord meer
+  WiFiClient client = _srv->client();
+  client.setNoDelay(true);
+  client.print(F("HTTP/1.1 200 OK\r\n"
+                 "Content-Type: text/event-stream\r\n"
+                 "Cache-Control: no-cache\r\n"
+                 "Connection: keep-alive\r\n"
+                 "Access-Control-Allow-Origin: *\r\n\r\n"
+                 "retry: 2000\n\n"));
+  *slot = client;
+}
+
+size_t LiveFeed::serialize() {
+  const char* db = _dbState ? _dbState() : "unknown";
+  int n = snprintf(_buffer, sizeof(_buffer), "{\"rssi\":%d,\"heap\":%lu,\"db\":\"%s\",\"uptime\":%lu}",
+                   WiFi.isConnected() ? (int)WiFi.RSSI() : 0, (unsigned long)ESP.getFreeHeap(), db,
+                   (unsigned long)(millis() / 1000));
+  if (n < 0 || n >= (int)sizeof(_buffer)) { strcpy(_buffer, "{}"); return 0; }
+  return n;
+}
+
+void LiveFeed::loop() {
+  const uint32_t now = millis();
+  if ((int32_t)(now - _next) < 0) return;
+  // te laat aangeroepen (blokkerend scherm): ticks inhalen heeft geen zin
+  _next = (now - _next >= _period) ? now + _period : _next + _period;
+
+  // zonder clients wordt er ook niet gesampled
+  if (!clients() || !serialize()) return;
+
+  // één keer opgebouwd, voor alle clients gelijk
+  char event[sizeof(_buffer) + 48];
+  const int n = snprintf(event, sizeof(event), "event: telemetry\nid: %lu\ndata: %s\n\n", (unsigned long)++_id, _buffer);
+  if (n < 0 || n >= (int)sizeof(event)) return;
+
+  for (WiFiClient& c : _clients) {
+    if (!c) { c = WiFiClient(); continue; }  // door de browser gesloten
+    // WiFiClient::write() wacht tot 10x 1 s op ruimte in de zendbuffer en houdt dan de hele loop() op.
+    // MSG_DONTWAIT neemt alleen wat nu past; een half verstuurd event maakt de stream onbruikbaar,
+    // dus dan gaat de verbinding dicht en verbindt de browser opnieuw.
+    const ssize_t sent = send(c.fd(), event, n, MSG_DONTWAIT);
+    if (sent != n) {
+      c.stop();
+      c = WiFiClient();
+      _dropped++;
+    }
+  }
+}
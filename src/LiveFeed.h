@@ -0,0 +1,48 @@
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WebServer.h>
+#include <functional>
+
+// Live data voor het Monitor-scherm en /events (Server-Sent Events).
+// Elke tick wordt één sample als JSON geserialiseerd en naar alle clients geschreven:
+//
+//   event: telemetry
+//   id: 42
+//   data: {"rssi":-61,"heap":182344,"db":"up","uptime":1234}
+//
+// Er staat niets in een wachtrij: een sample dat niet meteen in de zendbuffer van de socket past
+// (MSG_DONTWAIT) verbreekt die client, de browser verbindt zelf opnieuw. loop() wacht dus nooit op
+// een browser die niet meer leest. Vermogen en spanning zitten er niet in: dit board heeft geen meter.
+// De async variant (AsyncEventTelemetry) vraagt AsyncTCP, die dit project niet meer gebruikt.
+class LiveFeed {
+public:
+  static constexpr size_t MAX_CLIENTS = 4;
+
+  void attachRoutes(WebServer& server);  // registreert /events
+  void setRate(uint16_t ticksPerSecond);
+  void onDbState(std::function<const char*()> read) { _dbState = std::move(read); }
+
+  // sample en verstuur als de volgende tick aan de beurt is, vanuit loop()
+  void loop();
+
+  size_t clients() const;
+  uint32_t dropped() const { return _dropped; }
+
+private:
+  void handleEvents();
+  size_t serialize();
+
+private:
+  WebServer* _srv = nullptr;
+  WiFiClient _clients[MAX_CLIENTS];
+  std::function<const char*()> _dbState;
+
+  uint32_t _period = 1000;
+  uint32_t _next = 0;
+  uint32_t _id = 0;
+  uint32_t _dropped = 0;
+  char _buffer[160];
+};
+
+extern LiveFeed Feed;
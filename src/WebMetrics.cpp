@@ -0,0 +1,95 @@
+#include "WebMetrics.h"
+#include "LiveFeed.h"
+#include <StreamString.h>
+
+WebMetrics Metrics;
+
+static const uint32_t timeBounds[WebMetrics::TIME_BUCKETS] = {1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000, 5000000};
+static const uint32_t heapBounds[WebMetrics::HEAP_BUCKETS] = {256, 1024, 4096, 16384, 65536, 262144};
+
+void WebMetrics::attachRoutes(WebServer& server) {
+  _srv = &server;
+  _srv->on("/metrics", HTTP_GET, std::bind(&WebMetrics::handleMetrics, this));
+}
+
+WebServer::THandlerFunction WebMetrics::track(const char* label, WebServer::THandlerFunction handler) {
+  if (_count == MAX_ROUTES) return handler;
+  const size_t route = _count++;
+  _routes[route].label = label;
+  return [this, route, handler]() {
+    const uint32_t freeHeap = ESP.getFreeHeap();
+    const uint32_t start = micros();
+    handler();
+    // andere taken (WiFi, lwIP) lopen intussen door, hun allocaties tellen mee
+    record(route, micros() - start, (int32_t)freeHeap - (int32_t)ESP.getFreeHeap());
+  };
+}
+
+void WebMetrics::record(size_t route, uint32_t us, int32_t systemHeapDrop) {
+  Route& r = _routes[route];
+  r.requests++;
+  size_t i = 0;
+  while (i < TIME_BUCKETS && us > timeBounds[i]) i++;
+  r.time[i]++;
+  r.timeSum += us;
+  // weer vrijgegeven geheugen telt als geen daling
+  const uint32_t drop = systemHeapDrop > 0 ? systemHeapDrop : 0;
+  i = 0;
+  while (i < HEAP_BUCKETS && drop > heapBounds[i]) i++;
+  r.heap[i]++;
+  r.heapSum += drop;
+}
+
+static void printHistogram(Print& out, const char* name, const char* route, const uint32_t* counts,
+                           const uint32_t* bounds, size_t n, uint64_t sum, double scale) {
+  uint32_t cumulative = 0;
+  for (size_t i = 0; i <= n; i++) {
+    cumulative += counts[i];
+    out.printf("%s_bucket{route=\"%s\",le=\"", name, route);
+    if (i < n) out.print(bounds[i] * scale, scale < 1 ? 3 : 0);
+    else out.print("+Inf");
+    out.printf("\"} %lu\n", (unsigned long)cumulative);
+  }
+  out.printf("%s_sum{route=\"%s\"} ", name, route);
+  out.print(sum * scale, scale < 1 ? 6 : 0);
+  out.print('\n');
+  out.printf("%s_count{route=\"%s\"} %lu\n", name, route, (unsigned long)cumulative);
+}
+
+void WebMetrics::printTo(Print& out) const {
+  out.print(F("# TYPE gridconnect_requests_total counter\n"));
+  for (size_t i = 0; i < _count; i++) {
+    out.printf("gridconnect_requests_total{route=\"%s\"} %lu\n", _routes[i].label, (unsigned long)_routes[i].requests);
+  }
+
+  out.print(F("# TYPE gridconnect_handler_seconds histogram\n"));
+  for (size_t i = 0; i < _count; i++) {
+    const Route& r = _routes[i];
+    if (r.requests) printHistogram(out, "gridconnect_handler_seconds", r.label, r.time, timeBounds, TIME_BUCKETS, r.timeSum, 1e-6);
+  }
+
+  out.print(F("# TYPE gridconnect_system_heap_drop_bytes histogram\n"));
+  for (size_t i = 0; i < _count; i++) {
+    const Route& r = _routes[i];
+    if (r.requests) printHistogram(out, "gridconnect_system_heap_drop_bytes", r.label, r.heap, heapBounds, HEAP_BUCKETS, r.heapSum, 1);
+  }
+
+  out.print(F("# TYPE gridconnect_free_heap_bytes gauge\n"));
+  out.printf("gridconnect_free_heap_bytes %lu\n", (unsigned long)ESP.getFreeHeap());
+  out.print(F("# TYPE gridconnect_min_free_heap_bytes gauge\n"));
+  out.printf("gridconnect_min_free_heap_bytes %lu\n", (unsigned long)ESP.getMinFreeHeap());
+  out.print(F("# TYPE gridconnect_uptime_seconds counter\n"));
+  out.printf("gridconnect_uptime_seconds %lu\n", (unsigned long)(millis() / 1000));
+  out.print(F("# TYPE gridconnect_events_clients gauge\n"));
+  out.printf("gridconnect_events_clients %u\n", (unsigned)Feed.clients());
+  out.print(F("# TYPE gridconnect_events_dropped_total counter\n"));
+  out.printf("gridconnect_events_dropped_total %lu\n", (unsigned long)Feed.dropped());
+}
+
+void WebMetrics::handleMetrics() {
+  if (!_srv) return;
+  StreamString body;
+  body.reserve(512 + _count * 2048);
+  printTo(body);
+  _srv->send(200, "text/plain; version=0.0.4", body);
+}
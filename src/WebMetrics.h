@@ -0,0 +1,50 @@
+#pragma once
+#include <Arduino.h>
+#include <WebServer.h>
+
+// /metrics voor Prometheus (text format 0.0.4): per route het aantal requests, de tijd in de handler en hoe ver
+// de vrije heap van het hele systeem daarbij zakte, plus heap, uptime en de /events clients.
+//
+//   _srv->on("/scan", HTTP_GET, Metrics.track("/scan", std::bind(&WiFiConfig::handleScan, this)));
+//
+// De WebServer handelt één request tegelijk af in loop() en schrijft het antwoord binnen de handler weg, dus de
+// tijd in de handler is de responstijd tot het antwoord in de zendbuffer van de socket staat. Verstuurde bytes
+// geeft WebServer niet door, die staan er niet in. AsyncWebServerMetrics uit lib/ESPAsyncWebServer meet wel
+// TTFB en bytes, maar vraagt de async server die dit project niet gebruikt.
+class WebMetrics {
+public:
+  static constexpr size_t MAX_ROUTES = 12;
+  // bovengrenzen in microseconden (1-2-5 reeks) en bytes (machten van 4), daarna +Inf
+  static constexpr size_t TIME_BUCKETS = 12;
+  static constexpr size_t HEAP_BUCKETS = 6;
+
+  void attachRoutes(WebServer& server);  // registreert /metrics
+
+  // handler gemeten onder label; label moet blijven bestaan (een literal). Zijn alle plekken bezet, dan wordt
+  // handler ongemeten teruggegeven
+  WebServer::THandlerFunction track(const char* label, WebServer::THandlerFunction handler);
+
+  // meet één afgehandeld request, alloceert niet
+  void record(size_t route, uint32_t us, int32_t systemHeapDrop);
+
+  void printTo(Print& out) const;
+
+private:
+  struct Route {
+    const char* label = nullptr;
+    uint32_t requests = 0;
+    uint32_t time[TIME_BUCKETS + 1] = {};
+    uint64_t timeSum = 0;
+    uint32_t heap[HEAP_BUCKETS + 1] = {};
+    uint64_t heapSum = 0;
+  };
+
+  void handleMetrics();
+
+private:
+  WebServer* _srv = nullptr;
+  Route _routes[MAX_ROUTES];
+  size_t _count = 0;
+};
+
+extern WebMetrics Metrics;
@@ -1,6 +1,7 @@
 #include "WiFiConfig.h"
 #include <ElegantOTA.h>   // v2
 #include <ESPmDNS.h>
+#include "WebMetrics.h"
 
 // ---------- HTML UI ----------
 static String makeRootHtml() {
@@ -177,10 +178,10 @@ void WiFiConfig::saveCredentials(const String& ssid, const String& pass) {
 }
 
 void WiFiConfig::setupRoutes() {
-  _server.on("/",        HTTP_GET, std::bind(&WiFiConfig::handleRoot,    this));
-  _server.on("/scan",    HTTP_GET, std::bind(&WiFiConfig::handleScan,    this));
-  _server.on("/setwifi", HTTP_GET, std::bind(&WiFiConfig::handleSetWiFi, this));
-  _server.onNotFound(std::bind(&WiFiConfig::handleNotFound, this));
+  _server.on("/",        HTTP_GET, Metrics.track("/",        std::bind(&WiFiConfig::handleRoot,    this)));
+  _server.on("/scan",    HTTP_GET, Metrics.track("/scan",    std::bind(&WiFiConfig::handleScan,    this)));
+  _server.on("/setwifi", HTTP_GET, Metrics.track("/setwifi", std::bind(&WiFiConfig::handleSetWiFi, this)));
+  _server.onNotFound(Metrics.track("other", std::bind(&WiFiConfig::handleNotFound, this)));
 }
 
 void WiFiConfig::handleRoot() {
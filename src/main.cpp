@@ -8,6 +8,8 @@
 
 #include "WiFiConfig.h"
 #include "DeviceConfig.h"
+#include "LiveFeed.h"
+#include "WebMetrics.h"
 #include <qrcode.h>
 
 // ---------- TFT & Touch ----------
@@ -49,6 +51,25 @@ static const uint32_t DB_TCP_TIMEOUT_MS    = 600;
 static bool g_serverStarted = false;
 static bool g_routesRegistered = false;
 
+// ---------- OTA Login ----------
+static String g_otaUser = "admin";
+static String g_otaPass;
+
+// Wachtwoord per apparaat in NVS, bij de eerste start willekeurig gekozen
+void loadOtaCredentials() {
+  // zonder 0/O en 1/l/I, het wordt van het scherm overgetypt
+  static const char kAlphabet[] = "abcdefghijkmnpqrstuvwxyzABCDEFGHJKLMNPQRSTUVWXYZ23456789";
+  Preferences prefs;
+  prefs.begin("ota", false);
+  g_otaPass = prefs.getString("pass", "");
+  if (g_otaPass.isEmpty()) {
+    for (int i = 0; i < 12; i++) g_otaPass += kAlphabet[esp_random() % (sizeof(kAlphabet) - 1)];
+    prefs.putString("pass", g_otaPass);
+    Serial.println("OTA password generated");
+  }
+  prefs.end();
+}
+
 void registerAllRoutes() {
   if (g_routesRegistered) return;
   
@@ -59,9 +80,15 @@ void registerAllRoutes() {
   
   // Registreer Device configuratie routes
   DevCfg.attachRoutes(WiFiCfg.server());
+
+  // Live data voor het dashboard
+  Feed.attachRoutes(WiFiCfg.server());
+
+  // Prometheus metrics per route
+  Metrics.attachRoutes(WiFiCfg.server());
   
   // Start ElegantOTA
-  ElegantOTA.begin(&WiFiCfg.server(), "admin", "changeme");
+  ElegantOTA.begin(&WiFiCfg.server(), g_otaUser.c_str(), g_otaPass.c_str());
   
   g_routesRegistered = true;
   Serial.println("All routes registered successfully");
@@ -96,7 +123,7 @@ void ensureServerRunning() {
       Serial.print("Server accessible at: http://");
       Serial.println(WiFi.localIP());
       Serial.println("And at: http://gridconnect.local");
-      Serial.println("Routes available: /, /scan, /setwifi, /setup, /setsite, /update");
+      Serial.println("Routes available: /, /scan, /setwifi, /setup, /setsite, /update, /events, /metrics");
       
       // Test of de server reageert
       Serial.println("Testing server response...");
@@ -206,6 +233,30 @@ static void drawGridconnectLogo() {
   tft.drawCentreString("v1.0", 240, 260, 1);
 }
 
+static const char* dbStateName() {
+  return g_dbState == DbState::UP ? "up" : g_dbState == DbState::DOWN ? "down" : "unknown";
+}
+
+// Live waarden, dezelfde als op /events
+static void updateMonitor() {
+  tft.fillRect(20, 85, 440, 140, TFT_BLACK);
+  tft.setTextColor(TFT_WHITE, TFT_BLACK);
+  tft.drawString("Signal: " + (WiFi.isConnected() ? String(WiFi.RSSI()) + " dBm" : String("-")), 20, 85, 4);
+  tft.drawString("Free Memory: " + String(ESP.getFreeHeap() / 1024) + " kB", 20, 120, 4);
+  tft.drawString("Database: " + String(dbStateName()), 20, 155, 4);
+  tft.drawString("Uptime: " + String(millis() / 1000) + " sec", 20, 190, 4);
+  tft.setTextColor(TFT_DARKGREY, TFT_BLACK);
+  tft.drawString("Web clients: " + String(Feed.clients()), 300, 60, 2);
+}
+static void drawMonitor() {
+  tft.fillScreen(TFT_BLACK); drawHeaderWithStatus("System Monitor");
+  tft.setTextColor(TFT_CYAN, TFT_BLACK); tft.drawString("Live", 20, 60, 2);
+  tft.setTextColor(TFT_DARKGREY, TFT_BLACK);
+  tft.drawCentreString("Live feed: http://gridconnect.local/events", 240, 255, 2);
+  tft.drawCentreString("Touch anywhere to return", 240, 280, 2);
+  updateMonitor();
+}
+
 static void drawMainMenu() {
   tft.fillScreen(TFT_BLACK);
   drawHeaderWithStatus("GridConnect Control Panel");
@@ -353,6 +404,12 @@ void setup() {
   // Initialize WiFi and Device config
   WiFiCfg.begin();
   DevCfg.begin();
+
+  // na WiFiCfg.begin(): met de radio aan is esp_random() echt willekeurig
+  loadOtaCredentials();
+
+  Feed.setRate(2);
+  Feed.onDbState(dbStateName);
   
   Serial.println("WiFi and Device config initialized");
   Serial.print("WiFi Status: ");
@@ -381,6 +438,7 @@ void loop() {
   // BELANGRIJKSTE: WiFiCfg.loop() moet altijd worden aangeroepen
   WiFiCfg.loop();
   tickDbCheck();
+  Feed.loop();
   
   // Zorg dat de server altijd draait als we WiFi hebben
   if (WiFi.isConnected() && !g_serverStarted) {
@@ -478,9 +536,14 @@ void loop() {
       if (tft.getTouch(&tx, &ty)) {
         if (inButton(btnSettings, tx, ty)) { currentState = SETTINGS_MENU; drawSettingsMenu(); }
         else if (inButton(btnMonitor, tx, ty)) {
-          tft.fillScreen(TFT_BLACK); drawHeaderWithStatus("System Monitor");
-          tft.setTextColor(TFT_WHITE, TFT_BLACK); tft.drawCentreString("Coming Soon...", 240, 140, 2);
-          delay(1500); drawMainMenu();
+          drawMonitor();
+          delay(300);  // de aanraking van de knop zelf niet meteen als terug zien
+          while (!tft.getTouch(&tx, &ty)) {
+            WiFiCfg.loop(); tickDbCheck(); Feed.loop();
+            if (millis()-lastIconRefresh>800){refreshStatusIcons(); updateMonitor(); lastIconRefresh=millis();}
+            delay(30);
+          }
+          drawMainMenu();
         } else if (inButton(btnData, tx, ty)) {
           tft.fillScreen(TFT_BLACK); drawHeaderWithStatus("Data Logging");
           tft.setTextColor(TFT_WHITE, TFT_BLACK); tft.drawCentreString("Coming Soon...", 240, 140, 2);
@@ -501,6 +564,7 @@ void loop() {
           tft.drawString("CPU Freq: " + String(ESP.getCpuFreqMHz()) + " MHz", 250, 85, 2);
           tft.drawString("Uptime: " + String(millis() / 1000) + " sec", 250, 105, 2);
           tft.drawString("Flash Size: " + String(ESP.getFlashChipSize()) + " bytes", 250, 125, 2);
+          tft.drawString("OTA: " + g_otaUser + " / " + g_otaPass, 250, 145, 2);
           tft.setTextColor(TFT_DARKGREY, TFT_BLACK);
           tft.drawCentreString("Touch anywhere to return", 240, 280, 2);
           while (!tft.getTouch(&tx, &ty)) { WiFiCfg.loop(); tickDbCheck(); if (millis()-lastIconRefresh>800){refreshStatusIcons();lastIconRefresh=millis();} delay(30); }
@@ -0,0 +1,413 @@
+#pragma once
+
+/*
+  The parts of the ESP32 Arduino core the library uses, for the native unit tests (pio test -e native). Header only,
+  so the library builds against it unchanged. Time only moves when a test moves it, see host::advance().
+*/
+
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define Arduino_h
+#define ESP32 1
+// the IDF 4 paths build BackPort_SHA1Builder, the SHA-1 of the WebSocket handshake
+#define ESP_IDF_VERSION_MAJOR 4
+#define ESP_ARDUINO_VERSION_MAJOR 2
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define F(s) ((const __FlashStringHelper*)(s))
+#define FPSTR(s) ((const __FlashStringHelper*)(s))
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcasecmp_P strcasecmp
+#define strstr_P strstr
+#define snprintf_P snprintf
+#define sprintf_P sprintf
+#define vsnprintf_P vsnprintf
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define log_e(...) ((void)0)
+#define log_w(...) ((void)0)
+#define log_i(...) ((void)0)
+#define log_d(...) ((void)0)
+#define log_v(...) ((void)0)
+#define ets_printf(...) ((void)0)
+#define IRAM_ATTR
+#define __unused __attribute__((unused))
+#define MALLOC_CAP_SPIRAM 1
+#define MALLOC_CAP_8BIT 2
+
+namespace host {
+
+// microseconds since boot
+inline uint64_t now = 0;
+inline uint32_t seed = 0x2545f491;
+inline uint32_t freeHeap = 200 * 1024;
+
+inline void advance(uint32_t ms) {
+  now += (uint64_t)ms * 1000;
+}
+
+} // namespace host
+
+inline unsigned long millis() {
+  return host::now / 1000;
+}
+
+inline unsigned long micros() {
+  return host::now;
+}
+
+inline void delay(uint32_t ms) {
+  host::advance(ms);
+}
+
+inline void yield() {}
+
+// xorshift32, deterministic so a failing test fails the same way again
+inline uint32_t esp_random() {
+  host::seed ^= host::seed << 13;
+  host::seed ^= host::seed >> 17;
+  host::seed ^= host::seed << 5;
+  return host::seed;
+}
+
+inline long random(long max) {
+  return max > 0 ? esp_random() % max : 0;
+}
+
+inline long random(long min, long max) {
+  return max > min ? min + random(max - min) : min;
+}
+
+inline void* ps_malloc(size_t n) {
+  return malloc(n);
+}
+
+inline void* heap_caps_malloc(size_t n, uint32_t) {
+  return malloc(n);
+}
+
+class __FlashStringHelper;
+
+class String {
+  private:
+    std::string _s;
+
+    static std::string _number(unsigned long long v, unsigned base) {
+      char buf[66];
+      char* p = buf + sizeof(buf) - 1;
+      *p = '\0';
+      do {
+        const unsigned d = v % base;
+        *--p = d < 10 ? '0' + d : 'a' + d - 10;
+        v /= base;
+      } while (v);
+      return p;
+    }
+    static std::string _number(long long v, unsigned base) {
+      return v < 0 && base == 10 ? "-" + _number((unsigned long long)-v, base) : _number((unsigned long long)v, base);
+    }
+    static std::string _decimal(double v, unsigned decimals) {
+      char buf[64];
+      snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+      return buf;
+    }
+
+  public:
+    String() = default;
+    String(const char* s) : _s(s ? s : "") {}
+    String(const char* s, size_t n) : _s(s, n) {}
+    String(const __FlashStringHelper* s) : _s(s ? (const char*)s : "") {}
+    String(const std::string& s) : _s(s) {}
+    explicit String(char c) : _s(1, c) {}
+    explicit String(unsigned char v, unsigned char base = 10) : _s(_number((unsigned long long)v, base)) {}
+    explicit String(int v, unsigned char base = 10) : _s(_number((long long)v, base)) {}
+    explicit String(unsigned int v, unsigned char base = 10) : _s(_number((unsigned long long)v, base)) {}
+    explicit String(long v, unsigned char base = 10) : _s(_number((long long)v, base)) {}
+    explicit String(unsigned long v, unsigned char base = 10) : _s(_number((unsigned long long)v, base)) {}
+    explicit String(long long v, unsigned char base = 10) : _s(_number(v, base)) {}
+    explicit String(unsigned long long v, unsigned char base = 10) : _s(_number(v, base)) {}
+    explicit String(float v, unsigned char decimals = 2) : _s(_decimal(v, decimals)) {}
+    explicit String(double v, unsigned char decimals = 2) : _s(_decimal(v, decimals)) {}
+
+    unsigned int length() const { return _s.size(); }
+    bool isEmpty() const { return _s.empty(); }
+    const char* c_str() const { return _s.c_str(); }
+    char* begin() { return &_s[0]; }
+    char* end() { return &_s[0] + _s.size(); }
+    const char* begin() const { return _s.data(); }
+    const char* end() const { return _s.data() + _s.size(); }
+    bool reserve(unsigned int size) {
+      _s.reserve(size);
+      return true;
+    }
+    void clear() { _s.clear(); }
+    explicit operator bool() const { return true; }
+
+    bool concat(const String& s) {
+      _s += s._s;
+      return true;
+    }
+    bool concat(const char* s) {
+      _s += s ? s : "";
+      return true;
+    }
+    bool concat(const char* s, unsigned int n) {
+      _s.append(s, n);
+      return true;
+    }
+    bool concat(const uint8_t* s, unsigned int n) { return concat((const char*)s, n); }
+    bool concat(const __FlashStringHelper* s) { return concat((const char*)s); }
+    bool concat(char c) {
+      _s += c;
+      return true;
+    }
+    bool concat(unsigned char v) { return concat(String(v)); }
+    bool concat(int v) { return concat(String(v)); }
+    bool concat(unsigned int v) { return concat(String(v)); }
+    bool concat(long v) { return concat(String(v)); }
+    bool concat(unsigned long v) { return concat(String(v)); }
+    bool concat(long long v) { return concat(String(v)); }
+    bool concat(unsigned long long v) { return concat(String(v)); }
+    bool concat(float v) { return concat(String(v)); }
+    bool concat(double v) { return concat(String(v)); }
+    template <typename T>
+    String& operator+=(const T& v) {
+      concat(v);
+      return *this;
+    }
+    // the library assigns numbers, the ETag of a file for one
+    template <typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+    String& operator=(T v) {
+      return *this = String(v);
+    }
+
+    int compareTo(const String& s) const { return _s.compare(s._s); }
+    bool equals(const String& s) const { return _s == s._s; }
+    bool equals(const char* s) const { return _s == (s ? s : ""); }
+    bool equalsIgnoreCase(const String& s) const { return _s.size() == s._s.size() && !strcasecmp(c_str(), s.c_str()); }
+    bool operator==(const String& s) const { return _s == s._s; }
+    bool operator==(const char* s) const { return equals(s); }
+    bool operator!=(const String& s) const { return _s != s._s; }
+    bool operator!=(const char* s) const { return !equals(s); }
+    bool operator<(const String& s) const { return _s < s._s; }
+    bool operator>(const String& s) const { return _s > s._s; }
+    bool startsWith(const String& prefix) const { return _s.compare(0, prefix._s.size(), prefix._s) == 0; }
+    bool startsWith(const String& prefix, unsigned int offset) const {
+      return offset <= _s.size() && _s.compare(offset, prefix._s.size(), prefix._s) == 0;
+    }
+    bool endsWith(const String& suffix) const {
+      return _s.size() >= suffix._s.size() && _s.compare(_s.size() - suffix._s.size(), suffix._s.size(), suffix._s) == 0;
+    }
+
+    char charAt(unsigned int i) const { return i < _s.size() ? _s[i] : 0; }
+    void setCharAt(unsigned int i, char c) {
+      if (i < _s.size())
+        _s[i] = c;
+    }
+    char operator[](unsigned int i) const { return charAt(i); }
+    char& operator[](unsigned int i) { return _s[i]; }
+
+    int indexOf(char c, unsigned int from = 0) const {
+      const size_t i = _s.find(c, from);
+      return i == std::string::npos ? -1 : (int)i;
+    }
+    int indexOf(const String& s, unsigned int from = 0) const {
+      const size_t i = _s.find(s._s, from);
+      return i == std::string::npos ? -1 : (int)i;
+    }
+    int lastIndexOf(char c) const {
+      const size_t i = _s.rfind(c);
+      return i == std::string::npos ? -1 : (int)i;
+    }
+    int lastIndexOf(char c, unsigned int from) const {
+      const size_t i = _s.rfind(c, from);
+      return i == std::string::npos ? -1 : (int)i;
+    }
+    int lastIndexOf(const String& s) const {
+      const size_t i = _s.rfind(s._s);
+      return i == std::string::npos ? -1 : (int)i;
+    }
+    String substring(unsigned int from) const { return from < _s.size() ? String(_s.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+      if (from > to)
+        std::swap(from, to);
+      return from < _s.size() ? String(_s.substr(from, to - from)) : String();
+    }
+
+    void replace(char find, char with) { std::replace(_s.begin(), _s.end(), find, with); }
+    void replace(const String& find, const String& with) {
+      if (find._s.empty())
+        return;
+      for (size_t i = _s.find(find._s); i != std::string::npos; i = _s.find(find._s, i + with._s.size()))
+        _s.replace(i, find._s.size(), with._s);
+    }
+    void remove(unsigned int index) {
+      if (index < _s.size())
+        _s.erase(index);
+    }
+    void remove(unsigned int index, unsigned int count) {
+      if (index < _s.size())
+        _s.erase(index, count);
+    }
+    void toLowerCase() {
+      for (char& c : _s)
+        c = tolower((unsigned char)c);
+    }
+    void toUpperCase() {
+      for (char& c : _s)
+        c = toupper((unsigned char)c);
+    }
+    void trim() {
+      const size_t first = _s.find_first_not_of(" \t\r\n\f\v");
+      if (first == std::string::npos) {
+        _s.clear();
+        return;
+      }
+      _s = _s.substr(first, _s.find_last_not_of(" \t\r\n\f\v") - first + 1);
+    }
+
+    long toInt() const { return atol(c_str()); }
+    float toFloat() const { return atof(c_str()); }
+    double toDouble() const { return atof(c_str()); }
+
+    friend String operator+(const String& a, const String& b) { return String(a._s + b._s); }
+    friend String operator+(const String& a, const char* b) { return String(a._s + (b ? b : "")); }
+    friend String operator+(const char* a, const String& b) { return String((a ? a : "") + b._s); }
+    friend String operator+(const String& a, char b) { return String(a._s + b); }
+    friend String operator+(const String& a, const __FlashStringHelper* b) { return a + (const char*)b; }
+    friend String operator+(const String& a, int b) { return a + String(b); }
+    friend String operator+(const String& a, unsigned int b) { return a + String(b); }
+    friend String operator+(const String& a, long b) { return a + String(b); }
+    friend String operator+(const String& a, unsigned long b) { return a + String(b); }
+};
+
+inline const String emptyString;
+
+class Printable;
+
+class Print {
+  public:
+    virtual ~Print() = default;
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+      size_t n = 0;
+      while (size-- && write(*buffer++))
+        n++;
+      return n;
+    }
+    size_t write(const char* s) { return s ? write((const uint8_t*)s, strlen(s)) : 0; }
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t print(const __FlashStringHelper* s) { return write((const char*)s); }
+    size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+    size_t print(const char* s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char v, int base = 10) { return print(String(v, base)); }
+    size_t print(int v, int base = 10) { return print(String(v, base)); }
+    size_t print(unsigned int v, int base = 10) { return print(String(v, base)); }
+    size_t print(long v, int base = 10) { return print(String(v, base)); }
+    size_t print(unsigned long v, int base = 10) { return print(String(v, base)); }
+    size_t print(long long v, int base = 10) { return print(String(v, base)); }
+    size_t print(unsigned long long v, int base = 10) { return print(String(v, base)); }
+    size_t print(double v, int decimals = 2) { return print(String(v, decimals)); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(const T& v) {
+      const size_t n = print(v);
+      return n + println();
+    }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+      char buf[64];
+      va_list args;
+      va_start(args, format);
+      const int len = vsnprintf(buf, sizeof(buf), format, args);
+      va_end(args);
+      if (len < 0)
+        return 0;
+      if ((size_t)len < sizeof(buf))
+        return write((const uint8_t*)buf, len);
+      std::vector<char> big(len + 1);
+      va_start(args, format);
+      vsnprintf(big.data(), big.size(), format, args);
+      va_end(args);
+      return write((const uint8_t*)big.data(), len);
+    }
+};
+
+class Stream : public Print {
+  protected:
+    unsigned long _timeout = 1000;
+
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    virtual size_t readBytes(char* buffer, size_t length) {
+      size_t n = 0;
+      for (int c; n < length && (c = read()) >= 0; n++)
+        buffer[n] = c;
+      return n;
+    }
+    size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+};
+
+class IPAddress {
+  private:
+    // first octet in the low byte, like lwIP
+    uint32_t _address = 0;
+
+  public:
+    IPAddress() = default;
+    IPAddress(uint32_t address) : _address(address) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+    operator uint32_t() const { return _address; }
+    bool operator==(const IPAddress& other) const { return _address == other._address; }
+    bool operator!=(const IPAddress& other) const { return _address != other._address; }
+    uint8_t operator[](int i) const { return _address >> (8 * i); }
+    String toString() const {
+      char buf[16];
+      snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+      return String(buf);
+    }
+};
+
+class EspClass {
+  public:
+    uint32_t getFreeHeap() { return host::freeHeap; }
+    uint32_t getMinFreeHeap() { return host::freeHeap; }
+    uint32_t getMaxAllocHeap() { return host::freeHeap; }
+    uint32_t getHeapSize() { return 320 * 1024; }
+    uint32_t getFreePsram() { return 0; }
+    uint32_t getCycleCount() { return host::now * 240; }
+    const char* getChipModel() { return "host"; }
+};
+
+inline EspClass ESP;
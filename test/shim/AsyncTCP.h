@@ -0,0 +1,280 @@
+#pragma once
+
+/*
+  AsyncTCP for the native unit tests: an AsyncClient is driven by the test instead of lwIP. What the library sends
+  collects in output() once it is sent, the TCP window (space()) only opens again with acknowledge(), and
+  receive(), poll(), acknowledge() and remoteClose() call the handlers the library set, like the async task would.
+
+    AsyncClient* client = new AsyncClient(IPAddress(192, 168, 1, 7));
+    AsyncServer::at(80)->accept(client);
+    client->receive("GET / HTTP/1.1\r\nHost: x\r\n\r\n");
+    client->acknowledge();
+
+  close() calls the disconnect handler right away like AsyncTCP does, abort() reports ERR_ABRT and the disconnect
+  on the next AsyncClient::runEvents(), the way lwIP reports them later from its own task. The calls that touch the
+  connection are serialized, like AsyncTCP runs them on the lwIP thread, so a test may publish from another thread. The library deletes its
+  clients when they disconnect, so a test that outlives one keeps its peer():
+
+    std::shared_ptr<AsyncPeer> peer = client->peer();
+    while (peer->client)
+      peer->client->acknowledge();
+    // peer->output holds the response
+*/
+
+#include "Arduino.h"
+
+#include <mutex>
+
+#define ASYNC_WRITE_FLAG_COPY 0x01
+#define ASYNC_WRITE_FLAG_MORE 0x02
+
+#define ERR_OK 0
+#define ERR_ABRT -13
+
+class AsyncClient;
+
+// the remote end of a connection, what it received and the client while the library has not deleted it
+struct AsyncPeer {
+    AsyncClient* client;
+    std::string output;
+    // the segment handed to the data handler while it runs
+    const uint8_t* segment = nullptr;
+    size_t segmentLen = 0;
+};
+
+typedef std::function<void(void*, AsyncClient*)> AcConnectHandler;
+typedef std::function<void(void*, AsyncClient*, size_t len, uint32_t time)> AcAckHandler;
+typedef std::function<void(void*, AsyncClient*, int8_t error)> AcErrorHandler;
+typedef std::function<void(void*, AsyncClient*, void* data, size_t len)> AcDataHandler;
+typedef std::function<void(void*, AsyncClient*, uint32_t time)> AcTimeoutHandler;
+
+class AsyncClient {
+  private:
+    template <typename H>
+    struct Handler {
+        H cb;
+        void* arg = nullptr;
+    };
+
+    Handler<AcConnectHandler> _onDisconnect;
+    Handler<AcConnectHandler> _onPoll;
+    Handler<AcAckHandler> _onAck;
+    Handler<AcErrorHandler> _onError;
+    Handler<AcDataHandler> _onData;
+    Handler<AcTimeoutHandler> _onTimeout;
+
+    IPAddress _ip;
+    uint16_t _port;
+    size_t _window;
+    size_t _unacked = 0;
+    std::string _pending;
+    std::shared_ptr<AsyncPeer> _peer;
+    bool _connected = true;
+    bool _aborted = false;
+    uint32_t _rxTimeout = 0;
+    mutable std::recursive_mutex _lwip;
+
+    static std::vector<AsyncClient*>& _aborting() {
+      static std::vector<AsyncClient*> clients;
+      return clients;
+    }
+
+    void _disconnect() {
+      _connected = false;
+      if (_onDisconnect.cb)
+        _onDisconnect.cb(_onDisconnect.arg, this);
+    }
+
+  public:
+    explicit AsyncClient(IPAddress ip = IPAddress(192, 168, 1, 2), uint16_t port = 50000, size_t window = 5744)
+        : _ip(ip), _port(port), _window(window), _peer(std::make_shared<AsyncPeer>(AsyncPeer{this, {}})) {}
+    virtual ~AsyncClient() {
+      _peer->client = nullptr;
+      auto& aborting = _aborting();
+      aborting.erase(std::remove(aborting.begin(), aborting.end(), this), aborting.end());
+    }
+    AsyncClient(const AsyncClient&) = delete;
+    AsyncClient& operator=(const AsyncClient&) = delete;
+
+    // library side
+
+    void onDisconnect(AcConnectHandler cb, void* arg = nullptr) { _onDisconnect = {cb, arg}; }
+    void onPoll(AcConnectHandler cb, void* arg = nullptr) { _onPoll = {cb, arg}; }
+    void onAck(AcAckHandler cb, void* arg = nullptr) { _onAck = {cb, arg}; }
+    void onError(AcErrorHandler cb, void* arg = nullptr) { _onError = {cb, arg}; }
+    void onData(AcDataHandler cb, void* arg = nullptr) { _onData = {cb, arg}; }
+    void onTimeout(AcTimeoutHandler cb, void* arg = nullptr) { _onTimeout = {cb, arg}; }
+    void onConnect(AcConnectHandler, void* = nullptr) {}
+
+    bool connected() const { return _connected; }
+    bool disconnecting() const { return false; }
+    bool freeable() const { return !_connected; }
+    size_t space() const {
+      std::lock_guard<std::recursive_mutex> lock(_lwip);
+      const size_t used = _unacked + _pending.size();
+      return _connected && _window > used ? _window - used : 0;
+    }
+    bool canSend() const { return space() > 0; }
+    size_t add(const char* data, size_t size, uint8_t = ASYNC_WRITE_FLAG_COPY) {
+      std::lock_guard<std::recursive_mutex> lock(_lwip);
+      size = std::min(size, space());
+      _pending.append(data, size);
+      return size;
+    }
+    bool send() {
+      std::lock_guard<std::recursive_mutex> lock(_lwip);
+      if (!_connected)
+        return false;
+      _peer->output += _pending;
+      _unacked += _pending.size();
+      _pending.clear();
+      return true;
+    }
+    size_t write(const char* data, size_t size, uint8_t flags = ASYNC_WRITE_FLAG_COPY) {
+      std::lock_guard<std::recursive_mutex> lock(_lwip);
+      size = add(data, size, flags);
+      send();
+      return size;
+    }
+    size_t write(const char* data) { return write(data, strlen(data)); }
+    void close(bool = false) {
+      if (_connected)
+        _disconnect();
+    }
+    int8_t abort() {
+      if (_connected && !_aborted) {
+        _aborted = true;
+        _aborting().push_back(this);
+      }
+      return ERR_ABRT;
+    }
+    void setRxTimeout(uint32_t seconds) { _rxTimeout = seconds; }
+    uint32_t getRxTimeout() const { return _rxTimeout; }
+    void setAckTimeout(uint32_t) {}
+    void setNoDelay(bool) {}
+    void ackLater() {}
+    size_t ack(size_t len) { return len; }
+    IPAddress remoteIP() const { return _ip; }
+    uint16_t remotePort() const { return _port; }
+    IPAddress localIP() const { return IPAddress(192, 168, 1, 1); }
+    uint16_t localPort() const { return 80; }
+
+    // test side
+
+    // bytes sent so far, cleared by takeOutput()
+    const std::string& output() const { return _peer->output; }
+    std::string takeOutput() {
+      std::lock_guard<std::recursive_mutex> lock(_lwip);
+      std::string out;
+      out.swap(_peer->output);
+      return out;
+    }
+    std::shared_ptr<AsyncPeer> peer() const { return _peer; }
+    size_t unacked() const {
+      std::lock_guard<std::recursive_mutex> lock(_lwip);
+      return _unacked;
+    }
+    bool aborted() const { return _aborted; }
+    void setWindow(size_t window) {
+      std::lock_guard<std::recursive_mutex> lock(_lwip);
+      _window = window;
+    }
+
+    // handed over in a copy with a spare byte, the library unmasks in place and peeks one byte past the data like
+    // it can in an lwIP pbuf
+    void receive(const void* data, size_t len) {
+      if (!_connected || !_onData.cb)
+        return;
+      std::vector<uint8_t> segment(len + 1);
+      memcpy(segment.data(), data, len);
+      // the handler may delete this client
+      std::shared_ptr<AsyncPeer> peer = _peer;
+      peer->segment = segment.data();
+      peer->segmentLen = len;
+      _onData.cb(_onData.arg, this, segment.data(), len);
+      peer->segment = nullptr;
+      peer->segmentLen = 0;
+    }
+    void receive(const char* text) { receive(text, strlen(text)); }
+    // the peer acknowledged len bytes, all unacknowledged ones by default
+    void acknowledge(size_t len = SIZE_MAX, uint32_t rtt = 10) {
+      {
+        std::lock_guard<std::recursive_mutex> lock(_lwip);
+        len = std::min(len, _unacked);
+        _unacked -= len;
+      }
+      if (_connected && _onAck.cb)
+        _onAck.cb(_onAck.arg, this, len, rtt);
+    }
+    void poll() {
+      if (_connected && _onPoll.cb)
+        _onPoll.cb(_onPoll.arg, this);
+    }
+    void timeout() {
+      if (_connected && _onTimeout.cb)
+        _onTimeout.cb(_onTimeout.arg, this, _rxTimeout * 1000);
+    }
+    // the peer closed the connection
+    void remoteClose() {
+      if (_connected)
+        _disconnect();
+    }
+
+    // report the aborts, handlers may delete the clients
+    static void runEvents() {
+      auto& aborting = _aborting();
+      while (!aborting.empty()) {
+        AsyncClient* client = aborting.front();
+        aborting.erase(aborting.begin());
+        if (client->_onError.cb)
+          client->_onError.cb(client->_onError.arg, client, ERR_ABRT);
+        client->_disconnect();
+      }
+    }
+};
+
+class AsyncServer {
+  private:
+    uint16_t _port;
+    AcConnectHandler _onClient;
+    void* _arg = nullptr;
+
+    static std::vector<AsyncServer*>& _servers() {
+      static std::vector<AsyncServer*> servers;
+      return servers;
+    }
+
+  public:
+    explicit AsyncServer(uint16_t port) : _port(port) { _servers().push_back(this); }
+    ~AsyncServer() {
+      auto& servers = _servers();
+      servers.erase(std::remove(servers.begin(), servers.end(), this), servers.end());
+    }
+    AsyncServer(const AsyncServer&) = delete;
+    AsyncServer& operator=(const AsyncServer&) = delete;
+
+    void onClient(AcConnectHandler cb, void* arg) {
+      _onClient = cb;
+      _arg = arg;
+    }
+    void begin() {}
+    void end() {}
+    void setNoDelay(bool) {}
+
+    // test side
+
+    // the server listening on port, the one created last when there are several
+    static AsyncServer* at(uint16_t port) {
+      auto& servers = _servers();
+      for (auto it = servers.rbegin(); it != servers.rend(); ++it) {
+        if ((*it)->_port == port)
+          return *it;
+      }
+      return nullptr;
+    }
+    // hand over a new connection, the handler owns the client from now on
+    void accept(AsyncClient* client) {
+      if (_onClient)
+        _onClient(_arg, client);
+    }
+};
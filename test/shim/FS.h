@@ -0,0 +1,37 @@
+#pragma once
+#include "Arduino.h"
+
+// no file system on the host: files never exist and never open
+namespace fs {
+
+class File : public Stream {
+  public:
+    size_t write(uint8_t) override { return 0; }
+    size_t write(const uint8_t*, size_t) override { return 0; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    size_t read(uint8_t*, size_t) { return 0; }
+    bool seek(uint32_t) { return false; }
+    size_t position() const { return 0; }
+    size_t size() const { return 0; }
+    void close() {}
+    const char* name() const { return ""; }
+    const char* path() const { return ""; }
+    bool isDirectory() const { return false; }
+    time_t getLastWrite() { return 0; }
+    operator bool() const { return false; }
+};
+
+class FS {
+  public:
+    File open(const char*, const char* = "r", bool = false) { return File(); }
+    File open(const String& path, const char* mode = "r", bool create = false) { return open(path.c_str(), mode, create); }
+    bool exists(const char*) { return false; }
+    bool exists(const String&) { return false; }
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
@@ -0,0 +1,103 @@
+#pragma once
+#include "Arduino.h"
+
+// MD5 of the Digest authentication, RFC 1321
+class MD5Builder {
+  private:
+    uint32_t _state[4];
+    uint8_t _block[64];
+    uint64_t _total;
+    uint8_t _digest[16];
+
+    void _transform(const uint8_t* block) {
+      static const uint32_t k[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+      };
+      static const uint8_t r[64] = {7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+                                    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+      uint32_t m[16];
+      for (int i = 0; i < 16; i++)
+        m[i] = block[i * 4] | block[i * 4 + 1] << 8 | block[i * 4 + 2] << 16 | (uint32_t)block[i * 4 + 3] << 24;
+
+      uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+      for (int i = 0; i < 64; i++) {
+        uint32_t f;
+        int g;
+        if (i < 16) {
+          f = (b & c) | (~b & d);
+          g = i;
+        } else if (i < 32) {
+          f = (d & b) | (~d & c);
+          g = (5 * i + 1) % 16;
+        } else if (i < 48) {
+          f = b ^ c ^ d;
+          g = (3 * i + 5) % 16;
+        } else {
+          f = c ^ (b | ~d);
+          g = (7 * i) % 16;
+        }
+        const uint32_t x = a + f + k[i] + m[g];
+        a = d;
+        d = c;
+        c = b;
+        b += (x << r[i]) | (x >> (32 - r[i]));
+      }
+      _state[0] += a;
+      _state[1] += b;
+      _state[2] += c;
+      _state[3] += d;
+    }
+
+  public:
+    void begin() {
+      _state[0] = 0x67452301;
+      _state[1] = 0xefcdab89;
+      _state[2] = 0x98badcfe;
+      _state[3] = 0x10325476;
+      _total = 0;
+    }
+    void add(const uint8_t* data, size_t len) {
+      while (len) {
+        const size_t used = _total % 64;
+        const size_t n = std::min(len, 64 - used);
+        memcpy(_block + used, data, n);
+        _total += n;
+        data += n;
+        len -= n;
+        if (used + n == 64)
+          _transform(_block);
+      }
+    }
+    void add(const char* data) { add((const uint8_t*)data, strlen(data)); }
+    void add(const String& data) { add((const uint8_t*)data.c_str(), data.length()); }
+    void calculate() {
+      const uint64_t bits = _total * 8;
+      const uint8_t pad = 0x80, zero = 0;
+      add(&pad, 1);
+      while (_total % 64 != 56)
+        add(&zero, 1);
+      for (int i = 0; i < 8; i++) {
+        const uint8_t b = bits >> (i * 8);
+        add(&b, 1);
+      }
+      for (int i = 0; i < 16; i++)
+        _digest[i] = _state[i / 4] >> ((i % 4) * 8);
+    }
+    void getBytes(uint8_t* output) const { memcpy(output, _digest, 16); }
+    void getChars(char* output) const {
+      for (int i = 0; i < 16; i++)
+        sprintf(output + i * 2, "%02x", _digest[i]);
+    }
+    String toString() const {
+      char out[33];
+      getChars(out);
+      return String(out);
+    }
+};
@@ -0,0 +1,20 @@
+#pragma once
+#include "Arduino.h"
+
+class StreamString : public Stream, public String {
+  public:
+    size_t write(const uint8_t* data, size_t size) override {
+      concat((const char*)data, size);
+      return size;
+    }
+    size_t write(uint8_t data) override { return write(&data, 1); }
+    int available() override { return length(); }
+    int read() override {
+      if (!length())
+        return -1;
+      const char c = charAt(0);
+      remove(0, 1);
+      return (uint8_t)c;
+    }
+    int peek() override { return length() ? (uint8_t)charAt(0) : -1; }
+};
@@ -0,0 +1,12 @@
+#pragma once
+#include "Arduino.h"
+
+class WiFiClass {
+  public:
+    IPAddress localIP() { return IPAddress(192, 168, 1, 1); }
+    IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+    int8_t RSSI() { return -60; }
+    bool isConnected() { return true; }
+};
+
+inline WiFiClass WiFi;
@@ -0,0 +1,37 @@
+#pragma once
+
+#define base64_decode_expected_len(n) ((n * 3) / 4)
+
+inline int base64_decode_value(char value) {
+  if (value >= 'A' && value <= 'Z')
+    return value - 'A';
+  if (value >= 'a' && value <= 'z')
+    return value - 'a' + 26;
+  if (value >= '0' && value <= '9')
+    return value - '0' + 52;
+  if (value == '+')
+    return 62;
+  if (value == '/')
+    return 63;
+  return -1;
+}
+
+// stops at the first character that is not base64, padding included
+inline int base64_decode_chars(const char* code, int length, char* plaintext) {
+  char* out = plaintext;
+  unsigned bits = 0;
+  int count = 0;
+  for (int i = 0; i < length; i++) {
+    const int v = base64_decode_value(code[i]);
+    if (v < 0)
+      break;
+    bits = bits << 6 | v;
+    count += 6;
+    if (count >= 8) {
+      count -= 8;
+      *out++ = bits >> count;
+    }
+  }
+  *out = 0;
+  return out - plaintext;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+// libb64 encoder as in the ESP32 core, without line breaks
+
+typedef enum { step_A, step_B, step_C } base64_encodestep;
+
+typedef struct {
+    base64_encodestep step;
+    char result;
+    int stepcount;
+} base64_encodestate;
+
+#define base64_encode_expected_len(n) ((((4 * (n)) / 3) + 3) & ~3)
+
+inline void base64_init_encodestate(base64_encodestate* state) {
+  state->step = step_A;
+  state->result = 0;
+  state->stepcount = 0;
+}
+
+inline char base64_encode_value(char value) {
+  static const char* encoding = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  return value > 63 ? '=' : encoding[(int)value];
+}
+
+inline int base64_encode_block(const char* plaintext, int length, char* code, base64_encodestate* state) {
+  const char* p = plaintext;
+  const char* const end = plaintext + length;
+  char* c = code;
+  char result = state->result;
+
+  switch (state->step) {
+    while (1) {
+      case step_A:
+        if (p == end) {
+          state->result = result;
+          state->step = step_A;
+          return c - code;
+        }
+        result = (*p & 0xfc) >> 2;
+        *c++ = base64_encode_value(result);
+        result = (*p++ & 0x03) << 4;
+        [[fallthrough]];
+      case step_B:
+        if (p == end) {
+          state->result = result;
+          state->step = step_B;
+          return c - code;
+        }
+        result |= (*p & 0xf0) >> 4;
+        *c++ = base64_encode_value(result);
+        result = (*p++ & 0x0f) << 2;
+        [[fallthrough]];
+      case step_C:
+        if (p == end) {
+          state->result = result;
+          state->step = step_C;
+          return c - code;
+        }
+        result |= (*p & 0xc0) >> 6;
+        *c++ = base64_encode_value(result);
+        result = *p++ & 0x3f;
+        *c++ = base64_encode_value(result);
+        state->stepcount++;
+    }
+  }
+  return c - code;
+}
+
+inline int base64_encode_blockend(char* code, base64_encodestate* state) {
+  char* c = code;
+  switch (state->step) {
+    case step_B:
+      *c++ = base64_encode_value(state->result);
+      *c++ = '=';
+      *c++ = '=';
+      break;
+    case step_C:
+      *c++ = base64_encode_value(state->result);
+      *c++ = '=';
+      break;
+    case step_A:
+      break;
+  }
+  *c = 0;
+  return c - code;
+}
+
+inline int base64_encode_chars(const char* plaintext, int length, char* code) {
+  base64_encodestate state;
+  base64_init_encodestate(&state);
+  int len = base64_encode_block(plaintext, length, code, &state);
+  return len + base64_encode_blockend(code + len, &state);
+}
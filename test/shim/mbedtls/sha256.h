@@ -0,0 +1,108 @@
+#pragma once
+
+// the mbedTLS SHA-256 API AsyncCrypto uses on ESP32, over a plain implementation
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t state[8];
+    uint8_t block[64];
+    uint64_t total;
+} mbedtls_sha256_context;
+
+inline void mbedtls_sha256_block(uint32_t* state, const uint8_t* block) {
+  static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+  };
+  auto ror = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++)
+    w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+  for (int i = 16; i < 64; i++)
+    w[i] = w[i - 16] + (ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 7] + (ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+  uint32_t v[8];
+  memcpy(v, state, sizeof(v));
+  for (int i = 0; i < 64; i++) {
+    const uint32_t t1 = v[7] + (ror(v[4], 6) ^ ror(v[4], 11) ^ ror(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + k[i] + w[i];
+    const uint32_t t2 = (ror(v[0], 2) ^ ror(v[0], 13) ^ ror(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+    memmove(v + 1, v, 7 * sizeof(uint32_t));
+    v[4] += t1;
+    v[0] = t1 + t2;
+  }
+  for (int i = 0; i < 8; i++)
+    state[i] += v[i];
+}
+
+inline void mbedtls_sha256_init(mbedtls_sha256_context* ctx) {
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+inline void mbedtls_sha256_free(mbedtls_sha256_context* ctx) {
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+inline void mbedtls_sha256_clone(mbedtls_sha256_context* dst, const mbedtls_sha256_context* src) {
+  *dst = *src;
+}
+
+inline int mbedtls_sha256_starts_ret(mbedtls_sha256_context* ctx, int is224) {
+  static const uint32_t iv[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  if (is224)
+    return -1;
+  memcpy(ctx->state, iv, sizeof(iv));
+  ctx->total = 0;
+  return 0;
+}
+
+inline int mbedtls_sha256_update_ret(mbedtls_sha256_context* ctx, const unsigned char* input, size_t len) {
+  while (len) {
+    const size_t used = ctx->total % 64;
+    const size_t n = len < 64 - used ? len : 64 - used;
+    memcpy(ctx->block + used, input, n);
+    ctx->total += n;
+    input += n;
+    len -= n;
+    if (used + n == 64)
+      mbedtls_sha256_block(ctx->state, ctx->block);
+  }
+  return 0;
+}
+
+inline int mbedtls_sha256_finish_ret(mbedtls_sha256_context* ctx, unsigned char* output) {
+  const uint64_t bits = ctx->total * 8;
+  const uint8_t pad = 0x80;
+  const uint8_t zero = 0;
+  mbedtls_sha256_update_ret(ctx, &pad, 1);
+  while (ctx->total % 64 != 56)
+    mbedtls_sha256_update_ret(ctx, &zero, 1);
+  for (int i = 7; i >= 0; i--) {
+    const uint8_t b = bits >> (i * 8);
+    mbedtls_sha256_update_ret(ctx, &b, 1);
+  }
+  for (int i = 0; i < 32; i++)
+    output[i] = ctx->state[i / 4] >> (24 - (i % 4) * 8);
+  return 0;
+}
+
+inline int mbedtls_sha256_starts(mbedtls_sha256_context* ctx, int is224) {
+  return mbedtls_sha256_starts_ret(ctx, is224);
+}
+
+inline int mbedtls_sha256_update(mbedtls_sha256_context* ctx, const unsigned char* input, size_t len) {
+  return mbedtls_sha256_update_ret(ctx, input, len);
+}
+
+inline int mbedtls_sha256_finish(mbedtls_sha256_context* ctx, unsigned char* output) {
+  return mbedtls_sha256_finish_ret(ctx, output);
+}
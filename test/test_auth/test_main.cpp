@@ -0,0 +1,316 @@
+#include <ESPAsyncWebServer.h>
+#include <MD5Builder.h>
+#include <WebAuthentication.h>
+#include <unity.h>
+
+#include <chrono>
+
+/*
+  Basic and Digest authentication: the Basic header compared as base64 without decoding it, the Digest nonces
+  issued and accepted by AsyncDigestNonces (once per nonce count, within the TTL, while the table remembers them),
+  and the challenges and checks of AsyncWebServerRequest around them.
+*/
+
+static constexpr uint32_t TTL_MS = ASYNCWEBSERVER_DIGEST_NONCE_TTL * 1000UL;
+static const char* REALM = "esp";
+
+static AsyncDigestNonces& nonces = AsyncDigestNonces::Instance();
+
+static std::string md5(const std::string& in) {
+  MD5Builder md5;
+  md5.begin();
+  md5.add(in.c_str());
+  md5.calculate();
+  return md5.toString().c_str();
+}
+
+// the Authorization header of a browser answering the challenge with nonce
+static std::string digest(const char* username, const char* password, const std::string& nonce, uint32_t nc, const char* uri = "/secret", const char* method = "GET") {
+  char count[9];
+  snprintf(count, sizeof(count), "%08x", (unsigned)nc);
+  const std::string cnonce = "0a4f113b";
+  const std::string ha1 = md5(std::string(username) + ":" + REALM + ":" + password);
+  const std::string ha2 = md5(std::string(method) + ":" + uri);
+  const std::string response = md5(ha1 + ":" + nonce + ":" + count + ":" + cnonce + ":auth:" + ha2);
+  return std::string("Digest username=\"") + username + "\", realm=\"" + REALM + "\", nonce=\"" + nonce + "\", uri=\"" + uri +
+         "\", qop=auth, nc=" + count + ", cnonce=\"" + cnonce + "\", response=\"" + response + "\", opaque=\"5ccc069c403ebaf9f0171e9517f40e41\"";
+}
+
+// the header checked the way AsyncWebServerRequest::authenticate() does, without a request
+static bool check(const std::string& header, const char* password = "secret", bool* stale = nullptr) {
+  const char* value = header.c_str() + strlen("Digest ");
+  return checkDigestAuthentication(value, "GET", "admin", password, REALM, false, NULL, NULL, NULL, stale);
+}
+
+void setUp() {
+  // the nonces of the test before are expired and the table is free again
+  host::advance(TTL_MS + 1);
+}
+
+void tearDown() {}
+
+void test_basic_padding() {
+  // "a:b", "ab:cd" and "a:bc" need 0, 1 and 2 padding characters
+  TEST_ASSERT_TRUE(checkBasicAuthentication("YTpi", "a", "b"));
+  TEST_ASSERT_TRUE(checkBasicAuthentication("YWI6Y2Q=", "ab", "cd"));
+  TEST_ASSERT_TRUE(checkBasicAuthentication("YTpiYw==", "a", "bc"));
+  TEST_ASSERT_EQUAL_STRING("YTpiYw==", generateBasicHash("a", "bc").c_str());
+
+  // a long one against the encoder
+  const String hash = generateBasicHash("administrator", "correct horse battery staple");
+  TEST_ASSERT_TRUE(checkBasicAuthentication(hash.c_str(), "administrator", "correct horse battery staple"));
+}
+
+void test_basic_refused() {
+  // base64 is case sensitive
+  TEST_ASSERT_FALSE(checkBasicAuthentication("ytpi", "a", "b"));
+  TEST_ASSERT_FALSE(checkBasicAuthentication("YTPI", "a", "b"));
+  // padding missing, wrong or where data should be
+  TEST_ASSERT_FALSE(checkBasicAuthentication("YTpiYw", "a", "bc"));
+  TEST_ASSERT_FALSE(checkBasicAuthentication("YTpiYw=A", "a", "bc"));
+  TEST_ASSERT_FALSE(checkBasicAuthentication("YWI6Y2==", "ab", "cd"));
+  TEST_ASSERT_FALSE(checkBasicAuthentication("YTpi====", "a", "b"));
+  // other credentials, other split of the same text, nothing
+  TEST_ASSERT_FALSE(checkBasicAuthentication("YTpi", "a", "c"));
+  TEST_ASSERT_FALSE(checkBasicAuthentication("YTpiYw==", "a:", "c"));
+  TEST_ASSERT_FALSE(checkBasicAuthentication("", "a", "b"));
+  TEST_ASSERT_FALSE(checkBasicAuthentication(NULL, "a", "b"));
+  TEST_ASSERT_FALSE(checkBasicAuthentication("YTpi", NULL, "b"));
+
+  // every single character changed
+  const String hash = generateBasicHash("admin", "secret");
+  for (size_t i = 0; i < hash.length(); i++) {
+    String changed = hash;
+    changed.setCharAt(i, hash[i] == 'A' ? 'B' : 'A');
+    TEST_ASSERT_FALSE_MESSAGE(checkBasicAuthentication(changed.c_str(), "admin", "secret"), changed.c_str());
+  }
+}
+
+void test_digest_accept_and_replay() {
+  const AsyncDigestNonceStats before = nonces.stats();
+  const std::string nonce = nonces.issue().c_str();
+  TEST_ASSERT_EQUAL(32, nonce.size());
+
+  bool stale = false;
+  TEST_ASSERT_TRUE(check(digest("admin", "secret", nonce, 1), "secret", &stale));
+  TEST_ASSERT_FALSE(stale);
+  // the same nonce count again is a replay, the response itself is right so the client may retry
+  TEST_ASSERT_FALSE(check(digest("admin", "secret", nonce, 1), "secret", &stale));
+  TEST_ASSERT_TRUE(stale);
+  // higher ones are accepted, lower ones are not
+  TEST_ASSERT_TRUE(check(digest("admin", "secret", nonce, 2)));
+  TEST_ASSERT_TRUE(check(digest("admin", "secret", nonce, 7)));
+  TEST_ASSERT_FALSE(check(digest("admin", "secret", nonce, 5)));
+
+  // a wrong password is not stale, and does not use a nonce count
+  stale = false;
+  TEST_ASSERT_FALSE(check(digest("admin", "guess", nonce, 8), "secret", &stale));
+  TEST_ASSERT_FALSE(stale);
+  TEST_ASSERT_TRUE(check(digest("admin", "secret", nonce, 8)));
+
+  TEST_ASSERT_EQUAL(4, nonces.stats().accepted - before.accepted);
+  TEST_ASSERT_EQUAL(2, nonces.stats().replayed - before.replayed);
+}
+
+void test_digest_stale_and_forged() {
+  const std::string nonce = nonces.issue().c_str();
+  // a nonce not issued here, with every character changed in turn
+  for (size_t i = 0; i < nonce.size(); i++) {
+    std::string forged = nonce;
+    forged[i] = forged[i] == '0' ? '1' : '0';
+    bool stale = false;
+    TEST_ASSERT_FALSE_MESSAGE(check(digest("admin", "secret", forged, 1), "secret", &stale), forged.c_str());
+    TEST_ASSERT_TRUE(stale);
+  }
+  TEST_ASSERT_FALSE(check(digest("admin", "secret", nonce.substr(0, 31), 1)));
+  // the real one still has its first nonce count
+  TEST_ASSERT_TRUE(check(digest("admin", "secret", nonce, 1)));
+}
+
+void test_digest_expired() {
+  const std::string nonce = nonces.issue().c_str();
+  host::advance(TTL_MS - 1);
+  TEST_ASSERT_TRUE(check(digest("admin", "secret", nonce, 1)));
+  host::advance(1);
+  bool stale = false;
+  TEST_ASSERT_FALSE(check(digest("admin", "secret", nonce, 2), "secret", &stale));
+  TEST_ASSERT_TRUE(stale);
+}
+
+// when the table is full the nonce issued first is forgotten, with all the nonces issued before it
+static void tableFull() {
+  std::vector<std::string> issued;
+  for (size_t i = 0; i < ASYNCWEBSERVER_DIGEST_NONCES + 2; i++) {
+    issued.push_back(nonces.issue().c_str());
+    host::advance(10);
+  }
+  // the first one is never used, the others fill the table and one more
+  for (size_t i = 1; i < issued.size(); i++)
+    TEST_ASSERT_TRUE(check(digest("admin", "secret", issued[i], 1)));
+
+  // the second one was forgotten to make room, the first was issued before it
+  bool stale = false;
+  TEST_ASSERT_FALSE(check(digest("admin", "secret", issued[1], 2), "secret", &stale));
+  TEST_ASSERT_TRUE(stale);
+  TEST_ASSERT_FALSE(check(digest("admin", "secret", issued[0], 1)));
+  // the ones kept still count on, the table does not take the replay of a forgotten one
+  for (size_t i = 2; i < issued.size(); i++) {
+    TEST_ASSERT_FALSE(check(digest("admin", "secret", issued[i], 1)));
+    TEST_ASSERT_TRUE(check(digest("admin", "secret", issued[i], 2)));
+  }
+
+  // a nonce issued after the forgotten one is good
+  const std::string fresh = nonces.issue().c_str();
+  host::advance(10);
+  TEST_ASSERT_TRUE(check(digest("admin", "secret", fresh, 1)));
+}
+
+void test_digest_table_full() {
+  tableFull();
+}
+
+// the same across the wrap of millis()
+void test_digest_table_full_across_millis_wrap() {
+  host::now = (0x100000000ULL - 40) * 1000;
+  tableFull();
+  // millis() wrapped in the middle of it
+  TEST_ASSERT_LESS_THAN(TTL_MS, (uint32_t)millis());
+  // and the forgetting ends once the TTL is over
+  host::advance(TTL_MS);
+  const std::string nonce = nonces.issue().c_str();
+  TEST_ASSERT_TRUE(check(digest("admin", "secret", nonce, 1)));
+}
+
+// through the server: a middleware with the HA1 and a handler checking the plain password and the hash form
+
+static AsyncWebServer* startServer() {
+  AsyncWebServer* server = new AsyncWebServer(80);
+  // middlewares are not owned by the server
+  static AsyncAuthenticationMiddleware auth;
+  auth.setUsername("admin");
+  auth.setPassword("secret");
+  auth.setRealm(REALM);
+  auth.setAuthType(AsyncAuthType::AUTH_DIGEST);
+  auth.generateHash();
+  server->on("/secret", HTTP_GET, [](AsyncWebServerRequest* request) {
+    const String hash = String("admin:") + REALM + ":" + generateDigestHash("admin", "secret", REALM);
+    String body;
+    body += request->authenticate("admin", "secret", REALM) ? "plain " : "- ";
+    body += request->authenticate(hash.c_str()) ? "hash " : "- ";
+    body += request->authenticate("admin", "guess", REALM) ? "guess" : "-";
+    request->send(200, "text/plain", body);
+  }).addMiddleware(&auth);
+  server->begin();
+  return server;
+}
+
+static std::string get(const std::string& authorization) {
+  AsyncClient* client = new AsyncClient();
+  std::shared_ptr<AsyncPeer> peer = client->peer();
+  AsyncServer::at(80)->accept(client);
+  std::string request = "GET /secret HTTP/1.1\r\nHost: esp\r\n";
+  if (!authorization.empty())
+    request += "Authorization: " + authorization + "\r\n";
+  client->receive((request + "\r\n").c_str());
+  for (int i = 0; i < 10 && peer->client; i++)
+    peer->client->acknowledge();
+  if (peer->client)
+    peer->client->remoteClose();
+  return peer->output;
+}
+
+static std::string challengeNonce(const std::string& response) {
+  const size_t at = response.find("nonce=\"");
+  TEST_ASSERT_NOT_EQUAL(std::string::npos, at);
+  return response.substr(at + 7, 32);
+}
+
+void test_request_checks_once_per_nonce_count() {
+  AsyncWebServer* server = startServer();
+
+  const std::string challenge = get("");
+  TEST_ASSERT_EQUAL_STRING("401", challenge.substr(9, 3).c_str());
+  TEST_ASSERT_EQUAL(std::string::npos, challenge.find("stale=TRUE"));
+  const std::string nonce = challengeNonce(challenge);
+
+  // three checks in one request, the nonce count is used once and the wrong password still fails
+  const std::string ok = get(digest("admin", "secret", nonce, 1));
+  TEST_ASSERT_EQUAL_STRING("200", ok.substr(9, 3).c_str());
+  TEST_ASSERT_NOT_EQUAL(std::string::npos, ok.find("\r\n\r\nplain hash -"));
+
+  // the same header again is a replay, challenged with stale=TRUE so the browser retries without asking
+  const std::string replay = get(digest("admin", "secret", nonce, 1));
+  TEST_ASSERT_EQUAL_STRING("401", replay.substr(9, 3).c_str());
+  TEST_ASSERT_NOT_EQUAL(std::string::npos, replay.find("stale=TRUE"));
+  TEST_ASSERT_TRUE(nonce != challengeNonce(replay));
+
+  // a wrong password is not stale
+  const std::string wrong = get(digest("admin", "guess", nonce, 2));
+  TEST_ASSERT_EQUAL_STRING("401", wrong.substr(9, 3).c_str());
+  TEST_ASSERT_EQUAL(std::string::npos, wrong.find("stale=TRUE"));
+
+  TEST_ASSERT_EQUAL_STRING("200", get(digest("admin", "secret", nonce, 2)).substr(9, 3).c_str());
+  delete server;
+}
+
+template <typename F>
+static double nsPer(int rounds, F f) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++)
+    f(i);
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+}
+
+// what authentication adds to a request: the checks alone, and whole requests with and without the middleware
+void test_benchmark_auth_overhead() {
+  const String basic = generateBasicHash("admin", "secret");
+  int accepted = 0;
+  const double basicNs = nsPer(200000, [&](int) { accepted += checkBasicAuthentication(basic.c_str(), "admin", "secret"); });
+  TEST_ASSERT_EQUAL(200000, accepted);
+
+  const std::string nonce = nonces.issue().c_str();
+  accepted = 0;
+  const double digestNs = nsPer(20000, [&](int i) { accepted += check(digest("admin", "secret", nonce, i + 1)); });
+  TEST_ASSERT_EQUAL(20000, accepted);
+  const double headerNs = nsPer(20000, [&](int i) { accepted += digest("admin", "secret", nonce, i + 1).size() > 0; });
+
+  AsyncWebServer* server = startServer();
+  server->on("/open", HTTP_GET, [](AsyncWebServerRequest* request) { request->send(200, "text/plain", "plain hash -"); });
+  const std::string session = challengeNonce(get(""));
+  auto request = [](const char* url, const std::string& authorization) {
+    AsyncClient* client = new AsyncClient();
+    std::shared_ptr<AsyncPeer> peer = client->peer();
+    AsyncServer::at(80)->accept(client);
+    client->receive((std::string("GET ") + url + " HTTP/1.1\r\nHost: esp\r\nAuthorization: " + authorization + "\r\n\r\n").c_str());
+    for (int i = 0; i < 10 && peer->client; i++)
+      peer->client->acknowledge();
+    if (peer->client)
+      peer->client->remoteClose();
+    TEST_ASSERT_EQUAL_STRING("200", peer->output.substr(9, 3).c_str());
+  };
+  std::vector<std::string> headers;
+  for (int i = 0; i < 2000; i++)
+    headers.push_back(digest("admin", "secret", session, i + 1));
+  const double openNs = nsPer(2000, [&](int i) { request("/open", headers[i]); });
+  const double securedNs = nsPer(2000, [&](int i) { request("/secret", headers[i]); });
+  delete server;
+
+  char result[200];
+  snprintf(result, sizeof(result), "Basic check %.0f ns, Digest check %.0f ns, request %.1f us open, %.1f us with Digest (3 checks)",
+           basicNs, digestNs - headerNs, openNs / 1000, securedNs / 1000);
+  TEST_MESSAGE(result);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_basic_padding);
+  RUN_TEST(test_basic_refused);
+  RUN_TEST(test_digest_accept_and_replay);
+  RUN_TEST(test_digest_stale_and_forged);
+  RUN_TEST(test_digest_expired);
+  RUN_TEST(test_digest_table_full);
+  RUN_TEST(test_digest_table_full_across_millis_wrap);
+  RUN_TEST(test_request_checks_once_per_nonce_count);
+  RUN_TEST(test_benchmark_auth_overhead);
+  return UNITY_END();
+}
@@ -0,0 +1,257 @@
+#include <AsyncBudget.h>
+#include <AsyncEventSource.h>
+#include <ESPAsyncWebServer.h>
+#include <StreamString.h>
+#include <unity.h>
+
+#include <deque>
+
+/*
+  AsyncWebServerBudget under 32 consumers draining at different speeds, the slowest 64 bytes per tick. Producers
+  either queue whole messages (admit(), like SSE and WebSocket) or take what they can (grant(), like chunked
+  responses). The budget must never be exceeded, must not be held by flows that gave up, and every flow that keeps
+  asking must get its turn.
+*/
+
+static constexpr size_t LIMIT = 32 * 1024;
+static constexpr size_t CONSUMERS = 32;
+
+static AsyncWebServerBudget& budget = AsyncWebServerBudget::Instance();
+
+struct Consumer {
+    AsyncWebServerBudget::Flow flow;
+    // bytes held, in the order they were charged
+    std::deque<size_t> held;
+    size_t drainRate = 0;
+    bool chunked = false;
+    bool asking = true;
+    // ticks since the last grant while asking
+    uint32_t waiting = 0;
+    uint32_t longestWait = 0;
+    size_t granted = 0;
+
+    void produce() {
+      if (!asking)
+        return;
+      size_t got;
+      if (chunked) {
+        got = flow.grant(4096, 512);
+      } else {
+        const size_t size = 200 + esp_random() % 2800;
+        got = flow.admit(size) ? size : 0;
+      }
+      if (got) {
+        held.push_back(got);
+        granted += got;
+        waiting = 0;
+      } else {
+        longestWait = std::max(longestWait, ++waiting);
+      }
+    }
+
+    // the peer acknowledged drainRate bytes
+    void drain() {
+      size_t budget = drainRate;
+      while (budget && !held.empty()) {
+        const size_t n = std::min(budget, held.front());
+        held.front() -= n;
+        budget -= n;
+        flow.release(n);
+        if (!held.front())
+          held.pop_front();
+      }
+    }
+
+    size_t holding() const {
+      size_t n = 0;
+      for (size_t h : held)
+        n += h;
+      return n;
+    }
+};
+
+static size_t metric(const char* name) {
+  StreamString out;
+  budget.printTo(out);
+  // the sample, not the # TYPE line
+  const char* line = strstr(out.c_str(), (String("\n") + name + " ").c_str());
+  return line ? strtoul(line + strlen(name) + 2, nullptr, 10) : SIZE_MAX;
+}
+
+void setUp() {
+  budget.setLimit(LIMIT);
+  budget.setQuantum(1460);
+}
+
+void tearDown() {
+  budget.setLimit(0);
+}
+
+static void checkAccounts(const std::vector<Consumer*>& consumers) {
+  size_t held = 0;
+  for (const Consumer* c : consumers) {
+    TEST_ASSERT_EQUAL(c->holding(), c->flow.used());
+    held += c->holding();
+  }
+  TEST_ASSERT_EQUAL(held, budget.used());
+  TEST_ASSERT_LESS_OR_EQUAL(LIMIT, budget.used());
+}
+
+void test_slow_consumers() {
+  std::vector<Consumer*> consumers;
+  for (size_t i = 0; i < CONSUMERS; i++) {
+    Consumer* c = new Consumer();
+    // a quarter drains 64 bytes per tick, the others up to 4 KB
+    c->drainRate = i % 4 == 0 ? 64 : 256 << (i % 5);
+    c->chunked = i % 3 == 0;
+    consumers.push_back(c);
+  }
+
+  for (int tick = 0; tick < 20000; tick++) {
+    host::advance(1);
+    // producers in a different order every tick
+    const size_t first = esp_random() % CONSUMERS;
+    for (size_t i = 0; i < CONSUMERS; i++)
+      consumers[(first + i) % CONSUMERS]->produce();
+    checkAccounts(consumers);
+    for (Consumer* c : consumers)
+      c->drain();
+  }
+
+  size_t fewest = SIZE_MAX, most = 0;
+  uint32_t longestWait = 0;
+  for (Consumer* c : consumers) {
+    TEST_ASSERT_GREATER_THAN(0, c->granted);
+    longestWait = std::max(longestWait, c->longestWait);
+    fewest = std::min(fewest, c->granted);
+    most = std::max(most, c->granted);
+  }
+  char result[128];
+  snprintf(result, sizeof(result), "longest wait %u ticks, granted per flow %zu to %zu bytes", longestWait, fewest, most);
+  TEST_MESSAGE(result);
+  // a round deals every flow a quantum, a flow waits a few rounds at most
+  TEST_ASSERT_LESS_OR_EQUAL(200, longestWait);
+
+  for (Consumer* c : consumers)
+    delete c;
+  TEST_ASSERT_EQUAL(0, budget.used());
+  TEST_ASSERT_EQUAL(0, metric("asyncwebserver_budget_backlogged_flows"));
+}
+
+// flows refused once that then stop asking and hold nothing must not keep the credit dealt to them for long
+void test_idle_refused_flows_do_not_pin_credit() {
+  std::vector<Consumer*> busy, idle;
+  for (size_t i = 0; i < CONSUMERS / 2; i++) {
+    busy.push_back(new Consumer());
+    idle.push_back(new Consumer());
+  }
+
+  // the busy flows fill the budget, the others get refused and join the backlog
+  for (Consumer* c : busy) {
+    while (c->flow.admit(1024))
+      c->held.push_back(1024);
+  }
+  for (Consumer* c : idle) {
+    TEST_ASSERT_FALSE(c->flow.admit(2048));
+    c->asking = false;
+  }
+  TEST_ASSERT_EQUAL(CONSUMERS, metric("asyncwebserver_budget_backlogged_flows"));
+
+  // the busy flows keep sending as fast as their peers read, 100 ms per tick
+  size_t drained = 0, granted = 0;
+  for (Consumer* c : busy)
+    c->drainRate = 512;
+  for (int tick = 0; tick < 100; tick++) {
+    host::advance(100);
+    for (Consumer* c : busy) {
+      const size_t before = c->holding();
+      c->drain();
+      if (tick >= 50)
+        drained += before - c->holding();
+    }
+    for (Consumer* c : busy) {
+      while (c->flow.admit(1024)) {
+        c->held.push_back(1024);
+        if (tick >= 50)
+          granted += 1024;
+      }
+    }
+    // ASYNCWEBSERVER_BUDGET_IDLE_MS after they last asked the refused flows are gone
+    if (tick >= ASYNCWEBSERVER_BUDGET_IDLE_MS / 100)
+      TEST_ASSERT_LESS_OR_EQUAL(busy.size(), metric("asyncwebserver_budget_backlogged_flows"));
+  }
+  // what is read is sent again, none of it stays parked for the idle flows
+  char result[96];
+  snprintf(result, sizeof(result), "granted %zu of %zu bytes read in the last 5 s", granted, drained);
+  TEST_MESSAGE(result);
+  TEST_ASSERT_GREATER_OR_EQUAL(drained - 2 * 1024, granted);
+
+  for (Consumer* c : busy)
+    delete c;
+  for (Consumer* c : idle)
+    delete c;
+  TEST_ASSERT_EQUAL(0, budget.used());
+  TEST_ASSERT_EQUAL(0, metric("asyncwebserver_budget_backlogged_flows"));
+}
+
+void test_larger_than_limit_refused_without_waiting() {
+  AsyncWebServerBudget::Flow flow;
+  TEST_ASSERT_FALSE(flow.admit(LIMIT + 1));
+  TEST_ASSERT_EQUAL(0, flow.grant(LIMIT * 2, LIMIT + 1));
+  TEST_ASSERT_EQUAL(0, metric("asyncwebserver_budget_backlogged_flows"));
+  // others are not held up by it
+  AsyncWebServerBudget::Flow other;
+  TEST_ASSERT_TRUE(other.admit(LIMIT));
+}
+
+// the same through AsyncEventSource: 32 clients, a quarter of them barely reading
+void test_event_source_slow_clients() {
+  AsyncWebServer* server = new AsyncWebServer(80);
+  AsyncEventSource* events = new AsyncEventSource("/events");
+  server->addHandler(events);
+  server->begin();
+
+  std::vector<std::shared_ptr<AsyncPeer>> peers;
+  for (size_t i = 0; i < CONSUMERS; i++) {
+    AsyncClient* client = new AsyncClient(IPAddress(192, 168, 1, 10 + i));
+    peers.push_back(client->peer());
+    AsyncServer::at(80)->accept(client);
+    client->receive("GET /events HTTP/1.1\r\nHost: esp\r\nAccept: text/event-stream\r\n\r\n");
+    client->acknowledge();
+  }
+  TEST_ASSERT_EQUAL(CONSUMERS, events->count());
+
+  std::vector<size_t> received(CONSUMERS);
+  const std::string payload(700, 'x');
+  for (int tick = 0; tick < 2000; tick++) {
+    events->send(payload.c_str(), "tick", tick + 1);
+    TEST_ASSERT_LESS_OR_EQUAL(LIMIT, budget.used());
+    for (size_t i = 0; i < CONSUMERS; i++) {
+      if (!peers[i]->client)
+        continue;
+      // the slow ones acknowledge 64 bytes per tick
+      peers[i]->client->acknowledge(i % 4 == 0 ? 64 : SIZE_MAX);
+      received[i] += peers[i]->output.size();
+      peers[i]->output.clear();
+    }
+  }
+
+  for (size_t i = 0; i < CONSUMERS; i++) {
+    TEST_ASSERT_NOT_NULL(peers[i]->client);
+    TEST_ASSERT_GREATER_THAN(0, received[i]);
+  }
+  for (auto& peer : peers)
+    peer->client->remoteClose();
+  AsyncClient::runEvents();
+  delete server;
+  TEST_ASSERT_EQUAL(0, budget.used());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_slow_consumers);
+  RUN_TEST(test_idle_refused_flows_do_not_pin_credit);
+  RUN_TEST(test_larger_than_limit_refused_without_waiting);
+  RUN_TEST(test_event_source_slow_clients);
+  return UNITY_END();
+}
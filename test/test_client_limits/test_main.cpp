@@ -0,0 +1,189 @@
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <map>
+
+/*
+  The per IP request limit and the slow client deadlines of AsyncWebServer. The churn test opens and ends
+  connections from a pool of addresses, in every way a request can end, and checks each admission against a plain
+  count per IP: the table of ASYNCWEBSERVER_LIMIT_KEYS entries must never lose or keep an address, also when
+  _releaseClient() shifts entries back into the hole it leaves.
+*/
+
+static AsyncWebServer* server;
+
+void setUp() {
+  server = new AsyncWebServer(80);
+  server->on("/", HTTP_ANY, [](AsyncWebServerRequest* request) {
+    request->send(200, "text/plain", "ok");
+  });
+  server->begin();
+}
+
+void tearDown() {
+  delete server;
+  AsyncClient::runEvents();
+}
+
+struct Connection {
+    std::shared_ptr<AsyncPeer> peer;
+    uint32_t ip;
+};
+
+// nullptr peer when the connection was refused
+static std::shared_ptr<AsyncPeer> open(IPAddress ip) {
+  AsyncClient* client = new AsyncClient(ip);
+  std::shared_ptr<AsyncPeer> peer = client->peer();
+  AsyncServer::at(80)->accept(client);
+  AsyncClient::runEvents();
+  return peer->client ? peer : nullptr;
+}
+
+static void complete(const std::shared_ptr<AsyncPeer>& peer) {
+  if (peer->client)
+    peer->client->receive("GET / HTTP/1.1\r\nHost: esp\r\n\r\n");
+  for (int i = 0; i < 10 && peer->client; i++)
+    peer->client->acknowledge();
+}
+
+void test_churn_against_model() {
+  const uint8_t perIP = 2;
+  server->setMaxRequestsPerIP(perIP);
+  server->setHeaderTimeout(2000);
+
+  // more addresses than the table holds, several of them sharing a home slot
+  std::vector<IPAddress> pool;
+  for (int i = 0; i < 3 * ASYNCWEBSERVER_LIMIT_KEYS; i++)
+    pool.push_back(IPAddress(192, 168, esp_random() % 4, 1 + esp_random() % 254));
+
+  std::map<uint32_t, unsigned> model;
+  std::vector<Connection> open_;
+  uint32_t refused = 0;
+
+  for (int op = 0; op < 20000; op++) {
+    const uint32_t what = esp_random() % 8;
+    if (what < 4 || open_.empty()) {
+      const IPAddress ip = pool[esp_random() % pool.size()];
+      const uint32_t key = (uint32_t)ip;
+      const bool expected = model.count(key) ? model[key] < perIP : model.size() < ASYNCWEBSERVER_LIMIT_KEYS;
+      std::shared_ptr<AsyncPeer> peer = open(ip);
+      char what[64];
+      snprintf(what, sizeof(what), "op %d, %s with %u open", op, ip.toString().c_str(), model.count(key) ? model[key] : 0);
+      TEST_ASSERT_EQUAL_MESSAGE(expected, peer != nullptr, what);
+      if (peer) {
+        model[key]++;
+        open_.push_back({peer, key});
+      } else {
+        refused++;
+      }
+      continue;
+    }
+
+    const size_t i = esp_random() % open_.size();
+    Connection c = open_[i];
+    open_.erase(open_.begin() + i);
+    switch (what) {
+      case 4:
+        c.peer->client->remoteClose();
+        break;
+      case 5:
+        complete(c.peer);
+        break;
+      case 6:
+        // a slow client, caught by the header deadline on the next poll
+        c.peer->client->receive("GET / HTTP/1.1\r\n");
+        host::advance(2000);
+        c.peer->client->poll();
+        TEST_ASSERT_TRUE(c.peer->client->aborted());
+        break;
+      default:
+        c.peer->client->timeout();
+        break;
+    }
+    AsyncClient::runEvents();
+    TEST_ASSERT_NULL(c.peer->client);
+    if (!--model[c.ip])
+      model.erase(c.ip);
+  }
+
+  for (Connection& c : open_)
+    c.peer->client->remoteClose();
+  TEST_ASSERT_EQUAL(refused, server->limitStats().refused);
+
+  // all entries were released, every address gets in again
+  for (int i = 0; i < ASYNCWEBSERVER_LIMIT_KEYS; i++) {
+    std::shared_ptr<AsyncPeer> peer = open(pool[i]);
+    TEST_ASSERT_NOT_NULL(peer);
+    peer->client->remoteClose();
+  }
+}
+
+void test_header_timeout() {
+  server->setMaxRequestsPerIP(1);
+  server->setHeaderTimeout(2000);
+  std::shared_ptr<AsyncPeer> peer = open(IPAddress(10, 0, 0, 1));
+  TEST_ASSERT_NOT_NULL(peer);
+  TEST_ASSERT_NULL(open(IPAddress(10, 0, 0, 1)));
+
+  // a header line a second beats the rx timeout, not the deadline
+  peer->client->receive("GET / HTTP/1.1\r\n");
+  for (int i = 0; i < 5 && !peer->client->aborted(); i++) {
+    host::advance(1000);
+    peer->client->receive("X-Slow: 1\r\n");
+    peer->client->poll();
+  }
+  TEST_ASSERT_TRUE(peer->client->aborted());
+  AsyncClient::runEvents();
+  TEST_ASSERT_NULL(peer->client);
+  TEST_ASSERT_EQUAL(1, server->limitStats().headerTimeouts);
+
+  std::shared_ptr<AsyncPeer> again = open(IPAddress(10, 0, 0, 1));
+  TEST_ASSERT_NOT_NULL(again);
+  again->client->remoteClose();
+}
+
+void test_max_header_bytes() {
+  server->setMaxHeaderBytes(256);
+  std::shared_ptr<AsyncPeer> peer = open(IPAddress(10, 0, 0, 2));
+  const std::string line = "GET / HTTP/1.1\r\nX-Big: " + std::string(300, 'x');
+  peer->client->receive(line.c_str());
+  AsyncClient::runEvents();
+  TEST_ASSERT_NULL(peer->client);
+  TEST_ASSERT_EQUAL(1, server->limitStats().headerOverflows);
+}
+
+void test_slow_body() {
+  server->setMinBodyRate(100);
+  std::shared_ptr<AsyncPeer> peer = open(IPAddress(10, 0, 0, 3));
+  peer->client->receive("POST / HTTP/1.1\r\nHost: esp\r\nContent-Type: application/octet-stream\r\nContent-Length: 10000\r\n\r\n");
+  // 10 bytes per second
+  for (int i = 0; i < 10 && !peer->client->aborted(); i++) {
+    host::advance(1000);
+    peer->client->receive("0123456789");
+    peer->client->poll();
+  }
+  TEST_ASSERT_TRUE(peer->client->aborted());
+  AsyncClient::runEvents();
+  TEST_ASSERT_EQUAL(1, server->limitStats().slowBodies);
+
+  // one at the rate gets through
+  peer = open(IPAddress(10, 0, 0, 4));
+  peer->client->receive("POST / HTTP/1.1\r\nHost: esp\r\nContent-Type: application/octet-stream\r\nContent-Length: 1000\r\n\r\n");
+  for (int i = 0; i < 10 && peer->client && peer->output.empty(); i++) {
+    host::advance(1000);
+    peer->client->receive(std::string(100, 'b').c_str());
+    peer->client->poll();
+  }
+  TEST_ASSERT_TRUE_MESSAGE(peer->output.rfind("HTTP/1.1 200", 0) == 0, peer->output.c_str());
+  complete(peer);
+  TEST_ASSERT_EQUAL(1, server->limitStats().slowBodies);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_churn_against_model);
+  RUN_TEST(test_header_timeout);
+  RUN_TEST(test_max_header_bytes);
+  RUN_TEST(test_slow_body);
+  return UNITY_END();
+}
@@ -0,0 +1,271 @@
+#include <ESPAsyncWebServer.h>
+#include <Inflater.h>
+#include <unity.h>
+
+#include <chrono>
+
+/*
+  Responses compressed on the fly, decoded again with rawInflate() and checked against what the handler produced and
+  against the gzip and zlib trailers. The benchmark sends the same bodies over a link acknowledging a fixed number of
+  bytes per millisecond, a weak AP-mode connection, and compares the transfer time with and without compression.
+*/
+
+// bytes a millisecond, 1 Mbit/s
+static constexpr size_t LINK = 125;
+
+static AsyncWebServer* server;
+static std::string scan;
+static std::string page;
+static std::string noise;
+
+static void payloads() {
+  char entry[96];
+  scan = "[";
+  for (int i = 0; i < 150; i++) {
+    snprintf(entry, sizeof(entry), "%s{\"ssid\":\"network-%d\",\"rssi\":%d,\"channel\":%d,\"secure\":%s}", i ? "," : "", i, -40 - i % 50, 1 + i % 13,
+             i % 3 ? "true" : "false");
+    scan += entry;
+  }
+  scan += "]";
+
+  page = "<!DOCTYPE html><html><head><title>Meter</title></head><body><table>";
+  for (int i = 0; i < 200; i++) {
+    snprintf(entry, sizeof(entry), "<tr><td class=\"name\">phase %d</td><td class=\"value\">%d.%d W</td></tr>\n", i % 3 + 1, 1000 + i * 7, i % 10);
+    page += entry;
+  }
+  page += "</table></body></html>";
+
+  // what compresses the worst
+  uint32_t x = 2463534242u;
+  for (int i = 0; i < 8192; i++) {
+    x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+    noise += (char)('!' + x % 94);
+  }
+}
+
+void setUp() {
+  if (scan.empty())
+    payloads();
+  server = new AsyncWebServer(80);
+  server->on("/scan", HTTP_GET, [](AsyncWebServerRequest* request) {
+    request->send(request->beginResponse(200, "application/json", (const uint8_t*)scan.data(), scan.size()));
+  });
+  server->on("/page", HTTP_GET, [](AsyncWebServerRequest* request) {
+    request->send(request->beginResponse(200, "text/html", (const uint8_t*)page.data(), page.size()));
+  });
+  server->on("/noise", HTTP_GET, [](AsyncWebServerRequest* request) {
+    request->send(request->beginResponse(200, "text/plain", (const uint8_t*)noise.data(), noise.size()));
+  });
+  // a dynamic body of unknown length, produced 100 bytes at a time
+  server->on("/stream", HTTP_GET, [](AsyncWebServerRequest* request) {
+    request->send(request->beginChunkedResponse("application/json", [](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+      const size_t len = std::min<size_t>({maxLen, 100, scan.size() - index});
+      memcpy(buffer, scan.data() + index, len);
+      return len;
+    }));
+  });
+  server->begin();
+  CompressionPolicy::Instance().enable();
+}
+
+void tearDown() {
+  CompressionPolicy::Instance().disable();
+  delete server;
+}
+
+struct Response {
+    std::string head;
+    std::string body;
+    // simulated ms until the peer got the last byte
+    size_t ms = 0;
+};
+
+static Response get(const char* path, const char* acceptEncoding, size_t link = SIZE_MAX, const char* version = "1.1") {
+  AsyncClient* client = new AsyncClient();
+  std::shared_ptr<AsyncPeer> peer = client->peer();
+  AsyncServer::at(80)->accept(client);
+  std::string request = std::string("GET ") + path + " HTTP/" + version + "\r\nHost: esp\r\n";
+  if (acceptEncoding)
+    request += std::string("Accept-Encoding: ") + acceptEncoding + "\r\n";
+  client->receive((request + "\r\n").c_str());
+
+  Response response;
+  size_t delivered = 0;
+  for (; peer->client && response.ms < 100000; response.ms++) {
+    peer->client->acknowledge(link);
+    delivered += link;
+  }
+  TEST_ASSERT_NULL(peer->client);
+  // the connection is closed once the last bytes are sent, they still have to cross the link
+  for (; delivered < peer->output.size(); response.ms++)
+    delivered += link;
+
+  const size_t end = peer->output.find("\r\n\r\n");
+  TEST_ASSERT_NOT_EQUAL(std::string::npos, end);
+  response.head = peer->output.substr(0, end + 2);
+  const std::string raw = peer->output.substr(end + 4);
+  if (response.head.find("\r\ntransfer-encoding: chunked\r\n") == std::string::npos) {
+    response.body = raw;
+    return response;
+  }
+  for (size_t at = 0;;) {
+    char* digits;
+    const size_t len = strtoul(raw.c_str() + at, &digits, 16);
+    at = raw.find("\r\n", at) + 2;
+    if (!len)
+      break;
+    response.body += raw.substr(at, len);
+    at += len + 2;
+  }
+  return response;
+}
+
+static bool has(const Response& response, const char* header) {
+  return response.head.find(std::string("\r\n") + header + "\r\n") != std::string::npos;
+}
+
+static uint32_t crc32(const std::string& data) {
+  uint32_t crc = 0xffffffff;
+  for (uint8_t c : data) {
+    crc ^= c;
+    for (int k = 0; k < 8; k++)
+      crc = crc >> 1 ^ (0xedb88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+static uint32_t adler32(const std::string& data) {
+  uint32_t a = 1, b = 0;
+  for (uint8_t c : data) {
+    a = (a + c) % 65521;
+    b = (b + a) % 65521;
+  }
+  return b << 16 | a;
+}
+
+static uint32_t le32(const std::string& s, size_t at) {
+  return (uint8_t)s[at] | (uint8_t)s[at + 1] << 8 | (uint8_t)s[at + 2] << 16 | (uint32_t)(uint8_t)s[at + 3] << 24;
+}
+
+static uint32_t be32(const std::string& s, size_t at) {
+  return (uint32_t)(uint8_t)s[at] << 24 | (uint8_t)s[at + 1] << 16 | (uint8_t)s[at + 2] << 8 | (uint8_t)s[at + 3];
+}
+
+static std::string inflate(const std::string& deflated) {
+  std::vector<uint8_t> out;
+  TEST_ASSERT_EQUAL(INFLATE_OK, rawInflate((const uint8_t*)deflated.data(), deflated.size(), out, 1 << 20));
+  return std::string(out.begin(), out.end());
+}
+
+static std::string gunzip(const std::string& body) {
+  TEST_ASSERT_GREATER_THAN(18, body.size());
+  // magic, deflate, no flags
+  TEST_ASSERT_EQUAL_HEX8(0x1f, body[0]);
+  TEST_ASSERT_EQUAL_HEX8(0x8b, body[1]);
+  TEST_ASSERT_EQUAL(8, body[2]);
+  TEST_ASSERT_EQUAL(0, body[3]);
+  const std::string data = inflate(body.substr(10, body.size() - 18));
+  TEST_ASSERT_EQUAL_HEX32(crc32(data), le32(body, body.size() - 8));
+  TEST_ASSERT_EQUAL(data.size(), le32(body, body.size() - 4));
+  return data;
+}
+
+static std::string unzlib(const std::string& body) {
+  TEST_ASSERT_GREATER_THAN(6, body.size());
+  const uint8_t cmf = body[0], flg = body[1];
+  TEST_ASSERT_EQUAL(8, cmf & 0x0f);
+  TEST_ASSERT_LESS_OR_EQUAL(7, cmf >> 4);
+  TEST_ASSERT_EQUAL(0, (cmf << 8 | flg) % 31);
+  // no preset dictionary
+  TEST_ASSERT_EQUAL(0, flg & 0x20);
+  const std::string data = inflate(body.substr(2, body.size() - 6));
+  TEST_ASSERT_EQUAL_HEX32(adler32(data), be32(body, body.size() - 4));
+  return data;
+}
+
+void test_gzip_round_trip() {
+  for (const char* path : {"/scan", "/page", "/noise", "/stream"}) {
+    const Response response = get(path, "gzip, deflate");
+    TEST_ASSERT_TRUE_MESSAGE(has(response, "content-encoding: gzip"), response.head.c_str());
+    TEST_ASSERT_TRUE(has(response, "vary: accept-encoding"));
+    const std::string expected = !strcmp(path, "/page") ? page : !strcmp(path, "/noise") ? noise : scan;
+    TEST_ASSERT_TRUE_MESSAGE(gunzip(response.body) == expected, path);
+  }
+
+  // no chunks in HTTP/1.0, the body ends with the connection
+  const Response response = get("/page", "gzip", SIZE_MAX, "1.0");
+  TEST_ASSERT_FALSE(has(response, "transfer-encoding: chunked"));
+  TEST_ASSERT_TRUE(response.head.find("content-length") == std::string::npos);
+  TEST_ASSERT_TRUE(gunzip(response.body) == page);
+}
+
+void test_deflate_round_trip() {
+  for (const char* path : {"/scan", "/page", "/noise", "/stream"}) {
+    const Response response = get(path, "deflate");
+    TEST_ASSERT_TRUE_MESSAGE(has(response, "content-encoding: deflate"), response.head.c_str());
+    const std::string expected = !strcmp(path, "/page") ? page : !strcmp(path, "/noise") ? noise : scan;
+    TEST_ASSERT_TRUE_MESSAGE(unzlib(response.body) == expected, path);
+  }
+}
+
+void test_negotiation() {
+  TEST_ASSERT_EQUAL_STRING("gzip", CompressionPolicy::encoding("gzip, deflate, br"));
+  TEST_ASSERT_EQUAL_STRING("gzip", CompressionPolicy::encoding("deflate, gzip"));
+  TEST_ASSERT_EQUAL_STRING("gzip", CompressionPolicy::encoding("x-gzip"));
+  TEST_ASSERT_EQUAL_STRING("gzip", CompressionPolicy::encoding("*"));
+  TEST_ASSERT_EQUAL_STRING("deflate", CompressionPolicy::encoding("gzip;q=0, deflate"));
+  TEST_ASSERT_EQUAL_STRING("deflate", CompressionPolicy::encoding("gzip;q=0.4, deflate;q=0.5"));
+  TEST_ASSERT_EQUAL_STRING("deflate", CompressionPolicy::encoding("*;q=0.1, gzip;q=0"));
+  TEST_ASSERT_NULL(CompressionPolicy::encoding("gzip;q=0, deflate;q=0"));
+  TEST_ASSERT_NULL(CompressionPolicy::encoding("identity"));
+  TEST_ASSERT_NULL(CompressionPolicy::encoding("br, *;q=0"));
+  TEST_ASSERT_NULL(CompressionPolicy::encoding(""));
+
+  const Response identity = get("/scan", "identity");
+  TEST_ASSERT_FALSE(has(identity, "content-encoding: gzip"));
+  TEST_ASSERT_TRUE(identity.body == scan);
+  // under the threshold
+  CompressionPolicy::Instance().enable(scan.size() + 1);
+  TEST_ASSERT_TRUE(get("/scan", "gzip").body == scan);
+}
+
+// ratio and encoder CPU per KB, then the time to the last byte over the throttled link with and without compression
+void test_benchmark() {
+  std::string result;
+  for (const char* path : {"/scan", "/page", "/noise"}) {
+    const std::string& body = !strcmp(path, "/page") ? page : !strcmp(path, "/noise") ? noise : scan;
+
+    constexpr int rounds = 200;
+    size_t wire = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int n = 0; n < rounds; n++)
+      wire = get(path, "gzip").body.size();
+    const double gzipUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / rounds;
+    const auto plainStart = std::chrono::steady_clock::now();
+    for (int n = 0; n < rounds; n++)
+      get(path, nullptr);
+    const double plainUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - plainStart).count() / rounds;
+
+    // the link dominates, the CPU time measured above is added to the simulated transfer
+    const double plainMs = get(path, nullptr, LINK).ms + plainUs / 1000;
+    const double gzipMs = get(path, "gzip", LINK).ms + gzipUs / 1000;
+
+    char line[200];
+    snprintf(line, sizeof(line), "%s %zu -> %zu bytes (%.0f%%), %.1f us/KB to compress, %.0f ms -> %.0f ms at %zu KB/s; ", path, body.size(), wire,
+             100.0 * wire / body.size(), (gzipUs - plainUs) * 1024 / body.size(), plainMs, gzipMs, LINK * 1000 / 1024);
+    result += line;
+
+    if (strcmp(path, "/noise"))
+      TEST_ASSERT_LESS_THAN(plainMs, gzipMs);
+  }
+  TEST_MESSAGE(result.c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_gzip_round_trip);
+  RUN_TEST(test_deflate_round_trip);
+  RUN_TEST(test_negotiation);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,115 @@
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <chrono>
+
+/*
+  ContentTypes::fromPath() against the chain of endsWith() it replaced: the same type for every built-in
+  extension and for paths with none, registered types before the built-in ones, and the lookup time of both over
+  the paths a file server sees.
+*/
+
+using namespace asyncsrv;
+
+// AsyncFileResponse::_setContentTypeFromPath() before the table
+static const char* endsWithChain(const String& path) {
+  if (path.endsWith(T__html))
+    return T_text_html;
+  else if (path.endsWith(T__htm))
+    return T_text_html;
+  else if (path.endsWith(T__css))
+    return T_text_css;
+  else if (path.endsWith(T__json))
+    return T_application_json;
+  else if (path.endsWith(T__js))
+    return T_application_javascript;
+  else if (path.endsWith(T__png))
+    return T_image_png;
+  else if (path.endsWith(T__gif))
+    return T_image_gif;
+  else if (path.endsWith(T__jpg))
+    return T_image_jpeg;
+  else if (path.endsWith(T__ico))
+    return T_image_x_icon;
+  else if (path.endsWith(T__svg))
+    return T_image_svg_xml;
+  else if (path.endsWith(T__eot))
+    return T_font_eot;
+  else if (path.endsWith(T__woff))
+    return T_font_woff;
+  else if (path.endsWith(T__woff2))
+    return T_font_woff2;
+  else if (path.endsWith(T__ttf))
+    return T_font_ttf;
+  else if (path.endsWith(T__xml))
+    return T_text_xml;
+  else if (path.endsWith(T__pdf))
+    return T_application_pdf;
+  else if (path.endsWith(T__zip))
+    return T_application_zip;
+  else if (path.endsWith(T__gz))
+    return T_application_x_gzip;
+  return T_text_plain;
+}
+
+static const char* const paths[] = {
+  "/index.html", "/setup.htm", "/css/style.css", "/data.json", "/js/app.js", "/img/logo.png", "/img/spinner.gif",
+  "/img/photo.jpg", "/favicon.ico", "/img/icon.svg", "/fonts/a.eot", "/fonts/a.woff", "/fonts/a.woff2", "/fonts/a.ttf",
+  "/sitemap.xml", "/manual.pdf", "/backup.zip", "/js/app.js.gz", "/js/vendor.min.js", "/README", "/notes.txt",
+  "/v1.2/firmware", "/.hidden", "/dir.d/", "/file.", "/archive.tar", "/a.HTML",
+};
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_same_as_ends_with() {
+  const ContentTypes& types = ContentTypes::Instance();
+  for (const char* path : paths)
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(endsWithChain(path), types.fromPath(path), path);
+}
+
+void test_registered_types() {
+  ContentTypes types;
+  types.add(".wasm", "application/wasm");
+  types.add(".js", "text/javascript");
+  TEST_ASSERT_EQUAL_STRING("application/wasm", types.fromPath("/app.wasm"));
+  TEST_ASSERT_EQUAL_STRING("text/javascript", types.fromPath("/app.js"));
+  // registered again, the last one counts
+  types.add(".wasm", "application/octet-stream");
+  TEST_ASSERT_EQUAL_STRING("application/octet-stream", types.fromPath("/app.wasm"));
+  TEST_ASSERT_EQUAL_STRING(T_text_css, types.fromPath("/style.css"));
+  TEST_ASSERT_EQUAL_STRING(T_application_javascript, ContentTypes::Instance().fromPath("/app.js"));
+}
+
+template <class F> static double nsPerLookup(F lookup, const std::vector<String>& inputs) {
+  constexpr int ROUNDS = 20000;
+  size_t sum = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < ROUNDS; r++) {
+    for (const String& path : inputs)
+      sum += (uintptr_t)lookup(path);
+  }
+  const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  // the sum keeps the lookups from being optimised away
+  TEST_ASSERT_NOT_EQUAL(0, sum);
+  return ns / ROUNDS / inputs.size();
+}
+
+void test_benchmark() {
+  const std::vector<String> inputs(std::begin(paths), std::end(paths));
+  const ContentTypes& types = ContentTypes::Instance();
+  const double table = nsPerLookup([&types](const String& path) { return types.fromPath(path); }, inputs);
+  const double chain = nsPerLookup(endsWithChain, inputs);
+  char result[96];
+  snprintf(result, sizeof(result), "per lookup: table %.1f ns, endsWith chain %.1f ns", table, chain);
+  TEST_MESSAGE(result);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_same_as_ends_with);
+  RUN_TEST(test_registered_types);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,143 @@
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <chrono>
+
+// a request through the whole server, parser to response, on a mock connection
+
+// operator new calls, to count what a response costs
+static size_t allocations;
+
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  allocations++;
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+static AsyncWebServer* server;
+// the last /headers request
+static AsyncWebServerRequest* last;
+
+void setUp() {
+  server = new AsyncWebServer(80);
+  server->on("/hello", HTTP_GET, [](AsyncWebServerRequest* request) {
+    request->send(200, "text/plain", "Hello World!");
+  });
+  server->on("/headers", HTTP_GET, [](AsyncWebServerRequest* request) {
+    AsyncWebServerResponse* response = request->beginResponse(200, "text/plain", "Hello World!");
+    response->addHeader("x-set", "1");
+    // connection: close is set by the basic response itself
+    TEST_ASSERT_EQUAL(2, response->getHeaders().size());
+    request->send(response);
+    last = request;
+  });
+  server->onNotFound([](AsyncWebServerRequest* request) {
+    request->send(404);
+  });
+  server->begin();
+}
+
+void tearDown() {
+  delete server;
+}
+
+static std::string get(const char* path, const char* version = "1.1") {
+  AsyncClient* client = new AsyncClient();
+  std::shared_ptr<AsyncPeer> peer = client->peer();
+  AsyncServer::at(80)->accept(client);
+  std::string request = std::string("GET ") + path + " HTTP/" + version + "\r\nHost: esp\r\n\r\n";
+  client->receive(request.c_str());
+  // the server closes the connection once the response is acknowledged
+  for (int i = 0; i < 10 && peer->client; i++)
+    peer->client->acknowledge();
+  if (peer->client)
+    peer->client->remoteClose();
+  AsyncClient::runEvents();
+  TEST_ASSERT_NULL(peer->client);
+  return peer->output;
+}
+
+void test_get() {
+  const std::string response = get("/hello");
+  TEST_ASSERT_TRUE_MESSAGE(response.rfind("HTTP/1.1 200 OK\r\n", 0) == 0, response.c_str());
+  TEST_ASSERT_TRUE(response.find("content-length: 12\r\n") != std::string::npos);
+  TEST_ASSERT_TRUE(response.size() >= 12 && response.compare(response.size() - 12, 12, "Hello World!") == 0);
+}
+
+void test_not_found() {
+  const std::string response = get("/missing");
+  TEST_ASSERT_TRUE_MESSAGE(response.rfind("HTTP/1.1 404 Not Found\r\n", 0) == 0, response.c_str());
+}
+
+void test_status_line_version() {
+  TEST_ASSERT_EQUAL(0, get("/hello", "1.0").rfind("HTTP/1.0 200 OK\r\n", 0));
+  // not in the pre-serialised table
+  server->on("/created", HTTP_GET, [](AsyncWebServerRequest* request) { request->send(201); });
+  TEST_ASSERT_EQUAL(0, get("/created", "1.0").rfind("HTTP/1.0 201 Created\r\n", 0));
+}
+
+// per request, the mock connection included: default headers cost nothing, they are sent from one block
+void test_allocations_per_response() {
+  get("/hello");
+  size_t before = allocations;
+  get("/hello");
+  const size_t plain = allocations - before;
+
+  DefaultHeaders::Instance().addHeader("server", "esp");
+  DefaultHeaders::Instance().addHeader("x-content-type-options", "nosniff");
+  DefaultHeaders::Instance().addHeader("cache-control", "no-store");
+  DefaultHeaders::Instance().addHeader("access-control-allow-origin", "*");
+  get("/hello");
+  before = allocations;
+  const std::string response = get("/hello");
+  const size_t withDefaults = allocations - before;
+  TEST_ASSERT_TRUE(response.find("\r\nserver: esp\r\n") != std::string::npos);
+  TEST_ASSERT_TRUE(response.find("\r\naccess-control-allow-origin: *\r\n") != std::string::npos);
+  TEST_ASSERT_EQUAL(plain, withDefaults);
+
+  // the response keeps the headers set on it, and all of them are there for the logging middleware once it is sent
+  static_assert(std::is_same<decltype(last->getResponse()->getHeaders()), const std::list<AsyncWebHeader>&>::value, "getHeaders() returns a reference");
+  AsyncClient* client = new AsyncClient();
+  std::shared_ptr<AsyncPeer> peer = client->peer();
+  AsyncServer::at(80)->accept(client);
+  client->receive("GET /headers HTTP/1.1\r\nHost: esp\r\n\r\n");
+  std::vector<std::string> names;
+  for (const AsyncWebHeader& h : last->getResponse()->getAllHeaders())
+    names.push_back(h.name().c_str());
+  TEST_ASSERT_EQUAL(2, last->getResponse()->getHeaders().size());
+  client->remoteClose();
+  const std::vector<std::string> expected{"server", "x-content-type-options", "cache-control", "access-control-allow-origin", "connection", "x-set", "accept-ranges", "content-length", "content-type"};
+  TEST_ASSERT_TRUE(names == expected);
+
+  constexpr int rounds = 20000;
+  const auto start = std::chrono::steady_clock::now();
+  for (int n = 0; n < rounds; n++)
+    get("/hello");
+  const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / rounds;
+
+  char result[128];
+  snprintf(result, sizeof(result), "%zu allocations per request with or without 4 default headers, %.2f us per request", plain, us);
+  TEST_MESSAGE(result);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_get);
+  RUN_TEST(test_not_found);
+  RUN_TEST(test_status_line_version);
+  RUN_TEST(test_allocations_per_response);
+  return UNITY_END();
+}
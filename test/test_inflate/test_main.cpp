@@ -0,0 +1,330 @@
+#include <AsyncWebSocket.h>
+#include <ESPAsyncWebServer.h>
+#include <GzipEncoder.h>
+#include <Inflater.h>
+#include <unity.h>
+
+#include <chrono>
+
+/*
+  rawInflate() on what GzipEncoder produces and on streams built bit by bit to break it: invalid blocks, Huffman
+  codes with more codes than their lengths allow, back references before the start and output over the limit. A
+  permessage-deflate message must close with 1009 only when it inflates to too much, with 1007 when it is invalid.
+*/
+
+static constexpr size_t MAX_INFLATED = 8192;
+
+static AsyncWebServer* server;
+static AsyncWebSocket* ws;
+static std::vector<std::string> received;
+
+// LSB first, the way deflate packs its fields
+struct Bits {
+    std::vector<uint8_t> bytes;
+    uint8_t used = 8;
+
+    Bits& put(uint32_t value, uint8_t count) {
+      for (uint8_t i = 0; i < count; i++) {
+        if (used == 8) {
+          bytes.push_back(0);
+          used = 0;
+        }
+        bytes.back() |= ((value >> i) & 1) << used++;
+      }
+      return *this;
+    }
+    // Huffman codes go out MSB first
+    Bits& code(uint32_t value, uint8_t count) {
+      for (uint8_t i = count; i--;)
+        put(value >> i, 1);
+      return *this;
+    }
+    Bits& align() {
+      used = 8;
+      return *this;
+    }
+};
+
+static std::vector<uint8_t> deflate(const std::string& data) {
+  GzipEncoder encoder;
+  TEST_ASSERT_TRUE(encoder.begin(GzipEncoder::Format::Raw));
+  std::vector<uint8_t> out;
+  uint8_t buf[512];
+  size_t at = 0;
+  while (!encoder.finished()) {
+    for (size_t n; (n = encoder.read(buf, sizeof(buf)));)
+      out.insert(out.end(), buf, buf + n);
+    if (at < data.size())
+      at += encoder.write((const uint8_t*)data.data() + at, data.size() - at);
+    else
+      encoder.finish();
+  }
+  for (size_t n; (n = encoder.read(buf, sizeof(buf)));)
+    out.insert(out.end(), buf, buf + n);
+  return out;
+}
+
+static InflateStatus inflate(const std::vector<uint8_t>& in, size_t maxLen = 1 << 20) {
+  std::vector<uint8_t> out;
+  return rawInflate(in.data(), in.size(), out, maxLen);
+}
+
+static std::string json(size_t entries) {
+  std::string text = "[";
+  char entry[96];
+  for (size_t i = 0; i < entries; i++) {
+    snprintf(entry, sizeof(entry), "%s{\"id\":%u,\"power\":%u,\"voltage\":%u.%u,\"state\":\"%s\"}", i ? "," : "", (unsigned)i, (unsigned)(1000 + i * 13 % 700),
+             (unsigned)(228 + i % 5), (unsigned)(i % 10), i % 4 ? "on" : "off");
+    text += entry;
+  }
+  return text + "]";
+}
+
+void setUp() {
+  server = new AsyncWebServer(80);
+  ws = new AsyncWebSocket("/ws");
+  ws->enableDeflate(12, 64, MAX_INFLATED);
+  ws->onEvent([](AsyncWebSocket*, AsyncWebSocketClient*, AwsEventType type, void*, uint8_t* data, size_t len) {
+    if (type == WS_EVT_DATA)
+      received.emplace_back((const char*)data, len);
+  });
+  server->addHandler(ws);
+  server->begin();
+  received.clear();
+}
+
+void tearDown() {
+  delete server;
+}
+
+void test_round_trip() {
+  for (const std::string& text : {std::string(), std::string("a"), json(5), json(400), std::string(20000, 'z')}) {
+    const std::vector<uint8_t> in = deflate(text);
+    std::vector<uint8_t> out;
+    TEST_ASSERT_EQUAL(INFLATE_OK, rawInflate(in.data(), in.size(), out, text.size()));
+    TEST_ASSERT_TRUE(std::string(out.begin(), out.end()) == text);
+  }
+
+  // a stored block, then a sync flush without a final block, as permessage-deflate sends it
+  Bits stored;
+  stored.put(0, 1).put(0, 2).align().put(3, 16).put(0xfffc, 16);
+  stored.bytes.insert(stored.bytes.end(), {'a', 'b', 'c'});
+  stored.put(0, 1).put(0, 2).align().put(0, 16).put(0xffff, 16);
+  std::vector<uint8_t> out;
+  TEST_ASSERT_EQUAL(INFLATE_OK, rawInflate(stored.bytes.data(), stored.bytes.size(), out, 3));
+  TEST_ASSERT_EQUAL(3, out.size());
+}
+
+void test_malformed() {
+  // block type 3 is reserved
+  TEST_ASSERT_EQUAL(INFLATE_MALFORMED, inflate(Bits().put(1, 1).put(3, 2).bytes));
+  // stored block whose NLEN is not the complement of LEN
+  TEST_ASSERT_EQUAL(INFLATE_MALFORMED, inflate(Bits().put(1, 1).put(0, 2).align().put(3, 16).put(0xfffd, 16).bytes));
+  // stored block longer than the input
+  TEST_ASSERT_EQUAL(INFLATE_MALFORMED, inflate(Bits().put(1, 1).put(0, 2).align().put(3, 16).put(0xfffc, 16).put('a', 8).bytes));
+  // fixed block, literal/length 286 does not exist (code 11000110)
+  TEST_ASSERT_EQUAL(INFLATE_MALFORMED, inflate(Bits().put(1, 1).put(1, 2).code(0xc6, 8).bytes));
+  // fixed block, length 3 at distance 1 with nothing before it
+  TEST_ASSERT_EQUAL(INFLATE_MALFORMED, inflate(Bits().put(1, 1).put(1, 2).code(1, 7).code(0, 5).code(0, 7).bytes));
+  // fixed block cut before its end-of-block code
+  std::vector<uint8_t> truncated = deflate(json(50));
+  truncated.resize(truncated.size() / 2);
+  TEST_ASSERT_EQUAL(INFLATE_MALFORMED, inflate(truncated));
+  // dynamic block whose end-of-block code has length 0: literals 0-255 of length 8, then 0 for 256 and the distance
+  Bits noEnd;
+  noEnd.put(1, 1).put(2, 2).put(0, 5).put(0, 5).put(15, 4);
+  // the code length code: 0 and 8 of length 1, 4th and 5th in the transmission order
+  for (int i = 0; i < 19; i++)
+    noEnd.put(i == 3 || i == 4 ? 1 : 0, 3);
+  // symbol 0 has code 0, symbol 8 code 1
+  for (int i = 0; i < 256; i++)
+    noEnd.code(1, 1);
+  noEnd.code(0, 1).code(0, 1);
+  TEST_ASSERT_EQUAL(INFLATE_MALFORMED, inflate(noEnd.bytes));
+}
+
+// canonical Huffman codes for code lengths (RFC 1951 3.2.2), whether or not they fit the code space
+static std::vector<uint32_t> canonical(const std::vector<uint8_t>& lengths) {
+  uint32_t count[16] = {};
+  for (uint8_t len : lengths)
+    count[len]++;
+  count[0] = 0;
+  uint32_t next[16] = {};
+  for (int len = 1; len < 16; len++)
+    next[len] = (next[len - 1] + count[len - 1]) << 1;
+  std::vector<uint32_t> codes(lengths.size());
+  for (size_t i = 0; i < lengths.size(); i++)
+    if (lengths[i])
+      codes[i] = next[lengths[i]]++;
+  return codes;
+}
+
+// a final dynamic block holding the literal 'a', one distance code of length 0, every length sent on its own
+static std::vector<uint8_t> dynamicA(const std::vector<uint8_t>& codeLengthCode, const std::vector<uint8_t>& literalLengths) {
+  static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+  Bits bits;
+  bits.put(1, 1).put(2, 2).put(literalLengths.size() - 257, 5).put(0, 5).put(19 - 4, 4);
+  for (uint8_t symbol : order)
+    bits.put(codeLengthCode[symbol], 3);
+  const std::vector<uint32_t> clCodes = canonical(codeLengthCode);
+  for (uint8_t len : literalLengths)
+    bits.code(clCodes[len], codeLengthCode[len]);
+  bits.code(clCodes[0], codeLengthCode[0]);
+  const std::vector<uint32_t> codes = canonical(literalLengths);
+  bits.code(codes['a'], literalLengths['a']).code(codes[256], literalLengths[256]);
+  return bits.bytes;
+}
+
+// each stream is valid but for one Huffman code with more codes than its lengths leave room for
+void test_over_subscribed() {
+  // the code length code: 0, 1 and 2 use it all, the literal/length code 'a' and end of block of length 1
+  std::vector<uint8_t> codeLengthCode(19), literalLengths(257);
+  codeLengthCode[0] = 1, codeLengthCode[1] = 2, codeLengthCode[2] = 2;
+  literalLengths['a'] = 1, literalLengths[256] = 1;
+  std::vector<uint8_t> out;
+  std::vector<uint8_t> in = dynamicA(codeLengthCode, literalLengths);
+  TEST_ASSERT_EQUAL(INFLATE_OK, rawInflate(in.data(), in.size(), out, 16));
+  TEST_ASSERT_EQUAL(1, out.size());
+  TEST_ASSERT_EQUAL('a', out[0]);
+
+  // one more code length code of length 2
+  std::vector<uint8_t> overCodeLengths = codeLengthCode;
+  overCodeLengths[3] = 2;
+  TEST_ASSERT_EQUAL(INFLATE_MALFORMED, inflate(dynamicA(overCodeLengths, literalLengths)));
+
+  // end of block moved to length 2, with two more codes of that length
+  std::vector<uint8_t> overLiterals(259);
+  overLiterals['a'] = 1, overLiterals[256] = 2, overLiterals[257] = 2, overLiterals[258] = 2;
+  TEST_ASSERT_EQUAL(INFLATE_MALFORMED, inflate(dynamicA(codeLengthCode, overLiterals)));
+}
+
+void test_oversize() {
+  const std::string text = json(200);
+  const std::vector<uint8_t> in = deflate(text);
+  TEST_ASSERT_EQUAL(INFLATE_OK, inflate(in, text.size()));
+  TEST_ASSERT_EQUAL(INFLATE_TOO_BIG, inflate(in, text.size() - 1));
+  TEST_ASSERT_EQUAL(INFLATE_TOO_BIG, inflate(in, 10));
+
+  // 1 MB of zeros from less than 1% of that
+  const std::vector<uint8_t> bomb = deflate(std::string(1 << 20, '\0'));
+  TEST_ASSERT_LESS_THAN((1 << 20) / 100, bomb.size());
+  TEST_ASSERT_EQUAL(INFLATE_TOO_BIG, inflate(bomb, MAX_INFLATED));
+
+  // stored data over the limit
+  Bits stored;
+  stored.put(1, 1).put(0, 2).align().put(3, 16).put(0xfffc, 16);
+  stored.bytes.insert(stored.bytes.end(), {'a', 'b', 'c'});
+  TEST_ASSERT_EQUAL(INFLATE_TOO_BIG, inflate(stored.bytes, 2));
+}
+
+static std::shared_ptr<AsyncPeer> connect() {
+  AsyncClient* client = new AsyncClient();
+  std::shared_ptr<AsyncPeer> peer = client->peer();
+  AsyncServer::at(80)->accept(client);
+  client->receive("GET /ws HTTP/1.1\r\nHost: esp\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n"
+                  "Sec-WebSocket-Extensions: permessage-deflate; client_no_context_takeover; server_no_context_takeover\r\n\r\n");
+  client->acknowledge();
+  TEST_ASSERT_TRUE_MESSAGE(peer->output.find("permessage-deflate") != std::string::npos, peer->output.c_str());
+  peer->output.clear();
+  return peer;
+}
+
+// a compressed text message in one masked frame, without the 00 00 ff ff tail (RFC 7692 7.2.1)
+static void sendCompressed(const std::shared_ptr<AsyncPeer>& peer, std::vector<uint8_t> payload) {
+  if (payload.size() >= 4 && !memcmp(payload.data() + payload.size() - 4, "\x00\x00\xff\xff", 4))
+    payload.resize(payload.size() - 4);
+  std::vector<uint8_t> frame{0xc1};
+  if (payload.size() < 126) {
+    frame.push_back(0x80 | payload.size());
+  } else {
+    frame.push_back(0x80 | 126);
+    frame.push_back(payload.size() >> 8);
+    frame.push_back(payload.size() & 0xff);
+  }
+  const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+  frame.insert(frame.end(), mask, mask + 4);
+  for (size_t i = 0; i < payload.size(); i++)
+    frame.push_back(payload[i] ^ mask[i % 4]);
+  peer->client->receive(frame.data(), frame.size());
+  peer->client->acknowledge();
+}
+
+static bool closedWith(const std::string& out, uint16_t code) {
+  return out.size() >= 4 && (uint8_t)out[0] == 0x88 && (uint8_t)out[2] == code >> 8 && (uint8_t)out[3] == (code & 0xff);
+}
+
+static void disconnect(const std::shared_ptr<AsyncPeer>& peer) {
+  if (peer->client)
+    peer->client->remoteClose();
+  AsyncClient::runEvents();
+  ws->cleanupClients(0);
+}
+
+void test_websocket_close_codes() {
+  std::shared_ptr<AsyncPeer> peer = connect();
+  sendCompressed(peer, deflate("hello"));
+  TEST_ASSERT_EQUAL(1, received.size());
+  TEST_ASSERT_EQUAL_STRING("hello", received[0].c_str());
+
+  // a few bytes inflating past the limit
+  sendCompressed(peer, deflate(std::string(MAX_INFLATED + 1, 'x')));
+  TEST_ASSERT_TRUE(closedWith(peer->output, 1009));
+  disconnect(peer);
+
+  // invalid data right at the limit: 8100 stored bytes then a reserved block type
+  peer = connect();
+  Bits invalid;
+  invalid.put(0, 1).put(0, 2).align().put(8100, 16).put(~8100 & 0xffff, 16);
+  invalid.bytes.insert(invalid.bytes.end(), 8100, 'y');
+  invalid.put(1, 1).put(3, 2);
+  sendCompressed(peer, invalid.bytes);
+  TEST_ASSERT_TRUE_MESSAGE(closedWith(peer->output, 1007), "a malformed message is not one that is too big");
+  TEST_ASSERT_EQUAL(1, received.size());
+  disconnect(peer);
+}
+
+// ratio and CPU, compressing with GzipEncoder and inflating again, per KB of the original
+void test_benchmark() {
+  std::string noise;
+  uint32_t x = 2463534242u;
+  for (int i = 0; i < 8192; i++) {
+    x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+    noise += (char)('!' + x % 94);
+  }
+
+  std::string result;
+  const std::pair<const char*, std::string> inputs[] = {{"json", json(120)}, {"zeros", std::string(8192, '\0')}, {"noise", noise}};
+  for (const auto& input : inputs) {
+    const std::string& text = input.second;
+    constexpr int rounds = 500;
+    std::vector<uint8_t> in;
+    const auto start = std::chrono::steady_clock::now();
+    for (int n = 0; n < rounds; n++)
+      in = deflate(text);
+    const double deflateUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / rounds;
+
+    std::vector<uint8_t> out;
+    const auto inflateStart = std::chrono::steady_clock::now();
+    for (int n = 0; n < rounds; n++)
+      TEST_ASSERT_EQUAL(INFLATE_OK, rawInflate(in.data(), in.size(), out, text.size()));
+    const double inflateUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - inflateStart).count() / rounds;
+
+    char line[160];
+    snprintf(line, sizeof(line), "%s %zu -> %zu bytes (%.0f%%), deflate %.1f us/KB, inflate %.1f us/KB; ", input.first, text.size(), in.size(),
+             100.0 * in.size() / text.size(), deflateUs * 1024 / text.size(), inflateUs * 1024 / text.size());
+    result += line;
+  }
+  TEST_MESSAGE(result.c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_malformed);
+  RUN_TEST(test_over_subscribed);
+  RUN_TEST(test_oversize);
+  RUN_TEST(test_websocket_close_codes);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,141 @@
+#include <AsyncJson.h>
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#if ASYNC_JSON_SUPPORT != 1
+  #error "ArduinoJson is a lib_deps of [env:native]"
+#endif
+
+/*
+  Entity tags of the JSON responses and handlers: the tag hashed from the body, the version tag of a handler, a weak
+  comparison with every entry of If-None-Match, and HEAD answered like GET.
+*/
+
+static AsyncWebServer* server;
+static AsyncCallbackJsonWebHandler* state;
+static uint32_t version;
+static int built;
+
+void setUp() {
+  server = new AsyncWebServer(80);
+  server->on("/data", HTTP_GET | HTTP_HEAD | HTTP_POST, [](AsyncWebServerRequest* request) {
+    AsyncJsonResponse* response = new AsyncJsonResponse();
+    response->getRoot()["power"] = 1234;
+    response->getRoot()["state"] = "on";
+    response->setLength();
+    request->send(response);
+  });
+  state = new AsyncCallbackJsonWebHandler("/state", [](AsyncWebServerRequest* request, JsonVariant& json) {
+    built++;
+    AsyncJsonResponse* response = new AsyncJsonResponse();
+    response->getRoot()["version"] = version;
+    response->setLength();
+    request->send(response);
+  });
+  state->setVersion([] { return version; });
+  server->addHandler(state);
+  server->begin();
+  version = 7;
+  built = 0;
+}
+
+void tearDown() {
+  delete server;
+}
+
+static std::string exchange(const char* method, const char* path, const char* headers = "", const char* body = nullptr) {
+  AsyncClient* client = new AsyncClient();
+  std::shared_ptr<AsyncPeer> peer = client->peer();
+  AsyncServer::at(80)->accept(client);
+  std::string request = std::string(method) + " " + path + " HTTP/1.1\r\nHost: esp\r\n" + headers;
+  if (body)
+    request += "Content-Type: application/json\r\nContent-Length: " + std::to_string(strlen(body)) + "\r\n\r\n" + body;
+  else
+    request += "\r\n";
+  client->receive(request.c_str());
+  for (int i = 0; i < 10 && peer->client; i++)
+    peer->client->acknowledge();
+  if (peer->client)
+    peer->client->remoteClose();
+  AsyncClient::runEvents();
+  return peer->output;
+}
+
+static std::string header(const std::string& response, const char* name) {
+  const size_t at = response.find(std::string("\r\n") + name + ": ");
+  if (at == std::string::npos)
+    return "";
+  const size_t start = at + strlen(name) + 4;
+  return response.substr(start, response.find("\r\n", start) - start);
+}
+
+static std::string conditional(const char* method, const char* path, const std::string& inm) {
+  return exchange(method, path, ("If-None-Match: " + inm + "\r\n").c_str());
+}
+
+static bool status(const std::string& response, int code) {
+  return response.rfind("HTTP/1.1 " + std::to_string(code) + " ", 0) == 0;
+}
+
+void test_body_etag() {
+  const std::string response = exchange("GET", "/data");
+  TEST_ASSERT_TRUE_MESSAGE(status(response, 200), response.c_str());
+  const std::string etag = header(response, "etag");
+  TEST_ASSERT_EQUAL(10, etag.size());
+  TEST_ASSERT_EQUAL('"', etag[0]);
+  TEST_ASSERT_TRUE_MESSAGE(response.find("\r\n\r\n{\"power\":1234,\"state\":\"on\"}") != std::string::npos, response.c_str());
+
+  // the tag the 304 is decided on is the one the body went out with
+  const std::string notModified = conditional("GET", "/data", etag);
+  TEST_ASSERT_TRUE_MESSAGE(status(notModified, 304), notModified.c_str());
+  TEST_ASSERT_EQUAL_STRING(etag.c_str(), header(notModified, "etag").c_str());
+  TEST_ASSERT_TRUE(notModified.find("power") == std::string::npos);
+
+  TEST_ASSERT_TRUE(status(conditional("GET", "/data", "\"0badf00d\""), 200));
+  // a body that is not sent for a read is not hashed
+  TEST_ASSERT_EQUAL_STRING("", header(exchange("POST", "/data", "", "{}"), "etag").c_str());
+}
+
+void test_weak_match() {
+  const std::string etag = header(exchange("GET", "/data"), "etag");
+  TEST_ASSERT_TRUE(status(conditional("GET", "/data", "W/" + etag), 304));
+  TEST_ASSERT_TRUE(status(conditional("GET", "/data", "\"0badf00d\", " + etag), 304));
+  TEST_ASSERT_TRUE(status(conditional("GET", "/data", "*"), 304));
+
+  // the version tag is weak, the handler answers a list holding it without building the body
+  TEST_ASSERT_TRUE(status(conditional("GET", "/state", "W/\"7\""), 304));
+  TEST_ASSERT_TRUE(status(conditional("GET", "/state", "\"6\",W/\"7\""), 304));
+  TEST_ASSERT_TRUE(status(conditional("GET", "/state", "\"7\""), 304));
+  TEST_ASSERT_EQUAL(0, built);
+
+  const std::string changed = conditional("GET", "/state", "W/\"6\"");
+  TEST_ASSERT_TRUE(status(changed, 200));
+  TEST_ASSERT_EQUAL(1, built);
+  // only the version tag, the body was not hashed for one
+  TEST_ASSERT_EQUAL_STRING("W/\"7\"", header(changed, "etag").c_str());
+  version = 8;
+  TEST_ASSERT_TRUE(status(conditional("GET", "/state", "W/\"7\""), 200));
+  TEST_ASSERT_EQUAL(2, built);
+}
+
+void test_head() {
+  const std::string etag = header(exchange("GET", "/data"), "etag");
+  const std::string head = exchange("HEAD", "/data");
+  TEST_ASSERT_TRUE_MESSAGE(status(head, 200), head.c_str());
+  TEST_ASSERT_EQUAL_STRING(etag.c_str(), header(head, "etag").c_str());
+  TEST_ASSERT_TRUE(status(conditional("HEAD", "/data", etag), 304));
+
+  TEST_ASSERT_TRUE(status(conditional("HEAD", "/state", "W/\"7\""), 304));
+  TEST_ASSERT_EQUAL(0, built);
+  const std::string state = exchange("HEAD", "/state");
+  TEST_ASSERT_TRUE_MESSAGE(status(state, 200), state.c_str());
+  TEST_ASSERT_EQUAL_STRING("W/\"7\"", header(state, "etag").c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_body_etag);
+  RUN_TEST(test_weak_match);
+  RUN_TEST(test_head);
+  return UNITY_END();
+}
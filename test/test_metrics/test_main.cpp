@@ -0,0 +1,176 @@
+#include <AsyncMetrics.h>
+#include <ESPAsyncWebServer.h>
+#include <StreamString.h>
+#include <unity.h>
+
+#include <chrono>
+
+/*
+  AsyncWebServerMetrics fed by real requests: counts per tracked route and under "other", time to first byte and
+  to the last ack in their buckets, the bytes acknowledged and how far the system's free heap fell meanwhile. The
+  benchmark serves the same requests with and without metrics and times record() alone, which must not allocate.
+*/
+
+static size_t allocations;
+
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  allocations++;
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+static AsyncWebServer* server;
+static AsyncWebServerMetrics* metrics;
+// what the /scan handler takes from the heap and keeps, as a cache of the results would
+static uint32_t retained;
+
+void setUp() {
+  server = new AsyncWebServer(80);
+  metrics = new AsyncWebServerMetrics();
+  metrics->track(server->on("/scan", HTTP_GET, [](AsyncWebServerRequest* request) {
+    // the scan itself takes 3 ms before anything is sent
+    host::advance(3);
+    host::freeHeap -= retained;
+    request->send(200, "application/json", String(std::string(300, 'x').c_str()));
+  }),
+                 "/scan");
+  metrics->track(server->on("/page", HTTP_GET, [](AsyncWebServerRequest* request) {
+    request->send(200, "text/html", String(std::string(5000, 'p').c_str()));
+  }),
+                 "/page");
+  server->on("/other", HTTP_GET, [](AsyncWebServerRequest* request) { request->send(204); });
+  server->setMetrics(metrics);
+  server->begin();
+  host::freeHeap = 200 * 1024;
+  retained = 0;
+}
+
+void tearDown() {
+  delete server;
+  delete metrics;
+}
+
+// a request on its own connection, the peer acknowledging ackDelay ms after each send
+static std::string get(const char* path, uint32_t ackDelay = 0) {
+  AsyncClient* client = new AsyncClient();
+  std::shared_ptr<AsyncPeer> peer = client->peer();
+  AsyncServer::at(80)->accept(client);
+  client->receive((std::string("GET ") + path + " HTTP/1.1\r\nHost: esp\r\n\r\n").c_str());
+  for (int i = 0; i < 20 && peer->client; i++) {
+    host::advance(ackDelay);
+    peer->client->acknowledge();
+  }
+  if (peer->client)
+    peer->client->remoteClose();
+  AsyncClient::runEvents();
+  return peer->output;
+}
+
+static String exposition() {
+  StreamString out;
+  metrics->printTo(out);
+  return out;
+}
+
+static bool has(const String& text, const char* line) {
+  return text.indexOf(String(line) + "\n") >= 0;
+}
+
+void test_routes() {
+  TEST_ASSERT_TRUE(get("/scan").rfind("HTTP/1.1 200 OK\r\n", 0) == 0);
+  get("/scan");
+  get("/page");
+  get("/other");
+  get("/missing");
+  const String text = exposition();
+  TEST_ASSERT_TRUE_MESSAGE(has(text, "asyncwebserver_requests_total{route=\"/scan\"} 2"), text.c_str());
+  TEST_ASSERT_TRUE(has(text, "asyncwebserver_requests_total{route=\"/page\"} 1"));
+  // untracked handlers and the 404 of no handler at all
+  TEST_ASSERT_TRUE(has(text, "asyncwebserver_requests_total{route=\"other\"} 2"));
+
+  // the head and the body were acknowledged: /scan below 1 KB, /page up to 16 KB
+  TEST_ASSERT_TRUE(has(text, "asyncwebserver_response_bytes_bucket{route=\"/scan\",le=\"1024\"} 2"));
+  TEST_ASSERT_TRUE(has(text, "asyncwebserver_response_bytes_bucket{route=\"/page\",le=\"4096\"} 0"));
+  TEST_ASSERT_TRUE(has(text, "asyncwebserver_response_bytes_bucket{route=\"/page\",le=\"16384\"} 1"));
+  TEST_ASSERT_TRUE(has(text, "asyncwebserver_response_bytes_count{route=\"/page\"} 1"));
+
+  metrics->reset();
+  TEST_ASSERT_TRUE(exposition().indexOf("route=") < 0);
+}
+
+void test_latency() {
+  // 3 ms in the handler, then 20 ms for each round trip of the acks
+  get("/scan", 20);
+  const String text = exposition();
+  TEST_ASSERT_TRUE_MESSAGE(has(text, "asyncwebserver_ttfb_seconds_bucket{route=\"/scan\",le=\"0.002\"} 0"), text.c_str());
+  TEST_ASSERT_TRUE(has(text, "asyncwebserver_ttfb_seconds_bucket{route=\"/scan\",le=\"0.005\"} 1"));
+  TEST_ASSERT_TRUE(has(text, "asyncwebserver_ttfb_seconds_sum{route=\"/scan\"} 0.003000"));
+  TEST_ASSERT_TRUE(has(text, "asyncwebserver_response_seconds_bucket{route=\"/scan\",le=\"0.020\"} 0"));
+  TEST_ASSERT_TRUE(has(text, "asyncwebserver_response_seconds_bucket{route=\"/scan\",le=\"0.050\"} 1"));
+  TEST_ASSERT_TRUE(has(text, "asyncwebserver_response_seconds_bucket{route=\"/scan\",le=\"+Inf\"} 1"));
+}
+
+// the drop of the free heap, whoever caused it
+void test_system_heap_drop() {
+  get("/scan");
+  retained = 3000;
+  get("/scan");
+  // freed again while the request ran: a rise is counted as no drop
+  host::freeHeap += 10000;
+  retained = 0;
+  get("/scan");
+  const String text = exposition();
+  TEST_ASSERT_TRUE_MESSAGE(has(text, "asyncwebserver_system_heap_drop_bytes_bucket{route=\"/scan\",le=\"256\"} 2"), text.c_str());
+  TEST_ASSERT_TRUE(has(text, "asyncwebserver_system_heap_drop_bytes_bucket{route=\"/scan\",le=\"4096\"} 3"));
+  TEST_ASSERT_TRUE(has(text, "asyncwebserver_system_heap_drop_bytes_sum{route=\"/scan\"} 3000"));
+}
+
+void test_benchmark() {
+  constexpr int REQUESTS = 5000;
+  // warm up, the first request of a route sizes the buffers
+  get("/scan");
+  get("/page");
+
+  double us[2];
+  for (int withMetrics = 0; withMetrics < 2; withMetrics++) {
+    server->setMetrics(withMetrics ? metrics : nullptr);
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < REQUESTS; i++)
+      get(i % 2 ? "/scan" : "/page");
+    us[withMetrics] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / REQUESTS;
+  }
+
+  const AsyncWebHandler* handler = nullptr;
+  const size_t before = allocations;
+  const auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < 1000000; i++)
+    metrics->record(handler, i & 0xffff, i & 0xfffff, i & 0x3fff, (int32_t)(i & 0xfff) - 0x800);
+  const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / 1000000;
+  TEST_ASSERT_EQUAL(0, allocations - before);
+
+  char result[160];
+  snprintf(result, sizeof(result), "per request: %.2f us without metrics, %.2f us with, record() %.1f ns", us[0], us[1], ns);
+  TEST_MESSAGE(result);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_routes);
+  RUN_TEST(test_latency);
+  RUN_TEST(test_system_heap_drop);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,363 @@
+#include <AsyncIPHash.h>
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <chrono>
+
+/*
+  AsyncRateLimitMiddleware: the sliding window across the boundaries of its fixed windows, the Retry-After it
+  answers with, the per client table (spread of a LAN over it, entries taken over) and the 429 it sends.
+*/
+
+// operator new calls, for the paths that must not allocate
+static size_t allocations;
+
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  allocations++;
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+static constexpr size_t MAX = 10;
+static constexpr uint32_t WINDOW_MS = 1000;
+
+static uint32_t lan(uint8_t host) {
+  return (uint32_t)IPAddress(192, 168, 1, host);
+}
+
+static bool allowed(AsyncRateLimitMiddleware& limit, uint32_t key = 0) {
+  uint32_t retryAfter;
+  return limit.isRequestAllowed(key, retryAfter);
+}
+
+// requests allowed right now, until the first refused one
+static size_t burst(AsyncRateLimitMiddleware& limit, uint32_t key = 0) {
+  size_t n = 0;
+  while (n <= MAX && allowed(limit, key))
+    n++;
+  return n;
+}
+
+static void configure(AsyncRateLimitMiddleware& limit, bool perClient = false) {
+  limit.setMaxRequests(MAX);
+  limit.setWindowSize(WINDOW_MS / 1000);
+  limit.setPerClient(perClient);
+}
+
+void setUp() {
+  // every test starts at the beginning of a window of a new middleware
+  host::advance(WINDOW_MS - millis() % WINDOW_MS);
+}
+
+void tearDown() {}
+
+void test_window_boundaries() {
+  AsyncRateLimitMiddleware limit;
+  configure(limit);
+
+  // the whole limit in the last ms of a window
+  host::advance(WINDOW_MS - 1);
+  TEST_ASSERT_EQUAL(MAX, burst(limit));
+  // it still counts fully right after the boundary, then fades out with the overlap
+  host::advance(1);
+  TEST_ASSERT_EQUAL(0, burst(limit));
+  host::advance(WINDOW_MS / 2);
+  TEST_ASSERT_EQUAL(MAX / 2, burst(limit));
+  host::advance(WINDOW_MS / 4);
+  // 10 * 1/4 + 5 = 7.5 of 10, 9.5 after two more
+  TEST_ASSERT_EQUAL(3, burst(limit));
+
+  // a window with no request in between forgets all of it
+  host::advance(WINDOW_MS / 4 + WINDOW_MS);
+  TEST_ASSERT_EQUAL(MAX, burst(limit));
+
+  // a client asking all the time: never more than MAX in a fixed window, and as the previous window is taken as
+  // evenly spread, at most one more in any other span of WINDOW_MS
+  AsyncRateLimitMiddleware steady;
+  configure(steady);
+  std::vector<uint32_t> times;
+  const uint32_t begin = millis();
+  for (int ms = 0; ms < 20 * (int)WINDOW_MS; ms += 7) {
+    if (allowed(steady))
+      times.push_back(millis());
+    host::advance(7);
+  }
+  size_t fixed[20] = {};
+  for (uint32_t t : times)
+    fixed[(t - begin) / WINDOW_MS]++;
+  for (size_t n : fixed)
+    TEST_ASSERT_LESS_OR_EQUAL(MAX, n);
+  for (size_t i = 0; i + MAX + 1 < times.size(); i++)
+    TEST_ASSERT_GREATER_OR_EQUAL(WINDOW_MS, times[i + MAX + 1] - times[i]);
+  // and the limit is used, not just respected
+  TEST_ASSERT_GREATER_OR_EQUAL(MAX * 19, times.size());
+}
+
+// the request is refused until Retry-After and allowed from then on, for limits hit at any time of a window
+void test_retry_after() {
+  for (uint32_t offset = 0; offset < 2 * WINDOW_MS; offset += 37) {
+    for (size_t before = 0; before <= MAX; before += 3) {
+      AsyncRateLimitMiddleware limit;
+      configure(limit);
+      // some requests in the window before, the rest of the limit now
+      for (size_t i = 0; i < before; i++)
+        TEST_ASSERT_TRUE(allowed(limit));
+      host::advance(offset);
+      burst(limit);
+
+      uint32_t retryAfter;
+      TEST_ASSERT_FALSE(limit.isRequestAllowed(0, retryAfter));
+      TEST_ASSERT_GREATER_THAN(0, retryAfter);
+      TEST_ASSERT_LESS_OR_EQUAL(2 * WINDOW_MS / 1000, retryAfter);
+
+      uint32_t again;
+      host::advance((retryAfter - 1) * 1000);
+      TEST_ASSERT_FALSE(limit.isRequestAllowed(0, again));
+      host::advance(1000);
+      TEST_ASSERT_TRUE(limit.isRequestAllowed(0, again));
+      TEST_ASSERT_EQUAL(0, again);
+      setUp();
+    }
+  }
+
+  // the whole limit at the start of a window: the next window starts with it counted fully, 1 ms later it fades
+  AsyncRateLimitMiddleware limit;
+  configure(limit);
+  burst(limit);
+  uint32_t retryAfter;
+  TEST_ASSERT_FALSE(limit.isRequestAllowed(0, retryAfter));
+  TEST_ASSERT_EQUAL(2, retryAfter);
+
+  // longer windows, where the ms the request becomes allowed at may be a whole second away: 3 requests in the
+  // window before, 8 more 334 ms into this one, 3 * (10000 - e) < 2 * 10000 from e = 3334 on
+  AsyncRateLimitMiddleware slow;
+  slow.setMaxRequests(MAX);
+  slow.setWindowSize(10);
+  // windows are counted from millis() 0
+  host::advance(10000 - millis() % 10000);
+  for (int i = 0; i < 3; i++)
+    TEST_ASSERT_TRUE(allowed(slow));
+  host::advance(10334);
+  TEST_ASSERT_EQUAL(8, burst(slow));
+  TEST_ASSERT_FALSE(slow.isRequestAllowed(0, retryAfter));
+  TEST_ASSERT_EQUAL(3, retryAfter);
+  host::advance(2999);
+  TEST_ASSERT_FALSE(allowed(slow));
+  host::advance(1);
+  TEST_ASSERT_TRUE(allowed(slow));
+}
+
+// the hosts of a LAN differ in the low byte only, the table must still spread them
+void test_lan_spread() {
+  size_t hosts[ASYNCWEBSERVER_RATE_LIMIT_KEYS] = {};
+  for (int host = 0; host < 256; host++)
+    hosts[asyncsrv::ipSlot<ASYNCWEBSERVER_RATE_LIMIT_KEYS>(lan(host))]++;
+  for (size_t n : hosts) {
+    TEST_ASSERT_GREATER_OR_EQUAL(256 / ASYNCWEBSERVER_RATE_LIMIT_KEYS / 2, n);
+    TEST_ASSERT_LESS_OR_EQUAL(256 / ASYNCWEBSERVER_RATE_LIMIT_KEYS * 2, n);
+  }
+
+  // a few clients of the LAN each get the whole limit and keep their own count
+  AsyncRateLimitMiddleware limit;
+  configure(limit, true);
+  constexpr size_t CLIENTS = ASYNCWEBSERVER_RATE_LIMIT_KEYS / 2;
+  for (size_t i = 0; i < CLIENTS; i++)
+    TEST_ASSERT_EQUAL(MAX, burst(limit, lan(10 + i)));
+  for (size_t i = 0; i < CLIENTS; i++)
+    TEST_ASSERT_FALSE(allowed(limit, lan(10 + i)));
+  TEST_ASSERT_EQUAL(0, limit.evictions());
+}
+
+void test_evictions() {
+  AsyncRateLimitMiddleware limit;
+  configure(limit, true);
+
+  // four times as many clients as entries: all but those that found a free entry take one over
+  constexpr size_t CLIENTS = 4 * ASYNCWEBSERVER_RATE_LIMIT_KEYS;
+  for (size_t i = 0; i < CLIENTS; i++)
+    TEST_ASSERT_TRUE(allowed(limit, lan(i + 1)));
+  const uint32_t evictions = limit.evictions();
+  TEST_ASSERT_GREATER_OR_EQUAL(CLIENTS - ASYNCWEBSERVER_RATE_LIMIT_KEYS, evictions);
+  TEST_ASSERT_LESS_THAN(CLIENTS, evictions);
+
+  // a client that stays is found again, nothing is taken over for it
+  for (size_t i = 0; i < MAX - 1; i++)
+    TEST_ASSERT_TRUE(allowed(limit, lan(CLIENTS)));
+  TEST_ASSERT_FALSE(allowed(limit, lan(CLIENTS)));
+  TEST_ASSERT_EQUAL(evictions, limit.evictions());
+
+  // entries with nothing left in the sliding window are free to take, that is not an eviction
+  host::advance(2 * WINDOW_MS);
+  for (size_t i = 0; i < ASYNCWEBSERVER_RATE_LIMIT_KEYS / 4; i++)
+    TEST_ASSERT_TRUE(allowed(limit, lan(200 + i)));
+  TEST_ASSERT_EQUAL(evictions, limit.evictions());
+}
+
+static AsyncWebServer* server;
+static AsyncRateLimitMiddleware limiter;
+static size_t allocationsInChain;
+
+// allocations of the middlewares inside it
+static AsyncMiddlewareFunction measure([](AsyncWebServerRequest* request, ArMiddlewareNext next) {
+  const size_t before = allocations;
+  next();
+  allocationsInChain = allocations - before;
+});
+
+static AsyncMiddlewareFunction cors([](AsyncWebServerRequest* request, ArMiddlewareNext next) {
+  next();
+  request->getResponse()->addHeader("access-control-allow-origin", "*");
+});
+
+static std::shared_ptr<AsyncPeer> get(uint8_t host, size_t acks = 10) {
+  AsyncClient* client = new AsyncClient(IPAddress(192, 168, 1, host));
+  std::shared_ptr<AsyncPeer> peer = client->peer();
+  AsyncServer::at(80)->accept(client);
+  client->receive("GET /status HTTP/1.1\r\nHost: esp\r\n\r\n");
+  for (size_t i = 0; i < acks && peer->client; i++)
+    peer->client->acknowledge();
+  return peer;
+}
+
+static void close(const std::shared_ptr<AsyncPeer>& peer) {
+  if (peer->client)
+    peer->client->remoteClose();
+  AsyncClient::runEvents();
+}
+
+static void startServer(bool withCors) {
+  configure(limiter, true);
+  server = new AsyncWebServer(80);
+  server->addMiddleware(&measure);
+  if (withCors)
+    server->addMiddleware(&cors);
+  server->addMiddleware(&limiter);
+  server->on("/status", HTTP_GET, [](AsyncWebServerRequest* request) { request->send(200, "text/plain", "ok"); });
+  server->begin();
+}
+
+static void stopServer() {
+  delete server;
+  server = nullptr;
+  limiter = AsyncRateLimitMiddleware();
+}
+
+void test_too_many_requests() {
+  startServer(false);
+  // for the rest of the run, there is no way to remove it
+  DefaultHeaders::Instance().addHeader("server", "esp");
+
+  for (size_t i = 0; i < MAX; i++) {
+    auto peer = get(7);
+    TEST_ASSERT_EQUAL(0, peer->output.find("HTTP/1.1 200 OK\r\n"));
+    close(peer);
+  }
+  auto peer = get(7);
+  TEST_ASSERT_EQUAL_STRING("HTTP/1.1 429 Too Many Requests\r\nretry-after: 2\r\ncontent-length: 0\r\nconnection: close\r\nserver: esp\r\n\r\n", peer->output.c_str());
+  // the response object is a pool slot and the head is written from where it is
+  TEST_ASSERT_EQUAL(0, allocationsInChain);
+  TEST_ASSERT_NULL(peer->client);
+  TEST_ASSERT_EQUAL(1, limiter.limited());
+
+  // another client of the LAN is not limited by it
+  peer = get(8);
+  TEST_ASSERT_EQUAL(0, peer->output.find("HTTP/1.1 200 OK\r\n"));
+  close(peer);
+  stopServer();
+
+  // headers an outer middleware adds, and a window so small the head goes out in pieces
+  startServer(true);
+  for (size_t i = 0; i < MAX; i++)
+    close(get(7));
+  AsyncClient* client = new AsyncClient(IPAddress(192, 168, 1, 7), 50000, 16);
+  peer = client->peer();
+  AsyncServer::at(80)->accept(client);
+  client->receive("GET /status HTTP/1.1\r\nHost: esp\r\n\r\n");
+  for (int i = 0; i < 20 && peer->client; i++)
+    peer->client->acknowledge();
+  TEST_ASSERT_EQUAL_STRING("HTTP/1.1 429 Too Many Requests\r\nretry-after: 2\r\ncontent-length: 0\r\nconnection: close\r\nserver: esp\r\n"
+                           "access-control-allow-origin: *\r\n\r\n",
+                           peer->output.c_str());
+  close(peer);
+  stopServer();
+}
+
+// more 429s in flight than the pool holds: the rest come from the heap and go back there
+void test_pool_exhausted() {
+  startServer(false);
+  for (size_t i = 0; i < MAX; i++)
+    close(get(7));
+
+  std::vector<std::shared_ptr<AsyncPeer>> peers;
+  std::vector<size_t> chain;
+  for (size_t i = 0; i < ASYNCWEBSERVER_RATE_LIMIT_RESPONSES + 2; i++) {
+    // not acknowledged, the responses stay
+    peers.push_back(get(7, 0));
+    chain.push_back(allocationsInChain);
+    TEST_ASSERT_EQUAL(0, peers.back()->output.find("HTTP/1.1 429 Too Many Requests\r\n"));
+  }
+  for (size_t i = 0; i < chain.size(); i++)
+    TEST_ASSERT_EQUAL(i < ASYNCWEBSERVER_RATE_LIMIT_RESPONSES ? 0 : 1, chain[i]);
+  for (auto& peer : peers)
+    close(peer);
+
+  // and the slots are free again
+  close(get(7));
+  TEST_ASSERT_EQUAL(0, allocationsInChain);
+  stopServer();
+}
+
+void test_benchmark() {
+  AsyncRateLimitMiddleware limit;
+  configure(limit, true);
+  constexpr int rounds = 1000000;
+  auto start = std::chrono::steady_clock::now();
+  size_t refused = 0;
+  for (int n = 0; n < rounds; n++) {
+    if (n % 1000 == 0)
+      host::advance(1);
+    refused += !allowed(limit, lan(n % 8));
+  }
+  const double perCheck = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+  TEST_ASSERT_GREATER_THAN(0, refused);
+
+  startServer(false);
+  for (size_t i = 0; i < MAX; i++)
+    close(get(7));
+  constexpr int requests = 20000;
+  start = std::chrono::steady_clock::now();
+  for (int n = 0; n < requests; n++)
+    close(get(7));
+  const double perRefusal = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / requests;
+  TEST_ASSERT_EQUAL(requests, limiter.limited());
+  stopServer();
+
+  char result[128];
+  snprintf(result, sizeof(result), "%.0f ns per check of 8 clients, %.2f us per refused request over the mock connection", perCheck, perRefusal);
+  TEST_MESSAGE(result);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_window_boundaries);
+  RUN_TEST(test_retry_after);
+  RUN_TEST(test_lan_spread);
+  RUN_TEST(test_evictions);
+  RUN_TEST(test_too_many_requests);
+  RUN_TEST(test_pool_exhausted);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
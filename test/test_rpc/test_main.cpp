@@ -0,0 +1,352 @@
+#include <AsyncJson.h>
+#include <AsyncMessagePackRpc.h>
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <chrono>
+
+#if ASYNC_MSG_PACK_SUPPORT != 1
+  #error "ArduinoJson is a lib_deps of [env:native]"
+#endif
+
+/*
+  AsyncMessagePackRpc on a WebSocket, with the methods of examples/MessagePackRpc: requests answered with their
+  msgid, errors, notifications both ways, what is not a request ignored, and the method table. The benchmark sets
+  config.get over the one connection against GET /config with a connection per request, the way the setup page
+  fetches it, in host time and bytes on the wire. The mock has no network, its round trips and the TCP handshake
+  of every HTTP request come on top of that on a device.
+*/
+
+static AsyncWebServer* server;
+static AsyncWebSocket* ws;
+static AsyncMessagePackRpc* rpc;
+static std::string postcode;
+static int notified;
+
+static void configGet(JsonVariant result) {
+  result["postcode"] = postcode;
+  result["huisnummer"] = "7";
+}
+
+void setUp() {
+  server = new AsyncWebServer(80);
+  ws = new AsyncWebSocket("/rpc");
+  rpc = new AsyncMessagePackRpc();
+  rpc->on("config.get", [](AsyncWebSocketClient*, JsonVariantConst, JsonVariant result) {
+    configGet(result);
+    return true;
+  });
+  rpc->on("config.set", [](AsyncWebSocketClient*, JsonVariantConst params, JsonVariant result) {
+    if (!params["postcode"].is<const char*>()) {
+      result.set("postcode required");
+      return false;
+    }
+    postcode = params["postcode"].as<const char*>();
+    configGet(result);
+    return true;
+  });
+  rpc->on("wifi.scan", [](AsyncWebSocketClient*, JsonVariantConst, JsonVariant result) {
+    JsonArray list = result.to<JsonArray>();
+    for (int i = 0; i < 3; i++) {
+      JsonObject network = list.add<JsonObject>();
+      network["ssid"] = "net" + std::to_string(i);
+      network["rssi"] = -50 - 10 * i;
+    }
+    return true;
+  });
+  rpc->on("ui.seen", [](AsyncWebSocketClient*, JsonVariantConst params, JsonVariant) {
+    notified += params.as<int>();
+    return true;
+  });
+  rpc->attach(*ws);
+  ws->setMessageReassembly(1024);
+  server->addHandler(ws);
+  server->on("/config", HTTP_GET, [](AsyncWebServerRequest* request) {
+    AsyncJsonResponse* response = new AsyncJsonResponse();
+    configGet(response->getRoot());
+    response->setLength();
+    request->send(response);
+  });
+  server->begin();
+  postcode = "1234AB";
+  notified = 0;
+}
+
+// the server deletes its handlers, the dispatcher is the test's
+void tearDown() {
+  delete server;
+  delete rpc;
+}
+
+static std::shared_ptr<AsyncPeer> connect() {
+  AsyncClient* client = new AsyncClient();
+  std::shared_ptr<AsyncPeer> peer = client->peer();
+  AsyncServer::at(80)->accept(client);
+  client->receive("GET /rpc HTTP/1.1\r\nHost: esp\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n");
+  client->acknowledge();
+  TEST_ASSERT_TRUE_MESSAGE(peer->output.rfind("HTTP/1.1 101 Switching Protocols\r\n", 0) == 0, peer->output.c_str());
+  peer->output.clear();
+  return peer;
+}
+
+static void disconnect(const std::shared_ptr<AsyncPeer>& peer) {
+  if (peer->client)
+    peer->client->remoteClose();
+  AsyncClient::runEvents();
+  ws->cleanupClients(0);
+}
+
+// a masked frame of the client, the whole message in one
+static std::string frame(uint8_t opcode, const std::string& payload) {
+  std::string out(1, (char)(0x80 | opcode));
+  if (payload.size() < 126) {
+    out += (char)(0x80 | payload.size());
+  } else {
+    out += (char)(0x80 | 126);
+    out += (char)(payload.size() >> 8);
+    out += (char)payload.size();
+  }
+  const char key[4] = {0x12, 0x34, 0x56, 0x78};
+  out.append(key, 4);
+  for (size_t i = 0; i < payload.size(); i++)
+    out += payload[i] ^ key[i % 4];
+  return out;
+}
+
+// the payloads of the binary frames the server sent
+static std::vector<std::string> binaries(const std::string& out) {
+  std::vector<std::string> payloads;
+  size_t at = 0;
+  while (at + 2 <= out.size()) {
+    const uint8_t opcode = out[at] & 0x0f;
+    size_t len = (uint8_t)out[at + 1] & 0x7f;
+    size_t head = 2;
+    if (len == 126) {
+      len = (uint8_t)out[at + 2] << 8 | (uint8_t)out[at + 3];
+      head = 4;
+    }
+    if (opcode == WS_BINARY)
+      payloads.push_back(out.substr(at + head, len));
+    at += head + len;
+  }
+  return payloads;
+}
+
+static std::string pack(JsonVariantConst message) {
+  std::string out;
+  serializeMsgPack(message, out);
+  return out;
+}
+
+static std::string request(uint32_t msgid, const char* method, JsonVariantConst params) {
+  JsonDocument doc;
+  doc.add(0);
+  doc.add(msgid);
+  doc.add(method);
+  doc.add(params);
+  return pack(doc.as<JsonVariantConst>());
+}
+
+// one message in, what came back
+static std::vector<std::string> call(const std::shared_ptr<AsyncPeer>& peer, const std::string& message, uint8_t opcode = WS_BINARY) {
+  peer->client->receive(frame(opcode, message).data(), message.size() + (message.size() < 126 ? 6 : 8));
+  peer->client->acknowledge();
+  return binaries(peer->client->takeOutput());
+}
+
+static void decode(const std::string& payload, JsonDocument& doc) {
+  TEST_ASSERT_FALSE(deserializeMsgPack(doc, (const uint8_t*)payload.data(), payload.size()));
+}
+
+void test_request() {
+  std::shared_ptr<AsyncPeer> peer = connect();
+  JsonDocument none;
+  std::vector<std::string> replies = call(peer, request(7, "config.get", none.as<JsonVariantConst>()));
+  TEST_ASSERT_EQUAL(1, replies.size());
+  JsonDocument reply;
+  decode(replies[0], reply);
+  TEST_ASSERT_EQUAL(4, reply.size());
+  TEST_ASSERT_EQUAL(1, reply[0].as<int>());
+  TEST_ASSERT_EQUAL(7, reply[1].as<int>());
+  TEST_ASSERT_TRUE(reply[2].isNull());
+  TEST_ASSERT_EQUAL_STRING("1234AB", reply[3]["postcode"].as<const char*>());
+
+  // a msgid above 16 bits, the envelope is encoded by hand
+  replies = call(peer, request(0x12345678, "wifi.scan", none.as<JsonVariantConst>()));
+  decode(replies[0], reply);
+  TEST_ASSERT_EQUAL_HEX32(0x12345678, reply[1].as<uint32_t>());
+  TEST_ASSERT_EQUAL(3, reply[3].size());
+  TEST_ASSERT_EQUAL_STRING("net2", reply[3][2]["ssid"].as<const char*>());
+  TEST_ASSERT_EQUAL(-70, reply[3][2]["rssi"].as<int>());
+
+  JsonDocument params;
+  params["postcode"] = "9999ZZ";
+  replies = call(peer, request(300, "config.set", params.as<JsonVariantConst>()));
+  decode(replies[0], reply);
+  TEST_ASSERT_EQUAL(300, reply[1].as<int>());
+  TEST_ASSERT_TRUE(reply[2].isNull());
+  TEST_ASSERT_EQUAL_STRING("9999ZZ", postcode.c_str());
+  TEST_ASSERT_EQUAL_STRING("9999ZZ", reply[3]["postcode"].as<const char*>());
+  disconnect(peer);
+}
+
+void test_errors() {
+  std::shared_ptr<AsyncPeer> peer = connect();
+  JsonDocument params;
+  params["site"] = "x";
+  JsonDocument reply;
+  std::vector<std::string> replies = call(peer, request(1, "config.set", params.as<JsonVariantConst>()));
+  decode(replies[0], reply);
+  TEST_ASSERT_EQUAL_STRING("postcode required", reply[2].as<const char*>());
+  TEST_ASSERT_TRUE(reply[3].isNull());
+  TEST_ASSERT_EQUAL_STRING("1234AB", postcode.c_str());
+
+  replies = call(peer, request(2, "config.delete", params.as<JsonVariantConst>()));
+  decode(replies[0], reply);
+  TEST_ASSERT_EQUAL(2, reply[1].as<int>());
+  TEST_ASSERT_EQUAL_STRING("no such method", reply[2].as<const char*>());
+
+  // not requests: no answer, and the connection stays
+  const std::string valid = request(3, "config.get", params.as<JsonVariantConst>());
+  TEST_ASSERT_EQUAL(0, call(peer, valid, WS_TEXT).size());
+  TEST_ASSERT_EQUAL(0, call(peer, valid.substr(0, valid.size() - 3)).size());
+  TEST_ASSERT_EQUAL(0, call(peer, std::string("\x93\x01\x05\xc0", 4)).size());
+  TEST_ASSERT_EQUAL(0, call(peer, std::string("\x94\x00\xa1x", 4)).size());
+  JsonDocument negative;
+  negative.add(0);
+  negative.add(-1);
+  negative.add("config.get");
+  negative.add(nullptr);
+  TEST_ASSERT_EQUAL(0, call(peer, pack(negative.as<JsonVariantConst>())).size());
+  TEST_ASSERT_EQUAL(1, call(peer, valid).size());
+  disconnect(peer);
+}
+
+void test_notifications() {
+  std::shared_ptr<AsyncPeer> first = connect();
+  std::shared_ptr<AsyncPeer> second = connect();
+
+  // from the client, the handler runs and nothing is answered
+  JsonDocument seen;
+  seen.add(2);
+  seen.add("ui.seen");
+  seen.add(5);
+  TEST_ASSERT_EQUAL(0, call(first, pack(seen.as<JsonVariantConst>())).size());
+  TEST_ASSERT_EQUAL(5, notified);
+  seen[1] = "ui.unknown";
+  TEST_ASSERT_EQUAL(0, call(first, pack(seen.as<JsonVariantConst>())).size());
+
+  // to every client, the same bytes
+  JsonDocument metrics;
+  metrics["heap"] = 182344;
+  metrics["clients"] = 2;
+  TEST_ASSERT_EQUAL(AsyncWebSocket::ENQUEUED, rpc->notifyAll("metrics", metrics.as<JsonVariantConst>()));
+  first->client->acknowledge();
+  second->client->acknowledge();
+  const std::vector<std::string> a = binaries(first->client->takeOutput());
+  const std::vector<std::string> b = binaries(second->client->takeOutput());
+  TEST_ASSERT_EQUAL(1, a.size());
+  TEST_ASSERT_TRUE(a == b);
+  JsonDocument notification;
+  decode(a[0], notification);
+  TEST_ASSERT_EQUAL(3, notification.size());
+  TEST_ASSERT_EQUAL(2, notification[0].as<int>());
+  TEST_ASSERT_EQUAL_STRING("metrics", notification[1].as<const char*>());
+  TEST_ASSERT_EQUAL(182344, notification[2]["heap"].as<int>());
+  disconnect(first);
+  disconnect(second);
+}
+
+void test_method_table() {
+  AsyncMessagePackRpc table;
+  std::vector<std::string> names;
+  for (int i = 0; i < ASYNC_RPC_MAX_METHODS; i++)
+    names.push_back("method." + std::to_string(i));
+  std::vector<int> called(ASYNC_RPC_MAX_METHODS);
+  for (int i = 0; i < ASYNC_RPC_MAX_METHODS; i++) {
+    TEST_ASSERT_TRUE(table.on(names[i].c_str(), [&called, i](AsyncWebSocketClient*, JsonVariantConst, JsonVariant) {
+      called[i]++;
+      return true;
+    }));
+  }
+  TEST_ASSERT_FALSE(table.on("method.extra", [](AsyncWebSocketClient*, JsonVariantConst, JsonVariant) { return true; }));
+
+  // every method found by its own name, whatever order the hashes sorted them in
+  for (int i = 0; i < ASYNC_RPC_MAX_METHODS; i++) {
+    JsonDocument doc;
+    doc.add(2);
+    doc.add(names[i]);
+    doc.add(nullptr);
+    const std::string message = pack(doc.as<JsonVariantConst>());
+    AwsFrameInfo info = {};
+    info.final = 1;
+    info.opcode = WS_BINARY;
+    info.message_opcode = WS_BINARY;
+    info.len = message.size();
+    table.handleEvent(nullptr, nullptr, WS_EVT_DATA, &info, (uint8_t*)message.data(), message.size());
+  }
+  for (int i = 0; i < ASYNC_RPC_MAX_METHODS; i++)
+    TEST_ASSERT_EQUAL(1, called[i]);
+
+  // a name registered twice keeps its first handler
+  TEST_ASSERT_FALSE(rpc->on("config.get", [](AsyncWebSocketClient*, JsonVariantConst, JsonVariant) { return false; }));
+}
+
+static std::string httpGet(const char* path) {
+  AsyncClient* client = new AsyncClient();
+  std::shared_ptr<AsyncPeer> peer = client->peer();
+  AsyncServer::at(80)->accept(client);
+  client->receive((std::string("GET ") + path + " HTTP/1.1\r\nHost: 192.168.4.1\r\nAccept: */*\r\n\r\n").c_str());
+  for (int i = 0; i < 10 && peer->client; i++)
+    peer->client->acknowledge();
+  if (peer->client)
+    peer->client->remoteClose();
+  AsyncClient::runEvents();
+  return peer->output;
+}
+
+void test_benchmark() {
+  constexpr int CALLS = 2000;
+  const char* get = "GET /config HTTP/1.1\r\nHost: 192.168.4.1\r\nAccept: */*\r\n\r\n";
+
+  size_t httpBytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < CALLS; i++) {
+    const std::string response = httpGet("/config");
+    TEST_ASSERT_TRUE(response.find("\"postcode\":\"1234AB\"") != std::string::npos);
+    httpBytes += strlen(get) + response.size();
+  }
+  const double httpUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / CALLS;
+
+  std::shared_ptr<AsyncPeer> peer = connect();
+  JsonDocument none;
+  size_t rpcBytes = 0;
+  start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < CALLS; i++) {
+    const std::string message = request(i, "config.get", none.as<JsonVariantConst>());
+    peer->client->receive(frame(WS_BINARY, message).data(), message.size() + 6);
+    peer->client->acknowledge();
+    const std::string out = peer->client->takeOutput();
+    TEST_ASSERT_TRUE(out.find("1234AB") != std::string::npos);
+    rpcBytes += message.size() + 6 + out.size();
+  }
+  const double rpcUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / CALLS;
+  disconnect(peer);
+
+  char result[200];
+  snprintf(result, sizeof(result), "config.get: HTTP %.1f us and %zu bytes per request, RPC %.1f us and %zu bytes per call", httpUs,
+           httpBytes / CALLS, rpcUs, rpcBytes / CALLS);
+  TEST_MESSAGE(result);
+  TEST_ASSERT_TRUE(rpcBytes * 3 < httpBytes);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_request);
+  RUN_TEST(test_errors);
+  RUN_TEST(test_notifications);
+  RUN_TEST(test_method_table);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,14 @@
+// The portable HMAC-SHA256 of ESP8266 and RP2040, built here under another namespace next to the mbedTLS one the
+// ESP32 build uses, so the same vectors check both.
+
+#include <Arduino.h>
+
+#undef ESP32
+#define asyncsrv asyncsrv_portable
+#include "../../lib/ESPAsyncWebServer/src/AsyncCrypto.cpp"
+
+void portableHmac(const uint8_t* key, size_t keyLen, const uint8_t* data, size_t len, uint8_t* out) {
+  asyncsrv_portable::HmacSha256 hmac;
+  hmac.setKey(key, keyLen);
+  hmac.mac(data, len, out);
+}
@@ -0,0 +1,188 @@
+#include <AsyncSession.h>
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <chrono>
+
+/*
+  AsyncCrypto's HMAC-SHA256 against the RFC 4231 test vectors, and the session tokens signed with it: accepted
+  while valid, refused once expired, tampered with or issued before a reboot.
+*/
+
+void portableHmac(const uint8_t* key, size_t keyLen, const uint8_t* data, size_t len, uint8_t* out);
+
+void setUp() {}
+
+void tearDown() {}
+
+static std::vector<uint8_t> hex(const char* s) {
+  std::vector<uint8_t> out;
+  for (; s[0] && s[1]; s += 2)
+    out.push_back(strtoul(std::string(s, 2).c_str(), nullptr, 16));
+  return out;
+}
+
+static std::vector<uint8_t> text(const char* s) {
+  return std::vector<uint8_t>(s, s + strlen(s));
+}
+
+struct Vector {
+    std::vector<uint8_t> key;
+    std::vector<uint8_t> data;
+    const char* mac;
+};
+
+// RFC 4231 section 4, test case 5 (a truncated output) left out
+static std::vector<Vector> vectors() {
+  return {
+    {std::vector<uint8_t>(20, 0x0b), text("Hi There"), "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7"},
+    {text("Jefe"), text("what do ya want for nothing?"), "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"},
+    {std::vector<uint8_t>(20, 0xaa), std::vector<uint8_t>(50, 0xdd), "773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe"},
+    {hex("0102030405060708090a0b0c0d0e0f10111213141516171819"), std::vector<uint8_t>(50, 0xcd), "82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b"},
+    {std::vector<uint8_t>(131, 0xaa), text("Test Using Larger Than Block-Size Key - Hash Key First"), "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"},
+    {std::vector<uint8_t>(131, 0xaa),
+     text("This is a test using a larger than block-size key and a larger than block-size data. The key needs to be hashed before being used by the HMAC algorithm."),
+     "9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2"},
+  };
+}
+
+void test_hmac_rfc4231() {
+  for (const Vector& v : vectors()) {
+    uint8_t mac[asyncsrv::HmacSha256::MAC_SIZE];
+    asyncsrv::HmacSha256 hmac;
+    TEST_ASSERT_FALSE(hmac.hasKey());
+    hmac.setKey(v.key.data(), v.key.size());
+    TEST_ASSERT_TRUE(hmac.hasKey());
+    hmac.mac(v.data.data(), v.data.size(), mac);
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(hex(v.mac).data(), mac, sizeof(mac), v.mac);
+    // the keyed states are reused, a second MAC comes out the same
+    hmac.mac(v.data.data(), v.data.size(), mac);
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(hex(v.mac).data(), mac, sizeof(mac), v.mac);
+
+    portableHmac(v.key.data(), v.key.size(), v.data.data(), v.data.size(), mac);
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(hex(v.mac).data(), mac, sizeof(mac), v.mac);
+  }
+}
+
+void test_valid_token() {
+  AsyncSessionMiddleware session;
+  session.generateSecret();
+  const String token = session.issue();
+  TEST_ASSERT_EQUAL(AsyncSessionMiddleware::TOKEN_LENGTH, token.length());
+  TEST_ASSERT_TRUE(session.verify(token.c_str(), token.length()));
+  TEST_ASSERT_EQUAL(1, session.stats().issued);
+  TEST_ASSERT_EQUAL(1, session.stats().accepted);
+}
+
+void test_tampered_token() {
+  AsyncSessionMiddleware session;
+  session.generateSecret();
+  const String token = session.issue();
+
+  // every character changed, the expiry included
+  for (size_t i = 0; i < token.length(); i++) {
+    String forged = token;
+    forged.setCharAt(i, token[i] == 'A' ? 'B' : 'A');
+    TEST_ASSERT_FALSE_MESSAGE(session.verify(forged.c_str(), forged.length()), forged.c_str());
+  }
+  // cut short, too long, empty
+  TEST_ASSERT_FALSE(session.verify(token.c_str(), token.length() - 1));
+  TEST_ASSERT_FALSE(session.verify((token + "A").c_str(), token.length() + 1));
+  TEST_ASSERT_FALSE(session.verify("", 0));
+  TEST_ASSERT_EQUAL(0, session.stats().accepted);
+
+  // signed with another secret
+  AsyncSessionMiddleware other;
+  other.generateSecret();
+  TEST_ASSERT_FALSE(other.verify(token.c_str(), token.length()));
+}
+
+void test_expired_token() {
+  AsyncSessionMiddleware session;
+  session.generateSecret();
+  session.setLifetime(60);
+  const String token = session.issue();
+  host::advance(59 * 1000);
+  TEST_ASSERT_TRUE(session.verify(token.c_str(), token.length()));
+  host::advance(1000);
+  TEST_ASSERT_FALSE(session.verify(token.c_str(), token.length()));
+  TEST_ASSERT_EQUAL(1, session.stats().expired);
+}
+
+// a fixed secret survives the reboot, the tokens of the earlier boot must not
+void test_token_from_earlier_boot() {
+  const uint8_t secret[] = "a secret kept in NVS";
+  String token;
+  {
+    AsyncSessionMiddleware session;
+    session.setSecret(secret, sizeof(secret));
+    token = session.issue();
+    TEST_ASSERT_TRUE(session.verify(token.c_str(), token.length()));
+  }
+  const uint64_t uptime = host::now;
+  host::now = 0;
+  AsyncSessionMiddleware session;
+  session.setSecret(secret, sizeof(secret));
+  TEST_ASSERT_FALSE(session.verify(token.c_str(), token.length()));
+  TEST_ASSERT_EQUAL(1, session.stats().rejected);
+  host::now = uptime;
+}
+
+void test_requests() {
+  AsyncSessionMiddleware session;
+  session.generateSecret();
+  session.setCookieName("session");
+  const String token = session.issue();
+
+  AsyncWebServer* server = new AsyncWebServer(80);
+  server->on("/api", HTTP_GET, [](AsyncWebServerRequest* request) {
+    request->send(200, "text/plain", "ok");
+  }).addMiddleware(&session);
+  server->begin();
+
+  auto status = [](const std::string& headers) {
+    AsyncClient* client = new AsyncClient();
+    std::shared_ptr<AsyncPeer> peer = client->peer();
+    AsyncServer::at(80)->accept(client);
+    client->receive(("GET /api HTTP/1.1\r\nHost: esp\r\n" + headers + "\r\n").c_str());
+    for (int i = 0; i < 10 && peer->client; i++)
+      peer->client->acknowledge();
+    if (peer->client)
+      peer->client->remoteClose();
+    return peer->output.substr(9, 3);
+  };
+
+  TEST_ASSERT_EQUAL_STRING("200", status("Authorization: Bearer " + std::string(token.c_str()) + "\r\n").c_str());
+  TEST_ASSERT_EQUAL_STRING("200", status("Cookie: theme=dark; session=" + std::string(token.c_str()) + "\r\n").c_str());
+  TEST_ASSERT_EQUAL_STRING("401", status("").c_str());
+  TEST_ASSERT_EQUAL_STRING("401", status("Authorization: Bearer " + std::string(token.c_str(), 51) + "x\r\n").c_str());
+  delete server;
+}
+
+void test_verify_benchmark() {
+  AsyncSessionMiddleware session;
+  session.generateSecret();
+  const String token = session.issue();
+  const int rounds = 100000;
+  const auto start = std::chrono::steady_clock::now();
+  int accepted = 0;
+  for (int i = 0; i < rounds; i++)
+    accepted += session.verify(token.c_str(), token.length());
+  const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+  TEST_ASSERT_EQUAL(rounds, accepted);
+  char result[64];
+  snprintf(result, sizeof(result), "%.0f ns per verify", ns);
+  TEST_MESSAGE(result);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_hmac_rfc4231);
+  RUN_TEST(test_valid_token);
+  RUN_TEST(test_tampered_token);
+  RUN_TEST(test_expired_token);
+  RUN_TEST(test_token_from_earlier_boot);
+  RUN_TEST(test_requests);
+  RUN_TEST(test_verify_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,258 @@
+#include <AsyncEventSource.h>
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <chrono>
+
+/*
+  Events of AsyncEventSource as they reach the clients: every line of the message its own data field whatever
+  the line breaks, messages with NUL bytes through the length overload, and the encoded event shared by all
+  clients. The benchmark counts events per second and operator new calls per event sent to 4 clients, with fewer
+  and with more events in flight than SSE_EVENT_POOL_SIZE, against the String the encoder built per send before
+  the pooled exact-size encoding.
+*/
+
+using namespace asyncsrv;
+
+static constexpr size_t CLIENTS = 4;
+
+static size_t allocations;
+
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  allocations++;
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+static AsyncWebServer* server;
+static AsyncEventSource* events;
+static std::vector<AsyncEventSourceClient*> clients;
+static std::vector<std::shared_ptr<AsyncPeer>> peers;
+
+void setUp() {
+  server = new AsyncWebServer(80);
+  events = new AsyncEventSource("/events");
+  events->onConnect([](AsyncEventSourceClient* client) { clients.push_back(client); });
+  server->addHandler(events);
+  server->begin();
+
+  for (size_t i = 0; i < CLIENTS; i++) {
+    AsyncClient* client = new AsyncClient(IPAddress(192, 168, 1, 10 + i));
+    peers.push_back(client->peer());
+    AsyncServer::at(80)->accept(client);
+    client->receive("GET /events HTTP/1.1\r\nHost: esp\r\nAccept: text/event-stream\r\n\r\n");
+    client->acknowledge();
+    client->takeOutput();
+  }
+  TEST_ASSERT_EQUAL(CLIENTS, clients.size());
+}
+
+void tearDown() {
+  for (auto& peer : peers) {
+    if (peer->client)
+      peer->client->remoteClose();
+  }
+  AsyncClient::runEvents();
+  delete server;
+  clients.clear();
+  peers.clear();
+}
+
+// one round of the AsyncTCP task for every client, what each received
+static std::vector<std::string> network() {
+  std::vector<std::string> out(CLIENTS);
+  for (size_t i = 0; i < CLIENTS; i++) {
+    peers[i]->client->acknowledge();
+    peers[i]->client->poll();
+    out[i] = peers[i]->client->takeOutput();
+  }
+  return out;
+}
+
+static void expectEvent(const std::string& expected) {
+  for (const std::string& out : network())
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(expected.c_str(), out.c_str(), expected.c_str());
+}
+
+void test_encoding() {
+  TEST_ASSERT_EQUAL(AsyncEventSource::ENQUEUED, events->send("one", "e", 5, 1000));
+  expectEvent("retry: 1000\nid: 5\nevent: e\ndata: one\n\n");
+  events->send("a\nb");
+  expectEvent("data: a\ndata: b\n\n");
+  // a trailing line break ends the last line, it does not start another
+  events->send("a\r\nb\rc\n", "multi");
+  expectEvent("event: multi\ndata: a\ndata: b\ndata: c\n\n");
+  events->send("a\n\nb");
+  expectEvent("data: a\ndata: \ndata: b\n\n");
+  events->send("", "ping");
+  expectEvent("event: ping\ndata: \n\n");
+
+  // NUL bytes are part of the message
+  events->send((const uint8_t*)"x\0y\nz", 5, nullptr, 4294967295UL);
+  const std::string expected("id: 4294967295\ndata: x\0y\ndata: z\n\n", 34);
+  for (const std::string& out : network())
+    TEST_ASSERT_TRUE(out == expected);
+
+  // one client alone gets the same bytes
+  TEST_ASSERT_TRUE(clients[2]->send("solo", "e", 6));
+  const std::vector<std::string> out = network();
+  TEST_ASSERT_TRUE(out[1].empty());
+  TEST_ASSERT_EQUAL_STRING("id: 6\nevent: e\ndata: solo\n\n", out[2].c_str());
+}
+
+// AsyncEventSource's encoder before the pooled exact-size one
+static String generateEventMessage(const char* message, const char* event, uint32_t id, uint32_t reconnect) {
+  String str;
+  size_t len{0};
+  if (message)
+    len += strlen(message);
+  if (event)
+    len += strlen(event);
+  len += 42; // give it some overhead
+  str.reserve(len);
+
+  if (reconnect) {
+    str += T_retry_;
+    str += reconnect;
+    str += '\n';
+  }
+  if (id) {
+    str += T_id__;
+    str += id;
+    str += '\n';
+  }
+  if (event != NULL) {
+    str += T_event_;
+    str += event;
+    str += '\n';
+  }
+  if (!message)
+    return str;
+
+  size_t messageLen = strlen(message);
+  char* lineStart = (char*)message;
+  char* lineEnd;
+  do {
+    char* nextN = strchr(lineStart, '\n');
+    char* nextR = strchr(lineStart, '\r');
+    if (nextN == NULL && nextR == NULL) {
+      str += T_data_;
+      str += message;
+      str += T_nn;
+      return str;
+    }
+    char* nextLine = NULL;
+    if (nextN != NULL && nextR != NULL) {
+      if (nextR + 1 == nextN) {
+        lineEnd = nextR;
+        nextLine = nextN + 1;
+      } else {
+        lineEnd = std::min(nextR, nextN);
+        nextLine = lineEnd + 1;
+      }
+    } else if (nextN != NULL) {
+      lineEnd = nextN;
+      nextLine = nextN + 1;
+    } else {
+      lineEnd = nextR;
+      nextLine = nextR + 1;
+    }
+    str += T_data_;
+    str.concat(lineStart, lineEnd - lineStart);
+    str += '\n';
+    lineStart = nextLine;
+  } while (lineStart < ((char*)message + messageLen));
+  str += '\n';
+  return str;
+}
+
+// publishing only queues while the windows are closed, as before the AsyncTCP task runs, so the operator new
+// calls counted are those of sending and not of the mock connections taking the bytes
+static void deliver(size_t& bytes) {
+  for (auto& peer : peers)
+    peer->client->setWindow(5744);
+  for (const std::string& out : network())
+    bytes += out.size();
+  for (auto& peer : peers)
+    peer->client->setWindow(0);
+}
+
+struct Run {
+    double eventsPerSecond;
+    double newPerEvent;
+    size_t bytes;
+};
+
+// the peers read every few events and acknowledge them the next time, so up to twice that many are in flight
+static Run publish(const char* message, bool pooled, uint32_t every) {
+  constexpr uint32_t EVENTS = 100000;
+  Run run{0, 0, 0};
+  size_t sending = 0;
+  deliver(run.bytes);
+  const auto start = std::chrono::steady_clock::now();
+  for (uint32_t id = 1; id <= EVENTS; id++) {
+    const size_t before = allocations;
+    if (pooled) {
+      events->send(message, "power", id);
+    } else {
+      // what send() did before: a String built per event, then shared by the clients
+      AsyncEvent_SharedData_t data = std::make_shared<String>(generateEventMessage(message, "power", id, 0));
+      for (AsyncEventSourceClient* client : clients)
+        client->write(data, 0, id);
+    }
+    sending += allocations - before;
+    if (id % every == 0)
+      deliver(run.bytes);
+  }
+  run.eventsPerSecond = EVENTS / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  run.newPerEvent = double(sending) / EVENTS;
+  deliver(run.bytes);
+  deliver(run.bytes);
+  for (AsyncEventSourceClient* client : clients)
+    TEST_ASSERT_EQUAL(0, client->packetsWaiting());
+  return run;
+}
+
+void test_benchmark() {
+  static const char* const messages[] = {
+    "{\"p\":1234,\"u\":231.4,\"i\":5.36}",
+    "{\"trafo\":\"T-0042\",\"load\":[12.5,13.1,12.9,14.2,13.8,12.7,13.3,14.0]}",
+  };
+  std::string result = "to 4 clients, events/s and new per event, pooled encoding against a String per send:";
+  for (uint32_t every : {2, 8}) {
+    for (const char* message : messages) {
+      const Run pooled = publish(message, true, every);
+      const Run string = publish(message, false, every);
+      // the same events, none dropped
+      TEST_ASSERT_EQUAL(string.bytes, pooled.bytes);
+      // the pool holds every event in flight
+      if (2 * every <= SSE_EVENT_POOL_SIZE)
+        TEST_ASSERT_EQUAL(0, pooled.newPerEvent);
+      char line[112];
+      snprintf(line, sizeof(line), " | %zu B, %u in flight %.0f, %.2f against %.0f, %.2f", strlen(message), (unsigned)(2 * every),
+               pooled.eventsPerSecond, pooled.newPerEvent, string.eventsPerSecond, string.newPerEvent);
+      result += line;
+    }
+  }
+  TEST_MESSAGE(result.c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_encoding);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
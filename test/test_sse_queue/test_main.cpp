@@ -0,0 +1,156 @@
+#include <AsyncEventSource.h>
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#ifndef ESP32
+  #error "the queue locks are only compiled for ESP32, test/shim/Arduino.h defines it"
+#endif
+
+/*
+  The SSE client queue with an application thread publishing while the test thread plays the AsyncTCP task,
+  acknowledging and polling the connections. Every event must arrive once and in order, and the publish latency
+  is measured against the same events published with nothing running on the other side.
+*/
+
+static constexpr size_t CLIENTS = 4;
+static constexpr uint32_t EVENTS = 20000;
+
+static AsyncWebServer* server;
+static AsyncEventSource* events;
+static std::vector<AsyncEventSourceClient*> clients;
+static std::vector<std::shared_ptr<AsyncPeer>> peers;
+
+void setUp() {
+  server = new AsyncWebServer(80);
+  events = new AsyncEventSource("/events");
+  events->onConnect([](AsyncEventSourceClient* client) { clients.push_back(client); });
+  server->addHandler(events);
+  server->begin();
+
+  for (size_t i = 0; i < CLIENTS; i++) {
+    AsyncClient* client = new AsyncClient(IPAddress(192, 168, 1, 10 + i));
+    peers.push_back(client->peer());
+    AsyncServer::at(80)->accept(client);
+    client->receive("GET /events HTTP/1.1\r\nHost: esp\r\nAccept: text/event-stream\r\n\r\n");
+    client->acknowledge();
+    client->takeOutput();
+  }
+}
+
+void tearDown() {
+  for (auto& peer : peers) {
+    if (peer->client)
+      peer->client->remoteClose();
+  }
+  AsyncClient::runEvents();
+  delete server;
+  clients.clear();
+  peers.clear();
+}
+
+static bool queued() {
+  for (AsyncEventSourceClient* client : clients) {
+    if (client->packetsWaiting())
+      return true;
+  }
+  return false;
+}
+
+// what the application does before publishing: wait while a queue is nearly full, so nothing is discarded
+static bool full() {
+  for (AsyncEventSourceClient* client : clients) {
+    if (client->packetsWaiting() >= SSE_MAX_QUEUED_MESSAGES - 1)
+      return true;
+  }
+  return false;
+}
+
+// one round of the AsyncTCP task: the peers acknowledge what they got, then the poll
+static void network(std::vector<std::string>& received) {
+  for (size_t i = 0; i < CLIENTS; i++) {
+    peers[i]->client->acknowledge();
+    peers[i]->client->poll();
+    received[i] += peers[i]->client->takeOutput();
+  }
+}
+
+static uint32_t publish(uint32_t id, std::vector<uint32_t>& latencies) {
+  char data[32];
+  snprintf(data, sizeof(data), "{\"n\":%u}", (unsigned)id);
+  const auto start = std::chrono::steady_clock::now();
+  const AsyncEventSource::SendStatus status = events->send(data, "n", id);
+  latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+  return status == AsyncEventSource::ENQUEUED;
+}
+
+static void checkOrder(const std::vector<std::string>& received) {
+  for (const std::string& text : received) {
+    uint32_t next = 1;
+    for (size_t at = text.find("id: "); at != std::string::npos; at = text.find("id: ", at + 1))
+      TEST_ASSERT_EQUAL(next++, strtoul(text.c_str() + at + 4, nullptr, 10));
+    TEST_ASSERT_EQUAL(EVENTS, next - 1);
+  }
+}
+
+static uint32_t percentile(std::vector<uint32_t> latencies, double p) {
+  std::sort(latencies.begin(), latencies.end());
+  return latencies[std::min(latencies.size() - 1, (size_t)(latencies.size() * p))];
+}
+
+static std::vector<uint32_t> alone;
+
+// baseline: publish and network on the same thread, the queue locks are always free
+void test_publish_alone() {
+  std::vector<std::string> received(CLIENTS);
+  uint32_t enqueued = 0;
+  for (uint32_t id = 1; id <= EVENTS; id++) {
+    while (full())
+      network(received);
+    enqueued += publish(id, alone);
+  }
+  while (queued())
+    network(received);
+  TEST_ASSERT_EQUAL(EVENTS, enqueued);
+  checkOrder(received);
+}
+
+// an application thread publishes while this one runs the network side as fast as it can
+void test_publish_with_network_thread() {
+  std::vector<std::string> received(CLIENTS);
+  std::vector<uint32_t> latencies;
+  latencies.reserve(EVENTS);
+  std::atomic<bool> done{false};
+  uint32_t enqueued = 0;
+
+  std::thread app([&] {
+    for (uint32_t id = 1; id <= EVENTS; id++) {
+      while (full())
+        std::this_thread::yield();
+      enqueued += publish(id, latencies);
+    }
+    done = true;
+  });
+  while (!done || queued())
+    network(received);
+  app.join();
+
+  TEST_ASSERT_EQUAL(EVENTS, enqueued);
+  checkOrder(received);
+
+  char result[200];
+  snprintf(result, sizeof(result), "publish to %zu clients p50/p99/max: alone %u/%u/%u ns, with the network thread %u/%u/%u ns", CLIENTS,
+           (unsigned)percentile(alone, 0.5), (unsigned)percentile(alone, 0.99), (unsigned)percentile(alone, 1),
+           (unsigned)percentile(latencies, 0.5), (unsigned)percentile(latencies, 0.99), (unsigned)percentile(latencies, 1));
+  TEST_MESSAGE(result);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_publish_alone);
+  RUN_TEST(test_publish_with_network_thread);
+  return UNITY_END();
+}
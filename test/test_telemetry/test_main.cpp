@@ -0,0 +1,245 @@
+#include <AsyncBudget.h>
+#include <AsyncEventSource.h>
+#include <AsyncTelemetry.h>
+#include <ESPAsyncWebServer.h>
+#include <StreamString.h>
+#include <unity.h>
+
+#include <chrono>
+
+/*
+  AsyncEventTelemetry publishing 500 samples a second to 8 SSE clients, half of them reading far less than that.
+  A log event is sent on the same source every 50 ms. The slow clients must get the latest sample instead of a
+  growing queue, the log events must reach every client in order, and the budget must never be exceeded.
+*/
+
+static constexpr size_t CLIENTS = 8;
+static constexpr uint16_t RATE = 500;
+static constexpr size_t LIMIT = 32 * 1024;
+// ms of the run, one step is 1 ms
+static constexpr int STEPS = 5000;
+
+static AsyncWebServerBudget& budget = AsyncWebServerBudget::Instance();
+
+static AsyncWebServer* server;
+static AsyncEventSource* events;
+static std::vector<AsyncEventSourceClient*> clients;
+static std::vector<std::shared_ptr<AsyncPeer>> peers;
+
+static bool slow(size_t i) {
+  return i % 2;
+}
+
+static size_t occurrences(const std::string& text, const char* what) {
+  size_t n = 0;
+  for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1))
+    n++;
+  return n;
+}
+
+static size_t metric(const char* name) {
+  StreamString out;
+  events->printMetrics(out);
+  const char* line = strstr(out.c_str(), (String("\n") + name + "{").c_str());
+  if (!line)
+    return SIZE_MAX;
+  line = strchr(line, ' ');
+  return strtoul(line + 1, nullptr, 10);
+}
+
+void setUp() {
+  budget.setLimit(LIMIT);
+  server = new AsyncWebServer(80);
+  events = new AsyncEventSource("/events");
+  events->onConnect([](AsyncEventSourceClient* client) { clients.push_back(client); });
+  server->addHandler(events);
+  server->begin();
+
+  for (size_t i = 0; i < CLIENTS; i++) {
+    AsyncClient* client = new AsyncClient(IPAddress(192, 168, 1, 10 + i));
+    peers.push_back(client->peer());
+    AsyncServer::at(80)->accept(client);
+    client->receive("GET /events HTTP/1.1\r\nHost: esp\r\nAccept: text/event-stream\r\n\r\n");
+    client->acknowledge();
+    client->takeOutput();
+  }
+}
+
+void tearDown() {
+  for (auto& peer : peers) {
+    if (peer->client)
+      peer->client->remoteClose();
+  }
+  AsyncClient::runEvents();
+  delete server;
+  clients.clear();
+  peers.clear();
+  TEST_ASSERT_EQUAL(0, budget.used());
+  budget.setLimit(0);
+}
+
+void test_slow_clients_get_the_latest_sample() {
+  TEST_ASSERT_EQUAL(CLIENTS, events->count());
+  TEST_ASSERT_EQUAL(CLIENTS, clients.size());
+
+  uint32_t sample = 0;
+  AsyncEventTelemetry telemetry("telemetry");
+  telemetry.addInt("sample", [&sample] { return (int32_t)++sample; });
+  telemetry.addFloat("power", [] { return 1234.5f; });
+  telemetry.addFloat("voltage", [] { return 230.1f; });
+  telemetry.addInt("rssi", [] { return -61; });
+  telemetry.addInt("heap", [] { return (int32_t)ESP.getFreeHeap(); });
+  telemetry.addString("db", [] { return "up"; });
+  telemetry.setRate(RATE);
+  TEST_ASSERT_TRUE(telemetry.attach(*events));
+
+  std::vector<std::string> received(CLIENTS);
+  size_t deepest = 0;
+  uint32_t logs = 0;
+  for (int step = 0; step < STEPS; step++) {
+    host::advance(1);
+    telemetry.loop();
+    if (step % 50 == 0) {
+      char log[16];
+      snprintf(log, sizeof(log), "log %u", (unsigned)++logs);
+      events->send(log, "log");
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(LIMIT, budget.used());
+
+    for (size_t i = 0; i < CLIENTS; i++) {
+      TEST_ASSERT_NOT_NULL(peers[i]->client);
+      deepest = std::max(deepest, clients[i]->packetsWaiting());
+      // the slow ones read 16 KB a second, a third of what the samples alone take
+      peers[i]->client->acknowledge(slow(i) ? 16 : SIZE_MAX);
+      received[i] += peers[i]->output;
+      peers[i]->output.clear();
+    }
+  }
+
+  TEST_ASSERT_EQUAL(0, telemetry.stats().late);
+  TEST_ASSERT_EQUAL(0, telemetry.stats().discarded);
+  TEST_ASSERT_EQUAL(0, telemetry.stats().overflows);
+  TEST_ASSERT_EQUAL(STEPS * RATE / 1000, telemetry.stats().ticks);
+  // half the queue in flight, one sample waiting and the log events queued behind it
+  TEST_ASSERT_LESS_OR_EQUAL(SSE_MAX_QUEUED_MESSAGES / 2 + 4, deepest);
+
+  size_t fastSamples = SIZE_MAX, slowSamples = 0;
+  for (size_t i = 0; i < CLIENTS; i++) {
+    const std::string& text = received[i];
+    const size_t samples = occurrences(text, "event: telemetry\n");
+    if (slow(i)) {
+      slowSamples = std::max(slowSamples, samples);
+      TEST_ASSERT_GREATER_THAN(0, clients[i]->coalescedEvents());
+    } else {
+      fastSamples = std::min(fastSamples, samples);
+      TEST_ASSERT_EQUAL(telemetry.stats().ticks, samples);
+      TEST_ASSERT_EQUAL(0, clients[i]->coalescedEvents());
+    }
+
+    // the log events are never coalesced, every client gets all of them in order, except what is still queued
+    size_t next = 1;
+    for (size_t at = text.find("data: log "); at != std::string::npos; at = text.find("data: log ", at + 1))
+      TEST_ASSERT_EQUAL(next++, strtoul(text.c_str() + at + 10, nullptr, 10));
+    TEST_ASSERT_GREATER_OR_EQUAL(logs - 2, next - 1);
+
+    // the newest sample a slow client got is from the last half second, not one from the start
+    const size_t last = text.rfind("\"sample\":");
+    TEST_ASSERT_NOT_EQUAL(std::string::npos, last);
+    TEST_ASSERT_GREATER_OR_EQUAL(sample - RATE / 2, strtoul(text.c_str() + last + 9, nullptr, 10));
+  }
+  TEST_ASSERT_LESS_THAN(fastSamples, slowSamples);
+  TEST_ASSERT_GREATER_THAN(0, metric("asynceventsource_coalesced_total"));
+
+  char result[160];
+  snprintf(result, sizeof(result), "%u samples/s: fast clients got %zu/s, slow ones %zu/s, deepest queue %zu, %zu coalesced",
+           (unsigned)RATE, fastSamples * 1000 / STEPS, slowSamples * 1000 / STEPS, deepest, metric("asynceventsource_coalesced_total"));
+  TEST_MESSAGE(result);
+}
+
+// events sent by the application on the attached source keep queueing up, only the telemetry one is coalesced
+void test_attach_coalesces_only_the_telemetry_event() {
+  AsyncEventTelemetry telemetry("telemetry");
+  telemetry.addInt("n", [] { return 1; });
+  TEST_ASSERT_TRUE(telemetry.attach(*events));
+  TEST_ASSERT_FALSE(events->coalescing());
+
+  // nobody reads, the queues only grow
+  for (size_t i = 0; i < CLIENTS; i++)
+    peers[i]->client->setWindow(0);
+  for (int n = 0; n < 5; n++) {
+    TEST_ASSERT_TRUE(telemetry.publish());
+    events->send("x", "status");
+  }
+  for (AsyncEventSourceClient* client : clients) {
+    TEST_ASSERT_EQUAL(1 + 5, client->packetsWaiting());
+    TEST_ASSERT_EQUAL(4, client->coalescedEvents());
+  }
+}
+
+// a newer event never overtakes one with an id, the browser would resume from the older id after a reconnect
+void test_coalescing_keeps_ids_in_order() {
+  events->setCoalescing(true);
+  for (size_t i = 0; i < CLIENTS; i++)
+    peers[i]->client->setWindow(0);
+
+  events->send("a1", "a", 1);
+  events->send("b2", "b", 2);
+  // A@3 would go out before B@2
+  events->send("a3", "a", 3);
+  // without an id the client's last event id stays, it takes the place of A@1
+  events->send("b", "b");
+  events->send("log", "log");
+  // A@3 is the newest with an id, only an event without one is behind it
+  events->send("a4", "a", 4);
+  events->send("a5", "a", 5);
+
+  for (size_t i = 0; i < CLIENTS; i++) {
+    TEST_ASSERT_EQUAL(4, clients[i]->packetsWaiting());
+    TEST_ASSERT_EQUAL(3, clients[i]->coalescedEvents());
+    peers[i]->client->setWindow(5744);
+    peers[i]->client->acknowledge();
+    const std::string& text = peers[i]->output;
+    TEST_ASSERT_EQUAL_STRING("id: 1\nevent: a\ndata: a1\n\n"
+                             "event: b\ndata: b\n\n"
+                             "id: 5\nevent: a\ndata: a5\n\n"
+                             "event: log\ndata: log\n\n",
+                             text.c_str());
+  }
+  events->setCoalescing(false);
+}
+
+// fan out cost of a sample: sample, serialize, encode once, queue for every client and send
+void test_benchmark_publish() {
+  AsyncEventTelemetry telemetry("telemetry");
+  telemetry.addFloat("power", [] { return 1234.5f; });
+  telemetry.addFloat("voltage", [] { return 230.1f; }, 1);
+  telemetry.addInt("rssi", [] { return -61; });
+  telemetry.addInt("heap", [] { return (int32_t)ESP.getFreeHeap(); });
+  telemetry.addString("db", [] { return "up"; });
+  telemetry.attach(*events);
+
+  constexpr int rounds = 20000;
+  const auto start = std::chrono::steady_clock::now();
+  for (int n = 0; n < rounds; n++) {
+    telemetry.publish();
+    for (auto& peer : peers) {
+      peer->client->acknowledge();
+      peer->output.clear();
+    }
+  }
+  const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+  TEST_ASSERT_EQUAL(0, telemetry.stats().discarded);
+
+  char result[96];
+  snprintf(result, sizeof(result), "%.0f ns per sample sent to %zu clients", ns, CLIENTS);
+  TEST_MESSAGE(result);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_slow_clients_get_the_latest_sample);
+  RUN_TEST(test_attach_coalesces_only_the_telemetry_event);
+  RUN_TEST(test_coalescing_keeps_ids_in_order);
+  RUN_TEST(test_benchmark_publish);
+  return UNITY_END();
+}
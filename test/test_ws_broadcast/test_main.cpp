@@ -0,0 +1,246 @@
+#include <AsyncWebSocket.h>
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <chrono>
+
+#if DEFAULT_MAX_WS_CLIENTS < 32
+  #error "the benchmark broadcasts to 32 clients, [env:native] in platformio.ini sets DEFAULT_MAX_WS_CLIENTS"
+#endif
+
+/*
+  textAll() to several clients: the message framed once and the same bytes sent to every client, whatever window
+  each leaves, with a ping asked for while a frame is half sent going out behind it. The benchmark compares the
+  CPU time and operator new calls of one broadcast to 1, 8 and 32 clients against sending the same shared payload
+  to each client with text(), which builds the frame header per client.
+*/
+
+static size_t allocations;
+
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  allocations++;
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+struct Frame {
+    uint8_t opcode;
+    bool final;
+    std::string payload;
+};
+
+static AsyncWebServer* server;
+static AsyncWebSocket* ws;
+static std::vector<AsyncWebSocketClient*> clients;
+static std::vector<std::shared_ptr<AsyncPeer>> peers;
+
+void setUp() {
+  server = new AsyncWebServer(80);
+  ws = new AsyncWebSocket("/ws");
+  ws->onEvent([](AsyncWebSocket*, AsyncWebSocketClient* c, AwsEventType type, void*, uint8_t*, size_t) {
+    if (type == WS_EVT_CONNECT)
+      clients.push_back(c);
+  });
+  server->addHandler(ws);
+  server->begin();
+}
+
+void tearDown() {
+  for (auto& peer : peers) {
+    if (peer->client)
+      peer->client->remoteClose();
+  }
+  AsyncClient::runEvents();
+  ws->cleanupClients(0);
+  delete server;
+  clients.clear();
+  peers.clear();
+}
+
+static void connect(size_t n) {
+  while (peers.size() < n) {
+    AsyncClient* tcp = new AsyncClient(IPAddress(192, 168, 1, 10 + peers.size()));
+    std::shared_ptr<AsyncPeer> peer = tcp->peer();
+    AsyncServer::at(80)->accept(tcp);
+    tcp->receive("GET /ws HTTP/1.1\r\nHost: esp\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                 "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n");
+    tcp->acknowledge();
+    TEST_ASSERT_TRUE_MESSAGE(peer->output.rfind("HTTP/1.1 101 Switching Protocols\r\n", 0) == 0, peer->output.c_str());
+    peer->output.clear();
+    peers.push_back(peer);
+  }
+  TEST_ASSERT_EQUAL(n, clients.size());
+}
+
+// every peer acknowledges what it got until nothing is queued, what each received
+static std::vector<std::string> drain() {
+  std::vector<std::string> out(peers.size());
+  for (int round = 0; round < 10000; round++) {
+    bool queued = false;
+    for (size_t i = 0; i < peers.size(); i++) {
+      peers[i]->client->acknowledge();
+      out[i] += peers[i]->client->takeOutput();
+      queued |= clients[i]->queueLen() > 0;
+    }
+    if (!queued)
+      break;
+  }
+  for (size_t i = 0; i < peers.size(); i++)
+    out[i] += peers[i]->client->takeOutput();
+  return out;
+}
+
+// the frames in what the server sent, unmasked as a server sends them, all three length forms
+static std::vector<Frame> frames(const std::string& out) {
+  std::vector<Frame> result;
+  size_t at = 0;
+  while (at < out.size()) {
+    TEST_ASSERT_TRUE(at + 2 <= out.size());
+    const uint8_t first = out[at];
+    TEST_ASSERT_EQUAL_HEX8(0, out[at + 1] & 0x80);
+    uint64_t len = out[at + 1] & 0x7f;
+    size_t head = 2;
+    if (len >= 126) {
+      const size_t bytes = len == 126 ? 2 : 8;
+      TEST_ASSERT_TRUE(at + 2 + bytes <= out.size());
+      len = 0;
+      for (size_t i = 0; i < bytes; i++)
+        len = len << 8 | (uint8_t)out[at + 2 + i];
+      head += bytes;
+    }
+    TEST_ASSERT_TRUE(at + head + len <= out.size());
+    result.push_back({(uint8_t)(first & 0x0f), (first & 0x80) != 0, out.substr(at + head, len)});
+    at += head + len;
+  }
+  return result;
+}
+
+static std::string payload(size_t len, char seed) {
+  std::string out(len, 0);
+  for (size_t i = 0; i < len; i++)
+    out[i] = seed + i % 23;
+  return out;
+}
+
+void test_same_frames() {
+  connect(8);
+  for (size_t len : {1, 125, 126, 1000, 65535, 65536, 100000}) {
+    const std::string text = payload(len, 'a');
+    TEST_ASSERT_EQUAL(AsyncWebSocket::ENQUEUED, ws->textAll(text.data(), text.size()));
+    const std::vector<std::string> out = drain();
+    for (const std::string& received : out) {
+      TEST_ASSERT_TRUE(received == out[0]);
+      const std::vector<Frame> sent = frames(received);
+      TEST_ASSERT_EQUAL(1, sent.size());
+      TEST_ASSERT_EQUAL(WS_TEXT, sent[0].opcode);
+      TEST_ASSERT_TRUE(sent[0].final);
+      TEST_ASSERT_TRUE(sent[0].payload == text);
+    }
+  }
+}
+
+// windows that cut the shared frame in different places, and a ping asked for in the middle of it
+void test_windows() {
+  connect(4);
+  for (size_t i = 0; i < peers.size(); i++)
+    peers[i]->client->setWindow(20 + 50 * i);
+  const std::string first = payload(1000, 'A');
+  const std::string second = payload(300, 'a');
+  TEST_ASSERT_EQUAL(AsyncWebSocket::ENQUEUED, ws->binaryAll((const uint8_t*)first.data(), first.size()));
+  TEST_ASSERT_EQUAL(AsyncWebSocket::ENQUEUED, ws->textAll(second.data(), second.size()));
+  std::vector<std::string> out(peers.size());
+  for (size_t i = 0; i < peers.size(); i++) {
+    peers[i]->client->acknowledge();
+    out[i] += peers[i]->client->takeOutput();
+  }
+  TEST_ASSERT_EQUAL(AsyncWebSocket::ENQUEUED, ws->pingAll((const uint8_t*)"p", 1));
+  const std::vector<std::string> rest = drain();
+  for (size_t i = 0; i < peers.size(); i++) {
+    const std::vector<Frame> sent = frames(out[i] + rest[i]);
+    TEST_ASSERT_EQUAL(3, sent.size());
+    TEST_ASSERT_EQUAL(WS_BINARY, sent[0].opcode);
+    TEST_ASSERT_TRUE(sent[0].payload == first);
+    // not inside the frame it interrupted, not held back behind the next message
+    TEST_ASSERT_EQUAL(WS_PING, sent[1].opcode);
+    TEST_ASSERT_TRUE(sent[1].payload == "p");
+    TEST_ASSERT_EQUAL(WS_TEXT, sent[2].opcode);
+    TEST_ASSERT_TRUE(sent[2].payload == second);
+  }
+}
+
+// fewer bytes than the longest frame header: the shared frame needs none, it goes out a few bytes at a time
+void test_tiny_window() {
+  connect(2);
+  for (auto& peer : peers)
+    peer->client->setWindow(5);
+  const std::string text = payload(100, 'a');
+  TEST_ASSERT_EQUAL(AsyncWebSocket::ENQUEUED, ws->textAll(text.data(), text.size()));
+  for (const std::string& received : drain()) {
+    const std::vector<Frame> sent = frames(received);
+    TEST_ASSERT_EQUAL(1, sent.size());
+    TEST_ASSERT_TRUE(sent[0].payload == text);
+  }
+}
+
+void test_benchmark() {
+  constexpr size_t BROADCASTS = 20000;
+  const AsyncWebSocketSharedBuffer message = std::make_shared<std::vector<uint8_t>>(256, 'x');
+  std::string result = "per broadcast of 256 B, textAll() against text() per client:";
+  for (size_t n : {1, 8, 32}) {
+    connect(n);
+    char line[96];
+    for (bool all : {true, false}) {
+      size_t bytes = 0;
+      const size_t before = allocations;
+      const auto start = std::chrono::steady_clock::now();
+      for (size_t b = 0; b < BROADCASTS; b++) {
+        if (all) {
+          ws->textAll(message);
+        } else {
+          for (AsyncWebSocketClient* client : clients)
+            client->text(message);
+        }
+        // the peers acknowledge every few messages, before the queues fill up
+        if (b % 4 == 3) {
+          for (auto& peer : peers) {
+            peer->client->acknowledge();
+            bytes += peer->client->takeOutput().size();
+          }
+        }
+      }
+      const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+      const double perBroadcast = double(allocations - before) / BROADCASTS;
+      for (const std::string& out : drain())
+        bytes += out.size();
+      TEST_ASSERT_EQUAL(BROADCASTS * n * (256 + 4), bytes);
+      if (all)
+        snprintf(line, sizeof(line), " | %zu clients %.2f us %.1f new", n, us / BROADCASTS, perBroadcast);
+      else
+        snprintf(line, sizeof(line), " against %.2f us %.1f new", us / BROADCASTS, perBroadcast);
+      result += line;
+    }
+  }
+  TEST_MESSAGE(result.c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_same_frames);
+  RUN_TEST(test_windows);
+  RUN_TEST(test_tiny_window);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
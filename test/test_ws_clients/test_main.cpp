@@ -0,0 +1,187 @@
+#include <AsyncWebSocket.h>
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <chrono>
+#include <list>
+
+/*
+  The client slot table of AsyncWebSocket: an id names one connection and stops matching once it is gone, even
+  when the next connection takes its slot, and an upgrade past DEFAULT_MAX_WS_CLIENTS is refused with 503. The
+  benchmark looks clients up by id and sends to them by id, against a std::list searched for the id as before the
+  table.
+*/
+
+static size_t allocations;
+
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  allocations++;
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+static AsyncWebServer* server;
+static AsyncWebSocket* ws;
+static std::vector<AsyncWebSocketClient*> clients;
+static std::vector<std::shared_ptr<AsyncPeer>> peers;
+
+void setUp() {
+  server = new AsyncWebServer(80);
+  ws = new AsyncWebSocket("/ws");
+  ws->onEvent([](AsyncWebSocket*, AsyncWebSocketClient* c, AwsEventType type, void*, uint8_t*, size_t) {
+    if (type == WS_EVT_CONNECT)
+      clients.push_back(c);
+  });
+  server->addHandler(ws);
+  server->begin();
+}
+
+void tearDown() {
+  for (auto& peer : peers) {
+    if (peer->client)
+      peer->client->remoteClose();
+  }
+  AsyncClient::runEvents();
+  ws->cleanupClients(0);
+  delete server;
+  clients.clear();
+  peers.clear();
+}
+
+// a new connection asking for the upgrade, what the server answered
+static std::string upgrade() {
+  AsyncClient* tcp = new AsyncClient(IPAddress(192, 168, 1, 10 + peers.size()));
+  std::shared_ptr<AsyncPeer> peer = tcp->peer();
+  AsyncServer::at(80)->accept(tcp);
+  tcp->receive("GET /ws HTTP/1.1\r\nHost: esp\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+               "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n");
+  tcp->acknowledge();
+  const std::string answer = peer->output;
+  peer->output.clear();
+  peers.push_back(peer);
+  return answer;
+}
+
+static void connect(size_t n) {
+  while (clients.size() < n) {
+    const std::string answer = upgrade();
+    TEST_ASSERT_TRUE_MESSAGE(answer.rfind("HTTP/1.1 101 Switching Protocols\r\n", 0) == 0, answer.c_str());
+  }
+}
+
+void test_stale_id() {
+  connect(3);
+  const uint32_t gone = clients[1]->id();
+  TEST_ASSERT_TRUE(ws->client(gone) == clients[1]);
+  TEST_ASSERT_TRUE(ws->client(clients[0]->id()) == clients[0]);
+  TEST_ASSERT_TRUE(ws->client(clients[2]->id()) == clients[2]);
+  peers[1]->client->remoteClose();
+  AsyncClient::runEvents();
+  ws->cleanupClients(DEFAULT_MAX_WS_CLIENTS);
+  TEST_ASSERT_NULL(ws->client(gone));
+
+  // the next connection takes the free slot under a new id
+  connect(4);
+  AsyncWebSocketClient* next = clients[3];
+  TEST_ASSERT_EQUAL(gone & 0xff, next->id() & 0xff);
+  TEST_ASSERT_NOT_EQUAL(gone, next->id());
+  TEST_ASSERT_NULL(ws->client(gone));
+  TEST_ASSERT_FALSE(ws->text(gone, "old"));
+  TEST_ASSERT_TRUE(peers[3]->output.empty());
+  TEST_ASSERT_TRUE(ws->text(next->id(), "new"));
+  peers[3]->client->acknowledge();
+  TEST_ASSERT_TRUE(peers[3]->client->takeOutput() == std::string("\x81\x03new", 5));
+
+  size_t visited = 0;
+  for (AsyncWebSocketClient& c : ws->getClients()) {
+    TEST_ASSERT_TRUE(ws->client(c.id()) == &c);
+    visited++;
+  }
+  TEST_ASSERT_EQUAL(3, visited);
+  TEST_ASSERT_EQUAL(3, ws->count());
+}
+
+void test_full() {
+  connect(DEFAULT_MAX_WS_CLIENTS);
+  const std::string answer = upgrade();
+  TEST_ASSERT_TRUE_MESSAGE(answer.rfind("HTTP/1.1 503 ", 0) == 0, answer.c_str());
+  TEST_ASSERT_EQUAL(DEFAULT_MAX_WS_CLIENTS, ws->count());
+}
+
+void test_benchmark() {
+  constexpr size_t LOOKUPS = 1000000;
+  constexpr size_t SENDS = 100000;
+  connect(DEFAULT_MAX_WS_CLIENTS);
+  std::vector<uint32_t> ids;
+  std::list<AsyncWebSocketClient*> list;
+  for (AsyncWebSocketClient* c : clients) {
+    ids.push_back(c->id());
+    list.push_back(c);
+  }
+  // the client std::list::find_if() found before the table
+  auto find = [&list](uint32_t id) -> AsyncWebSocketClient* {
+    for (AsyncWebSocketClient* c : list) {
+      if (c->id() == id && c->status() == WS_CONNECTED)
+        return c;
+    }
+    return nullptr;
+  };
+
+  char result[160];
+  double ns[2];
+  for (bool table : {true, false}) {
+    size_t found = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+      const uint32_t id = ids[(i * 7) % ids.size()];
+      found += (table ? ws->client(id) : find(id)) != nullptr;
+    }
+    ns[!table] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / LOOKUPS;
+    TEST_ASSERT_EQUAL(LOOKUPS, found);
+  }
+  int at = snprintf(result, sizeof(result), "%zu clients, per lookup %.1f ns against %.1f ns", clients.size(), ns[0], ns[1]);
+
+  const AsyncWebSocketSharedBuffer message = std::make_shared<std::vector<uint8_t>>(32, 'x');
+  double us[2];
+  double perSend = 0;
+  for (bool table : {true, false}) {
+    const size_t before = allocations;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < SENDS; i++) {
+      const size_t c = (i * 7) % ids.size();
+      if (table)
+        ws->text(ids[c], message);
+      else if (AsyncWebSocketClient* client = find(ids[c]))
+        client->text(message);
+      peers[c]->client->acknowledge();
+    }
+    us[!table] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / SENDS;
+    if (table)
+      perSend = double(allocations - before) / SENDS;
+    for (auto& peer : peers)
+      peer->client->takeOutput();
+  }
+  snprintf(result + at, sizeof(result) - at, ", per send %.2f us against %.2f us, %.1f new", us[0], us[1], perSend);
+  TEST_MESSAGE(result);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_stale_id);
+  RUN_TEST(test_full);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,226 @@
+#include <AsyncWebSocket.h>
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <chrono>
+
+/*
+  The frames AsyncWebSocketClient sends: headers built on the stack, small payloads copied behind them and queued
+  messages batched into one send. Every length around the header size changes and the coalescing limit must come
+  out as the frame that was asked for, whatever window the peer leaves. The benchmark counts frames per second and
+  operator new calls per frame with the messages queued one by one and acknowledged in batches.
+*/
+
+static size_t allocations;
+
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  allocations++;
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+struct Frame {
+    uint8_t opcode;
+    bool final;
+    std::string payload;
+};
+
+static AsyncWebServer* server;
+static AsyncWebSocket* ws;
+static AsyncWebSocketClient* client;
+
+void setUp() {
+  server = new AsyncWebServer(80);
+  ws = new AsyncWebSocket("/ws");
+  ws->onEvent([](AsyncWebSocket*, AsyncWebSocketClient* c, AwsEventType type, void*, uint8_t*, size_t) {
+    if (type == WS_EVT_CONNECT)
+      client = c;
+  });
+  server->addHandler(ws);
+  server->begin();
+  client = nullptr;
+}
+
+void tearDown() {
+  delete server;
+}
+
+static std::shared_ptr<AsyncPeer> connect() {
+  AsyncClient* tcp = new AsyncClient();
+  std::shared_ptr<AsyncPeer> peer = tcp->peer();
+  AsyncServer::at(80)->accept(tcp);
+  tcp->receive("GET /ws HTTP/1.1\r\nHost: esp\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+               "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n");
+  tcp->acknowledge();
+  TEST_ASSERT_TRUE_MESSAGE(peer->output.rfind("HTTP/1.1 101 Switching Protocols\r\n", 0) == 0, peer->output.c_str());
+  TEST_ASSERT_NOT_NULL(client);
+  peer->output.clear();
+  return peer;
+}
+
+static void disconnect(const std::shared_ptr<AsyncPeer>& peer) {
+  if (peer->client)
+    peer->client->remoteClose();
+  AsyncClient::runEvents();
+  ws->cleanupClients(0);
+}
+
+// the frames in what the server sent, unmasked as a server sends them
+static std::vector<Frame> frames(const std::string& out) {
+  std::vector<Frame> result;
+  size_t at = 0;
+  while (at < out.size()) {
+    TEST_ASSERT_TRUE(at + 2 <= out.size());
+    const uint8_t first = out[at];
+    TEST_ASSERT_EQUAL_HEX8(0, out[at + 1] & 0x80);
+    size_t len = out[at + 1] & 0x7f;
+    size_t head = 2;
+    if (len == 126) {
+      len = (uint8_t)out[at + 2] << 8 | (uint8_t)out[at + 3];
+      head = 4;
+    } else {
+      TEST_ASSERT_TRUE(len < 126);
+    }
+    TEST_ASSERT_TRUE(at + head + len <= out.size());
+    result.push_back({(uint8_t)(first & 0x0f), (first & 0x80) != 0, out.substr(at + head, len)});
+    at += head + len;
+  }
+  return result;
+}
+
+// the messages the frames make up
+static std::vector<std::string> messages(const std::vector<Frame>& frames) {
+  std::vector<std::string> result;
+  std::string partial;
+  for (const Frame& frame : frames) {
+    if (frame.opcode >= 8)
+      continue;
+    partial += frame.payload;
+    if (frame.final) {
+      result.push_back(partial);
+      partial.clear();
+    }
+  }
+  return result;
+}
+
+static std::string payload(size_t len, char seed) {
+  std::string out(len, 0);
+  for (size_t i = 0; i < len; i++)
+    out[i] = seed + i % 23;
+  return out;
+}
+
+void test_lengths() {
+  std::shared_ptr<AsyncPeer> peer = connect();
+  // nothing to send, nothing queued
+  TEST_ASSERT_FALSE(client->text("", 0));
+  static const size_t lengths[] = {1, 124, 125, 126, 127, WS_FRAME_COALESCE_SIZE - 1, WS_FRAME_COALESCE_SIZE, WS_FRAME_COALESCE_SIZE + 1, 1000, 5000};
+  for (size_t len : lengths) {
+    const std::string text = payload(len, 'a');
+    TEST_ASSERT_TRUE(client->text(text.data(), text.size()));
+    for (int i = 0; i < 100 && client->queueLen(); i++)
+      peer->client->acknowledge();
+    const std::vector<Frame> sent = frames(peer->client->takeOutput());
+    TEST_ASSERT_EQUAL(1, sent.size());
+    TEST_ASSERT_EQUAL(WS_TEXT, sent[0].opcode);
+    TEST_ASSERT_TRUE(sent[0].final);
+    TEST_ASSERT_TRUE(sent[0].payload == text);
+  }
+  disconnect(peer);
+}
+
+// a window smaller than the messages: they go out in pieces, and every byte of each once. Room for the longest
+// header is kept, a window of 9 bytes carries one payload byte per frame
+void test_small_window() {
+  std::shared_ptr<AsyncPeer> peer = connect();
+  for (size_t window : {9, 64, 130, 700}) {
+    peer->client->setWindow(window);
+    std::vector<std::string> sent;
+    for (size_t len : {10, 125, 126, 300, 2000}) {
+      sent.push_back(payload(len, 'A' + sent.size()));
+      TEST_ASSERT_TRUE(client->binary((const uint8_t*)sent.back().data(), len));
+    }
+    std::string out;
+    for (int i = 0; i < 5000 && client->queueLen(); i++) {
+      peer->client->acknowledge();
+      out += peer->client->takeOutput();
+    }
+    out += peer->client->takeOutput();
+    const std::vector<std::string> received = messages(frames(out));
+    TEST_ASSERT_EQUAL(sent.size(), received.size());
+    for (size_t i = 0; i < sent.size(); i++)
+      TEST_ASSERT_TRUE(received[i] == sent[i]);
+  }
+  disconnect(peer);
+}
+
+// queued while nothing could be sent, the frames then go out in one send
+void test_batched() {
+  std::shared_ptr<AsyncPeer> peer = connect();
+  peer->client->setWindow(0);
+  for (int i = 0; i < 8; i++)
+    TEST_ASSERT_TRUE(client->text(payload(20, '0' + i).c_str()));
+  TEST_ASSERT_EQUAL(0, peer->output.size());
+  peer->client->setWindow(5744);
+  peer->client->acknowledge();
+  const std::vector<std::string> received = messages(frames(peer->client->takeOutput()));
+  TEST_ASSERT_EQUAL(8, received.size());
+  for (int i = 0; i < 8; i++)
+    TEST_ASSERT_TRUE(received[i] == payload(20, '0' + i));
+  disconnect(peer);
+}
+
+void test_benchmark() {
+  constexpr size_t FRAMES = 50000;
+  std::shared_ptr<AsyncPeer> peer = connect();
+  std::string result = "frames/s and allocations per frame:";
+  for (size_t len : {16, 125, 1024}) {
+    const std::string text = payload(len, 'a');
+    size_t bytes = 0;
+    const size_t before = allocations;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < FRAMES; i++) {
+      client->text(text.data(), text.size());
+      // the peer acknowledges every few frames, as a delayed ACK would, before they fill its window
+      if (i % 4 == 3) {
+        peer->client->acknowledge();
+        bytes += peer->client->takeOutput().size();
+      }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double perFrame = double(allocations - before) / FRAMES;
+    peer->client->acknowledge();
+    bytes += peer->client->takeOutput().size();
+    TEST_ASSERT_EQUAL(FRAMES * (len + (len < 126 ? 2 : 4)), bytes);
+    // what queueing the message costs, the frame header itself is built on the stack
+    TEST_ASSERT_TRUE(perFrame <= 3);
+    char line[96];
+    snprintf(line, sizeof(line), " | %zu B %.0f, %.1f", len, FRAMES / seconds, perFrame);
+    result += line;
+  }
+  TEST_MESSAGE(result.c_str());
+  disconnect(peer);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_lengths);
+  RUN_TEST(test_small_window);
+  RUN_TEST(test_batched);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
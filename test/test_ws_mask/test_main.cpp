@@ -0,0 +1,101 @@
+#include <AsyncWebSocket.h>
+#include <unity.h>
+
+#include <chrono>
+
+/*
+  webSocketMask() against masking one byte at a time: every length up to a few words, every alignment of source
+  and destination, every offset into the mask and in place. The benchmark runs both over frame sized payloads at
+  the alignments a payload arrives with, the word loop only runs when source and destination share theirs.
+*/
+
+void webSocketMask(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t* mask, size_t offset);
+
+static const uint8_t mask[4] = {0xa5, 0x3c, 0x0f, 0x81};
+
+static void bytewise(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t* mask, size_t offset) {
+  for (size_t i = 0; i < len; i++)
+    dst[i] = src[i] ^ mask[(offset + i) & 3];
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_matches_bytewise() {
+  alignas(4) uint8_t source[96 + 4];
+  alignas(4) uint8_t expected[96 + 4];
+  alignas(4) uint8_t out[96 + 8];
+  for (size_t i = 0; i < sizeof(source); i++)
+    source[i] = i * 37 + 11;
+
+  for (size_t len = 0; len <= 96; len++) {
+    for (size_t from = 0; from < 4; from++) {
+      for (size_t offset = 0; offset < 4; offset++) {
+        bytewise(expected, source + from, len, mask, offset);
+        for (size_t to = 0; to < 4; to++) {
+          // guard bytes around the destination must stay
+          memset(out, 0xee, sizeof(out));
+          webSocketMask(out + to, source + from, len, mask, offset);
+          TEST_ASSERT_EQUAL_MEMORY(expected, out + to, len);
+          for (size_t i = 0; i < sizeof(out); i++) {
+            if (i < to || i >= to + len)
+              TEST_ASSERT_EQUAL_HEX8(0xee, out[i]);
+          }
+        }
+        // in place, the way received payloads are unmasked
+        memcpy(out + from, source + from, len);
+        webSocketMask(out + from, out + from, len, mask, offset);
+        TEST_ASSERT_EQUAL_MEMORY(expected, out + from, len);
+      }
+    }
+  }
+
+  // a payload unmasked segment by segment ends up as one unmasked whole
+  std::vector<uint8_t> whole(source, source + 96);
+  for (size_t at = 0; at < 96;) {
+    const size_t len = std::min<size_t>(96 - at, 7 + at % 23);
+    webSocketMask(whole.data() + at, whole.data() + at, len, mask, at);
+    at += len;
+  }
+  bytewise(expected, source, 96, mask, 0);
+  TEST_ASSERT_EQUAL_MEMORY(expected, whole.data(), 96);
+}
+
+template <class F> static double rate(F mask, uint8_t* dst, const uint8_t* src, size_t len) {
+  const size_t rounds = (64 << 20) / len + 1;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t r = 0; r < rounds; r++)
+    mask(dst, src, len, ::mask, r);
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return rounds * len / seconds / 1e6;
+}
+
+void test_benchmark() {
+  static const size_t sizes[] = {16, 125, 1024, 16384};
+  std::vector<uint8_t> buffer(16384 + 8);
+  std::vector<uint8_t> other(16384 + 8);
+  std::string result = "MB/s word/byte:";
+  for (size_t len : sizes) {
+    char line[160];
+    // in place, aligned and not: both pointers share the alignment, the word loop runs after the first bytes
+    const double aligned = rate(webSocketMask, buffer.data(), buffer.data(), len);
+    const double alignedBytes = rate(bytewise, buffer.data(), buffer.data(), len);
+    const double shifted = rate(webSocketMask, buffer.data() + 1, buffer.data() + 1, len);
+    const double shiftedBytes = rate(bytewise, buffer.data() + 1, buffer.data() + 1, len);
+    // copied between buffers of different alignment: byte at a time either way
+    const double apart = rate(webSocketMask, other.data(), buffer.data() + 1, len);
+    const double apartBytes = rate(bytewise, other.data(), buffer.data() + 1, len);
+    snprintf(line, sizeof(line), " | %zu B in place %.0f/%.0f, +1 %.0f/%.0f, misaligned copy %.0f/%.0f", len, aligned, alignedBytes, shifted,
+             shiftedBytes, apart, apartBytes);
+    result += line;
+  }
+  TEST_MESSAGE(result.c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_matches_bytewise);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,441 @@
+#include <AsyncWebSocket.h>
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <chrono>
+
+/*
+  Message reassembly of AsyncWebSocket (setMessageReassembly()) against the messages that were sent. A case is
+  decoded from a byte string: messages of random length and type, split into frames with pings in between, masked,
+  and cut into TCP segments anywhere, inside frame headers too. Some cases then break the stream: a control frame
+  that is fragmented or longer than 125 bytes must close the connection with 1002 after the messages before it,
+  and random corruption must only not crash. test_fuzz() runs random byte strings through it, and the same case
+  runs under libFuzzer with
+
+    clang++ -std=gnu++17 -g -fsanitize=fuzzer,address,undefined -DWS_REASSEMBLY_FUZZER -I test/shim \
+      -I lib/ESPAsyncWebServer/src -I <unity> test/test_ws_reassembly/test_main.cpp lib/ESPAsyncWebServer/src/[A-Z]*.cpp
+*/
+
+static constexpr size_t MAX_MESSAGE = 4096;
+
+// operator new calls, for the paths that must not allocate
+static size_t allocations;
+
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  allocations++;
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+struct Message {
+    uint8_t opcode;
+    std::vector<uint8_t> payload;
+};
+
+static AsyncWebServer* server;
+static AsyncWebSocket* ws;
+static std::vector<Message> received;
+// frame by frame delivery, stitched together the way applications do without reassembly
+static Message partial;
+static bool badEvent;
+// the connection of the test, and where the data of the last event was
+static std::shared_ptr<AsyncPeer> current;
+static bool inSegment;
+
+static void onEvent(AsyncWebSocket*, AsyncWebSocketClient*, AwsEventType type, void* arg, uint8_t* data, size_t len) {
+  if (type != WS_EVT_DATA)
+    return;
+  const AwsFrameInfo* info = (const AwsFrameInfo*)arg;
+  inSegment = current && data >= current->segment && data + len <= current->segment + current->segmentLen;
+  if (ws->messageReassembly()) {
+    if (!info->final || info->index || info->num || info->len != len || info->opcode != info->message_opcode)
+      badEvent = true;
+    // the spare byte after the message
+    data[len] = 0;
+    received.push_back({info->message_opcode, std::vector<uint8_t>(data, data + len)});
+    return;
+  }
+  if (partial.payload.empty())
+    partial.opcode = info->message_opcode;
+  partial.payload.insert(partial.payload.end(), data, data + len);
+  if (info->final && info->index + len == info->len) {
+    received.push_back(partial);
+    partial = Message();
+  }
+}
+
+void setUp() {
+  server = new AsyncWebServer(80);
+  ws = new AsyncWebSocket("/ws");
+  ws->onEvent(onEvent);
+  server->addHandler(ws);
+  server->begin();
+  received.clear();
+  partial = Message();
+  badEvent = false;
+}
+
+// the server deletes its handlers
+void tearDown() {
+  delete server;
+}
+
+static std::shared_ptr<AsyncPeer> connect() {
+  AsyncClient* client = new AsyncClient();
+  std::shared_ptr<AsyncPeer> peer = client->peer();
+  AsyncServer::at(80)->accept(client);
+  client->receive("GET /ws HTTP/1.1\r\nHost: esp\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n");
+  client->acknowledge();
+  TEST_ASSERT_TRUE_MESSAGE(peer->output.rfind("HTTP/1.1 101 Switching Protocols\r\n", 0) == 0, peer->output.c_str());
+  peer->output.clear();
+  current = peer;
+  return peer;
+}
+
+static void disconnect(const std::shared_ptr<AsyncPeer>& peer) {
+  if (peer->client)
+    peer->client->remoteClose();
+  AsyncClient::runEvents();
+  ws->cleanupClients(0);
+  current.reset();
+}
+
+// a close frame with the status code was sent
+static bool closedWith(const std::string& out, uint16_t code) {
+  for (size_t at = out.find('\x88'); at != std::string::npos; at = out.find('\x88', at + 1)) {
+    if (at + 4 <= out.size() && (uint8_t)out[at + 1] >= 2 && (uint8_t)out[at + 2] == code >> 8 && (uint8_t)out[at + 3] == (code & 0xff))
+      return true;
+  }
+  return false;
+}
+
+static void appendFrame(std::vector<uint8_t>& stream, uint8_t opcode, bool fin, const uint8_t* payload, size_t len, uint32_t mask) {
+  stream.push_back((fin ? 0x80 : 0) | opcode);
+  if (len < 126) {
+    stream.push_back(0x80 | len);
+  } else {
+    stream.push_back(0x80 | 126);
+    stream.push_back(len >> 8);
+    stream.push_back(len);
+  }
+  const uint8_t key[4] = {(uint8_t)(mask >> 24), (uint8_t)(mask >> 16), (uint8_t)(mask >> 8), (uint8_t)mask};
+  stream.insert(stream.end(), key, key + 4);
+  for (size_t i = 0; i < len; i++)
+    stream.push_back(payload[i] ^ key[i % 4]);
+}
+
+// the fuzz input, zeros once it runs out
+class Input {
+  private:
+    const uint8_t* _data;
+    size_t _size;
+
+  public:
+    Input(const uint8_t* data, size_t size) : _data(data), _size(size) {}
+    uint8_t byte() {
+      if (!_size)
+        return 0;
+      _size--;
+      return *_data++;
+    }
+    uint16_t word() { return byte() | (uint16_t)byte() << 8; }
+    uint32_t dword() { return word() | (uint32_t)word() << 16; }
+};
+
+struct Case {
+    std::vector<Message> messages;
+    std::vector<uint8_t> stream;
+    // where the stream is cut into segments, ascending
+    std::vector<size_t> cuts;
+    enum { VALID, BAD_CONTROL, CORRUPT } kind = VALID;
+};
+
+static Case decode(const uint8_t* data, size_t size) {
+  Input in(data, size);
+  Case c;
+  // where each frame starts in the stream
+  std::vector<size_t> starts;
+  // where each message ends in the stream
+  std::vector<size_t> ends;
+  const size_t count = 1 + in.byte() % 8;
+  for (size_t m = 0; m < count; m++) {
+    Message message;
+    message.opcode = in.byte() & 1 ? WS_BINARY : WS_TEXT;
+    message.payload.resize(in.word() % (MAX_MESSAGE + 1));
+    uint32_t fill = in.dword() | 1;
+    for (uint8_t& b : message.payload) {
+      fill ^= fill << 13;
+      fill ^= fill >> 17;
+      fill ^= fill << 5;
+      b = fill;
+    }
+
+    const size_t frames = 1 + in.byte() % 5;
+    size_t offset = 0;
+    for (size_t f = 0; f < frames; f++) {
+      const bool fin = f + 1 == frames;
+      const size_t left = message.payload.size() - offset;
+      const size_t len = fin ? left : std::min(left, (size_t)in.word() % (left + 1));
+      starts.push_back(c.stream.size());
+      appendFrame(c.stream, f ? (uint8_t)WS_CONTINUATION : message.opcode, fin, message.payload.data() + offset, len, in.dword());
+      offset += len;
+      // control frames may come between the fragments of a message
+      if (!fin && in.byte() % 4 == 0) {
+        const uint8_t ping[4] = {'p', 'i', 'n', 'g'};
+        starts.push_back(c.stream.size());
+        appendFrame(c.stream, WS_PING, true, ping, sizeof(ping), in.dword());
+      }
+    }
+    c.messages.push_back(std::move(message));
+    ends.push_back(c.stream.size());
+  }
+
+  const uint8_t damage = in.byte();
+  if (damage % 8 == 1) {
+    // a control frame the peer must not send, before a frame: fragmented, or with a 126 or 127 byte length form
+    const size_t at = starts[in.byte() % starts.size()];
+    const uint8_t form = in.byte() % 3;
+    std::vector<uint8_t> bad = {(uint8_t)(form ? 0x89 : 0x09), (uint8_t)(0x80 | (form == 1 ? 126 : form == 2 ? 127 : 4))};
+    if (form == 1) {
+      bad.insert(bad.end(), {0x00, 0x7e});
+    } else if (form == 2) {
+      // 2^40 bytes, streamed until the connection closes
+      bad.insert(bad.end(), {0, 0, 0x01, 0, 0, 0, 0, 0});
+    }
+    bad.insert(bad.end(), {1, 2, 3, 4});
+    bad.insert(bad.end(), 200, 'p');
+    c.stream.insert(c.stream.begin() + at, bad.begin(), bad.end());
+    // the messages that ended before it are the ones that must come out
+    size_t before = 0;
+    while (before < ends.size() && ends[before] <= at)
+      before++;
+    c.messages.resize(before);
+    c.kind = Case::BAD_CONTROL;
+  } else if (damage % 8 == 2) {
+    for (size_t n = 1 + in.byte() % 4; n; n--)
+      c.stream[in.dword() % c.stream.size()] ^= in.byte() | 1;
+    c.kind = Case::CORRUPT;
+  }
+
+  const size_t segments = in.byte() % 32;
+  for (size_t s = 0; s < segments; s++) {
+    const size_t cut = in.dword() % c.stream.size();
+    if (cut)
+      c.cuts.push_back(cut);
+  }
+  std::sort(c.cuts.begin(), c.cuts.end());
+  c.cuts.erase(std::unique(c.cuts.begin(), c.cuts.end()), c.cuts.end());
+  c.cuts.push_back(c.stream.size());
+  return c;
+}
+
+static void feed(const std::shared_ptr<AsyncPeer>& peer, const Case& c) {
+  size_t start = 0;
+  for (size_t cut : c.cuts) {
+    if (!peer->client)
+      return;
+    peer->client->receive(c.stream.data() + start, cut - start);
+    peer->client->acknowledge();
+    start = cut;
+  }
+  // control frames go out one per ack
+  for (int i = 0; i < 8 && peer->client; i++)
+    peer->client->acknowledge();
+}
+
+// false when the messages did not come out the way they went in
+static bool runCase(const uint8_t* data, size_t size, bool reassemble) {
+  const Case c = decode(data, size);
+  ws->setMessageReassembly(reassemble ? MAX_MESSAGE : 0);
+  received.clear();
+  partial = Message();
+  badEvent = false;
+
+  std::shared_ptr<AsyncPeer> peer = connect();
+  feed(peer, c);
+  const bool open = peer->client != nullptr;
+  const bool closed1002 = closedWith(peer->output, 1002);
+  disconnect(peer);
+
+  // anything goes for a corrupt stream, as long as it does not crash
+  if (c.kind == Case::CORRUPT)
+    return true;
+  if (c.kind == Case::BAD_CONTROL ? !closed1002 : !open)
+    return false;
+  if (badEvent || received.size() != c.messages.size())
+    return false;
+  for (size_t i = 0; i < received.size(); i++) {
+    if (received[i].opcode != c.messages[i].opcode || received[i].payload != c.messages[i].payload)
+      return false;
+  }
+  return true;
+}
+
+#ifdef WS_REASSEMBLY_FUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  setUp();
+  if (!runCase(data, size, true) || !runCase(data, size, false))
+    abort();
+  tearDown();
+  return 0;
+}
+
+#else
+
+void test_fuzz() {
+  std::vector<uint8_t> input(256);
+  for (int i = 0; i < 2000; i++) {
+    for (uint8_t& b : input)
+      b = esp_random();
+    const size_t size = esp_random() % input.size();
+    char what[64];
+    snprintf(what, sizeof(what), "case %d, %u bytes", i, (unsigned)size);
+    TEST_ASSERT_TRUE_MESSAGE(runCase(input.data(), size, true), what);
+    TEST_ASSERT_TRUE_MESSAGE(runCase(input.data(), size, false), what);
+  }
+}
+
+void test_whole_frame_in_place() {
+  std::shared_ptr<AsyncPeer> peer = connect();
+  ws->setMessageReassembly(MAX_MESSAGE);
+  std::vector<uint8_t> stream;
+  const char text[] = "hello";
+  appendFrame(stream, WS_TEXT, true, (const uint8_t*)text, 5, 0x01020304);
+  received.reserve(1);
+  const size_t before = allocations;
+  peer->client->receive(stream.data(), stream.size());
+  // handed over in the received segment, the copies of the shim and of onEvent() are the only allocations
+  TEST_ASSERT_TRUE(inSegment);
+  TEST_ASSERT_EQUAL(1 + 1, allocations - before);
+  TEST_ASSERT_EQUAL(1, received.size());
+  TEST_ASSERT_EQUAL_STRING("hello", std::string(received[0].payload.begin(), received[0].payload.end()).c_str());
+  disconnect(peer);
+}
+
+void test_oversized_message_closes_1009() {
+  std::shared_ptr<AsyncPeer> peer = connect();
+  ws->setMessageReassembly(1000);
+  std::vector<uint8_t> payload(1200, 'x');
+  std::vector<uint8_t> stream;
+  appendFrame(stream, WS_TEXT, false, payload.data(), 600, 0x0a0b0c0d);
+  appendFrame(stream, WS_CONTINUATION, true, payload.data() + 600, 600, 0x0a0b0c0d);
+  peer->client->receive(stream.data(), stream.size());
+  peer->client->acknowledge();
+  TEST_ASSERT_EQUAL(0, received.size());
+  // a close frame with status 1009
+  const std::string out = peer->output;
+  TEST_ASSERT_TRUE(out.size() >= 4 && (uint8_t)out[0] == 0x88 && (uint8_t)out[2] == 0x03 && (uint8_t)out[3] == 0xf1);
+  disconnect(peer);
+}
+
+// a ping announcing 2^40 bytes must not be buffered as they come in
+void test_oversized_control_frame_closes_1002() {
+  std::shared_ptr<AsyncPeer> peer = connect();
+  const uint8_t header[] = {0x89, 0x80 | 127, 0, 0, 0x01, 0, 0, 0, 0, 0, 1, 2, 3, 4};
+  peer->client->receive(header, sizeof(header));
+  peer->client->acknowledge();
+  TEST_ASSERT_TRUE(closedWith(peer->output, 1002));
+
+  const std::vector<uint8_t> more(1436, 'p');
+  const size_t before = allocations;
+  for (int i = 0; i < 1000 && peer->client; i++)
+    peer->client->receive(more.data(), more.size());
+  // the copy of each segment the shim makes
+  TEST_ASSERT_LESS_OR_EQUAL(1000, allocations - before);
+  TEST_ASSERT_EQUAL(0, received.size());
+  disconnect(peer);
+}
+
+void test_fragmented_control_frame_closes_1002() {
+  std::shared_ptr<AsyncPeer> peer = connect();
+  std::vector<uint8_t> stream;
+  const uint8_t ping[4] = {'p', 'i', 'n', 'g'};
+  appendFrame(stream, WS_PING, false, ping, sizeof(ping), 0x01020304);
+  const char text[] = "after";
+  appendFrame(stream, WS_TEXT, true, (const uint8_t*)text, 5, 0x01020304);
+  peer->client->receive(stream.data(), stream.size());
+  peer->client->acknowledge();
+  TEST_ASSERT_TRUE(closedWith(peer->output, 1002));
+  TEST_ASSERT_EQUAL(0, received.size());
+  disconnect(peer);
+}
+
+// a header cut after every byte
+void test_header_across_segments() {
+  std::shared_ptr<AsyncPeer> peer = connect();
+  ws->setMessageReassembly(MAX_MESSAGE);
+  std::vector<uint8_t> payload(300, 'h');
+  std::vector<uint8_t> stream;
+  appendFrame(stream, WS_BINARY, true, payload.data(), payload.size(), 0x11223344);
+  for (size_t i = 0; i < stream.size(); i++)
+    peer->client->receive(stream.data() + i, 1);
+  TEST_ASSERT_EQUAL(1, received.size());
+  TEST_ASSERT_TRUE(received[0].payload == payload);
+  disconnect(peer);
+}
+
+// 4 KB messages in four frames, in 1436 byte segments
+static double throughput(bool reassemble) {
+  const size_t messages = 2000;
+  std::vector<uint8_t> payload(MAX_MESSAGE);
+  for (size_t i = 0; i < payload.size(); i++)
+    payload[i] = i * 7;
+  std::vector<uint8_t> stream;
+  for (size_t m = 0; m < messages; m++) {
+    for (size_t f = 0; f < 4; f++)
+      appendFrame(stream, f ? WS_CONTINUATION : WS_BINARY, f == 3, payload.data() + f * 1024, 1024, 0x5a5a5a5a + m);
+  }
+
+  ws->setMessageReassembly(reassemble ? MAX_MESSAGE : 0);
+  received.clear();
+  std::shared_ptr<AsyncPeer> peer = connect();
+  const auto start = std::chrono::steady_clock::now();
+  size_t offset = 0;
+  while (offset < stream.size() && peer->client) {
+    const size_t cut = std::min(offset + 1436, stream.size());
+    peer->client->receive(stream.data() + offset, cut - offset);
+    offset = cut;
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  TEST_ASSERT_NOT_NULL(peer->client);
+  disconnect(peer);
+  TEST_ASSERT_EQUAL(messages, received.size());
+  return stream.size() / seconds / 1e6;
+}
+
+void test_benchmark() {
+  const double frames = throughput(false);
+  const double whole = throughput(true);
+  char result[128];
+  snprintf(result, sizeof(result), "frame by frame %.0f MB/s, reassembled %.0f MB/s", frames, whole);
+  TEST_MESSAGE(result);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_whole_frame_in_place);
+  RUN_TEST(test_oversized_message_closes_1009);
+  RUN_TEST(test_oversized_control_frame_closes_1002);
+  RUN_TEST(test_fragmented_control_frame_closes_1002);
+  RUN_TEST(test_header_across_segments);
+  RUN_TEST(test_fuzz);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
+
+#endif
@@ -0,0 +1,235 @@
+#include <AsyncWebSocket.h>
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <chrono>
+
+#if DEFAULT_MAX_WS_CLIENTS < 32
+  #error "the benchmark publishes to 32 clients, [env:native] in platformio.ini sets DEFAULT_MAX_WS_CLIENTS"
+#endif
+
+/*
+  Topic subscriptions of AsyncWebSocket: publish() reaches the subscribers of a topic and nobody else, a
+  disconnected client is dropped from its topics and a topic nobody subscribes to any more frees its entry. The
+  benchmark publishes to 64 topics with 32 clients subscribed to 8 each, against the application keeping the
+  topics of every client itself and sending with text() to those that match.
+*/
+
+static size_t allocations;
+
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  allocations++;
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+static AsyncWebServer* server;
+static AsyncWebSocket* ws;
+static std::vector<AsyncWebSocketClient*> clients;
+static std::vector<std::shared_ptr<AsyncPeer>> peers;
+
+void setUp() {
+  server = new AsyncWebServer(80);
+  ws = new AsyncWebSocket("/ws");
+  ws->onEvent([](AsyncWebSocket*, AsyncWebSocketClient* c, AwsEventType type, void*, uint8_t*, size_t) {
+    if (type == WS_EVT_CONNECT)
+      clients.push_back(c);
+  });
+  server->addHandler(ws);
+  server->begin();
+}
+
+void tearDown() {
+  for (auto& peer : peers) {
+    if (peer->client)
+      peer->client->remoteClose();
+  }
+  AsyncClient::runEvents();
+  ws->cleanupClients(0);
+  delete server;
+  clients.clear();
+  peers.clear();
+}
+
+static void connect(size_t n) {
+  while (peers.size() < n) {
+    AsyncClient* tcp = new AsyncClient(IPAddress(192, 168, 1, 10 + peers.size()));
+    std::shared_ptr<AsyncPeer> peer = tcp->peer();
+    AsyncServer::at(80)->accept(tcp);
+    tcp->receive("GET /ws HTTP/1.1\r\nHost: esp\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                 "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n");
+    tcp->acknowledge();
+    TEST_ASSERT_TRUE_MESSAGE(peer->output.rfind("HTTP/1.1 101 Switching Protocols\r\n", 0) == 0, peer->output.c_str());
+    peer->output.clear();
+    peers.push_back(peer);
+  }
+  TEST_ASSERT_EQUAL(n, clients.size());
+}
+
+// what each peer received since the last call, acknowledged
+static std::vector<std::string> received() {
+  std::vector<std::string> out(peers.size());
+  for (size_t i = 0; i < peers.size(); i++) {
+    if (!peers[i]->client)
+      continue;
+    peers[i]->client->acknowledge();
+    out[i] = peers[i]->client->takeOutput();
+  }
+  return out;
+}
+
+// the unmasked text frame a server sends for a short message
+static std::string frame(const char* text) {
+  return std::string("\x81", 1) + (char)strlen(text) + text;
+}
+
+void test_publish() {
+  connect(4);
+  TEST_ASSERT_TRUE(ws->subscribe(clients[0], "trafo/1"));
+  TEST_ASSERT_TRUE(ws->subscribe(clients[1], "trafo/1"));
+  TEST_ASSERT_TRUE(ws->subscribe(clients[1], "trafo/2"));
+  TEST_ASSERT_TRUE(ws->subscribe(clients[2], "trafo/2"));
+  // twice is once
+  TEST_ASSERT_TRUE(ws->subscribe(clients[2], "trafo/2"));
+  TEST_ASSERT_EQUAL(2, ws->subscribers("trafo/1"));
+  TEST_ASSERT_EQUAL(2, ws->subscribers("trafo/2"));
+  TEST_ASSERT_TRUE(ws->subscribed(clients[1], "trafo/2"));
+  TEST_ASSERT_FALSE(ws->subscribed(clients[0], "trafo/2"));
+
+  TEST_ASSERT_EQUAL(AsyncWebSocket::ENQUEUED, ws->publish("trafo/1", "a"));
+  std::vector<std::string> out = received();
+  TEST_ASSERT_TRUE(out[0] == frame("a"));
+  TEST_ASSERT_TRUE(out[1] == frame("a"));
+  TEST_ASSERT_TRUE(out[2].empty());
+  TEST_ASSERT_TRUE(out[3].empty());
+
+  // one subscriber left, sent without the shared frame
+  ws->unsubscribe(clients[1], "trafo/2");
+  TEST_ASSERT_EQUAL(AsyncWebSocket::ENQUEUED, ws->publish("trafo/2", "b"));
+  out = received();
+  TEST_ASSERT_TRUE(out[0].empty());
+  TEST_ASSERT_TRUE(out[1].empty());
+  TEST_ASSERT_TRUE(out[2] == frame("b"));
+
+  TEST_ASSERT_EQUAL(AsyncWebSocket::DISCARDED, ws->publish("trafo/3", "c"));
+  for (const std::string& o : received())
+    TEST_ASSERT_TRUE(o.empty());
+}
+
+void test_disconnect() {
+  connect(3);
+  for (AsyncWebSocketClient* client : clients)
+    TEST_ASSERT_TRUE(ws->subscribe(client, "device/7"));
+  peers[1]->client->remoteClose();
+  AsyncClient::runEvents();
+  // deletes the closed client, closes none of the others
+  ws->cleanupClients(DEFAULT_MAX_WS_CLIENTS);
+  TEST_ASSERT_EQUAL(2, ws->subscribers("device/7"));
+
+  // the slot goes to the next connection, which has not subscribed
+  clients.erase(clients.begin() + 1);
+  peers.erase(peers.begin() + 1);
+  connect(3);
+  TEST_ASSERT_FALSE(ws->subscribed(clients[2], "device/7"));
+  TEST_ASSERT_EQUAL(AsyncWebSocket::ENQUEUED, ws->publish("device/7", "x"));
+  const std::vector<std::string> out = received();
+  TEST_ASSERT_TRUE(out[0] == frame("x"));
+  TEST_ASSERT_TRUE(out[1] == frame("x"));
+  TEST_ASSERT_TRUE(out[2].empty());
+}
+
+void test_topic_limit() {
+  connect(1);
+  char name[16];
+  for (int i = 0; i < WS_MAX_TOPICS; i++) {
+    snprintf(name, sizeof(name), "t/%d", i);
+    TEST_ASSERT_TRUE(ws->subscribe(clients[0], name));
+  }
+  TEST_ASSERT_FALSE(ws->subscribe(clients[0], "one/more"));
+  // a topic without subscribers frees its entry
+  ws->unsubscribe(clients[0], "t/5");
+  TEST_ASSERT_EQUAL(0, ws->subscribers("t/5"));
+  TEST_ASSERT_TRUE(ws->subscribe(clients[0], "one/more"));
+  TEST_ASSERT_TRUE(ws->subscribed(clients[0], "t/63"));
+  ws->unsubscribeAll(clients[0]);
+  TEST_ASSERT_EQUAL(0, ws->subscribers("t/63"));
+  TEST_ASSERT_EQUAL(0, ws->subscribers("one/more"));
+}
+
+void test_benchmark() {
+  constexpr size_t TOPICS = 64;
+  constexpr size_t CLIENTS = 32;
+  constexpr size_t ROUNDS = 500;
+  connect(CLIENTS);
+  std::vector<String> names;
+  for (size_t t = 0; t < TOPICS; t++)
+    names.push_back(String("trafo/") + String((unsigned)(1000 + t)));
+  // every client follows 8 topics, every topic has 4 subscribers
+  std::vector<std::vector<String>> following(CLIENTS);
+  for (size_t c = 0; c < CLIENTS; c++) {
+    for (size_t k = 0; k < 8; k++) {
+      const String& name = names[(2 * c + k) % TOPICS];
+      TEST_ASSERT_TRUE(ws->subscribe(clients[c], name.c_str()));
+      following[c].push_back(name);
+    }
+  }
+  for (size_t t = 0; t < TOPICS; t++)
+    TEST_ASSERT_EQUAL(4, ws->subscribers(names[t].c_str()));
+
+  const AsyncWebSocketSharedBuffer message = std::make_shared<std::vector<uint8_t>>(64, 'x');
+  std::string result = "per publish to 4 of 32 clients, 64 topics, publish() against a topic list per client:";
+  for (bool topics : {true, false}) {
+    size_t bytes = 0;
+    const size_t before = allocations;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < ROUNDS; r++) {
+      for (size_t t = 0; t < TOPICS; t++) {
+        if (topics) {
+          ws->publish(names[t].c_str(), message);
+        } else {
+          for (size_t c = 0; c < CLIENTS; c++) {
+            for (const String& name : following[c]) {
+              if (name == names[t]) {
+                clients[c]->text(message);
+                break;
+              }
+            }
+          }
+        }
+      }
+      for (const std::string& out : received())
+        bytes += out.size();
+    }
+    const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    const double perPublish = double(allocations - before) / (ROUNDS * TOPICS);
+    for (const std::string& out : received())
+      bytes += out.size();
+    TEST_ASSERT_EQUAL(ROUNDS * TOPICS * 4 * (64 + 2), bytes);
+    char line[64];
+    snprintf(line, sizeof(line), topics ? " %.2f us %.1f new" : " against %.2f us %.1f new", us / (ROUNDS * TOPICS), perPublish);
+    result += line;
+  }
+  TEST_MESSAGE(result.c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_publish);
+  RUN_TEST(test_disconnect);
+  RUN_TEST(test_topic_limit);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}